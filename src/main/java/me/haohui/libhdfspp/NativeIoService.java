@@ -33,7 +33,21 @@ class NativeIoService implements Closeable {
   }
 
   NativeIoService() {
-    handle = create();
+    this(1, false, false);
+  }
+
+  /**
+   * @param threads number of threads that run the event loops in
+   *                {@link #run()}, including the calling thread. Zero
+   *                means one thread per CPU.
+   * @param pinThreads pin each thread to a CPU.
+   * @param ioServicePerThread give each thread its own event loop, to
+   *                           which the connections are assigned in
+   *                           round-robin.
+   */
+  NativeIoService(int threads, boolean pinThreads,
+                  boolean ioServicePerThread) {
+    handle = create(threads, pinThreads, ioServicePerThread);
   }
 
   void run() {
@@ -49,7 +63,8 @@ class NativeIoService implements Closeable {
     destroy(handle);
   }
 
-  private native static long create();
+  private native static long create(int threads, boolean pinThreads,
+                                    boolean ioServicePerThread);
   private native static void nativeRun(long handle);
   private native static void stop(long handle);
   private native static void destroy(long handle);
@@ -22,8 +22,14 @@
 
 using namespace ::hdfs;
 
-JNIEXPORT jlong JNICALL Java_me_haohui_libhdfspp_NativeIoService_create(JNIEnv *, jclass) {
-  return reinterpret_cast<uintptr_t>(IoService::New());
+JNIEXPORT jlong JNICALL Java_me_haohui_libhdfspp_NativeIoService_create(JNIEnv *, jclass, jint threads,
+                                                                        jboolean pin_threads,
+                                                                        jboolean io_service_per_thread) {
+  IoServiceOptions options;
+  options.threads = threads;
+  options.pin_threads = pin_threads;
+  options.io_service_per_thread = io_service_per_thread;
+  return reinterpret_cast<uintptr_t>(IoService::New(options));
 }
 
 JNIEXPORT void JNICALL Java_me_haohui_libhdfspp_NativeIoService_nativeRun(JNIEnv *, jclass, jlong handle) {
@@ -34,7 +34,8 @@ Java_me_haohui_libhdfspp_NativeRpcEngine_create(JNIEnv *env, jclass, jlong io_se
                                                 jint version) {
   IoServiceImpl *io_service = reinterpret_cast<IoServiceImpl*>(io_service_handle);
 
-  RpcEngine *engine = new RpcEngine(&io_service->io_service(), ReadByteString(env, jclient_name),
+  RpcEngine *engine = new RpcEngine(&io_service->io_service(), Options(),
+                                    ReadByteString(env, jclient_name),
                                     ReadByteString(env, jprotocol).c_str(), version);
   return reinterpret_cast<uintptr_t>(engine);
 }
@@ -26,6 +26,7 @@
 #define INCLUDE_LIBHDFSPP_CHDFS_H_
 
 #include "stdlib.h"
+#include "time.h"
 
 struct hdfsFile_struct;
 struct hdfsFS_struct;
@@ -38,13 +39,44 @@ typedef hdfsFile_struct* hdfsFile;
  *    -need to start background thread(s) to run asio::io_service
  *    -connect to specified namenode host:port
  *    -this will need to be extended to allow application to control memory management routines
- *     by passing an allocator/deleter pair as well as specify io_service thread count 
+ *     by passing an allocator/deleter pair
  */
 extern "C" {
   hdfsFS hdfsConnect(const char *nnhost, unsigned short nnport);
 }
 
 
+/** 
+ * hdfsConnectWithThreads - Connect to the hdfs file system with several
+ * background threads running the asio::io_service.
+ * @param nnhost The host of the namenode.
+ * @param nnport The port of the namenode.
+ * @param io_threads Number of background threads, 0 for one per CPU.
+ * @param pin_threads Pin each background thread to a CPU if non-zero.
+ * @param io_service_per_thread Give each background thread its own
+ * asio::io_service if non-zero. Connections are assigned to them in round-robin.
+ * @return Returns a handle to the filesystem or NULL on error.
+ */
+extern "C" {
+  hdfsFS hdfsConnectWithThreads(const char *nnhost, unsigned short nnport, unsigned int io_threads,
+                                int pin_threads, int io_service_per_thread);
+}
+
+
+/**
+ * hdfsConnectNameservice - Connect to a nameservice with several
+ * NameNodes in high availability. The calls fail over to the next
+ * NameNode when the active one becomes a standby or goes down.
+ * @param nnhosts The hosts of the namenodes.
+ * @param nnports The ports of the namenodes.
+ * @param count The number of namenodes.
+ * @return Returns a handle to the filesystem or NULL on error.
+ */
+extern "C" {
+  hdfsFS hdfsConnectNameservice(const char **nnhosts, const unsigned short *nnports, int count);
+}
+
+
 /** 
  * hdfsDisconnect - Disconnect from the hdfs file system.
  * Disconnect from hdfs.
@@ -95,5 +127,317 @@ extern "C" {
 }
 
 
+/**
+ * hdfsPreadWithCacheHints - Positional read with its own hints to the
+ * page cache of the DataNodes, which override those of the file for
+ * this read only.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @param position Position from which to read
+ * @param buffer The buffer to copy read bytes into.
+ * @param length The length of the buffer.
+ * @param dropBehind 0 to keep the setting of the file, 1 to enable and
+ * 2 to disable drop-behind, as in hdfsFileSetDropBehind.
+ * @param readahead The number of bytes that the DataNode reads ahead,
+ * or negative to keep the setting of the file.
+ * @return Returns the number of bytes actually read, possibly less than
+ * than length;-1 on error.
+ */
+extern "C" {
+  size_t hdfsPreadWithCacheHints(hdfsFS fs, hdfsFile file, off_t position, void *buf,
+                                 size_t length, int dropBehind, long long readahead);
+}
+
+
+/**
+ * A range of the file for hdfsPreadv.
+ */
+struct hdfsReadRange {
+  off_t offset;
+  size_t length;
+  void *buffer;
+  /* Set to the number of bytes read into the buffer */
+  size_t readBytes;
+};
+
+
+/**
+ * hdfsPreadv - Positional read of many ranges of an open file at once.
+ * Nearby ranges within a block are merged into a single request to the
+ * DataNode, and all requests run in parallel.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @param ranges The ranges to read. The readBytes field of each range
+ * is set to the number of bytes read into its buffer, which is zero if
+ * any of the ranges is invalid.
+ * @param count The number of ranges.
+ * @return Returns 0 on success, -1 on error with errno set.
+ */
+extern "C" {
+  int hdfsPreadv(hdfsFS fs, hdfsFile file, struct hdfsReadRange *ranges, int count);
+}
+
+
+/**
+ * The callback of hdfsPreadAsync, with 0 or the errno of the failure,
+ * the number of bytes read and the context of the call.
+ */
+typedef void (*hdfsReadCallback)(int errnum, size_t readBytes, void *context);
+
+
+/**
+ * hdfsPreadAsync - Asynchronous positional read of data from an open
+ * file. The call returns at once, and the callback is called on a
+ * background thread of the file system once the read has finished.
+ * The file and the buffer must stay valid until then.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @param position Position from which to read
+ * @param buffer The buffer to copy read bytes into.
+ * @param length The length of the buffer.
+ * @param callback The function to call with the result.
+ * @param context Passed to the callback.
+ * @return Returns 0 if the read has been started, -1 on error with
+ * errno set, in which case the callback is not called.
+ */
+extern "C" {
+  int hdfsPreadAsync(hdfsFS fs, hdfsFile file, off_t position, void *buf, size_t length,
+                     hdfsReadCallback callback, void *context);
+}
+
+
+/**
+ * hdfsRead - Read data from an open file at its current position.
+ * Sequential reads keep the connection to the DataNode open across calls.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @param buffer The buffer to copy read bytes into.
+ * @param length The length of the buffer.
+ * @return Returns the number of bytes actually read, possibly less than
+ * than length only at the end of the file; 0 on error.
+ */
+extern "C" {
+  size_t hdfsRead(hdfsFS fs, hdfsFile file, void *buf, size_t length);
+}
+
+
+/**
+ * hdfsSeek - Seek to given offset in file.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @param desiredPos Offset into the file to seek into.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsSeek(hdfsFS fs, hdfsFile file, off_t desiredPos);
+}
+
+
+/**
+ * hdfsTell - Get the current offset in the file, in bytes.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @return Current offset, -1 on error.
+ */
+extern "C" {
+  off_t hdfsTell(hdfsFS fs, hdfsFile file);
+}
+
+
+/**
+ * hdfsFileSetDropBehind - Set whether the DataNodes drop the data of
+ * the subsequent reads of the file from their page cache once it has
+ * been sent, e.g., for one-pass scans that should not evict hot data.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @param dropBehind 0 to leave it to the DataNodes, 1 to enable, 2 to
+ * disable, 3 to enable it only for the reads that continue a
+ * sequential scan.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsFileSetDropBehind(hdfsFS fs, hdfsFile file, int dropBehind);
+}
+
+
+/**
+ * hdfsFileSetReadahead - Set the number of bytes that the DataNodes
+ * read ahead of the subsequent reads of the file.
+ * @param fs The configured filesystem handle.
+ * @param file The file handle.
+ * @param readahead The number of bytes, or negative to leave it to the
+ * DataNodes.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsFileSetReadahead(hdfsFS fs, hdfsFile file, long long readahead);
+}
+
+
+/**
+ * The kind of a path in hdfsFileInfo.
+ */
+typedef enum tObjectKind {
+  kObjectKindFile = 'F',
+  kObjectKindDirectory = 'D',
+} tObjectKind;
+
+
+/**
+ * The metadata of a path, laid out as in libhdfs.
+ */
+typedef struct {
+  tObjectKind mKind;   /* file or directory */
+  char *mName;         /* the absolute path */
+  time_t mLastMod;     /* the last modification time in seconds since the epoch */
+  off_t mSize;         /* the size of the file in bytes */
+  short mReplication;  /* the replication factor */
+  off_t mBlockSize;    /* the block size of the file */
+  char *mOwner;
+  char *mGroup;
+  short mPermissions;  /* the permission bits, e.g., 0755 */
+  time_t mLastAccess;  /* the last access time in seconds since the epoch */
+} hdfsFileInfo;
+
+
+/**
+ * The metadata functions below set errno on error, e.g., to ENOENT if
+ * the path does not exist or EACCES if the permission is denied.
+ */
+
+
+/**
+ * hdfsExists - Check whether a path exists.
+ * @param fs The configured filesystem handle.
+ * @param path The path to look for.
+ * @return Returns 0 if the path exists, -1 otherwise.
+ */
+extern "C" {
+  int hdfsExists(hdfsFS fs, const char *path);
+}
+
+
+/**
+ * hdfsGetPathInfo - Get the metadata of a path.
+ * @param fs The configured filesystem handle.
+ * @param path The path of the file or directory.
+ * @return Returns a hdfsFileInfo to be freed with hdfsFreeFileInfo, or
+ * NULL on error.
+ */
+extern "C" {
+  hdfsFileInfo *hdfsGetPathInfo(hdfsFS fs, const char *path);
+}
+
+
+/**
+ * hdfsListDirectory - Get the metadata of the entries of a directory.
+ * @param fs The configured filesystem handle.
+ * @param path The path of the directory.
+ * @param numEntries Set to the number of entries.
+ * @return Returns an array of numEntries hdfsFileInfo to be freed with
+ * hdfsFreeFileInfo, or NULL on error or if the directory is empty, in
+ * which case errno is set to 0.
+ */
+extern "C" {
+  hdfsFileInfo *hdfsListDirectory(hdfsFS fs, const char *path, int *numEntries);
+}
+
+
+/**
+ * hdfsFreeFileInfo - Free the result of hdfsGetPathInfo or hdfsListDirectory.
+ * @param infos The array of hdfsFileInfo.
+ * @param numEntries The number of entries in the array.
+ */
+extern "C" {
+  void hdfsFreeFileInfo(hdfsFileInfo *infos, int numEntries);
+}
+
+
+/**
+ * hdfsCreateDirectory - Create a directory and its missing parents.
+ * @param fs The configured filesystem handle.
+ * @param path The path of the directory.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsCreateDirectory(hdfsFS fs, const char *path);
+}
+
+
+/**
+ * hdfsDelete - Delete a file or a directory.
+ * @param fs The configured filesystem handle.
+ * @param path The path to delete.
+ * @param recursive Delete a non-empty directory with all its contents
+ * if non-zero.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsDelete(hdfsFS fs, const char *path, int recursive);
+}
+
+
+/**
+ * hdfsRename - Rename a file or a directory.
+ * @param fs The configured filesystem handle.
+ * @param oldPath The path to rename.
+ * @param newPath The new path.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsRename(hdfsFS fs, const char *oldPath, const char *newPath);
+}
+
+
+/**
+ * hdfsChmod - Change the permissions of a path.
+ * @param fs The configured filesystem handle.
+ * @param path The path of the file or directory.
+ * @param mode The permission bits, e.g., 0755.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsChmod(hdfsFS fs, const char *path, short mode);
+}
+
+
+/**
+ * hdfsChown - Change the owner and the group of a path.
+ * @param fs The configured filesystem handle.
+ * @param path The path of the file or directory.
+ * @param owner The new owner, or NULL to keep it.
+ * @param group The new group, or NULL to keep it.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsChown(hdfsFS fs, const char *path, const char *owner, const char *group);
+}
+
+
+/**
+ * hdfsSetReplication - Change the replication factor of a file.
+ * @param fs The configured filesystem handle.
+ * @param path The path of the file.
+ * @param replication The new replication factor.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsSetReplication(hdfsFS fs, const char *path, short replication);
+}
+
+
+/**
+ * hdfsUtime - Change the modification and the access time of a path.
+ * @param fs The configured filesystem handle.
+ * @param path The path of the file or directory.
+ * @param mtime The new modification time in seconds, or -1 to keep it.
+ * @param atime The new access time in seconds, or -1 to keep it.
+ * @return Returns 0 on success, -1 on error.
+ */
+extern "C" {
+  int hdfsUtime(hdfsFS fs, const char *path, time_t mtime, time_t atime);
+}
+
+
 #endif
 
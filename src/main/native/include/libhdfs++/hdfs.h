@@ -18,31 +18,327 @@
 #ifndef LIBHDFSPP_HDFS_H_
 #define LIBHDFSPP_HDFS_H_
 
+#include "libhdfs++/options.h"
 #include "libhdfs++/status.h"
 
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
 namespace hdfs {
 
 class IoService {
  public:
   static IoService *New();
+  static IoService *New(const IoServiceOptions &options);
+  /**
+   * Run the event loops with the worker threads in the options. The
+   * calling thread is one of them. The call returns after Stop().
+   **/
   virtual void Run() = 0;
   virtual void Stop() = 0;
   virtual ~IoService();
 };
 
 
+/**
+ * A range of the file in a vectored read, see
+ * InputStream::ReadVectored().
+ **/
+struct ReadRange {
+  size_t offset;
+  size_t length;
+  void *buffer;
+  /**
+   * Set by the read to the number of bytes that have been read into
+   * the buffer, which is the length of the range unless the range
+   * crosses the end of the file or the read has failed.
+   **/
+  size_t read_bytes;
+};
+
 class InputStream {
  public:
+  /**
+   * Read nbyte bytes at the offset of the file without changing the
+   * position of the stream. A read that spans multiple blocks reads
+   * the blocks from their DataNodes in parallel.
+   *
+   * The call might read less than nbyte bytes only when it reaches
+   * the end of the file or fails in the middle of the read.
+   **/
   virtual Status PositionRead(void *buf, size_t nbyte, size_t offset, size_t *read_bytes) = 0;
   virtual ~InputStream();
+
+  // The virtual functions below are appended after the destructor so
+  // that the vtable of the earlier ones keeps its layout.
+
+  /**
+   * Read data at the current position of the stream and advance the
+   * position. Sequential reads share a single connection to the
+   * DataNode which streams the rest of the block, thus they are much
+   * cheaper than the equivalent calls of PositionRead().
+   *
+   * The call might read less than nbyte bytes only when it reaches
+   * the end of the file or fails in the middle of the read.
+   **/
+  virtual Status Read(void *buf, size_t nbyte, size_t *read_bytes) = 0;
+  /**
+   * Read many ranges of the file at once, e.g., the column chunks of
+   * a columnar file. The ranges can come in any order. Ranges of the
+   * same block that are separated by no more than
+   * Options::vectored_read_max_gap bytes are merged into a single
+   * request to the DataNode, and the data is received directly into
+   * the buffers of the ranges. All requests run concurrently.
+   *
+   * Returns the first error if any of the requests has failed. A
+   * range that starts at or after the end of the file fails the call
+   * before any range is read.
+   **/
+  virtual Status ReadVectored(ReadRange *ranges, size_t count) = 0;
+  /**
+   * Set the position of the stream. Seeking forward by no more than
+   * the size of the read-ahead buffer keeps the current connection.
+   **/
+  virtual Status Seek(size_t offset) = 0;
+  virtual size_t Tell() = 0;
+
+  typedef void (*ReadHandler)(const Status &status, size_t read_bytes, void *context);
+  /**
+   * The asynchronous version of PositionRead(). The handler is called
+   * on a thread of the IoService with the status, the number of bytes
+   * that have been read and the context. The stream and the buffer
+   * must stay valid until then.
+   **/
+  virtual void AsyncPositionRead(void *buf, size_t nbyte, size_t offset,
+                                 ReadHandler handler, void *context) = 0;
+  /**
+   * PositionRead() with its own hints to the page cache of the
+   * DataNodes. The hints that cache_strategy specifies override those
+   * of the stream for this read only.
+   **/
+  virtual Status PositionRead(void *buf, size_t nbyte, size_t offset,
+                              const CacheStrategy &cache_strategy, size_t *read_bytes) = 0;
+  /**
+   * Set whether the DataNodes drop the data of the subsequent reads
+   * from their page cache once it has been sent. See
+   * DropBehindStrategy. The default is Options::drop_behind.
+   **/
+  virtual void SetDropBehind(DropBehindStrategy strategy) = 0;
+  /**
+   * Set the number of bytes that the DataNodes read ahead of the
+   * subsequent reads. A negative value leaves it to the DataNodes,
+   * which is the default.
+   **/
+  virtual void SetReadahead(long long bytes) = 0;
+};
+
+/**
+ * The metadata of a file, a directory or a symlink.
+ **/
+struct FileInfo {
+  enum Type {
+    kFile,
+    kDirectory,
+    kSymlink,
+  };
+  Type type;
+  // The absolute path
+  std::string path;
+  uint64_t length;
+  // The permission bits, e.g., 0755
+  unsigned short permissions;
+  std::string owner;
+  std::string group;
+  // Milliseconds since the epoch
+  uint64_t modification_time;
+  uint64_t access_time;
+  // The target of a symlink
+  std::string symlink;
+  // Zero for directories
+  unsigned replication;
+  uint64_t block_size;
+  uint64_t file_id;
+};
+
+/**
+ * The space that a directory tree occupies, see
+ * FileSystem::GetContentSummary().
+ **/
+struct ContentSummary {
+  uint64_t length;
+  uint64_t file_count;
+  uint64_t directory_count;
+  uint64_t quota;
+  // The raw space including all replicas
+  uint64_t space_consumed;
+  uint64_t space_quota;
+};
+
+/**
+ * The capacity and the health of the file system, see
+ * FileSystem::GetFsStats().
+ **/
+struct FsStats {
+  uint64_t capacity;
+  uint64_t used;
+  uint64_t remaining;
+  uint64_t under_replicated_blocks;
+  uint64_t corrupt_blocks;
+  uint64_t missing_blocks;
+};
+
+/**
+ * A listing of a directory that is fetched from the NameNode page by
+ * page, see FileSystem::OpenListing(). The next page is fetched while
+ * the caller processes the current one.
+ **/
+class DirectoryListing {
+ public:
+  /**
+   * Get the next page of entries. The entries are empty at the end of
+   * the listing.
+   **/
+  virtual Status Next(std::vector<FileInfo> *entries) = 0;
+  virtual ~DirectoryListing();
+};
+
+/**
+ * The RPC address of a NameNode.
+ **/
+struct NameNodeAddress {
+  std::string host;
+  unsigned short port;
 };
 
 class FileSystem {
  public:
   static Status New(IoService *io_service, const char *server,
                     unsigned short port, FileSystem **fsptr);
+  static Status New(IoService *io_service, const Options &options,
+                    const char *server, unsigned short port,
+                    FileSystem **fsptr);
+  /**
+   * Connect to a nameservice with several NameNodes in high
+   * availability. The calls go to the active NameNode and fail over to
+   * the next one when it turns out to be a standby or goes down. The
+   * active NameNode is remembered across the FileSystems of the
+   * process.
+   **/
+  static Status New(IoService *io_service, const Options &options,
+                    const std::vector<NameNodeAddress> &namenodes,
+                    FileSystem **fsptr);
+  /**
+   * The asynchronous version of New(). The handler is called on a
+   * thread of the IoService with the new FileSystem, which is owned by
+   * the caller, or nullptr if the connection has failed.
+   **/
+  static void AsyncConnect(IoService *io_service, const Options &options,
+                           const char *server, unsigned short port,
+                           const std::function<void(const Status &, FileSystem *)> &handler);
+  static void AsyncConnect(IoService *io_service, const Options &options,
+                           const std::vector<NameNodeAddress> &namenodes,
+                           const std::function<void(const Status &, FileSystem *)> &handler);
+
   virtual Status Open(const char *path, InputStream **isptr) = 0;
   virtual ~FileSystem();
+
+  // The virtual functions below are appended after the destructor so
+  // that the vtable of the earlier ones keeps its layout.
+
+  /**
+   * The asynchronous version of Open(). The handler is called on a
+   * thread of the IoService with the new InputStream, which is owned
+   * by the caller, or nullptr if the file cannot be opened.
+   **/
+  virtual void AsyncOpen(const char *path,
+                         const std::function<void(const Status &, InputStream *)> &handler) = 0;
+
+  /**
+   * The metadata operations on the NameNode. Each operation has a
+   * synchronous and an asynchronous version, whose handler is called
+   * on a thread of the IoService. A path that does not exist fails
+   * with the code of ENOENT, and the errors of the NameNode, e.g., a
+   * denied permission, come back as Status::Exception() with the class
+   * of the Java exception.
+   **/
+  virtual Status GetFileInfo(const char *path, FileInfo *info) = 0;
+  virtual void AsyncGetFileInfo(
+      const char *path,
+      const std::function<void(const Status &, const FileInfo &)> &handler) = 0;
+  /**
+   * List the entries of a directory, or the file itself if the path is
+   * a file. Large directories are fetched from the NameNode in several
+   * calls.
+   **/
+  virtual Status GetListing(const char *path, std::vector<FileInfo> *entries) = 0;
+  virtual void AsyncGetListing(
+      const char *path,
+      const std::function<void(const Status &, const std::vector<FileInfo> &)> &handler) = 0;
+  /**
+   * Open a listing of a directory that holds one page of entries at a
+   * time, for directories too large for GetListing(). The errors are
+   * reported by DirectoryListing::Next(). The listing must not outlive
+   * the FileSystem. Deleting it waits for the page in flight, thus it
+   * must not be deleted on a thread of the IoService, e.g., in the
+   * handler of an asynchronous call.
+   **/
+  virtual Status OpenListing(const char *path, DirectoryListing **listing) = 0;
+  /**
+   * Walk the tree under the path. The directories are listed in
+   * parallel, with up to Options::max_concurrent_listings calls in
+   * flight. The visitor is called with every page of entries of every
+   * directory, one call at a time but on any thread of the IoService,
+   * and returns false to stop the walk. Symlinks are not followed, and
+   * the directories that disappear during the walk are skipped.
+   **/
+  virtual Status Walk(const char *path,
+                      const std::function<bool(const std::vector<FileInfo> &)> &visitor) = 0;
+  virtual void AsyncWalk(const char *path,
+                         const std::function<bool(const std::vector<FileInfo> &)> &visitor,
+                         const std::function<void(const Status &)> &handler) = 0;
+  virtual Status Mkdirs(const char *path, unsigned short permissions,
+                        bool create_parent) = 0;
+  virtual void AsyncMkdirs(const char *path, unsigned short permissions,
+                           bool create_parent,
+                           const std::function<void(const Status &)> &handler) = 0;
+  virtual Status Delete(const char *path, bool recursive) = 0;
+  virtual void AsyncDelete(const char *path, bool recursive,
+                           const std::function<void(const Status &)> &handler) = 0;
+  /**
+   * Rename a file or a directory. A destination that is an existing
+   * directory receives the source as a child.
+   **/
+  virtual Status Rename(const char *oldpath, const char *newpath) = 0;
+  virtual void AsyncRename(const char *oldpath, const char *newpath,
+                           const std::function<void(const Status &)> &handler) = 0;
+  virtual Status SetPermission(const char *path, unsigned short permissions) = 0;
+  virtual void AsyncSetPermission(const char *path, unsigned short permissions,
+                                  const std::function<void(const Status &)> &handler) = 0;
+  /**
+   * Change the owner and the group. An empty name leaves it unchanged.
+   **/
+  virtual Status SetOwner(const char *path, const char *owner, const char *group) = 0;
+  virtual void AsyncSetOwner(const char *path, const char *owner, const char *group,
+                             const std::function<void(const Status &)> &handler) = 0;
+  virtual Status SetReplication(const char *path, unsigned replication) = 0;
+  virtual void AsyncSetReplication(const char *path, unsigned replication,
+                                   const std::function<void(const Status &)> &handler) = 0;
+  /**
+   * Set the modification and the access time in milliseconds since the
+   * epoch. A time of -1 leaves it unchanged.
+   **/
+  virtual Status SetTimes(const char *path, int64_t mtime, int64_t atime) = 0;
+  virtual void AsyncSetTimes(const char *path, int64_t mtime, int64_t atime,
+                             const std::function<void(const Status &)> &handler) = 0;
+  virtual Status GetContentSummary(const char *path, ContentSummary *summary) = 0;
+  virtual void AsyncGetContentSummary(
+      const char *path,
+      const std::function<void(const Status &, const ContentSummary &)> &handler) = 0;
+  virtual Status GetFsStats(FsStats *stats) = 0;
+  virtual void AsyncGetFsStats(
+      const std::function<void(const Status &, const FsStats &)> &handler) = 0;
 };
 
 }
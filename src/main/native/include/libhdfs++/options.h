@@ -22,16 +22,24 @@
 
 namespace hdfs {
 
+/**
+ * Hints to the DataNode on how to use its page cache for the data of a
+ * read. A hint that is not specified leaves the decision to the
+ * configuration of the DataNode.
+ **/
 struct CacheStrategy {
   bool drop_behind_specified;
+  // Whether the DataNode drops the data from its page cache once it
+  // has been sent, so that one-pass scans do not evict hot data.
   bool drop_behind;
   bool read_ahead_specified;
+  // Number of bytes that the DataNode reads ahead of the client
   unsigned long long read_ahead;
   CacheStrategy()
       : drop_behind_specified(false)
       , drop_behind(false)
       , read_ahead_specified(false)
-      , read_ahead(false)
+      , read_ahead(0)
   {}
 };
 
@@ -39,6 +47,12 @@ enum DropBehindStrategy {
   kUnspecified = 0,
   kEnableDropBehind  = 1,
   kDisableDropBehind = 2,
+  /**
+   * Enable drop-behind for the reads that continue a sequential scan
+   * of at least Options::adaptive_drop_behind_threshold bytes, and
+   * leave it to the DataNode otherwise.
+   **/
+  kAdaptiveDropBehind = 3,
 };
 
 enum EncryptionScheme {
@@ -57,6 +71,241 @@ struct BlockReaderOptions {
   {}
 };
 
+/**
+ * Options of the threads that run the asynchronous operations of an
+ * IoService.
+ **/
+struct IoServiceOptions {
+  /**
+   * Number of worker threads that IoService::Run() uses, including
+   * the calling thread. Zero means one thread per CPU.
+   * Default: 1
+   **/
+  unsigned threads;
+  /**
+   * Pin the i-th worker thread to the (i mod n)-th of the n CPUs that
+   * the process is allowed to run on, e.g., within a cpuset.
+   * Default: false
+   **/
+  bool pin_threads;
+  /**
+   * Give each worker thread its own event loop instead of sharing
+   * one among all threads. New connections are assigned to the event
+   * loops in round-robin, and all callbacks of a connection run on
+   * the same thread. This avoids the contention on the shared event
+   * loop at high thread counts.
+   * Default: false
+   **/
+  bool io_service_per_thread;
+
+  IoServiceOptions()
+      : threads(1)
+      , pin_threads(false)
+      , io_service_per_thread(false)
+  {}
+};
+
+/**
+ * Options to fine-tune the behavior of a FileSystem instance.
+ **/
+struct Options {
+  /**
+   * Time in milliseconds that an idle DataNode connection is kept in
+   * the connection pool. It should be shorter than the keepalive
+   * timeout of the DataNode (dfs.datanode.socket.reuse.keepalive).
+   * Default: 3000
+   **/
+  int datanode_idle_timeout;
+  /**
+   * Maximum number of idle DataNode connections kept in the
+   * connection pool. Zero disables connection reuse.
+   * Default: 64
+   **/
+  unsigned max_idle_datanode_connections;
+  /**
+   * Size in bytes of the read-ahead buffer of InputStream::Read(). Reads
+   * smaller than the buffer are served from the buffer, larger ones
+   * go directly to the DataNode connection. Zero disables the buffer.
+   * Default: 65536
+   **/
+  unsigned read_ahead_buffer_size;
+  /**
+   * Time in milliseconds to wait for a DataNode to return the data of
+   * a PositionRead() before starting the same read against the next
+   * replica of the block. Whichever read finishes first wins, and the
+   * other one is canceled. Zero disables hedged reads.
+   * Default: 0
+   **/
+  int hedged_read_threshold;
+  /**
+   * Time in milliseconds that the block locations of a file are kept
+   * in the block location cache, so that reopening the file does not
+   * need to ask the NameNode again. Files under construction are never
+   * cached. Zero disables the cache.
+   * Default: 10000
+   **/
+  int block_location_cache_ttl;
+  /**
+   * Maximum number of files whose block locations are kept in the
+   * block location cache. The least recently used file is evicted
+   * when the cache is full.
+   * Default: 1024
+   **/
+  unsigned max_cached_block_locations;
+  /**
+   * Size in bytes of the range of the file whose block locations are
+   * fetched from the NameNode at once. The range starts at the offset
+   * being read, and further ranges are fetched when the reads reach
+   * them. Zero fetches the locations of the whole file on open.
+   * Default: 1342177280 (10 blocks of 128MB)
+   **/
+  unsigned long long block_location_fetch_size;
+  /**
+   * Maximum number of bytes between two ranges of the same block in
+   * InputStream::ReadVectored() for the ranges to be merged into one
+   * request. The bytes in between are read and discarded, which is
+   * cheaper than another request for small gaps.
+   * Default: 65536
+   **/
+  unsigned vectored_read_max_gap;
+  /**
+   * Maximum number of bytes of the NameNode RPC requests that are sent
+   * in a single write. The requests queued while a write is in
+   * progress are sent together once it completes, up to this many
+   * bytes. A request larger than the limit is sent on its own. Zero
+   * sends one request per write.
+   * Default: 65536
+   **/
+  unsigned rpc_max_batch_bytes;
+  /**
+   * Number of connections to the NameNode. Each call is sent over the
+   * connection with the fewest outstanding calls, thus a call that
+   * waits for a large response, e.g., a big getListing(), does not
+   * delay the small calls behind it. Each connection occupies a
+   * reader thread of the NameNode.
+   * Default: 1
+   **/
+  unsigned rpc_connections;
+  /**
+   * Time in milliseconds to wait for the response of a NameNode RPC
+   * call before the attempt is considered failed. Zero disables the
+   * timeout.
+   * Default: 60000
+   **/
+  int rpc_timeout;
+  /**
+   * Maximum number of times that a NameNode RPC call which has timed
+   * out or lost its connection is retried. Only idempotent calls are
+   * retried once they have been sent, the others fail. The same limit
+   * applies to the attempts to reconnect to the NameNode. With several
+   * NameNodes in high availability the calls fail over to the next
+   * NameNode instead, and the limit applies to the rounds over all of
+   * them.
+   * Default: 10
+   **/
+  unsigned max_rpc_retries;
+  /**
+   * Delay in milliseconds before the first retry of a NameNode RPC
+   * call or connection. The delay doubles with every retry up to
+   * max_rpc_retry_delay, minus a random jitter.
+   * Default: 100
+   **/
+  int rpc_retry_delay;
+  /**
+   * Maximum delay in milliseconds between two retries.
+   * Default: 10000
+   **/
+  int max_rpc_retry_delay;
+  /**
+   * Time in milliseconds after which a NameNode connection that has
+   * sent nothing sends a ping, so that firewalls and NATs do not drop
+   * the idle connection and the NameNode does not reap it. Zero
+   * disables the pings.
+   * Default: 60000
+   **/
+  int rpc_ping_interval;
+  /**
+   * Time in milliseconds after which a NameNode connection without
+   * calls is closed, and reopened by the next call. It frees the
+   * resources of the NameNode that the idle connections hold. Zero
+   * keeps the connections open.
+   * Default: 0
+   **/
+  int rpc_max_idle_time;
+  /**
+   * Maximum number of getListing() calls in flight during
+   * FileSystem::Walk(). The walk lists this many directories, or pages
+   * of large directories, at once.
+   * Default: 16
+   **/
+  unsigned max_concurrent_listings;
+  /**
+   * Path of the UNIX domain socket of the DataNodes
+   * (dfs.domain.socket.path), in which _PORT stands for the data
+   * transfer port of the DataNode. The replicas on a DataNode of the
+   * same host are read directly from their block files, whose file
+   * descriptors the DataNode passes over the socket, instead of over
+   * TCP. Empty disables short-circuit reads.
+   * Default: empty
+   **/
+  std::string domain_socket_path;
+  /**
+   * Maximum number of local replicas whose file descriptors are kept
+   * open for the subsequent short-circuit reads. The least recently
+   * used replica is closed when the cache is full. Zero closes the
+   * replica after each read.
+   * Default: 256
+   **/
+  unsigned max_short_circuit_replicas;
+  /**
+   * Time in milliseconds that the file descriptors of a local replica
+   * are kept when the DataNode has not registered them in shared
+   * memory, and thus cannot tell the client that the replica has been
+   * moved or deleted. The registered replicas are kept until the
+   * DataNode invalidates them.
+   * Default: 300000
+   **/
+  int short_circuit_replica_expiry;
+  /**
+   * The drop-behind hint that the streams send to the DataNodes with
+   * their reads, until InputStream::SetDropBehind() changes it.
+   * Default: kUnspecified
+   **/
+  DropBehindStrategy drop_behind;
+  /**
+   * Number of bytes that a stream must have read contiguously before
+   * kAdaptiveDropBehind enables drop-behind for its next reads. A read
+   * that does not start where the previous one ended restarts the
+   * count.
+   * Default: 67108864
+   **/
+  unsigned long long adaptive_drop_behind_threshold;
+
+  Options()
+      : datanode_idle_timeout(3000)
+      , max_idle_datanode_connections(64)
+      , read_ahead_buffer_size(64 * 1024)
+      , hedged_read_threshold(0)
+      , block_location_cache_ttl(10000)
+      , max_cached_block_locations(1024)
+      , block_location_fetch_size(10ULL * 128 * 1024 * 1024)
+      , vectored_read_max_gap(64 * 1024)
+      , rpc_max_batch_bytes(64 * 1024)
+      , rpc_connections(1)
+      , rpc_timeout(60000)
+      , max_rpc_retries(10)
+      , rpc_retry_delay(100)
+      , max_rpc_retry_delay(10000)
+      , rpc_ping_interval(60000)
+      , rpc_max_idle_time(0)
+      , max_concurrent_listings(16)
+      , max_short_circuit_replicas(256)
+      , short_circuit_replica_expiry(300000)
+      , drop_behind(kUnspecified)
+      , adaptive_drop_behind_threshold(64 * 1024 * 1024)
+  {}
+};
+
 }
 
 #endif
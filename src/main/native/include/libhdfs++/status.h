@@ -41,32 +41,48 @@ class Status {
   { return Status(kInvalidArgument, msg); }
   static Status ResourceUnavailable(const char *msg)
   { return Status(kResourceUnavailable, msg); }
+  static Status PathNotFound(const char *msg)
+  { return Status(kPathNotFound, msg); }
   static Status Unimplemented()
   { return Status(kUnimplemented, ""); }
   static Status Error(const char *msg)
   { return Status(kGenericError, msg); }
   static Status InvalidEncryptionKey(const char *msg)
   { return Status(kInvalidEncryptionKey, msg); }
+  static Status ChecksumMismatch(const char *msg)
+  { return Status(kChecksumMismatch, msg); }
   static Status Exception(const char *expception_class_name, const char *error_message)
   { return Status(kException, expception_class_name, error_message); }
 
   // Returns true iff the status indicates success.
   bool ok() const { return (state_ == NULL); }
+  // Returns true iff the status carries an exception thrown by the
+  // server, whose class name starts the message.
+  bool is_exception() const { return code() == kException; }
+  // Returns true iff the status reports a path that does not exist.
+  bool is_path_not_found() const { return code() == kPathNotFound; }
+  // Returns true iff a DataNode has rejected the data encryption key.
+  bool is_invalid_encryption_key() const { return code() == kInvalidEncryptionKey; }
+  // Returns the class of the exception thrown by the server, or an
+  // empty string if the status does not carry an exception.
+  std::string exception_class() const;
 
   // Return a string representation of this status suitable for printing.
   // Returns the string "OK" for success.
   std::string ToString() const;
 
   int code() const {
-    return (state_ == NULL) ? kOk : static_cast<int>(state_[4]);
+    return (state_ == NULL) ? kOk : *reinterpret_cast<const int*>(state_ + 4);
   }
 
  private:
   // OK status has a NULL state_.  Otherwise, state_ is a new[] array
   // of the following form:
   //    state_[0..3] == length of message
-  //    state_[4]    == code
-  //    state_[5..]  == message
+  //    state_[4..7] == code
+  //    state_[8..]  == message
+  // followed by four bytes of the length of the exception class that
+  // starts the message, which are zero if there is none.
   const char* state_;
   friend class StatusHelper;
 
@@ -74,10 +90,13 @@ class Status {
     kOk = 0,
     kInvalidArgument = static_cast<unsigned>(std::errc::invalid_argument),
     kResourceUnavailable = static_cast<unsigned>(std::errc::resource_unavailable_try_again),
+    kPathNotFound = static_cast<unsigned>(std::errc::no_such_file_or_directory),
     kGenericError = 1,
-    kInvalidEncryptionKey = 2,
     kUnimplemented = 3,
+    kChecksumMismatch = 4,
     kException = 256,
+    // Apart from the errno values, e.g., ENOENT of kPathNotFound
+    kInvalidEncryptionKey = 257,
   };
 
   explicit Status(int code, const char *msg1, const char *msg2);
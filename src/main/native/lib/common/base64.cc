@@ -16,46 +16,39 @@ std::string Base64Encode(const std::string &src) {
   std::string dst;
   dst.reserve(encoded_size);
 
+  const unsigned char *s = reinterpret_cast<const unsigned char*>(src.data());
   size_t i = 0;
-  while (i + 3 < src.length()) {
-    const char *s = &src[i];
-    const int r[4] = {
-      s[0] >> 2,
-      ((s[0] << 4) | (s[1] >> 4)) & 0x3f,
-      ((s[1] << 2) | (s[2] >> 6)) & 0x3f,
-      s[2] & 0x3f };
-
-    std::transform(r, r + sizeof(r) / sizeof(int), std::back_inserter(dst),
-                   [&r](unsigned char v) { return kDictionary[v]; });
-    i += 3;
+  for (; i + 3 <= src.length(); i += 3) {
+    const unsigned r[4] = {
+      static_cast<unsigned>(s[i] >> 2u),
+      static_cast<unsigned>(((s[i] << 4u) | (s[i + 1] >> 4u)) & 0x3fu),
+      static_cast<unsigned>(((s[i + 1] << 2u) | (s[i + 2] >> 6u)) & 0x3fu),
+      static_cast<unsigned>(s[i + 2] & 0x3fu) };
+
+    std::transform(r, r + sizeof(r) / sizeof(unsigned), std::back_inserter(dst),
+                   [](unsigned v) { return kDictionary[v]; });
   }
 
-  size_t remained = src.length() - i;
-  const char *s = &src[i];
-
-  switch (remained) {
+  switch (src.length() - i) {
     case 0:
       break;
     case 1: {
       char padding[4] = {
-        kDictionary[s[0] >> 2],
-        kDictionary[(s[0] << 4) & 0x3f],
+        kDictionary[s[i] >> 2u],
+        kDictionary[(s[i] << 4u) & 0x3fu],
         '=', '=' };
       dst.append(padding, sizeof(padding));
     }
       break;
     case 2: {
       char padding[4] = {
-        kDictionary[src[i] >> 2],
-        kDictionary[((s[0] << 4) | (s[1] >> 4)) & 0x3f],
-        kDictionary[(s[1] << 2) & 0x3f],
+        kDictionary[s[i] >> 2u],
+        kDictionary[((s[i] << 4u) | (s[i + 1] >> 4u)) & 0x3fu],
+        kDictionary[(s[i + 1] << 2u) & 0x3fu],
         '=' };
       dst.append(padding, sizeof(padding));
     }
       break;
-    default:
-      assert("Unreachable");
-      break;
   }
   return dst;
 }
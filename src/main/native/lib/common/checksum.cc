@@ -0,0 +1,291 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "checksum.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HDFS_CHECKSUM_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace hdfs {
+
+namespace {
+
+// Reversed polynomials of CRC32 (IEEE 802.3) and CRC32C (Castagnoli)
+const uint32_t kCrc32Polynomial = 0xedb88320;
+const uint32_t kCrc32cPolynomial = 0x82f63b78;
+
+/*
+ * Lookup tables of the slicing-by-8 algorithm, where table[k][i] is
+ * the crc of the byte i followed by k zero bytes.
+ */
+struct CrcTable {
+  explicit CrcTable(uint32_t polynomial) {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; ++j) {
+        crc = (crc >> 1) ^ (polynomial & (0 - (crc & 1)));
+      }
+      table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+      }
+    }
+  }
+
+  uint32_t Update(uint32_t crc, const unsigned char *p, size_t length) const {
+    while (length && (reinterpret_cast<uintptr_t>(p) & 7)) {
+      crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+      --length;
+    }
+    while (length >= 8) {
+      uint32_t lo, hi;
+      memcpy(&lo, p, sizeof(lo));
+      memcpy(&hi, p + 4, sizeof(hi));
+      lo ^= crc;
+      crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+            table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+            table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+            table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+      p += 8;
+      length -= 8;
+    }
+    while (length--) {
+      crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+  }
+
+  uint32_t table[8][256];
+};
+
+const CrcTable &Crc32Lookup() {
+  static const CrcTable table(kCrc32Polynomial);
+  return table;
+}
+
+const CrcTable &Crc32cLookup() {
+  static const CrcTable table(kCrc32cPolynomial);
+  return table;
+}
+
+/*
+ * The kernels below take and return the crc before the final
+ * inversion, i.e., the raw state of the shift register.
+ */
+uint32_t Crc32Slicing8(uint32_t crc, const unsigned char *p, size_t length) {
+  return Crc32Lookup().Update(crc, p, length);
+}
+
+uint32_t Crc32cSlicing8(uint32_t crc, const unsigned char *p, size_t length) {
+  return Crc32cLookup().Update(crc, p, length);
+}
+
+#ifdef HDFS_CHECKSUM_X86
+
+__attribute__((target("sse4.2")))
+uint32_t Crc32cSse42(uint32_t crc, const unsigned char *p, size_t length) {
+  while (length && (reinterpret_cast<uintptr_t>(p) & 7)) {
+    crc = _mm_crc32_u8(crc, *p++);
+    --length;
+  }
+
+  uint64_t crc64 = crc;
+  while (length >= 32) {
+    uint64_t v[4];
+    memcpy(v, p, sizeof(v));
+    crc64 = _mm_crc32_u64(crc64, v[0]);
+    crc64 = _mm_crc32_u64(crc64, v[1]);
+    crc64 = _mm_crc32_u64(crc64, v[2]);
+    crc64 = _mm_crc32_u64(crc64, v[3]);
+    p += 32;
+    length -= 32;
+  }
+  while (length >= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    crc64 = _mm_crc32_u64(crc64, v);
+    p += 8;
+    length -= 8;
+  }
+
+  crc = static_cast<uint32_t>(crc64);
+  while (length--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+
+/*
+ * CRC32 by folding with carry-less multiplications, see "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ * by Gopal et al. The constants are the ones of the reflected
+ * IEEE polynomial, as used by the Linux kernel and zlib.
+ *
+ * Requires length >= 64 and a multiple of 16.
+ */
+alignas(16) const uint64_t kK1K2[] = { 0x0154442bd4, 0x01c6e41596 };
+alignas(16) const uint64_t kK3K4[] = { 0x01751997d0, 0x00ccaa009e };
+alignas(16) const uint64_t kK5K0[] = { 0x0163cd6124, 0x0000000000 };
+alignas(16) const uint64_t kPoly[] = { 0x01db710641, 0x01f7011641 };
+
+__attribute__((target("sse4.1,pclmul")))
+uint32_t Crc32FoldPclmul(uint32_t crc, const unsigned char *p, size_t length) {
+  const __m128i *in = reinterpret_cast<const __m128i *>(p);
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_loadu_si128(in);
+  x2 = _mm_loadu_si128(in + 1);
+  x3 = _mm_loadu_si128(in + 2);
+  x4 = _mm_loadu_si128(in + 3);
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(kK1K2));
+  in += 4;
+  length -= 64;
+
+  // Fold 64 bytes at a time in four independent lanes
+  while (length >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(in));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(in + 1));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(in + 2));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(in + 3));
+    in += 4;
+    length -= 64;
+  }
+
+  // Fold the four lanes into one
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(kK3K4));
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // Fold the remaining 16-byte blocks
+  while (length >= 16) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(in)), x5);
+    ++in;
+    length -= 16;
+  }
+
+  // Fold 128 bits into 64 bits
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(kK5K0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction into 32 bits
+  x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(kPoly));
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return _mm_extract_epi32(x1, 1);
+}
+
+uint32_t Crc32Pclmul(uint32_t crc, const unsigned char *p, size_t length) {
+  static const size_t kMinFoldLength = 64;
+  if (length >= kMinFoldLength) {
+    size_t folded = length & ~static_cast<size_t>(15);
+    crc = Crc32FoldPclmul(crc, p, folded);
+    p += folded;
+    length -= folded;
+  }
+  return Crc32Slicing8(crc, p, length);
+}
+
+bool CpuSupports(unsigned ecx_bit) {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return ecx & ecx_bit;
+}
+
+#endif
+
+typedef uint32_t (*CrcKernel)(uint32_t, const unsigned char *, size_t);
+
+CrcKernel Crc32Kernel() {
+#ifdef HDFS_CHECKSUM_X86
+  if (CpuSupports(bit_PCLMUL) && CpuSupports(bit_SSE4_1)) {
+    return Crc32Pclmul;
+  }
+#endif
+  return Crc32Slicing8;
+}
+
+CrcKernel Crc32cKernel() {
+#ifdef HDFS_CHECKSUM_X86
+  if (CpuSupports(bit_SSE4_2)) {
+    return Crc32cSse42;
+  }
+#endif
+  return Crc32cSlicing8;
+}
+
+}
+
+uint32_t Crc32(uint32_t crc, const void *data, size_t length) {
+  static const CrcKernel kernel = Crc32Kernel();
+  return ~kernel(~crc, static_cast<const unsigned char *>(data), length);
+}
+
+uint32_t Crc32c(uint32_t crc, const void *data, size_t length) {
+  static const CrcKernel kernel = Crc32cKernel();
+  return ~kernel(~crc, static_cast<const unsigned char *>(data), length);
+}
+
+namespace internal {
+
+uint32_t Crc32Sw(uint32_t crc, const void *data, size_t length) {
+  return ~Crc32Slicing8(~crc, static_cast<const unsigned char *>(data), length);
+}
+
+uint32_t Crc32cSw(uint32_t crc, const void *data, size_t length) {
+  return ~Crc32cSlicing8(~crc, static_cast<const unsigned char *>(data), length);
+}
+
+}
+
+}
@@ -0,0 +1,52 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_COMMON_CHECKSUM_H_
+#define LIB_COMMON_CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hdfs {
+
+/**
+ * The checksums of the data transfer protocol (CHECKSUM_CRC32 and
+ * CHECKSUM_CRC32C in hdfs.proto).
+ *
+ * Both functions follow the convention of zlib's crc32(): the crc
+ * parameter is the checksum of the preceding data, or 0 for the
+ * first piece, so that the checksum of a chunk can be computed
+ * incrementally over several buffers.
+ *
+ * The implementation uses the SSE4.2 crc32 instruction for CRC32C
+ * and the PCLMULQDQ instruction for CRC32 when the CPU supports them,
+ * and falls back to table-driven implementations otherwise.
+ **/
+uint32_t Crc32(uint32_t crc, const void *data, size_t length);
+uint32_t Crc32c(uint32_t crc, const void *data, size_t length);
+
+namespace internal {
+/*
+ * The table-driven implementations, exposed for testing.
+ */
+uint32_t Crc32Sw(uint32_t crc, const void *data, size_t length);
+uint32_t Crc32cSw(uint32_t crc, const void *data, size_t length);
+}
+
+}
+
+#endif
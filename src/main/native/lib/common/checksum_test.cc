@@ -0,0 +1,78 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "checksum.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+namespace hdfs {
+
+TEST(ChecksumTest, TestKnownValues) {
+  static const char kInput[] = "123456789";
+  ASSERT_EQ(0xcbf43926u, Crc32(0, kInput, 9));
+  ASSERT_EQ(0xe3069283u, Crc32c(0, kInput, 9));
+  ASSERT_EQ(0xcbf43926u, internal::Crc32Sw(0, kInput, 9));
+  ASSERT_EQ(0xe3069283u, internal::Crc32cSw(0, kInput, 9));
+  ASSERT_EQ(0u, Crc32(0, kInput, 0));
+  ASSERT_EQ(0u, Crc32c(0, kInput, 0));
+}
+
+/**
+ * The accelerated implementations must agree with the table-driven
+ * ones for every length and alignment, including the tails that do
+ * not fill a whole folding block.
+ **/
+TEST(ChecksumTest, TestMatchSoftware) {
+  std::mt19937 gen(42);
+  std::vector<unsigned char> data(4096 + 16);
+  for (auto &c : data) {
+    c = gen();
+  }
+
+  for (size_t align = 0; align < 16; ++align) {
+    for (size_t len = 0; len <= 600; ++len) {
+      const unsigned char *p = data.data() + align;
+      ASSERT_EQ(internal::Crc32Sw(0, p, len), Crc32(0, p, len)) << len;
+      ASSERT_EQ(internal::Crc32cSw(0, p, len), Crc32c(0, p, len)) << len;
+    }
+  }
+  ASSERT_EQ(internal::Crc32Sw(0, data.data(), 4096), Crc32(0, data.data(), 4096));
+  ASSERT_EQ(internal::Crc32cSw(0, data.data(), 4096), Crc32c(0, data.data(), 4096));
+}
+
+TEST(ChecksumTest, TestIncremental) {
+  std::mt19937 gen(7);
+  std::vector<unsigned char> data(1024);
+  for (auto &c : data) {
+    c = gen();
+  }
+
+  for (size_t split = 0; split <= data.size(); split += 37) {
+    uint32_t crc = Crc32(0, data.data(), split);
+    crc = Crc32(crc, data.data() + split, data.size() - split);
+    ASSERT_EQ(Crc32(0, data.data(), data.size()), crc);
+
+    uint32_t crcc = Crc32c(0, data.data(), split);
+    crcc = Crc32c(crcc, data.data() + split, data.size() - split);
+    ASSERT_EQ(Crc32c(0, data.data(), data.size()), crcc);
+  }
+}
+
+}
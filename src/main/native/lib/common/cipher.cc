@@ -0,0 +1,69 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cipher.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace hdfs {
+
+Status AesCtrCipher::Init(const std::string &key, const std::string &iv) {
+  const EVP_CIPHER *cipher;
+  switch (key.size()) {
+    case 16:
+      cipher = EVP_aes_128_ctr();
+      break;
+    case 24:
+      cipher = EVP_aes_192_ctr();
+      break;
+    case 32:
+      cipher = EVP_aes_256_ctr();
+      break;
+    default:
+      return Status::InvalidArgument("Invalid length of the AES key");
+  }
+  if (iv.size() != kIvSize) {
+    return Status::InvalidArgument("Invalid length of the AES IV");
+  }
+
+  ctx_.reset(EVP_CIPHER_CTX_new());
+  if (!ctx_ || !EVP_EncryptInit_ex(ctx_.get(), cipher, nullptr,
+                                   reinterpret_cast<const unsigned char*>(key.data()),
+                                   reinterpret_cast<const unsigned char*>(iv.data()))) {
+    ctx_.reset();
+    return Status::Error("Cannot initialize the AES cipher");
+  }
+  return Status::OK();
+}
+
+void AesCtrCipher::Update(const void *in, void *out, size_t length) {
+  auto src = static_cast<const unsigned char*>(in);
+  auto dst = static_cast<unsigned char*>(out);
+  // EVP takes the length as an int
+  while (length) {
+    int n = static_cast<int>(std::min<size_t>(length, INT_MAX / 2));
+    int written = 0;
+    EVP_EncryptUpdate(ctx_.get(), dst, &written, src, n);
+    src += n;
+    dst += n;
+    length -= n;
+  }
+}
+
+}
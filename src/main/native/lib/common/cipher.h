@@ -0,0 +1,66 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_COMMON_CIPHER_H_
+#define LIB_COMMON_CIPHER_H_
+
+#include "libhdfs++/status.h"
+
+#include <openssl/evp.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace hdfs {
+
+/**
+ * AES in the CTR mode, the AES/CTR/NoPadding cipher suite of the
+ * CryptoCodec of Hadoop. The IV is the initial 128-bit counter block,
+ * which is incremented as a big-endian number for each block of the
+ * stream.
+ *
+ * The cipher runs through EVP, which uses the AES-NI instructions
+ * when the CPU supports them. CTR encrypts and decrypts alike, and
+ * both work in place.
+ **/
+class AesCtrCipher {
+ public:
+  static const size_t kIvSize = 16;
+
+  /**
+   * Set up the cipher with a 128, 192 or 256-bit key and an IV at the
+   * start of the stream.
+   **/
+  Status Init(const std::string &key, const std::string &iv);
+  /**
+   * Transform the next length bytes of the stream from in to out,
+   * which can be the same buffer.
+   **/
+  void Update(const void *in, void *out, size_t length);
+  bool initialized() const { return ctx_ != nullptr; }
+
+ private:
+  struct ContextDeleter {
+    void operator()(EVP_CIPHER_CTX *ctx) const { EVP_CIPHER_CTX_free(ctx); }
+  };
+  std::unique_ptr<EVP_CIPHER_CTX, ContextDeleter> ctx_;
+};
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "cipher.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace hdfs {
+
+static std::string FromHex(const char *hex) {
+  std::string res;
+  for (; hex[0] && hex[1]; hex += 2) {
+    res.push_back(static_cast<char>(std::stoi(std::string(hex, 2), nullptr, 16)));
+  }
+  return res;
+}
+
+/**
+ * CTR-AES128.Encrypt of NIST SP 800-38A, F.5.1.
+ **/
+TEST(AesCtrCipherTest, TestKnownValues) {
+  const std::string key = FromHex("2b7e151628aed2a6abf7158809cf4f3c");
+  const std::string iv = FromHex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+  const std::string plain = FromHex(
+      "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+      "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+  const std::string cipher = FromHex(
+      "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+      "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee");
+
+  AesCtrCipher enc;
+  ASSERT_TRUE(enc.Init(key, iv).ok());
+  std::vector<char> out(plain.size());
+  enc.Update(plain.data(), out.data(), plain.size());
+  ASSERT_EQ(cipher, std::string(out.data(), out.size()));
+
+  // Decrypt in place, in pieces that do not align with the blocks
+  AesCtrCipher dec;
+  ASSERT_TRUE(dec.Init(key, iv).ok());
+  dec.Update(out.data(), out.data(), 7);
+  dec.Update(out.data() + 7, out.data() + 7, 30);
+  dec.Update(out.data() + 37, out.data() + 37, out.size() - 37);
+  ASSERT_EQ(plain, std::string(out.data(), out.size()));
+}
+
+TEST(AesCtrCipherTest, TestInvalidKey) {
+  AesCtrCipher c;
+  ASSERT_FALSE(c.Init(std::string(15, 'k'), std::string(16, 'i')).ok());
+  ASSERT_FALSE(c.Init(std::string(16, 'k'), std::string(8, 'i')).ok());
+  ASSERT_FALSE(c.initialized());
+}
+
+}
@@ -67,6 +67,9 @@ class Continuation {
  * into an asynchronous event loop, invoking the next continuation
  * can be done in the callback handler in the asynchronous event loop.
  *
+ * The pipeline stops at the first continuation that fails, and
+ * passes the error to the callback specified by the user.
+ *
  * The pipeline allocates the memory as follows. A pipeline is always
  * allocated on the heap. It owns all the continuations as well as the
  * the state specified by the user. Both the continuations and the
@@ -104,7 +107,7 @@ inline Pipeline<State> &Pipeline<State>::Push(Continuation *stage) {
 
 template<class State>
 inline void Pipeline<State>::Schedule(const Status &status) {
-  if (stage_ >= routines_.size()) {
+  if (!status.ok() || stage_ >= routines_.size()) {
     handler_(status, state_);
     routines_.clear();
     delete this;
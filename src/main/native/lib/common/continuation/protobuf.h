@@ -52,8 +52,10 @@ struct ReadDelimitedPBMessageContinuation : public Continuation {
     }
 
     size_t offset = 0, len = 0;
-    for (size_t i = 0; i + 1 < transferred && i < sizeof(int); ++i) {
-      len = (len << 7) | (buf_[i] & 0x7f);
+    // The length is a varint, whose groups of 7 bits come in the order
+    // of the least significant one first
+    for (size_t i = 0; i < transferred && i < sizeof(int); ++i) {
+      len |= static_cast<size_t>(buf_[i] & 0x7f) << (7 * i);
       if ((uint8_t)buf_.at(i) < 0x80) {
         offset = i + 1;
         break;
@@ -81,10 +83,13 @@ struct WriteDelimitedPBMessageContinuation : Continuation {
     namespace pbio = google::protobuf::io;
     int size = msg_->ByteSize();
     buf_.reserve(pbio::CodedOutputStream::VarintSize32(size) + size);
-    pbio::StringOutputStream ss(&buf_);
-    pbio::CodedOutputStream os(&ss);
-    os.WriteVarint32(size);
-    msg_->SerializeToCodedStream(&os);
+    {
+      // The streams have to be flushed before the buffer is written.
+      pbio::StringOutputStream ss(&buf_);
+      pbio::CodedOutputStream os(&ss);
+      os.WriteVarint32(size);
+      msg_->SerializeToCodedStream(&os);
+    }
     write_coroutine_ = std::shared_ptr<Continuation>(Write(stream_, asio::buffer(buf_)));
     write_coroutine_->Run([next](const Status &stat) { next(stat); });
   }
@@ -28,6 +28,9 @@ enum {
 enum Operation {
   kWriteBlock = 80,
   kReadBlock  = 81,
+  kRequestShortCircuitFds = 87,
+  kReleaseShortCircuitFds = 88,
+  kRequestShortCircuitShm = 89,
 };
 
 }
@@ -18,8 +18,11 @@
 
 #include "datatransfer_sasl.h"
 
+#include "common/util.h"
 #include "libhdfs++/status.h"
 
+#include <sstream>
+
 namespace hdfs {
 
 namespace DataTransferSaslStreamUtil {
@@ -46,5 +49,13 @@ void PrepareInitialHandshake(SaslMessage *msg) {
   msg->set_payload("");
 }
 
+void GetCredentials(const hadoop::hdfs::DataEncryptionKeyProto &key,
+                    std::string *username, std::string *password) {
+  std::ostringstream os;
+  os << key.keyid() << " " << key.blockpoolid() << " " << Base64Encode(key.nonce());
+  *username = os.str();
+  *password = Base64Encode(key.encryptionkey());
+}
+
 }
 }
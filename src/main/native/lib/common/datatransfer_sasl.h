@@ -18,6 +18,7 @@
 #ifndef COMMON_DATATRANSFER_SASL_H_
 #define COMMON_DATATRANSFER_SASL_H_
 
+#include "cipher.h"
 #include "sasl_authenticator.h"
 #include "common/continuation/asio.h"
 #include "common/continuation/protobuf.h"
@@ -27,29 +28,54 @@
 #include "datatransfer.h"
 #include "datatransfer.pb.h"
 
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <vector>
+
 namespace hdfs {
 
+/**
+ * A stream that encrypts the data transfer with a DataNode
+ * (dfs.encrypt.data.transfer).
+ *
+ * Handshake() authenticates the client with DIGEST-MD5 over the
+ * credentials derived from the data encryption key of the NameNode,
+ * and negotiates the AES/CTR/NoPadding cipher suite, whose keys are
+ * sealed with the auth-conf QOP of the SASL session. Afterwards the
+ * reads are decrypted in place in the buffers of the caller, and the
+ * writes are encrypted into a buffer of the stream.
+ *
+ * The stream passes the data through until the handshake completes,
+ * thus it also serves the connections that are not encrypted. The
+ * SASL security layer of Hadoop, which wraps every message when the
+ * DataNode does not agree on a cipher suite, is not supported.
+ **/
 template <class Stream>
 class DataTransferSaslStream {
  public:
   DataTransferSaslStream(const BlockReaderOptions &options,
-                         const std::shared_ptr<Stream> &stream,
-                         const std::string &username,
-                         const std::string &password)
+                         const std::shared_ptr<Stream> &stream)
       : stream_(stream)
       , options_(options)
-      , authenticator_(username, password)
   {}
 
   template<class Handler>
-  void Handshake(const Handler &next);
+  void Handshake(const std::string &username, const std::string &password,
+                 const Handler &next);
+  bool is_encrypted() const { return decrypt_.initialized(); }
 
   template <typename MutableBufferSequence, typename ReadHandler>
   ASIO_INITFN_RESULT_TYPE(ReadHandler,
       void (asio::error_code, std::size_t))
   async_read_some(const MutableBufferSequence& buffers,
                   ASIO_MOVE_ARG(ReadHandler) handler) {
-    return stream_->async_read_some(buffers, handler);
+    if (!is_encrypted()) {
+      return stream_->async_read_some(buffers, ASIO_MOVE_CAST(ReadHandler)(handler));
+    }
+    typedef typename std::decay<ReadHandler>::type Handler;
+    return stream_->async_read_some(buffers, DecryptHandler<MutableBufferSequence, Handler>(
+        &decrypt_, buffers, ASIO_MOVE_CAST(ReadHandler)(handler)));
   }
 
   template <typename ConstBufferSequence, typename WriteHandler>
@@ -58,17 +84,41 @@ class DataTransferSaslStream {
   async_write_some(const ConstBufferSequence& buffers,
       ASIO_MOVE_ARG(WriteHandler) handler)
   {
-    return stream_->async_write_some(buffers, handler);
+    if (!is_encrypted()) {
+      return stream_->async_write_some(buffers, ASIO_MOVE_CAST(WriteHandler)(handler));
+    }
+    // The cipher has moved past the encrypted bytes, thus they are
+    // written as a whole.
+    size_t size = Encrypt(buffers);
+    typedef typename std::decay<WriteHandler>::type Handler;
+    return asio::async_write(*stream_, asio::buffer(write_buf_.data(), size),
+                             WriteCompletionHandler<Handler>(
+                                 size, ASIO_MOVE_CAST(WriteHandler)(handler)));
   }
 
  private:
   DataTransferSaslStream(const DataTransferSaslStream&) = delete;
   DataTransferSaslStream &operator=(const DataTransferSaslStream &) = delete;
+  // The maximum number of bytes that a write encrypts at once
+  enum { kMaxWriteSize = 64 * 1024 };
+
   std::shared_ptr<Stream> stream_;
   BlockReaderOptions options_;
-  DigestMD5Authenticator authenticator_;
+  std::unique_ptr<DigestMD5Authenticator> authenticator_;
+  AesCtrCipher decrypt_;
+  AesCtrCipher encrypt_;
+  std::vector<char> write_buf_;
+
   struct ReadSaslMessageContinuation;
   struct AuthenticatorContinuation;
+  template <class MutableBufferSequence, class Handler>
+  struct DecryptHandler;
+  template <class Handler>
+  struct WriteCompletionHandler;
+
+  Status InitCiphers(const hadoop::hdfs::DataTransferEncryptorMessageProto &msg);
+  template <class ConstBufferSequence>
+  size_t Encrypt(const ConstBufferSequence &buffers);
 };
 
 namespace DataTransferSaslStreamUtil {
@@ -77,6 +127,12 @@ typedef hadoop::hdfs::DataTransferEncryptorMessageProto SaslMessage;
 
 Status ConvertToStatus(const SaslMessage *msg, std::string *payload);
 void PrepareInitialHandshake(SaslMessage *msg);
+/**
+ * The credentials of the SASL handshake for a data encryption key of
+ * the NameNode.
+ **/
+void GetCredentials(const hadoop::hdfs::DataEncryptionKeyProto &key,
+                    std::string *username, std::string *password);
 
 }
 
@@ -96,13 +152,16 @@ struct DataTransferSaslStream<Stream>::AuthenticatorContinuation
   virtual void Run(const Next& next) override {
     std::string response;
     Status status = authenticator_->EvaluateResponse(*request_, &response);
+    if (!status.ok()) {
+      next(status);
+      return;
+    }
+
     msg_->Clear();
-    if (status.ok()) {
-      // TODO: Handle encryption scheme
-      msg_->set_payload(response);
-      msg_->set_status(hadoop::hdfs::DataTransferEncryptorMessageProto_DataTransferEncryptorStatus_SUCCESS);
-    } else {
-      msg_->set_status(hadoop::hdfs::DataTransferEncryptorMessageProto_DataTransferEncryptorStatus_ERROR);
+    msg_->set_payload(response);
+    msg_->set_status(hadoop::hdfs::DataTransferEncryptorMessageProto_DataTransferEncryptorStatus_SUCCESS);
+    if (options_->encryption_scheme == kAESCTRNoPadding) {
+      msg_->add_cipheroption()->set_suite(hadoop::hdfs::AES_CTR_NOPADDING);
     }
     next(Status::OK());
   }
@@ -117,17 +176,20 @@ struct DataTransferSaslStream<Stream>::AuthenticatorContinuation
 template<class Stream>
 struct DataTransferSaslStream<Stream>::ReadSaslMessageContinuation
     : continuation::Continuation {
-  ReadSaslMessageContinuation(Stream *stream, std::string *data)
+  ReadSaslMessageContinuation(Stream *stream,
+                              hadoop::hdfs::DataTransferEncryptorMessageProto *msg,
+                              std::string *data)
       : stream_(stream)
+      , msg_(msg)
       , data_(data)
   {}
 
   virtual void Run(const Next& next) override {
     read_pb_.reset(
-        new continuation::ReadDelimitedPBMessageContinuation<Stream, 1024>(stream_, &resp_));
+        new continuation::ReadDelimitedPBMessageContinuation<Stream, 1024>(stream_, msg_));
     auto handler = [this,next](const Status &status) {
       if (status.ok()) {
-        Status new_stat = DataTransferSaslStreamUtil::ConvertToStatus(&resp_, data_);
+        Status new_stat = DataTransferSaslStreamUtil::ConvertToStatus(msg_, data_);
         next(new_stat);
       } else {
         next(status);
@@ -138,40 +200,156 @@ struct DataTransferSaslStream<Stream>::ReadSaslMessageContinuation
 
  private:
   Stream *stream_;
+  hadoop::hdfs::DataTransferEncryptorMessageProto *msg_;
   std::string *data_;
-  hadoop::hdfs::DataTransferEncryptorMessageProto resp_;
   std::unique_ptr<continuation::Continuation> read_pb_;
 };
 
+/*
+ * Decrypt the bytes that a read has transferred into the buffers
+ * before the handler sees them.
+ */
+template <class Stream>
+template <class MutableBufferSequence, class Handler>
+struct DataTransferSaslStream<Stream>::DecryptHandler {
+  template <class H>
+  DecryptHandler(AesCtrCipher *cipher, const MutableBufferSequence &buffers,
+                 H &&handler)
+      : cipher_(cipher)
+      , buffers_(buffers)
+      , handler_(std::forward<H>(handler))
+  {}
+
+  void operator()(const asio::error_code &ec, size_t transferred) {
+    size_t remaining = transferred;
+    for (auto it = buffers_.begin(); it != buffers_.end() && remaining; ++it) {
+      asio::mutable_buffer buf(*it);
+      size_t size = std::min(asio::buffer_size(buf), remaining);
+      char *data = asio::buffer_cast<char*>(buf);
+      cipher_->Update(data, data, size);
+      remaining -= size;
+    }
+    handler_(ec, transferred);
+  }
+
+ private:
+  AesCtrCipher *cipher_;
+  MutableBufferSequence buffers_;
+  Handler handler_;
+};
+
 template <class Stream>
 template <class Handler>
-void DataTransferSaslStream<Stream>::Handshake(const Handler &next) {
+struct DataTransferSaslStream<Stream>::WriteCompletionHandler {
+  template <class H>
+  WriteCompletionHandler(size_t size, H &&handler)
+      : size_(size)
+      , handler_(std::forward<H>(handler))
+  {}
+
+  void operator()(const asio::error_code &ec, size_t) {
+    handler_(ec, ec ? 0 : size_);
+  }
+
+ private:
+  size_t size_;
+  Handler handler_;
+};
+
+template <class Stream>
+template <class ConstBufferSequence>
+size_t DataTransferSaslStream<Stream>::Encrypt(const ConstBufferSequence &buffers) {
+  size_t size = std::min<size_t>(asio::buffer_size(buffers), kMaxWriteSize);
+  if (write_buf_.size() < size) {
+    write_buf_.resize(size);
+  }
+  size_t offset = 0;
+  for (auto it = buffers.begin(); it != buffers.end() && offset < size; ++it) {
+    asio::const_buffer buf(*it);
+    size_t n = std::min(asio::buffer_size(buf), size - offset);
+    encrypt_.Update(asio::buffer_cast<const char*>(buf), &write_buf_[offset], n);
+    offset += n;
+  }
+  return size;
+}
+
+template <class Stream>
+Status DataTransferSaslStream<Stream>::InitCiphers(
+    const hadoop::hdfs::DataTransferEncryptorMessageProto &msg) {
+  if (!msg.cipheroption_size()) {
+    return Status::Error("The DataNode has not negotiated a cipher suite, "
+                         "and the SASL security layer is not supported");
+  }
+  const auto &option = msg.cipheroption(0);
+  if (option.suite() != hadoop::hdfs::AES_CTR_NOPADDING) {
+    return Status::Error("The DataNode has negotiated an unsupported cipher suite");
+  }
+
+  // The keys are sealed in the order of inKey and outKey
+  std::string in_key, out_key;
+  Status status = authenticator_->Unwrap(option.inkey(), &in_key);
+  if (!status.ok()) {
+    return status;
+  }
+  status = authenticator_->Unwrap(option.outkey(), &out_key);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The DataNode reads with inKey and writes with outKey
+  status = decrypt_.Init(out_key, option.outiv());
+  if (!status.ok()) {
+    return status;
+  }
+  return encrypt_.Init(in_key, option.iniv());
+}
+
+template <class Stream>
+template <class Handler>
+void DataTransferSaslStream<Stream>::Handshake(const std::string &username,
+                                               const std::string &password,
+                                               const Handler &next) {
   using hadoop::hdfs::DataTransferEncryptorMessageProto;
   struct State {
     int magic_number;
     DataTransferEncryptorMessageProto request0;
-    std::string response0;
+    DataTransferEncryptorMessageProto response0;
+    std::string challenge;
     DataTransferEncryptorMessageProto request1;
-    std::string response1;
-    std::shared_ptr<Stream> stream;
+    DataTransferEncryptorMessageProto response1;
+    std::string server_response;
   };
-  auto s = std::make_shared<State>();
-  s->stream = stream_;
-  s->magic_number = htonl(kDataTransferSasl);
-  DataTransferSaslStreamUtil::PrepareInitialHandshake(&s->request0);
-
-  auto prog = continuation::Write(stream_, asio::buffer(reinterpret_cast<const char*>(&s->magic_number), sizeof(s->magic_number)))
-          >>= WriteDelimitedPBMessage(stream_.get(), &s->request0)
-          >>= ReadSaslMessageContinuation(stream_.get(), &s->response0)
-          >>= AuthenticatorContinuation(&authenticator_, &options_, &s->response0, &s->request1)
-          >>= WriteDelimitedPBMessage(stream_.get(), &s->request1)
-          >>= ReadSaslMessageContinuation(stream_.get(), &s->response1);
-
-  // TODO: Check whether the server and the client matches the QOP
-
-  auto m = std::shared_ptr<decltype(prog)>(new decltype(prog)(std::move(prog)));
-  m->Run([m,s,next](const Status &status) {
-      next(status);
+
+  authenticator_.reset(new DigestMD5Authenticator(username, password));
+  authenticator_->set_require_privacy(true);
+
+  auto m = continuation::Pipeline<State>::Create();
+  auto &s = m->state();
+  s.magic_number = htonl(kDataTransferSasl);
+  DataTransferSaslStreamUtil::PrepareInitialHandshake(&s.request0);
+
+  Stream *stream = stream_.get();
+  m->Push(continuation::Write(stream, asio::buffer(reinterpret_cast<const char*>(&s.magic_number),
+                                                   sizeof(s.magic_number))))
+      .Push(continuation::WriteDelimitedPBMessage(stream, &s.request0))
+      .Push(new ReadSaslMessageContinuation(stream, &s.response0, &s.challenge))
+      .Push(new AuthenticatorContinuation(authenticator_.get(), &options_,
+                                          &s.challenge, &s.request1))
+      .Push(continuation::WriteDelimitedPBMessage(stream, &s.request1))
+      .Push(new ReadSaslMessageContinuation(stream, &s.response1, &s.server_response));
+
+  m->Run([this,next](const Status &status, const State &state) {
+      if (!status.ok()) {
+        next(status);
+        return;
+      }
+
+      std::string result;
+      Status stat = authenticator_->EvaluateResponse(state.server_response, &result);
+      if (stat.ok()) {
+        stat = InitCiphers(state.response1);
+      }
+      next(stat);
     });
 }
 
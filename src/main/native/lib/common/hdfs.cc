@@ -18,6 +18,17 @@
 
 #include "wrapper.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace hdfs {
 
 IoService::~IoService() {}
@@ -26,4 +37,86 @@ IoService *IoService::New() {
   return new IoServiceImpl();
 }
 
+IoService *IoService::New(const IoServiceOptions &options) {
+  return new IoServiceImpl(options);
+}
+
+IoServiceImpl::IoServiceImpl()
+    : IoServiceImpl(IoServiceOptions())
+{}
+
+IoServiceImpl::IoServiceImpl(const IoServiceOptions &options)
+    : options_(options)
+    , threads_(options.threads)
+    , next_io_service_(0)
+{
+  if (!threads_) {
+    threads_ = std::max(1u, std::thread::hardware_concurrency());
+  }
+  unsigned n = options_.io_service_per_thread ? threads_ : 1;
+  for (unsigned i = 0; i < n; ++i) {
+    // A shared event loop gets a concurrency hint of the number of
+    // threads, a private one is run by a single thread.
+    io_services_.emplace_back(new ::asio::io_service(n == 1 ? threads_ : 1));
+  }
+
+#ifdef __linux__
+  // The threads that are created after a worker has been pinned
+  // inherit its affinity, thus the allowed CPUs are taken up front.
+  cpu_set_t cpuset;
+  if (options_.pin_threads && !sched_getaffinity(0, sizeof(cpuset), &cpuset)) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &cpuset)) {
+        cpus_.push_back(cpu);
+      }
+    }
+  }
+#endif
+}
+
+void IoServiceImpl::Run() {
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads_; ++i) {
+    workers.emplace_back(std::bind(&IoServiceImpl::RunWorker, this, i));
+  }
+  RunWorker(0);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void IoServiceImpl::Stop() {
+  for (auto &io_service : io_services_) {
+    io_service->stop();
+  }
+}
+
+::asio::io_service &IoServiceImpl::NextIoService() {
+  if (io_services_.size() == 1) {
+    return *io_services_[0];
+  }
+  return *io_services_[next_io_service_++ % io_services_.size()];
+}
+
+void IoServiceImpl::RunWorker(unsigned index) {
+#ifdef __linux__
+  if (!cpus_.empty()) {
+    int cpu = cpus_[index % cpus_.size()];
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (err) {
+      // The thread runs unpinned, which is only slower
+      fprintf(stderr, "libhdfs++: cannot pin the worker thread %u to CPU %d: %s\n",
+              index, cpu, strerror(err));
+    }
+  }
+#endif
+
+  auto &io_service = *io_services_[index % io_services_.size()];
+  ::asio::io_service::work work(io_service);
+  io_service.run();
+}
+
 }
@@ -0,0 +1,110 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_COMMON_MPSC_QUEUE_H_
+#define LIB_COMMON_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace hdfs {
+
+/**
+ * A lock-free multi-producer single-consumer queue.
+ *
+ * The producers push the elements onto a lock-free stack. The
+ * consumer takes the whole stack at once and reverses it, so that it
+ * receives the elements in the order in which they were pushed. This
+ * suits consumers that process the elements in batches, e.g., the
+ * write loop of a connection.
+ **/
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(nullptr) {}
+  ~MpscQueue();
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  /**
+   * Add an element to the queue. It can be called from any thread.
+   **/
+  void Push(T &&value);
+  /**
+   * Remove all elements from the queue and append them to the
+   * container in FIFO order. Only one thread can call it at a time.
+   * Return the number of elements removed.
+   **/
+  template <class Container>
+  size_t PopAll(Container *out);
+  bool empty() const { return head_.load() == nullptr; }
+
+ private:
+  struct Node {
+    T value;
+    Node *next;
+    explicit Node(T &&value) : value(std::move(value)), next(nullptr) {}
+  };
+  std::atomic<Node*> head_;
+};
+
+template <class T>
+MpscQueue<T>::~MpscQueue() {
+  Node *node = head_.load();
+  while (node) {
+    Node *next = node->next;
+    delete node;
+    node = next;
+  }
+}
+
+template <class T>
+void MpscQueue<T>::Push(T &&value) {
+  Node *node = new Node(std::move(value));
+  node->next = head_.load(std::memory_order_relaxed);
+  while (!head_.compare_exchange_weak(node->next, node)) {
+  }
+}
+
+template <class T>
+template <class Container>
+size_t MpscQueue<T>::PopAll(Container *out) {
+  Node *node = head_.exchange(nullptr);
+  // The stack holds the most recently pushed element first
+  Node *reversed = nullptr;
+  while (node) {
+    Node *next = node->next;
+    node->next = reversed;
+    reversed = node;
+    node = next;
+  }
+
+  size_t count = 0;
+  while (reversed) {
+    Node *next = reversed->next;
+    out->push_back(std::move(reversed->value));
+    delete reversed;
+    reversed = next;
+    ++count;
+  }
+  return count;
+}
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mpsc_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace hdfs {
+
+TEST(MpscQueueTest, TestFifo) {
+  MpscQueue<std::unique_ptr<int>> queue;
+  ASSERT_TRUE(queue.empty());
+  for (int i = 0; i < 10; ++i) {
+    queue.Push(std::unique_ptr<int>(new int(i)));
+  }
+  ASSERT_FALSE(queue.empty());
+
+  std::deque<std::unique_ptr<int>> out;
+  ASSERT_EQ(10u, queue.PopAll(&out));
+  ASSERT_TRUE(queue.empty());
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_EQ(i, *out[i]);
+  }
+  ASSERT_EQ(0u, queue.PopAll(&out));
+
+  // The queue frees the elements that have not been popped
+  queue.Push(std::unique_ptr<int>(new int(10)));
+}
+
+/**
+ * The elements of every producer must arrive exactly once and in the
+ * order in which that producer pushed them.
+ **/
+TEST(MpscQueueTest, TestConcurrentProducers) {
+  static const int kProducers = 8;
+  static const int kElements = 20000;
+  MpscQueue<int> queue;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, p]() {
+        for (int i = 0; i < kElements; ++i) {
+          queue.Push(p * kElements + i);
+        }
+      });
+  }
+
+  std::vector<int> next(kProducers, 0);
+  int received = 0;
+  std::vector<int> out;
+  while (received < kProducers * kElements) {
+    out.clear();
+    queue.PopAll(&out);
+    for (int v : out) {
+      int p = v / kElements;
+      ASSERT_EQ(next[p], v % kElements);
+      ++next[p];
+      ++received;
+    }
+  }
+
+  for (auto &t : producers) {
+    t.join();
+  }
+  ASSERT_TRUE(queue.empty());
+}
+
+}
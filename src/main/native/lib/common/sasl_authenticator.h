@@ -20,45 +20,101 @@
 
 #include "libhdfs++/status.h"
 
+#include <openssl/evp.h>
+
+#include <memory>
+#include <string>
+
 namespace hdfs {
 
 class DigestMD5AuthenticatorTest_TestResponse_Test;
+class DigestMD5AuthenticatorTest_TestPrivacy_Test;
 
 /**
  * A specialized implementation of RFC 2831 for the HDFS
  * DataTransferProtocol.
  *
+ * The auth-conf QOP is supported with the 3des cipher only, which
+ * every Java implementation offers. It protects the keys of the
+ * cipher negotiated for the data transfer, see Wrap() and Unwrap().
+ *
  * The current lacks the following features:
  *   * Encoding the username, realm, and password in ISO-8859-1 when
  * it is required by the RFC. They are always encoded in UTF-8.
  *   * Checking whether the challenges from the server are
  * well-formed.
  *   * Specifying authzid, digest-uri and maximum buffer size.
- *   * Supporting QOP other than the auth level.
+ *   * Supporting the auth-int QOP and the ciphers other than 3des.
  **/
 class DigestMD5Authenticator {
  public:
+  /**
+   * Evaluate a challenge of the server. The first challenge yields the
+   * response of the client. The second one carries the rspauth of the
+   * server, which completes the authentication with an empty result.
+   **/
   Status EvaluateResponse(const std::string &payload, std::string *result);
   DigestMD5Authenticator(const std::string &username, const std::string &password,
                          bool mock_nonce = false);
 
+  /**
+   * Require the auth-conf QOP, which the authentication fails without.
+   * It must be called before the first challenge is evaluated.
+   **/
+  void set_require_privacy(bool require) { require_privacy_ = require; }
+  bool is_complete() const { return state_ == kComplete; }
+  bool is_privacy_negotiated() const { return qop_ == "auth-conf"; }
+
+  /**
+   * Seal a message for the server, or open a message of the server,
+   * with the security layer of auth-conf. The messages must be opened
+   * in the order in which the server has sealed them.
+   **/
+  Status Wrap(const std::string &message, std::string *result);
+  Status Unwrap(const std::string &message, std::string *result);
+
  private:
+  enum State {
+    kFirstChallenge,
+    kServerResponse,
+    kComplete,
+  };
+  struct CipherContextDeleter {
+    void operator()(EVP_CIPHER_CTX *ctx) const { EVP_CIPHER_CTX_free(ctx); }
+  };
+  typedef std::unique_ptr<EVP_CIPHER_CTX, CipherContextDeleter> CipherContext;
+
   Status GenerateFirstResponse(std::string *result);
-  Status GenerateResponseValue(std::string *response_value);
+  Status GenerateResponseValue(const std::string &a2, std::string *response_value);
   Status ParseFirstChallenge(const std::string &payload);
+  Status VerifyServerResponse(const std::string &payload);
+  Status InitSecurityLayer();
 
   static size_t NextToken(const std::string &payload, size_t off, std::string *tok);
   void GenerateCNonce();
+  std::string SessionKey() const;
   std::string username_;
   std::string password_;
   std::string nonce_;
   std::string cnonce_;
   std::string realm_;
   std::string qop_;
+  std::string cipher_;
   unsigned nonce_count_;
+  bool require_privacy_;
+  State state_;
+
+  // The keys and the sequence numbers of the security layer
+  std::string client_integrity_key_;
+  std::string server_integrity_key_;
+  unsigned client_seq_num_;
+  unsigned server_seq_num_;
+  CipherContext encrypt_ctx_;
+  CipherContext decrypt_ctx_;
 
   const bool TEST_mock_cnonce_;
   friend class DigestMD5AuthenticatorTest_TestResponse_Test;
+  friend class DigestMD5AuthenticatorTest_TestPrivacy_Test;
 };
 
 }
@@ -19,9 +19,14 @@
 
 #include "common/util.h"
 
+#include <openssl/hmac.h>
 #include <openssl/rand.h>
 #include <openssl/md5.h>
 
+#include <arpa/inet.h>
+
+#include <cctype>
+#include <cstring>
 #include <iomanip>
 #include <map>
 #include <sstream>
@@ -30,29 +35,65 @@ namespace hdfs {
 
 static std::string QuoteString(const std::string &src);
 static std::string GetMD5Digest(const std::string &src);
+static std::string GetHMACMD5(const std::string &key, const std::string &src);
 static std::string BinaryToHex(const std::string &src);
+static bool HasOption(const std::string &options, const std::string &option);
 
 static const char kDigestUri[] = "hdfs/0";
 static const size_t kMaxBufferSize = 65536;
+static const char kEmptyBodyHash[] = ":00000000000000000000000000000000";
+// The messages of the security layer carry the first 10 bytes of the
+// HMAC, a message type and a sequence number, see S 2.3 and 2.4 in
+// RFC2831.
+static const size_t kMACSize = 10;
+static const size_t kDESBlockSize = 8;
+static const char kMessageType[] = {0, 1};
 
 DigestMD5Authenticator::DigestMD5Authenticator(const std::string &username, const std::string &password, bool mock_nonce)
     : username_(username)
     , password_(password)
     , nonce_count_(0)
+    , require_privacy_(false)
+    , state_(kFirstChallenge)
+    , client_seq_num_(0)
+    , server_seq_num_(0)
     , TEST_mock_cnonce_(mock_nonce)
 {}
 
 Status DigestMD5Authenticator::EvaluateResponse(const std::string &payload, std::string *result) {
-  Status status = ParseFirstChallenge(payload);
-  if (status.ok()) {
-    status = GenerateFirstResponse(result);
+  Status status;
+  switch (state_) {
+    case kFirstChallenge:
+      status = ParseFirstChallenge(payload);
+      if (status.ok()) {
+        status = GenerateFirstResponse(result);
+      }
+      if (status.ok()) {
+        state_ = kServerResponse;
+      }
+      break;
+    case kServerResponse:
+      result->clear();
+      status = VerifyServerResponse(payload);
+      if (status.ok() && is_privacy_negotiated()) {
+        status = InitSecurityLayer();
+      }
+      if (status.ok()) {
+        state_ = kComplete;
+      }
+      break;
+    case kComplete:
+      status = Status::Error("The authentication has completed");
+      break;
   }
   return status;
-  return Status::Error("");
 }
 
 size_t DigestMD5Authenticator::NextToken(const std::string &payload, size_t off, std::string *tok) {
   tok->clear();
+  while (off < payload.size() && isspace(static_cast<unsigned char>(payload[off]))) {
+    ++off;
+  }
   if (off >= payload.size()) {
     return std::string::npos;
   }
@@ -63,29 +104,27 @@ size_t DigestMD5Authenticator::NextToken(const std::string &payload, size_t off,
     return off + 1;
   }
 
-  int quote_count = 0;
-  for (; off < payload.size(); ++off) {
-    char c = payload[off];
-    if (c == '"') {
-      ++quote_count;
-      if (quote_count == 2) {
+  if (c == '"') {
+    // A quoted string can contain commas, e.g., the list of the QOPs,
+    // and escape a character with a backslash
+    for (++off; off < payload.size(); ++off) {
+      c = payload[off];
+      if (c == '"') {
         return off + 1;
+      } else if (c == '\\' && off + 1 < payload.size()) {
+        c = payload[++off];
       }
-      continue;
+      tok->append(&c, 1);
     }
+    return off;
+  }
 
-    if (c == '=') {
-      if (quote_count) {
-        tok->append(&c, 1);
-      } else {
-        break;
-      }
-    } else if (('0' <= c && c <= '9') || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')
-        || c == '+' || c == '/' || c == '-' || c == '_' || c == '@') {
-      tok->append(&c, 1);
-    } else {
+  for (; off < payload.size(); ++off) {
+    c = payload[off];
+    if (c == '=' || c == ',' || isspace(static_cast<unsigned char>(c))) {
       break;
     }
+    tok->append(&c, 1);
   }
   return off;
 }
@@ -98,7 +137,9 @@ void DigestMD5Authenticator::GenerateCNonce() {
   }
 }
 
-Status DigestMD5Authenticator::ParseFirstChallenge(const std::string &payload) {
+static std::map<std::string, std::string> ParseDirectives(
+    const std::string &payload,
+    size_t (*next_token)(const std::string &, size_t, std::string *)) {
   std::map<std::string, std::string> props;
   std::string token;
   enum {
@@ -113,7 +154,7 @@ Status DigestMD5Authenticator::ParseFirstChallenge(const std::string &payload) {
   std::string lval, rval;
   size_t off = 0;
   while (true) {
-    off = NextToken(payload, off, &token);
+    off = next_token(payload, off, &token);
     if (off == std::string::npos) {
       break;
     }
@@ -136,7 +177,11 @@ Status DigestMD5Authenticator::ParseFirstChallenge(const std::string &payload) {
         break;
     }
   }
+  return props;
+}
 
+Status DigestMD5Authenticator::ParseFirstChallenge(const std::string &payload) {
+  auto props = ParseDirectives(payload, &NextToken);
   if (props["algorithm"] != "md5-sess"
       || props["charset"] != "utf-8"
       || props.find("nonce") == props.end()) {
@@ -144,17 +189,26 @@ Status DigestMD5Authenticator::ParseFirstChallenge(const std::string &payload) {
   }
   realm_ = props["realm"];
   nonce_ = props["nonce"];
-  qop_ = props["qop"];
-  return Status::OK();
-}
 
-Status DigestMD5Authenticator::GenerateFirstResponse(std::string *result) {
-  // TODO: Support auth-int and auth-conf
-  // Handle cipher
-  if (qop_ != "auth") {
+  // The server offers the QOPs in a list, and auth by default
+  const std::string qops = props.count("qop") ? props["qop"] : "auth";
+  if (require_privacy_) {
+    if (!HasOption(qops, "auth-conf")) {
+      return Status::Error("The server does not offer the auth-conf QOP");
+    } else if (!HasOption(props["cipher"], "3des")) {
+      return Status::Unimplemented();
+    }
+    qop_ = "auth-conf";
+    cipher_ = "3des";
+  } else if (HasOption(qops, "auth")) {
+    qop_ = "auth";
+  } else {
     return Status::Unimplemented();
   }
+  return Status::OK();
+}
 
+Status DigestMD5Authenticator::GenerateFirstResponse(std::string *result) {
   std::stringstream ss;
   GenerateCNonce();
   ss << "charset=utf-8,username=\"" << QuoteString(username_) << "\""
@@ -167,34 +221,56 @@ Status DigestMD5Authenticator::GenerateFirstResponse(std::string *result) {
   if (realm_.size()) {
     ss << ",realm=\"" << QuoteString(realm_) << "\"";
   }
+  // The absent qop stands for auth
+  if (qop_ != "auth") {
+    ss << ",qop=" << qop_ << ",cipher=" << cipher_;
+  }
 
   ss << ",nc=" << std::hex << std::setw(8) << std::setfill('0') << ++nonce_count_;
+  std::string a2 = std::string("AUTHENTICATE:") + kDigestUri;
+  if (qop_ != "auth") {
+    a2 += kEmptyBodyHash;
+  }
   std::string response_value;
-  GenerateResponseValue(&response_value);
+  GenerateResponseValue(a2, &response_value);
   ss << ",response=" << response_value;
   *result = ss.str();
   return result->size() > 4096 ? Status::Error("Response too big") : Status::OK();
 }
 
+Status DigestMD5Authenticator::VerifyServerResponse(const std::string &payload) {
+  auto props = ParseDirectives(payload, &NextToken);
+  // The A2 of the response-auth omits the method, see S 2.1.3 in RFC2831
+  std::string a2 = std::string(":") + kDigestUri;
+  if (qop_ != "auth") {
+    a2 += kEmptyBodyHash;
+  }
+  std::string expected;
+  GenerateResponseValue(a2, &expected);
+  if (props["rspauth"] != expected) {
+    return Status::Error("The server failed the mutual authentication");
+  }
+  return Status::OK();
+}
+
 /**
- * Generate the response value specified in S 2.1.2.1 in RFC2831.
+ * The H(A1) of S 2.1.2.1 in RFC2831, which the keys of the security
+ * layer are derived from.
  **/
-Status DigestMD5Authenticator::GenerateResponseValue(std::string *response_value) {
+std::string DigestMD5Authenticator::SessionKey() const {
   std::stringstream begin_a1, a1_ss;
-  std::string a1, a2;
-
-  if (qop_ == "auth") {
-    a2 = std::string("AUTHENTICATE:") + kDigestUri;
-  } else {
-    a2 = std::string("AUTHENTICATE:") + kDigestUri + ":00000000000000000000000000000000";
-  }
-
   begin_a1 << username_ << ":" << realm_ << ":" << password_;
   a1_ss << GetMD5Digest(begin_a1.str()) << ":" << nonce_
         << ":" << cnonce_ << ":" << username_;
+  return GetMD5Digest(a1_ss.str());
+}
 
+/**
+ * Generate the response value specified in S 2.1.2.1 in RFC2831.
+ **/
+Status DigestMD5Authenticator::GenerateResponseValue(const std::string &a2, std::string *response_value) {
   std::stringstream combine_ss;
-  combine_ss << BinaryToHex(GetMD5Digest(a1_ss.str()))
+  combine_ss << BinaryToHex(SessionKey())
              << ":" << nonce_
              << ":" << std::hex << std::setw(8) << std::setfill('0') << nonce_count_
              << ":" << cnonce_ << ":" << qop_
@@ -203,6 +279,133 @@ Status DigestMD5Authenticator::GenerateResponseValue(std::string *response_value
   return Status::OK();
 }
 
+/**
+ * Spread 7 bytes of a sealing key over the 8 bytes of a DES key, of
+ * which the lowest bit of each byte is the unused parity bit.
+ **/
+static void ExpandDESKey(const unsigned char *in, unsigned char *out) {
+  out[0] = in[0];
+  for (int i = 1; i < 7; ++i) {
+    out[i] = (in[i - 1] << (8 - i)) | (in[i] >> i);
+  }
+  out[7] = in[6] << 1;
+}
+
+static EVP_CIPHER_CTX *NewTripleDESContext(const std::string &sealing_key, bool encrypt) {
+  // The two-key 3DES of S 2.4 in RFC2831: the first 14 bytes of the key
+  // are the keys k1 and k2 of EDE(k1, k2, k1), and the last 8 bytes are
+  // the IV. The CBC chain continues across the messages.
+  const unsigned char *kc = reinterpret_cast<const unsigned char*>(sealing_key.data());
+  unsigned char key[24];
+  ExpandDESKey(kc, key);
+  ExpandDESKey(kc + 7, key + 8);
+  memcpy(key + 16, key, 8);
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  if (ctx && EVP_CipherInit_ex(ctx, EVP_des_ede3_cbc(), nullptr, key, kc + 8, encrypt)) {
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+  } else {
+    EVP_CIPHER_CTX_free(ctx);
+    ctx = nullptr;
+  }
+  OPENSSL_cleanse(key, sizeof(key));
+  return ctx;
+}
+
+Status DigestMD5Authenticator::InitSecurityLayer() {
+  const std::string ha1 = SessionKey();
+  client_integrity_key_ = GetMD5Digest(ha1 + "Digest session key to client-to-server signing key magic constant");
+  server_integrity_key_ = GetMD5Digest(ha1 + "Digest session key to server-to-client signing key magic constant");
+  // 3des takes all 16 bytes of H(A1), unlike rc4-40 and rc4-56
+  encrypt_ctx_.reset(NewTripleDESContext(
+      GetMD5Digest(ha1 + "Digest H(A1) to client-to-server sealing key magic constant"), true));
+  decrypt_ctx_.reset(NewTripleDESContext(
+      GetMD5Digest(ha1 + "Digest H(A1) to server-to-client sealing key magic constant"), false));
+  if (!encrypt_ctx_ || !decrypt_ctx_) {
+    return Status::Error("Cannot initialize the cipher of the security layer");
+  }
+  return Status::OK();
+}
+
+static std::string SequenceNumber(unsigned seq_num) {
+  uint32_t n = htonl(seq_num);
+  return std::string(reinterpret_cast<const char*>(&n), sizeof(n));
+}
+
+Status DigestMD5Authenticator::Wrap(const std::string &message, std::string *result) {
+  if (!is_complete() || !encrypt_ctx_) {
+    return Status::Error("The auth-conf QOP has not been negotiated");
+  }
+
+  const std::string seq_num = SequenceNumber(client_seq_num_);
+  // The padding makes the message, the padding and the MAC a multiple
+  // of the block size, and each byte of it holds its length.
+  size_t padding = kDESBlockSize - (message.size() + kMACSize) % kDESBlockSize;
+  std::string plaintext = message;
+  plaintext.append(padding, static_cast<char>(padding));
+  plaintext.append(GetHMACMD5(client_integrity_key_, seq_num + message), 0, kMACSize);
+
+  result->resize(plaintext.size());
+  int length = 0;
+  if (!EVP_CipherUpdate(encrypt_ctx_.get(), reinterpret_cast<unsigned char*>(&(*result)[0]), &length,
+                        reinterpret_cast<const unsigned char*>(plaintext.data()), plaintext.size())) {
+    return Status::Error("Cannot encrypt the message");
+  }
+  result->append(kMessageType, sizeof(kMessageType));
+  result->append(seq_num);
+  ++client_seq_num_;
+  return Status::OK();
+}
+
+Status DigestMD5Authenticator::Unwrap(const std::string &message, std::string *result) {
+  if (!is_complete() || !decrypt_ctx_) {
+    return Status::Error("The auth-conf QOP has not been negotiated");
+  }
+
+  const size_t trailer = sizeof(kMessageType) + sizeof(uint32_t);
+  if (message.size() < trailer + 2 * kDESBlockSize ||
+      (message.size() - trailer) % kDESBlockSize) {
+    return Status::Error("Invalid length of the sealed message");
+  }
+  const size_t ciphertext_size = message.size() - trailer;
+  const std::string seq_num = SequenceNumber(server_seq_num_);
+  if (memcmp(&message[ciphertext_size], kMessageType, sizeof(kMessageType)) ||
+      message.compare(ciphertext_size + sizeof(kMessageType), seq_num.size(), seq_num)) {
+    return Status::Error("Unexpected sequence number of the sealed message");
+  }
+
+  std::string plaintext(ciphertext_size, 0);
+  int length = 0;
+  if (!EVP_CipherUpdate(decrypt_ctx_.get(), reinterpret_cast<unsigned char*>(&plaintext[0]), &length,
+                        reinterpret_cast<const unsigned char*>(message.data()), ciphertext_size)) {
+    return Status::Error("Cannot decrypt the message");
+  }
+
+  size_t padding = static_cast<unsigned char>(plaintext[ciphertext_size - kMACSize - 1]);
+  if (padding < 1 || padding > kDESBlockSize) {
+    return Status::Error("Invalid padding of the sealed message");
+  }
+  result->assign(plaintext, 0, ciphertext_size - kMACSize - padding);
+  std::string mac = GetHMACMD5(server_integrity_key_, seq_num + *result).substr(0, kMACSize);
+  if (plaintext.compare(ciphertext_size - kMACSize, kMACSize, mac)) {
+    result->clear();
+    return Status::Error("Invalid MAC of the sealed message");
+  }
+  ++server_seq_num_;
+  return Status::OK();
+}
+
+static bool HasOption(const std::string &options, const std::string &option) {
+  std::stringstream ss(options);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item == option) {
+      return true;
+    }
+  }
+  return false;
+}
+
 static std::string QuoteString(const std::string &src) {
   std::string dst;
   dst.resize(2 * src.size());
@@ -226,6 +429,14 @@ static std::string GetMD5Digest(const std::string &src) {
   return std::string(reinterpret_cast<char*>(res), sizeof(res));
 }
 
+static std::string GetHMACMD5(const std::string &key, const std::string &src) {
+  unsigned char res[EVP_MAX_MD_SIZE];
+  unsigned length = 0;
+  HMAC(EVP_md5(), key.data(), key.size(), reinterpret_cast<const unsigned char*>(src.data()),
+       src.size(), res, &length);
+  return std::string(reinterpret_cast<char*>(res), length);
+}
+
 static std::string BinaryToHex(const std::string &src) {
   std::stringstream ss;
   ss << std::hex << std::setfill('0');
@@ -35,4 +35,35 @@ TEST(DigestMD5AuthenticatorTest, TestResponse) {
   ASSERT_TRUE(result.find("response=3a286c2c385b92a06ebc66d58b8c4330") != std::string::npos);
 }
 
+/**
+ * The auth-conf QOP negotiates the 3des cipher, and the messages of
+ * the server sealed by it are opened in order.
+ **/
+TEST(DigestMD5AuthenticatorTest, TestPrivacy) {
+  DigestMD5Authenticator auth("key1 BP-1 bm9uY2U=", "c2VjcmV0a2V5", true);
+  auth.cnonce_ = "OA6MHXh6VqTrRk";
+  auth.set_require_privacy(true);
+  std::string result;
+  Status status = auth.EvaluateResponse("nonce=\"cMkPPuGb444+QbjK2e98aRKUte/b/HHaPrDXSf4VmXc=\",realm=\"0\",qop=\"auth,auth-int,auth-conf\",cipher=\"rc4-40,rc4-56,rc4,des,3des\",maxbuf=65536,charset=utf-8,algorithm=md5-sess", &result);
+  ASSERT_TRUE(status.ok());
+  ASSERT_TRUE(result.find("qop=auth-conf,cipher=3des") != std::string::npos);
+  ASSERT_TRUE(result.find("response=2a36b3c5e81a8199067c1840e7e118ce") != std::string::npos);
+
+  status = auth.EvaluateResponse("rspauth=e3e2abc27d7d88862e75bb09b2bd6a0d", &result);
+  ASSERT_TRUE(status.ok());
+  ASSERT_TRUE(auth.is_complete());
+  ASSERT_TRUE(auth.is_privacy_negotiated());
+
+  static const char kSealed[] =
+      "\x08\x4b\x35\xe8\x6f\xe9\x52\xcf\xba\x3e\x53\xfd\x08\xd8\xda\xc7"
+      "\xfe\xa1\x5d\x65\xc6\xe3\x93\x6c\x2c\x70\x9a\x87\x62\x0f\x24\x77"
+      "\x00\x01\x00\x00\x00\x00";
+  status = auth.Unwrap(std::string(kSealed, sizeof(kSealed) - 1), &result);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ("0123456789abcdef", result);
+  // The sequence number has moved on
+  status = auth.Unwrap(std::string(kSealed, sizeof(kSealed) - 1), &result);
+  ASSERT_FALSE(status.ok());
+}
+
 }
@@ -35,7 +35,7 @@ const char *Status::ConstructState(int code, const char *msg1, const char *msg2)
   const uint32_t len1 = strlen(msg1);
   const uint32_t len2 = msg2 ? strlen(msg2) : 0;
   const uint32_t size = len1 + (len2 ? (2 + len2) : 0);
-  char* result = new char[size + 8 + 2];
+  char* result = new char[size + 12];
   *reinterpret_cast<uint32_t*>(result) = size;
   *reinterpret_cast<uint32_t*>(result + 4) = code;
   memcpy(result + 8, msg1, len1);
@@ -44,6 +44,8 @@ const char *Status::ConstructState(int code, const char *msg1, const char *msg2)
     result[9 + len1] = ' ';
     memcpy(result + 10 + len1, msg2, len2);
   }
+  const uint32_t class_len = code == kException ? len1 : 0;
+  memcpy(result + 8 + size, &class_len, sizeof(class_len));
   return result;
 }
 
@@ -56,11 +58,21 @@ std::string Status::ToString() const {
   }
 }
 
+std::string Status::exception_class() const {
+  if (!state_) {
+    return std::string();
+  }
+  uint32_t size, class_len;
+  memcpy(&size, state_, sizeof(size));
+  memcpy(&class_len, state_ + 8 + size, sizeof(class_len));
+  return std::string(state_ + 8, class_len);
+}
+
 const char* Status::CopyState(const char* state) {
   uint32_t size;
   memcpy(&size, state, sizeof(size));
-  char* result = new char[size + 8];
-  memcpy(result, state, size + 8);
+  char* result = new char[size + 12];
+  memcpy(result, state, size + 12);
   return result;
 }
 
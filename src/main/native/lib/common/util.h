@@ -22,9 +22,12 @@
 
 #include <asio/error_code.hpp>
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/message_lite.h>
 #include <google/protobuf/io/coded_stream.h>
 
+#include <memory>
+
 namespace hdfs {
 
 static inline Status ToStatus(const ::asio::error_code &ec) {
@@ -51,6 +54,19 @@ static inline void ReadDelimitedPBMessage(
   in->PopLimit(limit);
 }
 
+/**
+ * Create a message on its own protobuf arena. The sub-messages and
+ * the strings created when parsing into the message are allocated
+ * from the arena rather than one by one from the heap, and the whole
+ * arena is released at once when the last reference to the message
+ * goes away.
+ **/
+template <class T>
+std::shared_ptr<T> CreateArenaMessage() {
+  auto arena = std::make_shared<::google::protobuf::Arena>();
+  return std::shared_ptr<T>(arena, ::google::protobuf::Arena::CreateMessage<T>(arena.get()));
+}
+
 std::string Base64Encode(const std::string &src);
 
 }
@@ -23,18 +23,38 @@
 
 #include <asio/io_service.hpp>
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 namespace hdfs {
 
 class IoServiceImpl : public IoService {
  public:
-  virtual void Run() override {
-    asio::io_service::work work(io_service_);
-    io_service_.run();
-  }
-  virtual void Stop() override { io_service_.stop(); }
-  ::asio::io_service &io_service() { return io_service_; }
+  IoServiceImpl();
+  explicit IoServiceImpl(const IoServiceOptions &options);
+  virtual void Run() override;
+  virtual void Stop() override;
+  /**
+   * The event loop for the states that outlive a single connection,
+   * e.g., the timers and the RPC engines.
+   **/
+  ::asio::io_service &io_service() { return *io_services_[0]; }
+  /**
+   * The event loop for a new connection. It is the same as
+   * io_service() unless each thread has its own event loop, in which
+   * case the event loops are assigned in round-robin.
+   **/
+  ::asio::io_service &NextIoService();
  private:
-  ::asio::io_service io_service_;
+  const IoServiceOptions options_;
+  unsigned threads_;
+  std::vector<std::unique_ptr<::asio::io_service> > io_services_;
+  std::atomic<unsigned> next_io_service_;
+  // The CPUs that the worker threads are pinned to
+  std::vector<int> cpus_;
+
+  void RunWorker(unsigned index);
 };
 
 }
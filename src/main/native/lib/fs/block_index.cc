@@ -0,0 +1,80 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "block_index.h"
+
+#include <algorithm>
+
+namespace hdfs {
+
+using ::hadoop::hdfs::LocatedBlockProto;
+
+LocatedBlock::LocatedBlock(const LocatedBlockProto &block)
+    : block(block)
+{
+  for (const auto &loc : block.locs()) {
+    const auto &datanode = loc.id();
+    asio::error_code ec;
+    auto address = ::asio::ip::address::from_string(datanode.ipaddr(), ec);
+    if (!ec) {
+      endpoints.push_back(::asio::ip::tcp::endpoint(address, datanode.xferport()));
+    }
+  }
+}
+
+void BlockIndex::Insert(const LocatedBlockProto &block) {
+  auto it = std::lower_bound(offsets_.begin(), offsets_.end(), block.offset());
+  size_t index = it - offsets_.begin();
+  auto located = std::make_shared<LocatedBlock>(block);
+  if (it != offsets_.end() && *it == block.offset()) {
+    lengths_[index] = located->length();
+    blocks_[index] = located;
+  } else {
+    offsets_.insert(it, block.offset());
+    lengths_.insert(lengths_.begin() + index, located->length());
+    blocks_.insert(blocks_.begin() + index, located);
+  }
+}
+
+BlockIndex::BlockPtr BlockIndex::Find(uint64_t offset) const {
+  size_t index = Lookup(offset);
+  return index == kNotFound ? nullptr : blocks_[index];
+}
+
+size_t BlockIndex::Lookup(uint64_t offset) const {
+  size_t n = offsets_.size();
+  if (!n || offset < offsets_.front()) {
+    return kNotFound;
+  }
+
+  // Guess the position assuming the blocks have the same size, which
+  // is exact for the contiguous blocks of a file.
+  if (n > 1) {
+    uint64_t average_length = (offsets_.back() - offsets_.front()) / (n - 1);
+    size_t guess = std::min<uint64_t>((offset - offsets_.front()) / average_length, n - 1);
+    if (Contains(guess, offset)) {
+      return guess;
+    }
+  }
+
+  auto it = std::upper_bound(offsets_.begin(), offsets_.end(), offset);
+  size_t index = it - offsets_.begin() - 1;
+  return Contains(index, offset) ? index : kNotFound;
+}
+
+}
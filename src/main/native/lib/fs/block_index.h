@@ -0,0 +1,87 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FS_BLOCK_INDEX_H_
+#define FS_BLOCK_INDEX_H_
+
+#include "hdfs.pb.h"
+
+#include <asio/ip/tcp.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * A block of a file together with the endpoints of the DataNodes
+ * that hold its replicas, in the order given by the NameNode. The
+ * endpoints are parsed once when the block is added to the index
+ * rather than on every read.
+ **/
+struct LocatedBlock {
+  ::hadoop::hdfs::LocatedBlockProto block;
+  std::vector<::asio::ip::tcp::endpoint> endpoints;
+
+  explicit LocatedBlock(const ::hadoop::hdfs::LocatedBlockProto &block);
+  uint64_t offset() const { return block.offset(); }
+  uint64_t length() const { return block.b().numbytes(); }
+};
+
+/**
+ * An index of the blocks of a file sorted by their offsets.
+ *
+ * The offsets and the lengths of the blocks are kept in separate
+ * arrays so that a lookup only touches a few cache lines. As most
+ * files consist of blocks of the same size, a lookup first guesses
+ * the position of the block by interpolation, and falls back to a
+ * binary search if the guess misses.
+ *
+ * The index is not thread-safe.
+ **/
+class BlockIndex {
+ public:
+  typedef std::shared_ptr<const LocatedBlock> BlockPtr;
+
+  /**
+   * Add the block to the index. A block at the same offset is
+   * replaced.
+   **/
+  void Insert(const ::hadoop::hdfs::LocatedBlockProto &block);
+  /**
+   * Return the block that contains the offset, or nullptr if there
+   * is none.
+   **/
+  BlockPtr Find(uint64_t offset) const;
+  size_t size() const { return offsets_.size(); }
+
+ private:
+  static const size_t kNotFound = static_cast<size_t>(-1);
+
+  std::vector<uint64_t> offsets_;
+  std::vector<uint64_t> lengths_;
+  std::vector<BlockPtr> blocks_;
+
+  bool Contains(size_t index, uint64_t offset) const {
+    return offsets_[index] <= offset && offset - offsets_[index] < lengths_[index];
+  }
+  size_t Lookup(uint64_t offset) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "block_index.h"
+
+#include <gtest/gtest.h>
+
+namespace hdfs {
+
+using ::hadoop::hdfs::LocatedBlockProto;
+
+static LocatedBlockProto Block(uint64_t id, uint64_t offset, uint64_t length) {
+  LocatedBlockProto res;
+  res.set_offset(offset);
+  res.mutable_b()->set_blockid(id);
+  res.mutable_b()->set_numbytes(length);
+  return res;
+}
+
+static uint64_t FindId(const BlockIndex &index, uint64_t offset) {
+  auto block = index.Find(offset);
+  return block ? block->block.b().blockid() : 0;
+}
+
+TEST(BlockIndexTest, TestUniformBlocks) {
+  BlockIndex index;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    index.Insert(Block(i + 1, i * 128, 128));
+  }
+  index.Insert(Block(1001, 1000 * 128, 5));
+  for (uint64_t offset = 0; offset < 1000 * 128 + 5; ++offset) {
+    ASSERT_EQ(offset / 128 + 1, FindId(index, offset));
+  }
+  ASSERT_EQ(0, FindId(index, 1000 * 128 + 5));
+}
+
+TEST(BlockIndexTest, TestIrregularBlocks) {
+  BlockIndex index;
+  // Inserted out of order, with a gap in [30, 100) that has not been
+  // fetched yet
+  index.Insert(Block(3, 100, 1000));
+  index.Insert(Block(1, 0, 10));
+  index.Insert(Block(2, 10, 20));
+  index.Insert(Block(4, 1100, 1));
+  ASSERT_EQ(4, index.size());
+  ASSERT_EQ(1, FindId(index, 9));
+  ASSERT_EQ(2, FindId(index, 10));
+  ASSERT_EQ(2, FindId(index, 29));
+  ASSERT_EQ(0, FindId(index, 30));
+  ASSERT_EQ(0, FindId(index, 99));
+  ASSERT_EQ(3, FindId(index, 100));
+  ASSERT_EQ(3, FindId(index, 1099));
+  ASSERT_EQ(4, FindId(index, 1100));
+  ASSERT_EQ(0, FindId(index, 1101));
+
+  index.Insert(Block(5, 100, 1000));
+  ASSERT_EQ(4, index.size());
+  ASSERT_EQ(5, FindId(index, 500));
+}
+
+TEST(BlockIndexTest, TestEndpoints) {
+  auto proto = Block(1, 0, 10);
+  auto loc = proto.add_locs()->mutable_id();
+  loc->set_ipaddr("10.0.0.1");
+  loc->set_xferport(50010);
+  proto.add_locs()->mutable_id()->set_ipaddr("not an address");
+
+  LocatedBlock block(proto);
+  ASSERT_EQ(1, block.endpoints.size());
+  ASSERT_EQ("10.0.0.1", block.endpoints[0].address().to_string());
+  ASSERT_EQ(50010, block.endpoints[0].port());
+}
+
+}
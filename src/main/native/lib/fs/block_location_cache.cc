@@ -0,0 +1,138 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "block_location_cache.h"
+
+namespace hdfs {
+
+using ::hadoop::hdfs::LocatedBlocksProto;
+
+FileBlockLocations::FileBlockLocations(const LocatedBlocksProto &locations)
+    : file_length_(locations.filelength())
+    , under_construction_(locations.underconstruction())
+    , fetched_at_(Clock::now())
+{
+  Merge(locations);
+}
+
+FileBlockLocations::BlockPtr FileBlockLocations::FindBlock(uint64_t offset) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return index_.Find(offset);
+}
+
+Status FileBlockLocations::Merge(const LocatedBlocksProto &locations) {
+  // The length of a file under construction grows as its blocks
+  // are completed.
+  if (!under_construction_ && (locations.underconstruction() ||
+                               locations.filelength() != file_length_)) {
+    return Status::Error("The file has been modified since it was opened");
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  for (const auto &block : locations.blocks()) {
+    index_.Insert(block);
+  }
+  if (locations.has_lastblock() && locations.lastblock().b().numbytes()) {
+    index_.Insert(locations.lastblock());
+  }
+  return Status::OK();
+}
+
+BlockLocationCache::BlockLocationCache(size_t max_entries,
+                                       std::chrono::milliseconds ttl)
+    : max_entries_(max_entries)
+    , ttl_(ttl)
+{}
+
+std::shared_ptr<FileBlockLocations>
+BlockLocationCache::Get(const std::string &path) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = index_.find(path);
+  if (it == index_.end()) {
+    return nullptr;
+  }
+
+  auto entry = it->second;
+  if (Clock::now() - entry->locations->fetched_at() >= ttl_) {
+    lru_.erase(entry);
+    index_.erase(it);
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, entry);
+  return entry->locations;
+}
+
+void BlockLocationCache::Put(const std::string &path,
+                             const std::shared_ptr<FileBlockLocations> &locations) {
+  if (!max_entries_ || ttl_.count() <= 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = index_.find(path);
+  if (it != index_.end()) {
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+  lru_.push_front(Entry{path, locations});
+  index_.insert(std::make_pair(path, lru_.begin()));
+  EvictLocked(Clock::now());
+}
+
+void BlockLocationCache::Invalidate(const std::string &path) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = index_.find(path);
+  if (it != index_.end()) {
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+}
+
+void BlockLocationCache::InvalidateTree(const std::string &path) {
+  std::string dir = path;
+  if (dir.empty() || dir.back() != '/') {
+    dir += '/';
+  }
+  std::string file = dir.substr(0, dir.size() - 1);
+
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto it = lru_.begin(); it != lru_.end();) {
+    if (it->path == file || it->path.compare(0, dir.size(), dir) == 0) {
+      index_.erase(it->path);
+      it = lru_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+size_t BlockLocationCache::size() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return lru_.size();
+}
+
+void BlockLocationCache::EvictLocked(Clock::time_point now) {
+  /* assumed to be called from a context that has already acquired the lock_ */
+  while (!lru_.empty() && (lru_.size() > max_entries_ ||
+                           now - lru_.back().locations->fetched_at() >= ttl_)) {
+    index_.erase(lru_.back().path);
+    lru_.pop_back();
+  }
+}
+
+}
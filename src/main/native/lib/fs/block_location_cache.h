@@ -0,0 +1,124 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FS_BLOCK_LOCATION_CACHE_H_
+#define FS_BLOCK_LOCATION_CACHE_H_
+
+#include "block_index.h"
+
+#include "libhdfs++/status.h"
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace hdfs {
+
+/**
+ * The block locations of a file that have been fetched from the
+ * NameNode so far.
+ *
+ * The NameNode returns the locations of the blocks within the range
+ * of the file given in the getBlockLocations() request. The first
+ * range is fetched when the file is opened, and the following ranges
+ * are merged in as the reads reach them. The object is shared by all
+ * InputStreams of the file through the BlockLocationCache, thus it
+ * is thread-safe.
+ **/
+class FileBlockLocations {
+ public:
+  typedef std::chrono::steady_clock Clock;
+  typedef BlockIndex::BlockPtr BlockPtr;
+
+  explicit FileBlockLocations(const ::hadoop::hdfs::LocatedBlocksProto &locations);
+
+  uint64_t file_length() const { return file_length_; }
+  bool under_construction() const { return under_construction_; }
+  Clock::time_point fetched_at() const { return fetched_at_; }
+
+  /**
+   * Return the block that contains the offset, or nullptr if its
+   * location has not been fetched yet.
+   **/
+  BlockPtr FindBlock(uint64_t offset);
+  /**
+   * Merge the blocks of a subsequent getBlockLocations() response.
+   * Fail if the response belongs to a different version of the file,
+   * e.g., the file has been replaced since it was opened.
+   **/
+  Status Merge(const ::hadoop::hdfs::LocatedBlocksProto &locations);
+
+ private:
+  const uint64_t file_length_;
+  const bool under_construction_;
+  const Clock::time_point fetched_at_;
+  std::mutex lock_;
+  BlockIndex index_;
+};
+
+/**
+ * A cache of the block locations of the files that have been opened,
+ * keyed by the path of the file.
+ *
+ * The getBlockLocations() response does not carry the inode id of the
+ * file, thus a file that is replaced under the same path is only
+ * noticed once the entry expires, or once a read of the stale
+ * locations fails and the entry is invalidated.
+ **/
+class BlockLocationCache {
+ public:
+  BlockLocationCache(size_t max_entries, std::chrono::milliseconds ttl);
+
+  /**
+   * Return the cached locations of the file, or nullptr if there is
+   * no entry or the entry has expired.
+   **/
+  std::shared_ptr<FileBlockLocations> Get(const std::string &path);
+  void Put(const std::string &path,
+           const std::shared_ptr<FileBlockLocations> &locations);
+  void Invalidate(const std::string &path);
+  /**
+   * Invalidate the path and all the paths under it, e.g., after the
+   * directory has been deleted or renamed.
+   **/
+  void InvalidateTree(const std::string &path);
+  size_t size();
+
+ private:
+  typedef FileBlockLocations::Clock Clock;
+  struct Entry {
+    std::string path;
+    std::shared_ptr<FileBlockLocations> locations;
+  };
+  typedef std::list<Entry> LruList;
+
+  const size_t max_entries_;
+  const std::chrono::milliseconds ttl_;
+  // The most recently used entry comes first
+  LruList lru_;
+  std::unordered_map<std::string, LruList::iterator> index_;
+  std::mutex lock_;
+
+  void EvictLocked(Clock::time_point now);
+};
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "block_location_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace hdfs {
+
+using ::hadoop::hdfs::LocatedBlocksProto;
+
+static const uint64_t kBlockSize = 1024;
+
+/*
+ * The locations of the blocks [first, last) of a file with the given
+ * number of full blocks.
+ */
+static LocatedBlocksProto Blocks(unsigned blocks, unsigned first, unsigned last) {
+  LocatedBlocksProto res;
+  res.set_filelength(blocks * kBlockSize);
+  res.set_underconstruction(false);
+  res.set_islastblockcomplete(true);
+  for (unsigned i = first; i < last; ++i) {
+    auto b = res.add_blocks();
+    b->set_offset(i * kBlockSize);
+    b->mutable_b()->set_blockid(i);
+    b->mutable_b()->set_numbytes(kBlockSize);
+  }
+  return res;
+}
+
+static std::shared_ptr<FileBlockLocations> Locations(unsigned blocks) {
+  return std::make_shared<FileBlockLocations>(Blocks(blocks, 0, blocks));
+}
+
+TEST(BlockLocationCacheTest, TestFindBlock) {
+  FileBlockLocations locations(Blocks(10, 0, 2));
+  ASSERT_EQ(10 * kBlockSize, locations.file_length());
+  ASSERT_EQ(0, locations.FindBlock(0)->block.b().blockid());
+  ASSERT_EQ(1, locations.FindBlock(2 * kBlockSize - 1)->block.b().blockid());
+  ASSERT_EQ(nullptr, locations.FindBlock(2 * kBlockSize));
+
+  ASSERT_TRUE(locations.Merge(Blocks(10, 5, 7)).ok());
+  ASSERT_EQ(nullptr, locations.FindBlock(4 * kBlockSize));
+  ASSERT_EQ(5, locations.FindBlock(5 * kBlockSize)->block.b().blockid());
+  ASSERT_EQ(6, locations.FindBlock(7 * kBlockSize - 1)->block.b().blockid());
+  ASSERT_EQ(nullptr, locations.FindBlock(10 * kBlockSize));
+
+  ASSERT_TRUE(locations.Merge(Blocks(10, 1, 6)).ok());
+  ASSERT_EQ(3, locations.FindBlock(3 * kBlockSize)->block.b().blockid());
+  ASSERT_FALSE(locations.Merge(Blocks(11, 7, 11)).ok());
+}
+
+TEST(BlockLocationCacheTest, TestEvictLeastRecentlyUsed) {
+  BlockLocationCache cache(2, std::chrono::milliseconds(60000));
+  auto l1 = Locations(1), l2 = Locations(2), l3 = Locations(3);
+  cache.Put("/1", l1);
+  cache.Put("/2", l2);
+  ASSERT_EQ(l1, cache.Get("/1"));
+  cache.Put("/3", l3);
+  ASSERT_EQ(2, cache.size());
+  ASSERT_EQ(l1, cache.Get("/1"));
+  ASSERT_EQ(nullptr, cache.Get("/2"));
+  ASSERT_EQ(l3, cache.Get("/3"));
+
+  cache.Invalidate("/3");
+  ASSERT_EQ(nullptr, cache.Get("/3"));
+  ASSERT_EQ(1, cache.size());
+}
+
+TEST(BlockLocationCacheTest, TestInvalidateTree) {
+  BlockLocationCache cache(16, std::chrono::milliseconds(60000));
+  for (const char *path : {"/a", "/a/1", "/a/b/2", "/ab", "/b/1"}) {
+    cache.Put(path, Locations(1));
+  }
+  cache.InvalidateTree("/a");
+  ASSERT_EQ(nullptr, cache.Get("/a"));
+  ASSERT_EQ(nullptr, cache.Get("/a/1"));
+  ASSERT_EQ(nullptr, cache.Get("/a/b/2"));
+  ASSERT_NE(nullptr, cache.Get("/ab"));
+  ASSERT_EQ(2, cache.size());
+
+  cache.InvalidateTree("/b/");
+  ASSERT_EQ(nullptr, cache.Get("/b/1"));
+  cache.InvalidateTree("/");
+  ASSERT_EQ(0, cache.size());
+}
+
+TEST(BlockLocationCacheTest, TestExpiration) {
+  BlockLocationCache cache(16, std::chrono::milliseconds(10));
+  cache.Put("/1", Locations(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(nullptr, cache.Get("/1"));
+  ASSERT_EQ(0, cache.size());
+
+  BlockLocationCache disabled(16, std::chrono::milliseconds(0));
+  disabled.Put("/1", Locations(1));
+  ASSERT_EQ(nullptr, disabled.Get("/1"));
+}
+
+}
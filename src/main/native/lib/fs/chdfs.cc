@@ -21,19 +21,41 @@
 
 //Intended to be compatible with libhdfs(3).  Currently only a subset of operations are supported.
 //  hdfsConnect
+//  hdfsConnectWithThreads
+//  hdfsConnectNameservice
 //  hdfsDisconnect
 //  hdfsOpenFile
 //  hdfsCloseFile
 //  hdfsPread
+//  hdfsPreadWithCacheHints
+//  hdfsPreadv
+//  hdfsPreadAsync
+//  hdfsRead
+//  hdfsSeek
+//  hdfsTell
+//  hdfsFileSetDropBehind
+//  hdfsFileSetReadahead
+//  hdfsExists
+//  hdfsGetPathInfo
+//  hdfsListDirectory
+//  hdfsFreeFileInfo
+//  hdfsCreateDirectory
+//  hdfsDelete
+//  hdfsRename
+//  hdfsChmod
+//  hdfsChown
+//  hdfsSetReplication
+//  hdfsUtime
 
 
 //todo: 
 //  Need to be able to pass in parameters to hint at resource allocation like how many threads call run on io_service
-//  Implement real streams that keep track of position on top of inputstream
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <pthread.h>
+#include <string.h>
 
 #include "libhdfs++/chdfs.h"
 #include "libhdfs++/hdfs.h"
@@ -41,6 +63,7 @@
 #include <iostream>
 #include <string>
 #include <thread>
+#include <vector>
 
 
 //---------------------------------------------------------------------------------------
@@ -49,6 +72,8 @@
 
 using namespace hdfs;
 
+static int ToErrno(const Status &stat);
+
 void *call_run(void *servicePtr) {
   IoService *wrappedService = reinterpret_cast<IoService*>(servicePtr);
   wrappedService->Run();
@@ -56,14 +81,14 @@ void *call_run(void *servicePtr) {
 }
 
 //Copied almost directly from inputstream_test.
-//Eventually add a way for the user to specify how many threads call run on io_service
 class Executor {
 public:
-  Executor() {
+  Executor(const IoServiceOptions &options) {
     //Create a new IoService object. This wraps the boost io_service object.
-    io_service_ = std::unique_ptr<IoService>(IoService::New());
+    io_service_ = std::unique_ptr<IoService>(IoService::New(options));
 
     //Call run on IoService object in a background thread, the run call should never return.
+    //Run() starts the rest of the worker threads specified in the options.
     int ret = pthread_create(&processing_thread, NULL, call_run, reinterpret_cast<void*>(io_service_.get()));
     
     if(ret != 0) {
@@ -126,10 +151,19 @@ struct hdfsFS_struct {
  *    -connect to specified namenode host:port
  *    -this will need to be extended to allow application to pass a few things:
  *      -malloc/delete pair for using specialized pools
- *      -thread count for background threads
  */
 hdfsFS hdfsConnect(const char *nnhost, unsigned short nnport) {
-  std::unique_ptr<Executor> background_io_service = std::unique_ptr<Executor>(new Executor());
+  return hdfsConnectWithThreads(nnhost, nnport, 1, 0, 0);
+}
+
+
+hdfsFS hdfsConnectWithThreads(const char *nnhost, unsigned short nnport, unsigned int io_threads,
+                              int pin_threads, int io_service_per_thread) {
+  IoServiceOptions options;
+  options.threads = io_threads;
+  options.pin_threads = pin_threads != 0;
+  options.io_service_per_thread = io_service_per_thread != 0;
+  std::unique_ptr<Executor> background_io_service = std::unique_ptr<Executor>(new Executor(options));
 
   if(NULL == background_io_service) 
     return NULL;
@@ -145,6 +179,24 @@ hdfsFS hdfsConnect(const char *nnhost, unsigned short nnport) {
 }
 
 
+hdfsFS hdfsConnectNameservice(const char **nnhosts, const unsigned short *nnports, int count) {
+  std::vector<NameNodeAddress> namenodes;
+  for (int i = 0; i < count; ++i) {
+    namenodes.push_back(NameNodeAddress{nnhosts[i], nnports[i]});
+  }
+  std::unique_ptr<Executor> background_io_service = std::unique_ptr<Executor>(new Executor(IoServiceOptions()));
+
+  //connect to the active NN, fileSystem will be set on success
+  FileSystem *fileSystem = NULL;
+  Status stat = FileSystem::New(background_io_service->io_service(), Options(), namenodes, &fileSystem);
+  if(!stat.ok())
+    return NULL;
+
+  //make a hdfsFS handle
+  return new hdfsFS_struct(fileSystem, background_io_service.release());
+}
+
+
 int hdfsDisconnect(hdfsFS fs) {
   //delete fs if it exists, fs dtor shall clean up everything it owns
   if(NULL != fs)
@@ -200,3 +252,382 @@ size_t hdfsPread(hdfsFS fs, hdfsFile file, off_t position, void *buf, size_t len
 }
 
 
+size_t hdfsPreadWithCacheHints(hdfsFS fs, hdfsFile file, off_t position, void *buf,
+                               size_t length, int dropBehind, long long readahead) {
+  if(NULL == fs || NULL == file || dropBehind < kUnspecified || dropBehind > kDisableDropBehind) {
+    return 0;
+  }
+
+  CacheStrategy hints;
+  if(dropBehind != kUnspecified) {
+    hints.drop_behind_specified = true;
+    hints.drop_behind = dropBehind == kEnableDropBehind;
+  }
+  if(readahead >= 0) {
+    hints.read_ahead_specified = true;
+    hints.read_ahead = readahead;
+  }
+
+  size_t readBytes = 0;
+  Status stat = file->inputStream->PositionRead(buf, length, position, hints, &readBytes);
+  if(!stat.ok()) {
+    return 0;
+  }
+
+  return readBytes;
+}
+
+
+int hdfsPreadv(hdfsFS fs, hdfsFile file, struct hdfsReadRange *ranges, int count) {
+  if(NULL == fs || NULL == file || count < 0 || (count > 0 && NULL == ranges)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  //Validate all ranges before reading any, so that readBytes is set on every path
+  bool valid = true;
+  for(int i = 0; i < count; i++) {
+    ranges[i].readBytes = 0;
+    if(ranges[i].offset < 0 || (ranges[i].length > 0 && NULL == ranges[i].buffer)) {
+      valid = false;
+    }
+  }
+  if(!valid) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  std::vector<ReadRange> readRanges(count);
+  for(int i = 0; i < count; i++) {
+    readRanges[i].offset = ranges[i].offset;
+    readRanges[i].length = ranges[i].length;
+    readRanges[i].buffer = ranges[i].buffer;
+  }
+
+  Status stat = file->inputStream->ReadVectored(readRanges.data(), readRanges.size());
+  for(int i = 0; i < count; i++) {
+    ranges[i].readBytes = readRanges[i].read_bytes;
+  }
+  if(!stat.ok()) {
+    errno = ToErrno(stat);
+    return -1;
+  }
+  return 0;
+}
+
+
+struct PreadAsyncContext {
+  hdfsReadCallback callback;
+  void *context;
+};
+
+static void OnPreadAsyncFinished(const Status &stat, size_t readBytes, void *context) {
+  PreadAsyncContext *c = reinterpret_cast<PreadAsyncContext*>(context);
+  c->callback(stat.ok() ? 0 : ToErrno(stat), readBytes, c->context);
+  delete c;
+}
+
+int hdfsPreadAsync(hdfsFS fs, hdfsFile file, off_t position, void *buf, size_t length,
+                   hdfsReadCallback callback, void *context) {
+  if(NULL == fs || NULL == file || NULL == callback || position < 0 || (length > 0 && NULL == buf)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  PreadAsyncContext *c = new PreadAsyncContext;
+  c->callback = callback;
+  c->context = context;
+  file->inputStream->AsyncPositionRead(buf, length, position, OnPreadAsyncFinished, c);
+  return 0;
+}
+
+
+size_t hdfsRead(hdfsFS fs, hdfsFile file, void *buf, size_t length) {
+  if(NULL == fs || NULL == file) {
+    //possibly set errno here
+    return 0;
+  }
+
+  size_t readBytes = 0;
+  Status stat = file->inputStream->Read(buf, length, &readBytes);
+  if(!stat.ok()) {
+    //possibly set errno here
+    return 0;
+  }
+
+  return readBytes;
+}
+
+
+int hdfsSeek(hdfsFS fs, hdfsFile file, off_t desiredPos) {
+  if(NULL == fs || NULL == file || desiredPos < 0) {
+    return -1;
+  }
+
+  Status stat = file->inputStream->Seek(desiredPos);
+  if(!stat.ok()) {
+    return -1;
+  }
+  return 0;
+}
+
+
+off_t hdfsTell(hdfsFS fs, hdfsFile file) {
+  if(NULL == fs || NULL == file) {
+    return -1;
+  }
+
+  return file->inputStream->Tell();
+}
+
+
+int hdfsFileSetDropBehind(hdfsFS fs, hdfsFile file, int dropBehind) {
+  if(NULL == fs || NULL == file || dropBehind < kUnspecified || dropBehind > kAdaptiveDropBehind) {
+    return -1;
+  }
+
+  file->inputStream->SetDropBehind(static_cast<DropBehindStrategy>(dropBehind));
+  return 0;
+}
+
+
+int hdfsFileSetReadahead(hdfsFS fs, hdfsFile file, long long readahead) {
+  if(NULL == fs || NULL == file) {
+    return -1;
+  }
+
+  file->inputStream->SetReadahead(readahead);
+  return 0;
+}
+
+
+//---------------------------------------------------------------------------------------
+//  Metadata operations
+//---------------------------------------------------------------------------------------
+
+//The errno of the exceptions of the NameNode, as in libhdfs
+static const struct {
+  const char *exceptionClass;
+  int errnum;
+} kExceptionErrnos[] = {
+  {"org.apache.hadoop.security.AccessControlException", EACCES},
+  {"org.apache.hadoop.fs.InvalidPathException", EINVAL},
+  {"java.io.FileNotFoundException", ENOENT},
+  {"org.apache.hadoop.fs.FileAlreadyExistsException", EEXIST},
+  {"org.apache.hadoop.fs.ParentNotDirectoryException", ENOTDIR},
+  {"org.apache.hadoop.fs.PathIsNotEmptyDirectoryException", ENOTEMPTY},
+  {"org.apache.hadoop.fs.UnresolvedLinkException", ENOLINK},
+  {"org.apache.hadoop.hdfs.protocol.DSQuotaExceededException", EDQUOT},
+  {"org.apache.hadoop.hdfs.protocol.NSQuotaExceededException", EDQUOT},
+  {"java.lang.IllegalArgumentException", EINVAL},
+};
+
+//The errno of a failed status
+static int ToErrno(const Status &stat) {
+  int errnum = EIO;
+  if(stat.is_exception()) {
+    std::string exceptionClass = stat.exception_class();
+    for(const auto &e : kExceptionErrnos) {
+      if(exceptionClass == e.exceptionClass) {
+        errnum = e.errnum;
+        break;
+      }
+    }
+  } else if(stat.code() == ENOENT || stat.code() == EINVAL || stat.code() == EAGAIN) {
+    errnum = stat.code();
+  }
+  return errnum;
+}
+
+//Set errno from a failed status and return -1
+static int SetErrno(const Status &stat) {
+  errno = ToErrno(stat);
+  return -1;
+}
+
+static void ToHdfsFileInfo(const FileInfo &info, hdfsFileInfo *out) {
+  out->mKind = info.type == FileInfo::kDirectory ? kObjectKindDirectory : kObjectKindFile;
+  out->mName = strdup(info.path.c_str());
+  out->mLastMod = info.modification_time / 1000;
+  out->mSize = info.length;
+  out->mReplication = info.replication;
+  out->mBlockSize = info.block_size;
+  out->mOwner = strdup(info.owner.c_str());
+  out->mGroup = strdup(info.group.c_str());
+  out->mPermissions = info.permissions;
+  out->mLastAccess = info.access_time / 1000;
+}
+
+
+int hdfsExists(hdfsFS fs, const char *path) {
+  if(NULL == fs || NULL == path) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  FileInfo info;
+  Status stat = fs->fileSystem->GetFileInfo(path, &info);
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
+
+
+hdfsFileInfo *hdfsGetPathInfo(hdfsFS fs, const char *path) {
+  if(NULL == fs || NULL == path) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  FileInfo info;
+  Status stat = fs->fileSystem->GetFileInfo(path, &info);
+  if(!stat.ok()) {
+    SetErrno(stat);
+    return NULL;
+  }
+
+  hdfsFileInfo *res = static_cast<hdfsFileInfo*>(calloc(1, sizeof(hdfsFileInfo)));
+  if(NULL == res) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  ToHdfsFileInfo(info, res);
+  return res;
+}
+
+
+hdfsFileInfo *hdfsListDirectory(hdfsFS fs, const char *path, int *numEntries) {
+  if(NULL == fs || NULL == path || NULL == numEntries) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  *numEntries = 0;
+  std::vector<FileInfo> entries;
+  Status stat = fs->fileSystem->GetListing(path, &entries);
+  if(!stat.ok()) {
+    SetErrno(stat);
+    return NULL;
+  }
+  if(entries.empty()) {
+    errno = 0;
+    return NULL;
+  }
+
+  hdfsFileInfo *res = static_cast<hdfsFileInfo*>(calloc(entries.size(), sizeof(hdfsFileInfo)));
+  if(NULL == res) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  for(size_t i = 0; i < entries.size(); i++) {
+    ToHdfsFileInfo(entries[i], &res[i]);
+  }
+  *numEntries = entries.size();
+  return res;
+}
+
+
+void hdfsFreeFileInfo(hdfsFileInfo *infos, int numEntries) {
+  if(NULL == infos)
+    return;
+  for(int i = 0; i < numEntries; i++) {
+    free(infos[i].mName);
+    free(infos[i].mOwner);
+    free(infos[i].mGroup);
+  }
+  free(infos);
+}
+
+
+int hdfsCreateDirectory(hdfsFS fs, const char *path) {
+  if(NULL == fs || NULL == path) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  Status stat = fs->fileSystem->Mkdirs(path, 0755, true);
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
+
+
+int hdfsDelete(hdfsFS fs, const char *path, int recursive) {
+  if(NULL == fs || NULL == path) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  Status stat = fs->fileSystem->Delete(path, recursive != 0);
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
+
+
+int hdfsRename(hdfsFS fs, const char *oldPath, const char *newPath) {
+  if(NULL == fs || NULL == oldPath || NULL == newPath) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  Status stat = fs->fileSystem->Rename(oldPath, newPath);
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
+
+
+int hdfsChmod(hdfsFS fs, const char *path, short mode) {
+  if(NULL == fs || NULL == path) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  Status stat = fs->fileSystem->SetPermission(path, mode);
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
+
+
+int hdfsChown(hdfsFS fs, const char *path, const char *owner, const char *group) {
+  if(NULL == fs || NULL == path || (NULL == owner && NULL == group)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  Status stat = fs->fileSystem->SetOwner(path, owner ? owner : "", group ? group : "");
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
+
+
+int hdfsSetReplication(hdfsFS fs, const char *path, short replication) {
+  if(NULL == fs || NULL == path || replication <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  Status stat = fs->fileSystem->SetReplication(path, replication);
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
+
+
+int hdfsUtime(hdfsFS fs, const char *path, time_t mtime, time_t atime) {
+  if(NULL == fs || NULL == path) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  //-1 keeps the time, the NameNode takes milliseconds otherwise
+  int64_t mtimeMs = mtime == -1 ? -1 : static_cast<int64_t>(mtime) * 1000;
+  int64_t atimeMs = atime == -1 ? -1 : static_cast<int64_t>(atime) * 1000;
+  Status stat = fs->fileSystem->SetTimes(path, mtimeMs, atimeMs);
+  if(!stat.ok())
+    return SetErrno(stat);
+  return 0;
+}
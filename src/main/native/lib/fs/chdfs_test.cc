@@ -0,0 +1,397 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "libhdfs++/chdfs.h"
+
+#include "mock_namespace.h"
+#include "reader/mock_datanode.h"
+
+#include "ClientNamenodeProtocol.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+
+#include <future>
+
+namespace hdfs {
+
+using ::hadoop::hdfs::GetBlockLocationsResponseProto;
+
+static const uint64_t kBlockSize = 200000;
+static const uint64_t kFileLength = 2 * kBlockSize + 100000;
+
+/*
+ * The C API against a NameNode and a DataNode that are mocks. The
+ * NameNode serves the metadata of a MockNamespace, which lists 10
+ * entries per page, and the blocks of a file of kFileLength bytes at
+ * "/foo", which are all on the DataNode.
+ */
+class CApiTest : public ::testing::Test {
+ protected:
+  MockNameNode nn_;
+  MockNamespace ns_;
+  MockDataNode dn_;
+  hdfsFS fs_;
+  hdfsFile file_;
+
+  CApiTest() : ns_(&nn_, 10), fs_(NULL), file_(NULL) {
+    nn_.SetMethod("getBlockLocations", [this](const std::string &, std::string *response) {
+        GetBlockLocationsResponseProto resp;
+        Blocks(resp.mutable_locations());
+        *response = resp.SerializeAsString();
+        return Status::OK();
+      });
+  }
+
+  ~CApiTest() {
+    if (file_) {
+      hdfsCloseFile(fs_, file_);
+    }
+    if (fs_) {
+      hdfsDisconnect(fs_);
+    }
+  }
+
+  void Connect() {
+    fs_ = hdfsConnect("127.0.0.1", nn_.endpoint().port());
+    ASSERT_TRUE(fs_ != NULL);
+  }
+
+  void Open() {
+    Connect();
+    file_ = hdfsOpenFile(fs_, "/foo", 0, 0, 0, 0);
+    ASSERT_TRUE(file_ != NULL);
+  }
+
+  void Blocks(::hadoop::hdfs::LocatedBlocksProto *res) {
+    res->set_filelength(kFileLength);
+    res->set_underconstruction(false);
+    res->set_islastblockcomplete(true);
+    for (uint64_t offset = 0, id = 1; offset < kFileLength; offset += kBlockSize, ++id) {
+      auto b = res->add_blocks();
+      b->set_offset(offset);
+      b->set_corrupt(false);
+      b->mutable_b()->set_poolid("pool");
+      b->mutable_b()->set_blockid(id);
+      b->mutable_b()->set_generationstamp(1);
+      b->mutable_b()->set_numbytes(std::min(kBlockSize, kFileLength - offset));
+      auto token = b->mutable_blocktoken();
+      token->set_identifier("");
+      token->set_password("");
+      token->set_kind("");
+      token->set_service("");
+      auto dn = b->add_locs()->mutable_id();
+      dn->set_ipaddr(dn_.endpoint().address().to_string());
+      dn->set_hostname("localhost");
+      dn->set_datanodeuuid("uuid");
+      dn->set_xferport(dn_.endpoint().port());
+      dn->set_infoport(0);
+      dn->set_ipcport(0);
+    }
+  }
+
+  // The content of the file at [offset, offset + length)
+  static std::string FileData(uint64_t offset, size_t length) {
+    std::string res(length, '\0');
+    for (size_t i = 0; i < length; ++i) {
+      uint64_t pos = offset + i;
+      res[i] = MockDataNode::BlockData(pos / kBlockSize + 1, pos % kBlockSize);
+    }
+    return res;
+  }
+};
+
+TEST_F(CApiTest, TestPreadv) {
+  Open();
+
+  // Unsorted, overlapping, and across the blocks and the end of the file
+  struct {
+    off_t offset;
+    size_t length;
+  } ranges[] = {
+    {2 * kBlockSize + 1000, 500},
+    {1500, 2000},
+    {100, 1000},
+    {2000, 1000},
+    {kBlockSize - 300, 600},
+    {kFileLength - 100, 300},
+  };
+  const int count = sizeof(ranges) / sizeof(ranges[0]);
+
+  std::vector<std::string> bufs;
+  std::vector<hdfsReadRange> read_ranges(count);
+  for (int i = 0; i < count; ++i) {
+    bufs.emplace_back(ranges[i].length, '\0');
+  }
+  for (int i = 0; i < count; ++i) {
+    read_ranges[i].offset = ranges[i].offset;
+    read_ranges[i].length = ranges[i].length;
+    read_ranges[i].buffer = &bufs[i][0];
+    read_ranges[i].readBytes = 1;
+  }
+  ASSERT_EQ(0, hdfsPreadv(fs_, file_, read_ranges.data(), count));
+  for (int i = 0; i < count; ++i) {
+    size_t expected = std::min<uint64_t>(ranges[i].length, kFileLength - ranges[i].offset);
+    ASSERT_EQ(expected, read_ranges[i].readBytes) << i;
+    EXPECT_EQ(FileData(ranges[i].offset, expected), bufs[i].substr(0, expected)) << i;
+  }
+  EXPECT_EQ(6u, dn_.requests(kReadBlock));
+}
+
+TEST_F(CApiTest, TestPreadvInvalidRange) {
+  Open();
+
+  std::string buf(1000, '\0');
+  hdfsReadRange ranges[2];
+  for (auto &r : ranges) {
+    r.offset = 0;
+    r.length = buf.size();
+    r.buffer = &buf[0];
+  }
+
+  // A negative offset, a buffer missing, or a range after the end of
+  // the file fails the call without reading any range
+  for (int invalid = 0; invalid < 3; ++invalid) {
+    ranges[1].offset = invalid == 0 ? -1 : invalid == 1 ? 0 : kFileLength;
+    ranges[1].buffer = invalid == 1 ? NULL : &buf[0];
+    for (auto &r : ranges) {
+      r.readBytes = 1;
+    }
+    errno = 0;
+    EXPECT_EQ(-1, hdfsPreadv(fs_, file_, ranges, 2)) << invalid;
+    EXPECT_EQ(EINVAL, errno) << invalid;
+    for (const auto &r : ranges) {
+      EXPECT_EQ(0u, r.readBytes) << invalid;
+    }
+  }
+  EXPECT_EQ(0u, dn_.requests(kReadBlock));
+
+  errno = 0;
+  EXPECT_EQ(-1, hdfsPreadv(fs_, file_, NULL, 1));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(0, hdfsPreadv(fs_, file_, NULL, 0));
+}
+
+// The hints to the page cache of the DataNode in the last request,
+// e.g., "dropbehind=1 readahead=4096", empty if there are none
+static std::string LastCacheHints(MockDataNode *dn) {
+  std::string res;
+  const auto &c = dn->read_requests().back().cachingstrategy();
+  if (c.has_dropbehind()) {
+    res += "dropbehind=" + std::to_string(c.dropbehind());
+  }
+  if (c.has_readahead()) {
+    res += std::string(res.empty() ? "" : " ") + "readahead=" + std::to_string(c.readahead());
+  }
+  return res;
+}
+
+TEST_F(CApiTest, TestCacheHints) {
+  Open();
+  char buf[1000];
+
+  ASSERT_EQ(sizeof(buf), hdfsPread(fs_, file_, 0, buf, sizeof(buf)));
+  EXPECT_EQ("", LastCacheHints(&dn_));
+  ASSERT_EQ(sizeof(buf), hdfsPreadWithCacheHints(fs_, file_, 0, buf, sizeof(buf), 1, 4096));
+  EXPECT_EQ("dropbehind=1 readahead=4096", LastCacheHints(&dn_));
+  ASSERT_EQ(sizeof(buf), hdfsPreadWithCacheHints(fs_, file_, 0, buf, sizeof(buf), 2, -1));
+  EXPECT_EQ("dropbehind=0", LastCacheHints(&dn_));
+
+  // The settings of the file apply unless the read overrides them
+  ASSERT_EQ(0, hdfsFileSetDropBehind(fs_, file_, 1));
+  ASSERT_EQ(0, hdfsFileSetReadahead(fs_, file_, 65536));
+  ASSERT_EQ(sizeof(buf), hdfsPread(fs_, file_, 0, buf, sizeof(buf)));
+  EXPECT_EQ("dropbehind=1 readahead=65536", LastCacheHints(&dn_));
+  ASSERT_EQ(sizeof(buf), hdfsPreadWithCacheHints(fs_, file_, 0, buf, sizeof(buf), 0, 0));
+  EXPECT_EQ("dropbehind=1 readahead=0", LastCacheHints(&dn_));
+  ASSERT_EQ(sizeof(buf), hdfsPreadWithCacheHints(fs_, file_, 0, buf, sizeof(buf), 2, -1));
+  EXPECT_EQ("dropbehind=0 readahead=65536", LastCacheHints(&dn_));
+
+  ASSERT_EQ(0, hdfsFileSetDropBehind(fs_, file_, 0));
+  ASSERT_EQ(0, hdfsFileSetReadahead(fs_, file_, -1));
+  ASSERT_EQ(sizeof(buf), hdfsPread(fs_, file_, 0, buf, sizeof(buf)));
+  EXPECT_EQ("", LastCacheHints(&dn_));
+
+  EXPECT_EQ(-1, hdfsFileSetDropBehind(fs_, file_, 4));
+  EXPECT_EQ(-1, hdfsFileSetDropBehind(fs_, file_, -1));
+}
+
+// The result of an hdfsPreadAsync()
+struct PreadResult {
+  std::promise<std::pair<int, size_t> > done;
+
+  static void OnRead(int errnum, size_t readBytes, void *context) {
+    static_cast<PreadResult*>(context)->done.set_value(std::make_pair(errnum, readBytes));
+  }
+};
+
+TEST_F(CApiTest, TestPreadAsync) {
+  Open();
+
+  const off_t position = kBlockSize - 1000;
+  std::string buf(kBlockSize, '\0');
+  PreadResult read;
+  ASSERT_EQ(0, hdfsPreadAsync(fs_, file_, position, &buf[0], buf.size(),
+                              PreadResult::OnRead, &read));
+  auto result = read.done.get_future().get();
+  EXPECT_EQ(0, result.first);
+  ASSERT_EQ(buf.size(), result.second);
+  EXPECT_EQ(FileData(position, buf.size()), buf);
+
+  // The errors of the read come back on the callback
+  dn_.set_read_status(::hadoop::hdfs::ERROR);
+  PreadResult failed;
+  ASSERT_EQ(0, hdfsPreadAsync(fs_, file_, 0, &buf[0], 1000, PreadResult::OnRead, &failed));
+  result = failed.done.get_future().get();
+  EXPECT_EQ(EIO, result.first);
+  EXPECT_EQ(0u, result.second);
+
+  PreadResult eof;
+  ASSERT_EQ(0, hdfsPreadAsync(fs_, file_, kFileLength, &buf[0], 1000, PreadResult::OnRead, &eof));
+  result = eof.done.get_future().get();
+  EXPECT_EQ(EINVAL, result.first);
+  EXPECT_EQ(0u, result.second);
+}
+
+TEST_F(CApiTest, TestPreadAsyncInvalidArguments) {
+  Open();
+
+  // The callback is not called when the read is not started
+  char buf[100];
+  PreadResult read;
+  errno = 0;
+  EXPECT_EQ(-1, hdfsPreadAsync(fs_, file_, 0, NULL, sizeof(buf), PreadResult::OnRead, &read));
+  EXPECT_EQ(EINVAL, errno);
+  errno = 0;
+  EXPECT_EQ(-1, hdfsPreadAsync(fs_, file_, -1, buf, sizeof(buf), PreadResult::OnRead, &read));
+  EXPECT_EQ(EINVAL, errno);
+  errno = 0;
+  EXPECT_EQ(-1, hdfsPreadAsync(fs_, file_, 0, buf, sizeof(buf), NULL, &read));
+  EXPECT_EQ(EINVAL, errno);
+  errno = 0;
+  EXPECT_EQ(-1, hdfsPreadAsync(NULL, file_, 0, buf, sizeof(buf), PreadResult::OnRead, &read));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(0u, dn_.requests(kReadBlock));
+}
+
+TEST_F(CApiTest, TestGetPathInfo) {
+  ns_.AddFile("/dir/file", 12345);
+  Connect();
+
+  hdfsFileInfo *info = hdfsGetPathInfo(fs_, "/dir/file");
+  ASSERT_TRUE(info != NULL);
+  EXPECT_EQ(kObjectKindFile, info->mKind);
+  EXPECT_STREQ("/dir/file", info->mName);
+  EXPECT_EQ(12345, info->mSize);
+  EXPECT_EQ(3, info->mReplication);
+  EXPECT_STREQ("hdfs", info->mOwner);
+  EXPECT_EQ(0644, info->mPermissions);
+  // The times are in seconds
+  EXPECT_EQ(1000, info->mLastMod);
+  EXPECT_EQ(2000, info->mLastAccess);
+  hdfsFreeFileInfo(info, 1);
+  EXPECT_EQ(0, hdfsExists(fs_, "/dir"));
+
+  errno = 0;
+  EXPECT_TRUE(hdfsGetPathInfo(fs_, "/missing") == NULL);
+  EXPECT_EQ(ENOENT, errno);
+  errno = 0;
+  EXPECT_EQ(-1, hdfsExists(fs_, "/missing"));
+  EXPECT_EQ(ENOENT, errno);
+}
+
+TEST_F(CApiTest, TestListDirectory) {
+  for (int i = 0; i < 25; ++i) {
+    ns_.AddFile("/dir/file" + std::to_string(100 + i), i);
+  }
+  ns_.AddDirectory("/dir/sub");
+  Connect();
+
+  int count = 0;
+  hdfsFileInfo *infos = hdfsListDirectory(fs_, "/dir", &count);
+  ASSERT_TRUE(infos != NULL);
+  ASSERT_EQ(26, count);
+  for (int i = 0; i < 25; ++i) {
+    EXPECT_EQ("/dir/file" + std::to_string(100 + i), infos[i].mName);
+    EXPECT_EQ(kObjectKindFile, infos[i].mKind);
+  }
+  EXPECT_STREQ("/dir/sub", infos[25].mName);
+  EXPECT_EQ(kObjectKindDirectory, infos[25].mKind);
+  hdfsFreeFileInfo(infos, count);
+  EXPECT_EQ(3u, nn_.calls("getListing"));
+
+  // An empty directory has no entries and no error
+  errno = EIO;
+  EXPECT_TRUE(hdfsListDirectory(fs_, "/dir/sub", &count) == NULL);
+  EXPECT_EQ(0, count);
+  EXPECT_EQ(0, errno);
+  EXPECT_TRUE(hdfsListDirectory(fs_, "/missing", &count) == NULL);
+  EXPECT_EQ(ENOENT, errno);
+}
+
+TEST_F(CApiTest, TestCreateDeleteRename) {
+  Connect();
+
+  ASSERT_EQ(0, hdfsCreateDirectory(fs_, "/a/b"));
+  EXPECT_TRUE(ns_.IsDirectory("/a/b"));
+  ASSERT_EQ(0, hdfsRename(fs_, "/a/b", "/a/c"));
+  EXPECT_TRUE(ns_.IsDirectory("/a/c"));
+  EXPECT_FALSE(ns_.Exists("/a/b"));
+
+  // A failed rename is not an exception of the NameNode
+  errno = 0;
+  EXPECT_EQ(-1, hdfsRename(fs_, "/a/b", "/a/d"));
+  EXPECT_EQ(EIO, errno);
+
+  errno = 0;
+  EXPECT_EQ(-1, hdfsDelete(fs_, "/a", 0));
+  EXPECT_EQ(ENOTEMPTY, errno);
+  ASSERT_EQ(0, hdfsDelete(fs_, "/a", 1));
+  EXPECT_FALSE(ns_.Exists("/a"));
+  errno = 0;
+  EXPECT_EQ(-1, hdfsDelete(fs_, "/a", 1));
+  EXPECT_EQ(ENOENT, errno);
+
+  ns_.AddFile("/file", 1);
+  errno = 0;
+  EXPECT_EQ(-1, hdfsCreateDirectory(fs_, "/file"));
+  EXPECT_EQ(EEXIST, errno);
+}
+
+TEST_F(CApiTest, TestAccessControlException) {
+  ns_.AddDirectory("/private");
+  ns_.SetException("/private", "org.apache.hadoop.security.AccessControlException");
+  Connect();
+
+  errno = 0;
+  EXPECT_TRUE(hdfsGetPathInfo(fs_, "/private") == NULL);
+  EXPECT_EQ(EACCES, errno);
+  errno = 0;
+  EXPECT_EQ(-1, hdfsCreateDirectory(fs_, "/private"));
+  EXPECT_EQ(EACCES, errno);
+  errno = 0;
+  EXPECT_EQ(-1, hdfsDelete(fs_, "/private", 1));
+  EXPECT_EQ(EACCES, errno);
+  int count = 0;
+  errno = 0;
+  EXPECT_TRUE(hdfsListDirectory(fs_, "/private", &count) == NULL);
+  EXPECT_EQ(EACCES, errno);
+  EXPECT_TRUE(ns_.Exists("/private"));
+}
+
+}
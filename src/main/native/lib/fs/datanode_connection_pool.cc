@@ -0,0 +1,96 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "datanode_connection_pool.h"
+
+namespace hdfs {
+
+DataNodeConnectionPool::DataNodeConnectionPool(size_t max_idle_connections,
+                                               std::chrono::milliseconds idle_timeout)
+    : max_idle_connections_(max_idle_connections)
+    , idle_timeout_(idle_timeout)
+{}
+
+std::shared_ptr<DataNodeConnectionPool::Socket>
+DataNodeConnectionPool::Acquire(const Endpoint &endpoint) {
+  std::lock_guard<std::mutex> lock(lock_);
+  EvictLocked(Clock::now());
+  return AcquireLocked(endpoint);
+}
+
+void DataNodeConnectionPool::Release(const Endpoint &endpoint,
+                                     const std::shared_ptr<Socket> &conn) {
+  if (!max_idle_connections_ || !conn->is_open()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  auto now = Clock::now();
+  lru_.push_front(Entry{endpoint, conn, now});
+  index_.insert(std::make_pair(endpoint, lru_.begin()));
+  EvictLocked(now);
+}
+
+size_t DataNodeConnectionPool::size() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return lru_.size();
+}
+
+std::shared_ptr<DataNodeConnectionPool::Socket>
+DataNodeConnectionPool::AcquireLocked(const Endpoint &endpoint) {
+  /* assumed to be called from a context that has already acquired the lock_ */
+  auto range = index_.equal_range(endpoint);
+  if (range.first == range.second) {
+    return nullptr;
+  }
+
+  // Prefer the most recently used connection as it is the least
+  // likely one to be closed by the DataNode.
+  auto best = range.first;
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second->idle_since > best->second->idle_since) {
+      best = it;
+    }
+  }
+
+  auto conn = best->second->conn;
+  lru_.erase(best->second);
+  index_.erase(best);
+  return conn;
+}
+
+void DataNodeConnectionPool::EvictLocked(Clock::time_point now) {
+  /* assumed to be called from a context that has already acquired the lock_ */
+  while (!lru_.empty() && (lru_.size() > max_idle_connections_ ||
+                           now - lru_.back().idle_since >= idle_timeout_)) {
+    EraseLocked(std::prev(lru_.end()));
+  }
+}
+
+void DataNodeConnectionPool::EraseLocked(LruList::iterator it) {
+  auto range = index_.equal_range(it->endpoint);
+  for (auto i = range.first; i != range.second; ++i) {
+    if (i->second == it) {
+      index_.erase(i);
+      break;
+    }
+  }
+  lru_.erase(it);
+}
+
+}
@@ -0,0 +1,106 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FS_DATANODE_CONNECTION_POOL_H_
+#define FS_DATANODE_CONNECTION_POOL_H_
+
+#include <asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace hdfs {
+
+/**
+ * A pool of idle connections to the DataNodes, keyed by the endpoint
+ * of the DataNode.
+ *
+ * A DataNode keeps the connection open after it has finished serving
+ * an OP_READ_BLOCK request, and waits for the next operation for a
+ * short period of time. The pool keeps these connections so that the
+ * subsequent reads can skip the TCP handshake. Idle connections are
+ * dropped once they have been idle longer than the timeout, or when
+ * the pool is full, in which case the least recently used connection
+ * is evicted.
+ *
+ * Only connections whose RemoteBlockReader has finished the whole
+ * read (i.e., in the kFinished state) can be released into the pool.
+ **/
+class DataNodeConnectionPool {
+ public:
+  typedef ::asio::ip::tcp::socket Socket;
+  typedef ::asio::ip::tcp::endpoint Endpoint;
+  typedef std::chrono::steady_clock Clock;
+
+  DataNodeConnectionPool(size_t max_idle_connections,
+                         std::chrono::milliseconds idle_timeout);
+
+  /**
+   * Take an idle connection to any of the endpoints in [begin,
+   * end). The endpoints are tried in order. Return nullptr if there
+   * is no usable connection in the pool.
+   **/
+  template<class Iterator>
+  std::shared_ptr<Socket> Acquire(Iterator begin, Iterator end);
+  std::shared_ptr<Socket> Acquire(const Endpoint &endpoint);
+  /**
+   * Return a connection that has finished its last operation back
+   * to the pool.
+   **/
+  void Release(const Endpoint &endpoint, const std::shared_ptr<Socket> &conn);
+  size_t size();
+
+ private:
+  struct Entry {
+    Endpoint endpoint;
+    std::shared_ptr<Socket> conn;
+    Clock::time_point idle_since;
+  };
+  typedef std::list<Entry> LruList;
+
+  const size_t max_idle_connections_;
+  const std::chrono::milliseconds idle_timeout_;
+  // Idle connections, the most recently used one comes first
+  LruList lru_;
+  std::multimap<Endpoint, LruList::iterator> index_;
+  std::mutex lock_;
+
+  std::shared_ptr<Socket> AcquireLocked(const Endpoint &endpoint);
+  void EvictLocked(Clock::time_point now);
+  void EraseLocked(LruList::iterator it);
+};
+
+template<class Iterator>
+std::shared_ptr<DataNodeConnectionPool::Socket>
+DataNodeConnectionPool::Acquire(Iterator begin, Iterator end) {
+  std::lock_guard<std::mutex> lock(lock_);
+  EvictLocked(Clock::now());
+  for (Iterator it = begin; it != end; ++it) {
+    auto conn = AcquireLocked(*it);
+    if (conn) {
+      return conn;
+    }
+  }
+  return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "datanode_connection_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace hdfs {
+
+using ::asio::ip::tcp;
+
+static std::shared_ptr<tcp::socket> NewSocket(asio::io_service *io_service) {
+  auto s = std::make_shared<tcp::socket>(*io_service);
+  s->open(tcp::v4());
+  return s;
+}
+
+static tcp::endpoint Endpoint(unsigned short port) {
+  return tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), port);
+}
+
+TEST(DataNodeConnectionPoolTest, TestAcquireByEndpoint) {
+  asio::io_service io_service;
+  DataNodeConnectionPool pool(16, std::chrono::milliseconds(60000));
+  auto s1 = NewSocket(&io_service), s2 = NewSocket(&io_service);
+  pool.Release(Endpoint(1), s1);
+  pool.Release(Endpoint(2), s2);
+
+  ASSERT_EQ(nullptr, pool.Acquire(Endpoint(3)));
+  std::vector<tcp::endpoint> eps = {Endpoint(3), Endpoint(2), Endpoint(1)};
+  ASSERT_EQ(s2, pool.Acquire(eps.begin(), eps.end()));
+  ASSERT_EQ(s1, pool.Acquire(eps.begin(), eps.end()));
+  ASSERT_EQ(nullptr, pool.Acquire(eps.begin(), eps.end()));
+  ASSERT_EQ(0, pool.size());
+}
+
+TEST(DataNodeConnectionPoolTest, TestEvictLeastRecentlyUsed) {
+  asio::io_service io_service;
+  DataNodeConnectionPool pool(2, std::chrono::milliseconds(60000));
+  auto s1 = NewSocket(&io_service), s2 = NewSocket(&io_service),
+      s3 = NewSocket(&io_service);
+  pool.Release(Endpoint(1), s1);
+  pool.Release(Endpoint(1), s2);
+  pool.Release(Endpoint(1), s3);
+  ASSERT_EQ(2, pool.size());
+  ASSERT_EQ(s3, pool.Acquire(Endpoint(1)));
+  ASSERT_EQ(s2, pool.Acquire(Endpoint(1)));
+  ASSERT_EQ(nullptr, pool.Acquire(Endpoint(1)));
+}
+
+TEST(DataNodeConnectionPoolTest, TestIdleTimeout) {
+  asio::io_service io_service;
+  DataNodeConnectionPool pool(16, std::chrono::milliseconds(10));
+  pool.Release(Endpoint(1), NewSocket(&io_service));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(nullptr, pool.Acquire(Endpoint(1)));
+  ASSERT_EQ(0, pool.size());
+}
+
+TEST(DataNodeConnectionPoolTest, TestDisabledOrClosed) {
+  asio::io_service io_service;
+  DataNodeConnectionPool disabled(0, std::chrono::milliseconds(60000));
+  disabled.Release(Endpoint(1), NewSocket(&io_service));
+  ASSERT_EQ(0, disabled.size());
+
+  DataNodeConnectionPool pool(16, std::chrono::milliseconds(60000));
+  pool.Release(Endpoint(1), std::make_shared<tcp::socket>(io_service));
+  ASSERT_EQ(0, pool.size());
+}
+
+}
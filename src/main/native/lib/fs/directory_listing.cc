@@ -0,0 +1,242 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filesystem.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <future>
+
+namespace hdfs {
+
+DirectoryListing::~DirectoryListing()
+{}
+
+/**
+ * A listing that keeps one page in flight. The page is fetched on the
+ * IoService while the caller processes the previous one, and Next()
+ * only waits when the caller is faster than the NameNode.
+ **/
+class DirectoryListingImpl : public DirectoryListing {
+ public:
+  DirectoryListingImpl(FileSystemImpl *fs, const std::string &path);
+  ~DirectoryListingImpl();
+  virtual Status Next(std::vector<FileInfo> *entries) override;
+
+ private:
+  /**
+   * The state is shared with the handler of the page in flight, which
+   * still holds the lock when it wakes up the destructor.
+   **/
+  struct State {
+    std::mutex lock;
+    std::condition_variable ready;
+    bool fetching;
+    bool done;
+    Status status;
+    std::shared_ptr<FileSystemImpl::ListingPage> page;
+    State() : fetching(false), done(false) {}
+  };
+
+  FileSystemImpl * const fs_;
+  const std::string path_;
+  std::shared_ptr<State> state_;
+
+  static void Fetch(FileSystemImpl *fs, const std::string &path,
+                    const std::string &start_after,
+                    const std::shared_ptr<State> &state);
+};
+
+DirectoryListingImpl::DirectoryListingImpl(FileSystemImpl *fs,
+                                           const std::string &path)
+    : fs_(fs)
+    , path_(path)
+    , state_(std::make_shared<State>())
+{
+  state_->fetching = true;
+  Fetch(fs_, path_, "", state_);
+}
+
+DirectoryListingImpl::~DirectoryListingImpl() {
+  std::unique_lock<std::mutex> lock(state_->lock);
+  // The page in flight uses the FileSystem, which the caller may
+  // destroy right after the listing. The page completes on a thread of
+  // the IoService, thus deleting the listing on such a thread while a
+  // page is in flight deadlocks when the IoService has a single thread.
+  state_->ready.wait(lock, [this]() { return !state_->fetching; });
+}
+
+void DirectoryListingImpl::Fetch(FileSystemImpl *fs, const std::string &path,
+                                 const std::string &start_after,
+                                 const std::shared_ptr<State> &state) {
+  fs->AsyncGetListingPage(path, start_after, [state](
+      const Status &status, const std::shared_ptr<FileSystemImpl::ListingPage> &page) {
+      std::lock_guard<std::mutex> lock(state->lock);
+      state->fetching = false;
+      state->status = status;
+      state->page = page;
+      state->ready.notify_all();
+    });
+}
+
+Status DirectoryListingImpl::Next(std::vector<FileInfo> *entries) {
+  entries->clear();
+  std::shared_ptr<FileSystemImpl::ListingPage> page;
+  {
+    std::unique_lock<std::mutex> lock(state_->lock);
+    state_->ready.wait(lock, [this]() { return !state_->fetching; });
+    if (state_->done || !state_->status.ok()) {
+      return state_->status;
+    }
+    page = std::move(state_->page);
+    if (page->start_after.empty()) {
+      state_->done = true;
+    } else {
+      state_->fetching = true;
+    }
+  }
+
+  if (!page->start_after.empty()) {
+    Fetch(fs_, path_, page->start_after, state_);
+  }
+  entries->swap(page->entries);
+  return Status::OK();
+}
+
+Status FileSystemImpl::OpenListing(const char *path, DirectoryListing **listing) {
+  *listing = new DirectoryListingImpl(this, path);
+  return Status::OK();
+}
+
+/**
+ * The directories of a walk that remain to be listed. A directory
+ * with more entries than fit into one page is pushed again with the
+ * name to continue after. The stack makes the walk go deep first,
+ * which keeps it small for wide trees.
+ **/
+struct FileSystemImpl::TreeWalk {
+  struct Task {
+    std::string path;
+    std::string start_after;
+  };
+  std::string root;
+  std::function<bool(const std::vector<FileInfo> &)> visitor;
+  std::function<void(const Status &)> handler;
+
+  std::mutex lock;
+  std::vector<Task> pending;
+  unsigned in_flight;
+  bool stopped;
+  Status status;
+  // Serializes the calls of the visitor
+  std::mutex visit_lock;
+  TreeWalk() : in_flight(0), stopped(false) {}
+};
+
+Status FileSystemImpl::Walk(const char *path,
+                            const std::function<bool(const std::vector<FileInfo> &)> &visitor) {
+  auto stat = std::make_shared<std::promise<Status>>();
+  std::future<Status> future(stat->get_future());
+  AsyncWalk(path, visitor, [stat](const Status &status) { stat->set_value(status); });
+  return future.get();
+}
+
+void FileSystemImpl::AsyncWalk(const char *path,
+                               const std::function<bool(const std::vector<FileInfo> &)> &visitor,
+                               const std::function<void(const Status &)> &handler) {
+  auto walk = std::make_shared<TreeWalk>();
+  walk->root = path;
+  walk->visitor = visitor;
+  walk->handler = handler;
+  walk->pending.push_back(TreeWalk::Task{path, ""});
+  ContinueWalk(walk);
+}
+
+void FileSystemImpl::ContinueWalk(const std::shared_ptr<TreeWalk> &walk) {
+  const unsigned max_in_flight = std::max(options_.max_concurrent_listings, 1u);
+  std::vector<TreeWalk::Task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(walk->lock);
+    while (!walk->stopped && walk->in_flight < max_in_flight &&
+           !walk->pending.empty()) {
+      tasks.push_back(std::move(walk->pending.back()));
+      walk->pending.pop_back();
+      ++walk->in_flight;
+    }
+    if (walk->in_flight == 0 && tasks.empty()) {
+      walk->pending.clear();
+      Status status = walk->status;
+      // The walk completes only once, when the last listing returns
+      if (walk->handler) {
+        auto handler = std::move(walk->handler);
+        walk->handler = nullptr;
+        Complete(handler, status);
+      }
+      return;
+    }
+  }
+
+  for (const auto &task : tasks) {
+    std::string dir = task.path;
+    AsyncGetListingPage(dir, task.start_after, [this,walk,dir](
+        const Status &status, const std::shared_ptr<ListingPage> &page) {
+        bool ok = status.ok();
+        // A directory that is deleted while the walk runs is skipped
+        if (!ok && !(status.is_path_not_found() && dir != walk->root)) {
+          std::lock_guard<std::mutex> lock(walk->lock);
+          if (!walk->stopped) {
+            walk->stopped = true;
+            walk->status = status;
+          }
+        }
+
+        if (ok && !page->entries.empty()) {
+          std::lock_guard<std::mutex> visit_lock(walk->visit_lock);
+          bool stopped;
+          {
+            std::lock_guard<std::mutex> lock(walk->lock);
+            stopped = walk->stopped;
+          }
+          if (!stopped && !walk->visitor(page->entries)) {
+            std::lock_guard<std::mutex> lock(walk->lock);
+            walk->stopped = true;
+          }
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(walk->lock);
+          --walk->in_flight;
+          if (ok && !walk->stopped) {
+            if (!page->start_after.empty()) {
+              walk->pending.push_back(TreeWalk::Task{dir, page->start_after});
+            }
+            // Pushed in reverse so that the subdirectories are listed
+            // in the order of the listing
+            for (auto it = page->entries.rbegin(); it != page->entries.rend(); ++it) {
+              if (it->type == FileInfo::kDirectory && it->path != dir) {
+                walk->pending.push_back(TreeWalk::Task{it->path, ""});
+              }
+            }
+          }
+        }
+        ContinueWalk(walk);
+      });
+  }
+}
+
+}
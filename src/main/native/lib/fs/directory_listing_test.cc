@@ -0,0 +1,201 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "filesystem.h"
+#include "mock_namespace.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+
+namespace hdfs {
+
+/*
+ * Listings and walks of a FileSystemImpl against a mock NameNode,
+ * which lists 3 entries per page. The tree under /root has 11 entries
+ * in 4 directories:
+ *
+ *   /root/a/x/f1, /root/a/x/f2, /root/a/f1, /root/a/f2, /root/a/f3,
+ *   /root/b/f1, /root/b/f2, /root/c
+ */
+class DirectoryListingTest : public ::testing::Test {
+ protected:
+  MockNameNode nn_;
+  MockNamespace ns_;
+  std::unique_ptr<IoService> io_service_;
+  std::thread worker_;
+  std::unique_ptr<FileSystemImpl> fs_;
+
+  DirectoryListingTest()
+      : ns_(&nn_, 3)
+      , io_service_(IoService::New(IoServiceOptions()))
+      , worker_(std::bind(&IoService::Run, io_service_.get()))
+  {
+    for (const char *path : {"/root/a/x/f1", "/root/a/x/f2", "/root/a/f1", "/root/a/f2",
+                             "/root/a/f3", "/root/b/f1", "/root/b/f2", "/root/c"}) {
+      ns_.AddFile(path, 1);
+    }
+  }
+
+  ~DirectoryListingTest() {
+    if (fs_) {
+      fs_->rpc_engine().Shutdown();
+    }
+    io_service_->Stop();
+    worker_.join();
+  }
+
+  void Connect(const Options &options = Options()) {
+    fs_.reset(new FileSystemImpl(io_service_.get(), options));
+    auto endpoint = nn_.endpoint();
+    ASSERT_TRUE(fs_->Connect({NameNodeAddress{endpoint.address().to_string(),
+                                              endpoint.port()}}).ok());
+  }
+
+  // A walk that lists one directory at a time, in the order of the tree
+  void ConnectSerial() {
+    Options options;
+    options.max_concurrent_listings = 1;
+    Connect(options);
+  }
+
+  static std::vector<std::string> Paths(const std::vector<FileInfo> &entries) {
+    std::vector<std::string> res;
+    for (const auto &e : entries) {
+      res.push_back(e.path);
+    }
+    return res;
+  }
+};
+
+TEST_F(DirectoryListingTest, TestNextInPages) {
+  Connect();
+  DirectoryListing *l = nullptr;
+  ASSERT_TRUE(fs_->OpenListing("/root/a", &l).ok());
+  std::unique_ptr<DirectoryListing> listing(l);
+
+  std::vector<FileInfo> entries;
+  ASSERT_TRUE(listing->Next(&entries).ok());
+  EXPECT_EQ((std::vector<std::string>{"/root/a/f1", "/root/a/f2", "/root/a/f3"}),
+            Paths(entries));
+  ASSERT_TRUE(listing->Next(&entries).ok());
+  EXPECT_EQ(std::vector<std::string>{"/root/a/x"}, Paths(entries));
+  EXPECT_EQ(FileInfo::kDirectory, entries[0].type);
+  // The end of the listing, for good
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(listing->Next(&entries).ok());
+    EXPECT_TRUE(entries.empty());
+  }
+  EXPECT_EQ(2u, nn_.calls("getListing"));
+
+  ASSERT_TRUE(fs_->OpenListing("/missing", &l).ok());
+  listing.reset(l);
+  EXPECT_TRUE(listing->Next(&entries).is_path_not_found());
+  EXPECT_TRUE(entries.empty());
+}
+
+TEST_F(DirectoryListingTest, TestDeleteListingWithPageInFlight) {
+  Connect();
+  for (int i = 0; i < 10; ++i) {
+    ns_.AddFile("/big/f" + std::to_string(i), 1);
+  }
+  DirectoryListing *l = nullptr;
+  ASSERT_TRUE(fs_->OpenListing("/big", &l).ok());
+  std::vector<FileInfo> entries;
+  ASSERT_TRUE(l->Next(&entries).ok());
+  EXPECT_EQ(3u, entries.size());
+  // Waits for the prefetched page
+  delete l;
+  EXPECT_EQ(2u, nn_.calls("getListing"));
+}
+
+TEST_F(DirectoryListingTest, TestWalk) {
+  Connect();
+  std::vector<std::string> visited;
+  std::atomic_uint pages(0);
+  ASSERT_TRUE(fs_->Walk("/root", [&visited,&pages](const std::vector<FileInfo> &entries) {
+      auto paths = Paths(entries);
+      visited.insert(visited.end(), paths.begin(), paths.end());
+      EXPECT_LE(paths.size(), 3u);
+      ++pages;
+      return true;
+    }).ok());
+
+  std::set<std::string> expected{
+    "/root/a", "/root/a/x", "/root/a/x/f1", "/root/a/x/f2", "/root/a/f1", "/root/a/f2",
+    "/root/a/f3", "/root/b", "/root/b/f1", "/root/b/f2", "/root/c"};
+  EXPECT_EQ(expected.size(), visited.size());
+  EXPECT_EQ(expected, std::set<std::string>(visited.begin(), visited.end()));
+  // /root/a takes two pages, the other directories one
+  EXPECT_EQ(5u, pages);
+  EXPECT_EQ(5u, nn_.calls("getListing"));
+}
+
+TEST_F(DirectoryListingTest, TestWalkStopsEarly) {
+  ConnectSerial();
+  unsigned visits = 0;
+  ASSERT_TRUE(fs_->Walk("/root", [&visits](const std::vector<FileInfo> &) {
+      ++visits;
+      return false;
+    }).ok());
+  EXPECT_EQ(1u, visits);
+  EXPECT_EQ(1u, nn_.calls("getListing"));
+
+  // Stop in the middle of the tree, at the second page of /root/a
+  std::vector<std::string> visited;
+  ASSERT_TRUE(fs_->Walk("/root", [&visited](const std::vector<FileInfo> &entries) {
+      auto paths = Paths(entries);
+      visited.insert(visited.end(), paths.begin(), paths.end());
+      return paths.front() != "/root/a/x";
+    }).ok());
+  EXPECT_EQ((std::vector<std::string>{"/root/a", "/root/b", "/root/c", "/root/a/f1",
+                                      "/root/a/f2", "/root/a/f3", "/root/a/x"}),
+            visited);
+  EXPECT_EQ(4u, nn_.calls("getListing"));
+}
+
+TEST_F(DirectoryListingTest, TestWalkSkipsDeletedDirectories) {
+  ConnectSerial();
+  // /root/b is deleted after it has been listed in /root, but before
+  // it is listed itself
+  ns_.set_listing_hook([this](const std::string &path) {
+      if (path == "/root/a") {
+        ns_.Remove("/root/b");
+      }
+    });
+  std::vector<std::string> visited;
+  ASSERT_TRUE(fs_->Walk("/root", [&visited](const std::vector<FileInfo> &entries) {
+      auto paths = Paths(entries);
+      visited.insert(visited.end(), paths.begin(), paths.end());
+      return true;
+    }).ok());
+  EXPECT_EQ(9u, visited.size());
+  EXPECT_EQ(1u, std::count(visited.begin(), visited.end(), "/root/b"));
+  EXPECT_EQ(0u, std::count(visited.begin(), visited.end(), "/root/b/f1"));
+  EXPECT_EQ(5u, nn_.calls("getListing"));
+
+  // The root of the walk itself must exist
+  ns_.Remove("/root");
+  EXPECT_TRUE(fs_->Walk("/root", [](const std::vector<FileInfo> &) {
+      return true;
+    }).is_path_not_found());
+}
+
+}
@@ -22,6 +22,8 @@
 
 #include <asio/ip/tcp.hpp>
 
+#include <chrono>
+#include <future>
 #include <limits>
 
 namespace hdfs {
@@ -36,55 +38,283 @@ FileSystem::~FileSystem()
 
 Status FileSystem::New(IoService *io_service, const char *server,
                        unsigned short port, FileSystem **fsptr) {
-  std::unique_ptr<FileSystemImpl> impl(new FileSystemImpl(io_service));
-  Status stat = impl->Connect(server, port);
+  return New(io_service, Options(), server, port, fsptr);
+}
+
+Status FileSystem::New(IoService *io_service, const Options &options,
+                       const char *server, unsigned short port,
+                       FileSystem **fsptr) {
+  return New(io_service, options, {NameNodeAddress{server, port}}, fsptr);
+}
+
+Status FileSystem::New(IoService *io_service, const Options &options,
+                       const std::vector<NameNodeAddress> &namenodes,
+                       FileSystem **fsptr) {
+  std::unique_ptr<FileSystemImpl> impl(new FileSystemImpl(io_service, options));
+  Status stat = impl->Connect(namenodes);
   if (stat.ok()) {
     *fsptr = impl.release();
   }
   return stat;
 }
 
-FileSystemImpl::FileSystemImpl(IoService *io_service)
+void FileSystem::AsyncConnect(IoService *io_service, const Options &options,
+                              const char *server, unsigned short port,
+                              const std::function<void(const Status &, FileSystem *)> &handler) {
+  AsyncConnect(io_service, options, {NameNodeAddress{server, port}}, handler);
+}
+
+void FileSystem::AsyncConnect(IoService *io_service, const Options &options,
+                              const std::vector<NameNodeAddress> &namenodes,
+                              const std::function<void(const Status &, FileSystem *)> &handler) {
+  auto impl = new FileSystemImpl(io_service, options);
+  impl->AsyncConnect(namenodes, [impl,handler](const Status &status) {
+      if (!status.ok()) {
+        delete impl;
+        handler(status, nullptr);
+        return;
+      }
+      handler(status, impl);
+    });
+}
+
+FileSystemImpl::FileSystemImpl(IoService *io_service, const Options &options)
     : io_service_(static_cast<IoServiceImpl*>(io_service))
-    , engine_(&io_service_->io_service(), RpcEngine::GetRandomClientName(),
+    , options_(options)
+    , engine_(&io_service_->NextIoService(), options,
+              RpcEngine::GetRandomClientName(),
               kNamenodeProtocol, kNamenodeProtocolVersion)
     , namenode_(&engine_)
+    , connection_pool_(options.max_idle_datanode_connections,
+                       std::chrono::milliseconds(options.datanode_idle_timeout))
+    , block_location_cache_(options.max_cached_block_locations,
+                            std::chrono::milliseconds(options.block_location_cache_ttl))
+    , short_circuit_cache_(options)
+    , data_transfer_encryption_(kEncryptionUnknown)
 {}
 
-Status FileSystemImpl::Connect(const char *server, unsigned short port) {
-  asio::error_code ec;
-  tcp::resolver resolver(io_service_->io_service());
-  tcp::resolver::query query(tcp::v4(), server, std::to_string(port));
-  tcp::resolver::iterator iterator = resolver.resolve(query, ec);
+Status FileSystemImpl::Connect(const std::vector<NameNodeAddress> &namenodes) {
+  auto stat = std::make_shared<std::promise<Status>>();
+  std::future<Status> future(stat->get_future());
+  AsyncConnect(namenodes, [stat](const Status &status) { stat->set_value(status); });
+  return future.get();
+}
 
-  if (ec) {
-    return ToStatus(ec);
+void FileSystemImpl::AsyncConnect(const std::vector<NameNodeAddress> &namenodes,
+                                  const std::function<void(const Status &)> &handler) {
+  if (namenodes.empty()) {
+    handler(Status::InvalidArgument("No NameNode address"));
+    return;
   }
 
-  Status stat = engine_.Connect(*iterator);
-  if (!stat.ok()) {
-    return stat;
-  }
-  engine_.StartReadLoop();
-  return stat;
+  // Resolve the NameNodes one after another, keeping all addresses of
+  // each, e.g., both the IPv4 and the IPv6 ones.
+  struct State {
+    std::vector<NameNodeAddress> namenodes;
+    std::vector<std::vector<tcp::endpoint>> endpoints;
+    tcp::resolver resolver;
+    std::function<void(const std::shared_ptr<State> &)> resolve_next;
+    State(::asio::io_service &io_service) : resolver(io_service) {}
+  };
+  auto state = std::make_shared<State>(io_service_->io_service());
+  state->namenodes = namenodes;
+  state->resolve_next = [this,handler](const std::shared_ptr<State> &s) {
+    if (s->endpoints.size() == s->namenodes.size()) {
+      engine_.AsyncConnect(s->endpoints, handler);
+      return;
+    }
+
+    const NameNodeAddress &nn = s->namenodes[s->endpoints.size()];
+    tcp::resolver::query query(nn.host, std::to_string(nn.port));
+    s->resolver.async_resolve(query, [s,handler](const asio::error_code &ec,
+                                                 tcp::resolver::iterator iterator) {
+        if (ec) {
+          handler(ToStatus(ec));
+          return;
+        }
+        s->endpoints.emplace_back(iterator, tcp::resolver::iterator());
+        s->resolve_next(s);
+      });
+  };
+  state->resolve_next(state);
 }
 
 Status FileSystemImpl::Open(const char *path, InputStream **isptr) {
   using ::hadoop::hdfs::GetBlockLocationsRequestProto;
   using ::hadoop::hdfs::GetBlockLocationsResponseProto;
 
-  GetBlockLocationsRequestProto req;
-  auto resp = std::make_shared<GetBlockLocationsResponseProto>();
-  req.set_src(path);
-  req.set_offset(0);
-  req.set_length(std::numeric_limits<long long>::max());
-  Status stat = namenode_.GetBlockLocations(&req, resp);
-  if (!stat.ok()) {
-    return stat;
+  auto locations = block_location_cache_.Get(path);
+  if (!locations) {
+    GetBlockLocationsRequestProto req;
+    auto resp = CreateArenaMessage<GetBlockLocationsResponseProto>();
+    PrepareBlockLocationsRequest(path, 0, &req);
+    Status stat = namenode_.GetBlockLocations(&req, resp);
+    if (!stat.ok()) {
+      return stat;
+    }
+
+    locations = AddBlockLocations(path, resp->locations());
   }
 
-  *isptr = new InputStreamImpl(this, &resp->locations());
+  *isptr = new InputStreamImpl(this, path, locations);
   return Status::OK();
 }
 
+void FileSystemImpl::AsyncOpen(const char *path,
+                               const std::function<void(const Status &, InputStream *)> &handler) {
+  using ::hadoop::hdfs::GetBlockLocationsRequestProto;
+  using ::hadoop::hdfs::GetBlockLocationsResponseProto;
+
+  std::string p(path);
+  auto locations = block_location_cache_.Get(p);
+  if (locations) {
+    io_service_->io_service().post([this,p,locations,handler]() {
+        handler(Status::OK(), new InputStreamImpl(this, p, locations));
+      });
+    return;
+  }
+
+  GetBlockLocationsRequestProto req;
+  auto resp = CreateArenaMessage<GetBlockLocationsResponseProto>();
+  PrepareBlockLocationsRequest(p, 0, &req);
+  namenode_.AsyncGetBlockLocations(&req, resp, [this,p,resp,handler](const Status &status) {
+      // Leave the RPC read loop before calling back into the user
+      // code, so that it does not delay the other responses.
+      io_service_->io_service().post([this,p,resp,status,handler]() {
+          if (!status.ok()) {
+            handler(status, nullptr);
+            return;
+          }
+          auto locations = AddBlockLocations(p, resp->locations());
+          handler(status, new InputStreamImpl(this, p, locations));
+        });
+    });
+}
+
+std::shared_ptr<FileBlockLocations> FileSystemImpl::AddBlockLocations(
+    const std::string &path, const ::hadoop::hdfs::LocatedBlocksProto &locations) {
+  auto res = std::make_shared<FileBlockLocations>(locations);
+  if (!res->under_construction()) {
+    block_location_cache_.Put(path, res);
+  }
+  return res;
+}
+
+void FileSystemImpl::AsyncFetchBlockLocations(
+    const std::string &path, uint64_t offset,
+    const std::shared_ptr<FileBlockLocations> &locations,
+    const std::function<void(const Status &)> &handler) {
+  using ::hadoop::hdfs::GetBlockLocationsRequestProto;
+  using ::hadoop::hdfs::GetBlockLocationsResponseProto;
+
+  GetBlockLocationsRequestProto req;
+  auto resp = CreateArenaMessage<GetBlockLocationsResponseProto>();
+  PrepareBlockLocationsRequest(path, offset, &req);
+  namenode_.AsyncGetBlockLocations(&req, resp, [this,path,locations,resp,handler](const Status &status) {
+      Status stat = status;
+      if (stat.ok()) {
+        stat = locations->Merge(resp->locations());
+      }
+      if (!stat.ok()) {
+        block_location_cache_.Invalidate(path);
+      }
+      // Do not run the read on the RPC read loop, so that it does not
+      // delay the other responses.
+      io_service_->io_service().post([stat,handler]() { handler(stat); });
+    });
+}
+
+void FileSystemImpl::PrepareBlockLocationsRequest(
+    const std::string &path, uint64_t offset,
+    ::hadoop::hdfs::GetBlockLocationsRequestProto *req) const {
+  uint64_t length = options_.block_location_fetch_size;
+  if (!length) {
+    length = std::numeric_limits<long long>::max();
+  }
+  req->set_src(path);
+  req->set_offset(offset);
+  req->set_length(length);
+}
+
+void FileSystemImpl::AsyncGetDataEncryptionKey(
+    const std::function<void(const Status &, const DataEncryptionKeyPtr &)> &handler) {
+  using ::hadoop::hdfs::GetServerDefaultsRequestProto;
+  using ::hadoop::hdfs::GetServerDefaultsResponseProto;
+  using namespace std::chrono;
+
+  DataTransferEncryption encryption;
+  DataEncryptionKeyPtr key;
+  {
+    std::lock_guard<std::mutex> lock(encryption_key_lock_);
+    encryption = data_transfer_encryption_;
+    key = encryption_key_;
+  }
+
+  // The expiry date is in milliseconds since the epoch
+  uint64_t now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+  if (encryption == kEncryptionDisabled) {
+    handler(Status::OK(), nullptr);
+    return;
+  } else if (key && key->expirydate() > now) {
+    handler(Status::OK(), key);
+    return;
+  } else if (encryption == kEncryptionEnabled) {
+    FetchDataEncryptionKey(handler);
+    return;
+  }
+
+  GetServerDefaultsRequestProto req;
+  auto resp = std::make_shared<GetServerDefaultsResponseProto>();
+  namenode_.AsyncGetServerDefaults(&req, resp, [this,resp,handler](const Status &status) {
+      if (!status.ok()) {
+        // Fall back to a plain handshake, which a DataNode that requires
+        // encryption rejects. An exception is the answer of the
+        // NameNode, e.g., of one that does not know the method, and
+        // does not change, while the next connection asks again after
+        // any other error.
+        if (status.is_exception()) {
+          std::lock_guard<std::mutex> lock(encryption_key_lock_);
+          data_transfer_encryption_ = kEncryptionDisabled;
+        }
+        io_service_->io_service().post([handler]() { handler(Status::OK(), nullptr); });
+        return;
+      }
+
+      bool encrypt = resp->serverdefaults().encryptdatatransfer();
+      {
+        std::lock_guard<std::mutex> lock(encryption_key_lock_);
+        data_transfer_encryption_ = encrypt ? kEncryptionEnabled : kEncryptionDisabled;
+      }
+      if (!encrypt) {
+        io_service_->io_service().post([handler]() { handler(Status::OK(), nullptr); });
+        return;
+      }
+      FetchDataEncryptionKey(handler);
+    });
+}
+
+void FileSystemImpl::FetchDataEncryptionKey(
+    const std::function<void(const Status &, const DataEncryptionKeyPtr &)> &handler) {
+  using ::hadoop::hdfs::GetDataEncryptionKeyRequestProto;
+  using ::hadoop::hdfs::GetDataEncryptionKeyResponseProto;
+
+  GetDataEncryptionKeyRequestProto req;
+  auto resp = std::make_shared<GetDataEncryptionKeyResponseProto>();
+  namenode_.AsyncGetDataEncryptionKey(&req, resp, [this,resp,handler](const Status &status) {
+      DataEncryptionKeyPtr key;
+      if (status.ok() && resp->has_dataencryptionkey()) {
+        // The key shares the lifetime of the response
+        key = DataEncryptionKeyPtr(resp, &resp->dataencryptionkey());
+        std::lock_guard<std::mutex> lock(encryption_key_lock_);
+        encryption_key_ = key;
+      }
+      io_service_->io_service().post([status,key,handler]() { handler(status, key); });
+    });
+}
+
+void FileSystemImpl::InvalidateDataEncryptionKey() {
+  std::lock_guard<std::mutex> lock(encryption_key_lock_);
+  encryption_key_.reset();
+}
+
 }
@@ -18,36 +18,290 @@
 #ifndef FS_FILESYSTEM_H_
 #define FS_FILESYSTEM_H_
 
+#include "block_location_cache.h"
+#include "datanode_connection_pool.h"
+#include "short_circuit_cache.h"
 #include "namenode_protocol.h"
 #include "common/wrapper.h"
 #include "libhdfs++/hdfs.h"
 
+#include <functional>
+#include <mutex>
+
 namespace hdfs {
 
 class FileSystemImpl : public FileSystem {
  public:
-  FileSystemImpl(IoService *io_service);
-  Status Connect(const char *server, unsigned short port);
+  FileSystemImpl(IoService *io_service, const Options &options);
+  Status Connect(const std::vector<NameNodeAddress> &namenodes);
+  void AsyncConnect(const std::vector<NameNodeAddress> &namenodes,
+                    const std::function<void(const Status &)> &handler);
   virtual Status Open(const char *path, InputStream **isptr) override;
-  RpcEngine &rpc_engine() { return engine_; }
+  virtual void AsyncOpen(const char *path,
+                         const std::function<void(const Status &, InputStream *)> &handler) override;
+  virtual Status GetFileInfo(const char *path, FileInfo *info) override;
+  virtual void AsyncGetFileInfo(
+      const char *path,
+      const std::function<void(const Status &, const FileInfo &)> &handler) override;
+  virtual Status GetListing(const char *path, std::vector<FileInfo> *entries) override;
+  virtual void AsyncGetListing(
+      const char *path,
+      const std::function<void(const Status &, const std::vector<FileInfo> &)> &handler) override;
+  virtual Status OpenListing(const char *path, DirectoryListing **listing) override;
+  virtual Status Walk(const char *path,
+                      const std::function<bool(const std::vector<FileInfo> &)> &visitor) override;
+  virtual void AsyncWalk(const char *path,
+                         const std::function<bool(const std::vector<FileInfo> &)> &visitor,
+                         const std::function<void(const Status &)> &handler) override;
+  virtual Status Mkdirs(const char *path, unsigned short permissions,
+                        bool create_parent) override;
+  virtual void AsyncMkdirs(const char *path, unsigned short permissions,
+                           bool create_parent,
+                           const std::function<void(const Status &)> &handler) override;
+  virtual Status Delete(const char *path, bool recursive) override;
+  virtual void AsyncDelete(const char *path, bool recursive,
+                           const std::function<void(const Status &)> &handler) override;
+  virtual Status Rename(const char *oldpath, const char *newpath) override;
+  virtual void AsyncRename(const char *oldpath, const char *newpath,
+                           const std::function<void(const Status &)> &handler) override;
+  virtual Status SetPermission(const char *path, unsigned short permissions) override;
+  virtual void AsyncSetPermission(const char *path, unsigned short permissions,
+                                  const std::function<void(const Status &)> &handler) override;
+  virtual Status SetOwner(const char *path, const char *owner, const char *group) override;
+  virtual void AsyncSetOwner(const char *path, const char *owner, const char *group,
+                             const std::function<void(const Status &)> &handler) override;
+  virtual Status SetReplication(const char *path, unsigned replication) override;
+  virtual void AsyncSetReplication(const char *path, unsigned replication,
+                                   const std::function<void(const Status &)> &handler) override;
+  virtual Status SetTimes(const char *path, int64_t mtime, int64_t atime) override;
+  virtual void AsyncSetTimes(const char *path, int64_t mtime, int64_t atime,
+                             const std::function<void(const Status &)> &handler) override;
+  virtual Status GetContentSummary(const char *path, ContentSummary *summary) override;
+  virtual void AsyncGetContentSummary(
+      const char *path,
+      const std::function<void(const Status &, const ContentSummary &)> &handler) override;
+  virtual Status GetFsStats(FsStats *stats) override;
+  virtual void AsyncGetFsStats(
+      const std::function<void(const Status &, const FsStats &)> &handler) override;
+
+  /**
+   * A page of a directory listing. The listing continues after the
+   * name in start_after, which is empty at the end of the listing.
+   **/
+  struct ListingPage {
+    std::vector<FileInfo> entries;
+    std::string start_after;
+  };
+  /**
+   * Fetch the page of the listing of the directory that follows the
+   * name. The handler is called outside of the RPC read loop.
+   **/
+  void AsyncGetListingPage(
+      const std::string &path, const std::string &start_after,
+      const std::function<void(const Status &, const std::shared_ptr<ListingPage> &)> &handler);
+
+  HaRpcEngine &rpc_engine() { return engine_; }
+  ClientNamenodeProtocol &namenode() { return namenode_; }
+  IoServiceImpl &io_service() { return *io_service_; }
+  DataNodeConnectionPool &connection_pool() { return connection_pool_; }
+  BlockLocationCache &block_location_cache() { return block_location_cache_; }
+  ShortCircuitCache &short_circuit_cache() { return short_circuit_cache_; }
+  const Options &options() const { return options_; }
+  /**
+   * Fetch the locations of the blocks of the next range of the file
+   * starting at offset, and merge them into the locations.
+   **/
+  void AsyncFetchBlockLocations(const std::string &path, uint64_t offset,
+                                const std::shared_ptr<FileBlockLocations> &locations,
+                                const std::function<void(const Status &)> &handler);
+
+  typedef std::shared_ptr<const ::hadoop::hdfs::DataEncryptionKeyProto> DataEncryptionKeyPtr;
+  /**
+   * Get the key that encrypts the data transfer with the DataNodes, or
+   * nullptr if the cluster does not encrypt it
+   * (dfs.encrypt.data.transfer) or the NameNode cannot tell. The key
+   * is fetched from the NameNode once and shared by all streams until
+   * it expires. The handler is called outside of the RPC read loop.
+   **/
+  void AsyncGetDataEncryptionKey(
+      const std::function<void(const Status &, const DataEncryptionKeyPtr &)> &handler);
+  /**
+   * Drop the current key after a DataNode has rejected it, e.g., when
+   * the NameNode has rolled its keys.
+   **/
+  void InvalidateDataEncryptionKey();
  private:
   IoServiceImpl *io_service_;
-  RpcEngine engine_;
+  const Options options_;
+  HaRpcEngine engine_;
   ClientNamenodeProtocol namenode_;
+  DataNodeConnectionPool connection_pool_;
+  BlockLocationCache block_location_cache_;
+  ShortCircuitCache short_circuit_cache_;
+
+  /*
+   * Whether the DataNodes encrypt the data transfer, which the server
+   * defaults of the NameNode tell, and the current key if they do.
+   */
+  enum DataTransferEncryption {
+    kEncryptionUnknown,
+    kEncryptionDisabled,
+    kEncryptionEnabled,
+  };
+  std::mutex encryption_key_lock_;
+  DataTransferEncryption data_transfer_encryption_;
+  DataEncryptionKeyPtr encryption_key_;
+  void FetchDataEncryptionKey(
+      const std::function<void(const Status &, const DataEncryptionKeyPtr &)> &handler);
+
+  struct Listing;
+  void FetchListing(const std::shared_ptr<Listing> &listing,
+                    const std::string &start_after);
+  struct TreeWalk;
+  void ContinueWalk(const std::shared_ptr<TreeWalk> &walk);
+  // Call the handler of an operation outside of the RPC read loop
+  void Complete(const std::function<void(const Status &)> &handler,
+                const Status &status);
+
+  std::shared_ptr<FileBlockLocations> AddBlockLocations(
+      const std::string &path, const ::hadoop::hdfs::LocatedBlocksProto &locations);
+  void PrepareBlockLocationsRequest(
+      const std::string &path, uint64_t offset,
+      ::hadoop::hdfs::GetBlockLocationsRequestProto *req) const;
 };
 
 class InputStreamImpl : public InputStream {
  public:
-  InputStreamImpl(FileSystemImpl *fs, const ::hadoop::hdfs::LocatedBlocksProto *blocks);
+  InputStreamImpl(FileSystemImpl *fs, const std::string &path,
+                  const std::shared_ptr<FileBlockLocations> &locations);
   virtual Status PositionRead(void *buf, size_t nbyte, size_t offset, size_t *read_bytes) override;
+  virtual Status PositionRead(void *buf, size_t nbyte, size_t offset,
+                              const CacheStrategy &cache_strategy, size_t *read_bytes) override;
+  virtual Status Read(void *buf, size_t nbyte, size_t *read_bytes) override;
+  virtual Status ReadVectored(ReadRange *ranges, size_t count) override;
+  virtual Status Seek(size_t offset) override;
+  virtual size_t Tell() override;
+  virtual void SetDropBehind(DropBehindStrategy strategy) override;
+  virtual void SetReadahead(long long bytes) override;
+  /**
+   * The blocks that the read spans are read from their DataNodes
+   * concurrently, and the handler is called once all of them have
+   * finished, with the number of bytes that have been read
+   * contiguously from the offset.
+   **/
+  virtual void AsyncPositionRead(void *buf, size_t nbyte, size_t offset,
+                                 ReadHandler handler, void *context) override;
   template<class MutableBufferSequence, class Handler>
   void AsyncPreadSome(size_t offset, const MutableBufferSequence &buffers,
                       const Handler &handler);
  private:
+  struct BlockReaderConnection;
+  typedef FileBlockLocations::BlockPtr BlockPtr;
+
+  /**
+   * Find the block that contains the offset. The locations of the
+   * block are fetched from the NameNode if they are not known yet.
+   **/
+  template<class Handler>
+  void AsyncFindBlock(uint64_t offset, const Handler &handler);
+  Status FindBlock(uint64_t offset, BlockPtr *block);
+  /**
+   * Open the range [offset_within_block, offset_within_block + length)
+   * of the block for reading. A replica on a DataNode of this host is
+   * read directly from its block file if short-circuit reads are
+   * enabled, otherwise the range is requested from a DataNode.
+   **/
+  template<class Handler>
+  void AsyncConnectBlock(const BlockPtr &block,
+                         uint64_t offset_within_block, uint64_t length,
+                         const BlockReaderOptions &options, const Handler &handler);
+  /**
+   * Connect to a DataNode that holds the block, and request the range
+   * of the block. The handler is called with the connection once the
+   * DataNode has accepted the request. A rejected encryption key is
+   * replaced and retried once, unless key_retried is set.
+   **/
+  template<class Handler>
+  void AsyncConnectDataNode(const BlockPtr &block,
+                            uint64_t offset_within_block, uint64_t length,
+                            const BlockReaderOptions &options,
+                            bool use_pooled_connection, bool key_retried,
+                            const Handler &handler);
+  template<class Handler>
+  void AsyncReadBlock(const BlockPtr &block,
+                      uint64_t offset_within_block,
+                      const ::asio::mutable_buffers_1 &buffers,
+                      const BlockReaderOptions &options, const Handler &handler);
+  void ReleaseConnection(const std::shared_ptr<BlockReaderConnection> &conn);
+
+  struct HedgedRead;
+  void AsyncHedgedReadBlock(const BlockPtr &block,
+                            uint64_t offset_within_block,
+                            const ::asio::mutable_buffers_1 &buffers,
+                            const BlockReaderOptions &options,
+                            const std::function<void(const Status &, size_t)> &handler);
+  void StartHedgedLeg(const std::shared_ptr<HedgedRead> &h, int leg);
+  void OnHedgedLegFinished(const std::shared_ptr<HedgedRead> &h, int leg,
+                           const Status &status, size_t transferred,
+                           const std::shared_ptr<BlockReaderConnection> &conn);
+
+  /**
+   * The options of the block readers of a read that starts at the
+   * offset. The hints of the read override those of the stream.
+   **/
+  BlockReaderOptions ReaderOptions(uint64_t offset,
+                                   const CacheStrategy &hints = CacheStrategy());
+  // Account the bytes that have been read contiguously from the offset
+  void RecordRead(uint64_t offset, size_t length);
+
+  struct MultiBlockRead;
+  void StartPositionRead(void *buf, size_t nbyte, size_t offset,
+                         const CacheStrategy &hints,
+                         const std::function<void(const Status &, size_t)> &handler);
+  void StartBlockReads(const std::shared_ptr<MultiBlockRead> &r, size_t offset);
+  void OnBlockReadFinished(const std::shared_ptr<MultiBlockRead> &r, size_t offset,
+                           size_t length, const Status &status, size_t transferred);
+
+  struct VectoredRead;
+  void StartVectoredRead(const std::shared_ptr<VectoredRead> &r, size_t request);
+
+  Status OpenBlockStream(size_t offset);
+  Status ReadBlockStream(char *buf, size_t size, size_t *transferred);
+
   FileSystemImpl *fs_;
-  unsigned long long file_length_;
-  std::vector<::hadoop::hdfs::LocatedBlockProto> blocks_;
+  const std::string path_;
+  const std::shared_ptr<FileBlockLocations> locations_;
+  const unsigned long long file_length_;
+
+  /*
+   * States of the sequential Read(). The block stream is a block
+   * reader that streams from stream_position_ up to the end of the
+   * block at stream_end_. The read-ahead buffer holds the bytes of the
+   * stream starting at the file offset read_ahead_offset_.
+   */
+  std::mutex stream_lock_;
+  size_t position_;
+  std::shared_ptr<BlockReaderConnection> stream_;
+  uint64_t stream_position_;
+  uint64_t stream_end_;
+  std::vector<char> read_ahead_;
+  size_t read_ahead_offset_;
+  size_t read_ahead_size_;
+
+  /*
+   * The hints to the page cache of the DataNodes. The end offset of
+   * the last read and the number of bytes read contiguously up to it
+   * detect the sequential scans for kAdaptiveDropBehind.
+   */
+  std::mutex cache_lock_;
+  DropBehindStrategy drop_behind_;
+  long long read_ahead_bytes_;
+  uint64_t sequential_end_;
+  uint64_t sequential_bytes_;
+
   struct HandshakeContinuation;
+  struct DisableNagleContinuation;
+  struct DataTransferSaslContinuation;
   template<class MutableBufferSequence>
   struct ReadBlockContinuation;
 };
@@ -0,0 +1,411 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filesystem.h"
+
+#include "common/util.h"
+
+#include <future>
+#include <iterator>
+
+namespace hdfs {
+
+using namespace ::hadoop::hdfs;
+
+/**
+ * The metadata operations of FileSystemImpl. The synchronous versions
+ * wait for the asynchronous ones, whose handlers run on the IoService
+ * but outside of the RPC read loop.
+ **/
+
+static Status Wait(const std::function<void(const std::function<void(const Status &)> &)> &op) {
+  auto stat = std::make_shared<std::promise<Status>>();
+  std::future<Status> future(stat->get_future());
+  op([stat](const Status &status) { stat->set_value(status); });
+  return future.get();
+}
+
+static std::string JoinPath(const std::string &parent, const std::string &name) {
+  // The NameNode lists a file as a single entry without a name
+  if (name.empty()) {
+    return parent;
+  } else if (!parent.empty() && parent.back() == '/') {
+    return parent + name;
+  }
+  return parent + "/" + name;
+}
+
+static void ToFileInfo(const std::string &path, const HdfsFileStatusProto &fs,
+                       FileInfo *info) {
+  switch (fs.filetype()) {
+    case HdfsFileStatusProto::IS_DIR: info->type = FileInfo::kDirectory; break;
+    case HdfsFileStatusProto::IS_SYMLINK: info->type = FileInfo::kSymlink; break;
+    default: info->type = FileInfo::kFile; break;
+  }
+  info->path = path;
+  info->length = fs.length();
+  info->permissions = fs.permission().perm();
+  info->owner = fs.owner();
+  info->group = fs.group();
+  info->modification_time = fs.modification_time();
+  info->access_time = fs.access_time();
+  info->symlink = fs.symlink();
+  info->replication = fs.block_replication();
+  info->block_size = fs.blocksize();
+  info->file_id = fs.fileid();
+}
+
+void FileSystemImpl::Complete(const std::function<void(const Status &)> &handler,
+                              const Status &status) {
+  io_service_->io_service().post([handler,status]() { handler(status); });
+}
+
+Status FileSystemImpl::GetFileInfo(const char *path, FileInfo *info) {
+  return Wait([this,path,info](const std::function<void(const Status &)> &h) {
+      AsyncGetFileInfo(path, [info,h](const Status &status, const FileInfo &result) {
+          *info = result;
+          h(status);
+        });
+    });
+}
+
+void FileSystemImpl::AsyncGetFileInfo(
+    const char *path,
+    const std::function<void(const Status &, const FileInfo &)> &handler) {
+  GetFileInfoRequestProto req;
+  req.set_src(path);
+  auto resp = std::make_shared<GetFileInfoResponseProto>();
+  std::string p(path);
+  namenode_.AsyncGetFileInfo(&req, resp, [this,p,resp,handler](const Status &status) {
+      io_service_->io_service().post([p,resp,status,handler]() {
+          FileInfo info = FileInfo();
+          if (status.ok() && !resp->has_fs()) {
+            handler(Status::PathNotFound(p.c_str()), info);
+            return;
+          } else if (status.ok()) {
+            ToFileInfo(p, resp->fs(), &info);
+          }
+          handler(status, info);
+        });
+    });
+}
+
+struct FileSystemImpl::Listing {
+  std::string path;
+  std::vector<FileInfo> entries;
+  std::function<void(const Status &, const std::vector<FileInfo> &)> handler;
+};
+
+Status FileSystemImpl::GetListing(const char *path, std::vector<FileInfo> *entries) {
+  return Wait([this,path,entries](const std::function<void(const Status &)> &h) {
+      AsyncGetListing(path, [entries,h](const Status &status,
+                                        const std::vector<FileInfo> &result) {
+          *entries = result;
+          h(status);
+        });
+    });
+}
+
+void FileSystemImpl::AsyncGetListing(
+    const char *path,
+    const std::function<void(const Status &, const std::vector<FileInfo> &)> &handler) {
+  auto listing = std::make_shared<Listing>();
+  listing->path = path;
+  listing->handler = handler;
+  FetchListing(listing, "");
+}
+
+void FileSystemImpl::FetchListing(const std::shared_ptr<Listing> &l,
+                                  const std::string &start_after) {
+  AsyncGetListingPage(l->path, start_after, [this,l](const Status &status,
+                                                     const std::shared_ptr<ListingPage> &page) {
+      if (!status.ok()) {
+        l->handler(status, l->entries);
+        return;
+      }
+      if (l->entries.empty()) {
+        l->entries.swap(page->entries);
+      } else {
+        std::move(page->entries.begin(), page->entries.end(),
+                  std::back_inserter(l->entries));
+      }
+      if (!page->start_after.empty()) {
+        FetchListing(l, page->start_after);
+        return;
+      }
+      l->handler(status, l->entries);
+    });
+}
+
+void FileSystemImpl::AsyncGetListingPage(
+    const std::string &path, const std::string &start_after,
+    const std::function<void(const Status &, const std::shared_ptr<ListingPage> &)> &handler) {
+  GetListingRequestProto req;
+  req.set_src(path);
+  req.set_startafter(start_after);
+  req.set_needlocation(false);
+  auto resp = CreateArenaMessage<GetListingResponseProto>();
+  namenode_.AsyncGetListing(&req, resp, [this,path,resp,handler](const Status &status) {
+      io_service_->io_service().post([path,resp,status,handler]() {
+          auto page = std::make_shared<ListingPage>();
+          if (status.ok() && !resp->has_dirlist()) {
+            handler(Status::PathNotFound(path.c_str()), page);
+            return;
+          } else if (!status.ok()) {
+            handler(status, page);
+            return;
+          }
+
+          // The NameNode returns a limited number of entries per call
+          // (dfs.ls.limit), and the listing continues after the last one.
+          const auto &partial = resp->dirlist().partiallisting();
+          page->entries.resize(partial.size());
+          for (int i = 0; i < partial.size(); ++i) {
+            ToFileInfo(JoinPath(path, partial.Get(i).path()), partial.Get(i),
+                       &page->entries[i]);
+          }
+          if (resp->dirlist().remainingentries() && partial.size()) {
+            page->start_after = partial.Get(partial.size() - 1).path();
+          }
+          handler(status, page);
+        });
+    });
+}
+
+Status FileSystemImpl::Mkdirs(const char *path, unsigned short permissions,
+                              bool create_parent) {
+  return Wait([=](const std::function<void(const Status &)> &h) {
+      AsyncMkdirs(path, permissions, create_parent, h);
+    });
+}
+
+void FileSystemImpl::AsyncMkdirs(const char *path, unsigned short permissions,
+                                 bool create_parent,
+                                 const std::function<void(const Status &)> &handler) {
+  MkdirsRequestProto req;
+  req.set_src(path);
+  req.mutable_masked()->set_perm(permissions);
+  req.set_createparent(create_parent);
+  auto resp = std::make_shared<MkdirsResponseProto>();
+  std::string p(path);
+  namenode_.AsyncMkdirs(&req, resp, [this,p,resp,handler](const Status &status) {
+      if (status.ok() && !resp->result()) {
+        Complete(handler, Status::Error(("Cannot create directory " + p).c_str()));
+        return;
+      }
+      Complete(handler, status);
+    });
+}
+
+Status FileSystemImpl::Delete(const char *path, bool recursive) {
+  return Wait([=](const std::function<void(const Status &)> &h) {
+      AsyncDelete(path, recursive, h);
+    });
+}
+
+void FileSystemImpl::AsyncDelete(const char *path, bool recursive,
+                                 const std::function<void(const Status &)> &handler) {
+  DeleteRequestProto req;
+  req.set_src(path);
+  req.set_recursive(recursive);
+  auto resp = std::make_shared<DeleteResponseProto>();
+  std::string p(path);
+  namenode_.AsyncDelete(&req, resp, [this,p,resp,handler](const Status &status) {
+      // Invalidate once the NameNode has executed the call, so that a
+      // concurrent open does not cache the locations again. A failed
+      // call might have been executed as well.
+      block_location_cache_.InvalidateTree(p);
+      if (status.ok() && !resp->result()) {
+        Complete(handler, Status::PathNotFound(p.c_str()));
+        return;
+      }
+      Complete(handler, status);
+    });
+}
+
+Status FileSystemImpl::Rename(const char *oldpath, const char *newpath) {
+  return Wait([=](const std::function<void(const Status &)> &h) {
+      AsyncRename(oldpath, newpath, h);
+    });
+}
+
+void FileSystemImpl::AsyncRename(const char *oldpath, const char *newpath,
+                                 const std::function<void(const Status &)> &handler) {
+  RenameRequestProto req;
+  req.set_src(oldpath);
+  req.set_dst(newpath);
+  auto resp = std::make_shared<RenameResponseProto>();
+  std::string p(oldpath), dst(newpath);
+  namenode_.AsyncRename(&req, resp, [this,p,dst,resp,handler](const Status &status) {
+      // The destination might have been a file that is now replaced,
+      // or a directory that now holds the source
+      block_location_cache_.InvalidateTree(p);
+      block_location_cache_.InvalidateTree(dst);
+      if (status.ok() && !resp->result()) {
+        Complete(handler, Status::Error(("Cannot rename " + p).c_str()));
+        return;
+      }
+      Complete(handler, status);
+    });
+}
+
+Status FileSystemImpl::SetPermission(const char *path, unsigned short permissions) {
+  return Wait([=](const std::function<void(const Status &)> &h) {
+      AsyncSetPermission(path, permissions, h);
+    });
+}
+
+void FileSystemImpl::AsyncSetPermission(const char *path, unsigned short permissions,
+                                        const std::function<void(const Status &)> &handler) {
+  SetPermissionRequestProto req;
+  req.set_src(path);
+  req.mutable_permission()->set_perm(permissions);
+  auto resp = std::make_shared<SetPermissionResponseProto>();
+  namenode_.AsyncSetPermission(&req, resp, [this,resp,handler](const Status &status) {
+      Complete(handler, status);
+    });
+}
+
+Status FileSystemImpl::SetOwner(const char *path, const char *owner, const char *group) {
+  return Wait([=](const std::function<void(const Status &)> &h) {
+      AsyncSetOwner(path, owner, group, h);
+    });
+}
+
+void FileSystemImpl::AsyncSetOwner(const char *path, const char *owner, const char *group,
+                                   const std::function<void(const Status &)> &handler) {
+  SetOwnerRequestProto req;
+  req.set_src(path);
+  if (owner && *owner) {
+    req.set_username(owner);
+  }
+  if (group && *group) {
+    req.set_groupname(group);
+  }
+  auto resp = std::make_shared<SetOwnerResponseProto>();
+  namenode_.AsyncSetOwner(&req, resp, [this,resp,handler](const Status &status) {
+      Complete(handler, status);
+    });
+}
+
+Status FileSystemImpl::SetReplication(const char *path, unsigned replication) {
+  return Wait([=](const std::function<void(const Status &)> &h) {
+      AsyncSetReplication(path, replication, h);
+    });
+}
+
+void FileSystemImpl::AsyncSetReplication(const char *path, unsigned replication,
+                                         const std::function<void(const Status &)> &handler) {
+  SetReplicationRequestProto req;
+  req.set_src(path);
+  req.set_replication(replication);
+  auto resp = std::make_shared<SetReplicationResponseProto>();
+  std::string p(path);
+  namenode_.AsyncSetReplication(&req, resp, [this,p,resp,handler](const Status &status) {
+      // The NameNode refuses to set the replication of a directory
+      if (status.ok() && !resp->result()) {
+        Complete(handler, Status::Error(("Cannot set the replication of " + p).c_str()));
+        return;
+      }
+      Complete(handler, status);
+    });
+}
+
+Status FileSystemImpl::SetTimes(const char *path, int64_t mtime, int64_t atime) {
+  return Wait([=](const std::function<void(const Status &)> &h) {
+      AsyncSetTimes(path, mtime, atime, h);
+    });
+}
+
+void FileSystemImpl::AsyncSetTimes(const char *path, int64_t mtime, int64_t atime,
+                                   const std::function<void(const Status &)> &handler) {
+  SetTimesRequestProto req;
+  req.set_src(path);
+  // The NameNode reads the fields as signed longs, where -1 means
+  // unchanged
+  req.set_mtime(static_cast<uint64_t>(mtime));
+  req.set_atime(static_cast<uint64_t>(atime));
+  auto resp = std::make_shared<SetTimesResponseProto>();
+  namenode_.AsyncSetTimes(&req, resp, [this,resp,handler](const Status &status) {
+      Complete(handler, status);
+    });
+}
+
+Status FileSystemImpl::GetContentSummary(const char *path, ContentSummary *summary) {
+  return Wait([this,path,summary](const std::function<void(const Status &)> &h) {
+      AsyncGetContentSummary(path, [summary,h](const Status &status,
+                                               const ContentSummary &result) {
+          *summary = result;
+          h(status);
+        });
+    });
+}
+
+void FileSystemImpl::AsyncGetContentSummary(
+    const char *path,
+    const std::function<void(const Status &, const ContentSummary &)> &handler) {
+  GetContentSummaryRequestProto req;
+  req.set_path(path);
+  auto resp = std::make_shared<GetContentSummaryResponseProto>();
+  namenode_.AsyncGetContentSummary(&req, resp, [this,resp,handler](const Status &status) {
+      ContentSummary summary = ContentSummary();
+      if (status.ok()) {
+        const ContentSummaryProto &s = resp->summary();
+        summary.length = s.length();
+        summary.file_count = s.filecount();
+        summary.directory_count = s.directorycount();
+        summary.quota = s.quota();
+        summary.space_consumed = s.spaceconsumed();
+        summary.space_quota = s.spacequota();
+      }
+      io_service_->io_service().post([summary,status,handler]() {
+          handler(status, summary);
+        });
+    });
+}
+
+Status FileSystemImpl::GetFsStats(FsStats *stats) {
+  return Wait([this,stats](const std::function<void(const Status &)> &h) {
+      AsyncGetFsStats([stats,h](const Status &status, const FsStats &result) {
+          *stats = result;
+          h(status);
+        });
+    });
+}
+
+void FileSystemImpl::AsyncGetFsStats(
+    const std::function<void(const Status &, const FsStats &)> &handler) {
+  GetFsStatusRequestProto req;
+  auto resp = std::make_shared<GetFsStatsResponseProto>();
+  namenode_.AsyncGetFsStats(&req, resp, [this,resp,handler](const Status &status) {
+      FsStats stats = FsStats();
+      if (status.ok()) {
+        stats.capacity = resp->capacity();
+        stats.used = resp->used();
+        stats.remaining = resp->remaining();
+        stats.under_replicated_blocks = resp->under_replicated();
+        stats.corrupt_blocks = resp->corrupt_blocks();
+        stats.missing_blocks = resp->missing_blocks();
+      }
+      io_service_->io_service().post([stats,status,handler]() {
+          handler(status, stats);
+        });
+    });
+}
+
+}
@@ -0,0 +1,178 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "filesystem.h"
+#include "mock_namespace.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace hdfs {
+
+static const char kAccessControlException[] = "org.apache.hadoop.security.AccessControlException";
+
+/*
+ * The metadata operations of a FileSystemImpl against a mock NameNode,
+ * which lists 10 entries per page.
+ */
+class FileSystemMetadataTest : public ::testing::Test {
+ protected:
+  MockNameNode nn_;
+  MockNamespace ns_;
+  std::unique_ptr<IoService> io_service_;
+  std::thread worker_;
+  std::unique_ptr<FileSystemImpl> fs_;
+
+  FileSystemMetadataTest()
+      : ns_(&nn_, 10)
+      , io_service_(IoService::New(IoServiceOptions()))
+      , worker_(std::bind(&IoService::Run, io_service_.get()))
+  {
+    fs_.reset(new FileSystemImpl(io_service_.get(), Options()));
+    auto endpoint = nn_.endpoint();
+    EXPECT_TRUE(fs_->Connect({NameNodeAddress{endpoint.address().to_string(),
+                                              endpoint.port()}}).ok());
+  }
+
+  ~FileSystemMetadataTest() {
+    fs_->rpc_engine().Shutdown();
+    io_service_->Stop();
+    worker_.join();
+  }
+};
+
+TEST_F(FileSystemMetadataTest, TestGetFileInfo) {
+  ns_.AddFile("/dir/file", 12345);
+
+  FileInfo info;
+  ASSERT_TRUE(fs_->GetFileInfo("/dir/file", &info).ok());
+  EXPECT_EQ(FileInfo::kFile, info.type);
+  EXPECT_EQ("/dir/file", info.path);
+  EXPECT_EQ(12345u, info.length);
+  EXPECT_EQ(0644, info.permissions);
+  EXPECT_EQ("hdfs", info.owner);
+  EXPECT_EQ("supergroup", info.group);
+  EXPECT_EQ(3u, info.replication);
+
+  ASSERT_TRUE(fs_->GetFileInfo("/dir", &info).ok());
+  EXPECT_EQ(FileInfo::kDirectory, info.type);
+  EXPECT_EQ(0755, info.permissions);
+
+  // The NameNode answers without a status for a missing path
+  Status stat = fs_->GetFileInfo("/missing", &info);
+  EXPECT_TRUE(stat.is_path_not_found());
+  EXPECT_EQ(Status::PathNotFound("").code(), stat.code());
+}
+
+TEST_F(FileSystemMetadataTest, TestGetListingInPages) {
+  for (int i = 0; i < 25; ++i) {
+    ns_.AddFile("/dir/file" + std::to_string(100 + i), i);
+  }
+  ns_.AddDirectory("/dir/sub");
+
+  std::vector<FileInfo> entries;
+  ASSERT_TRUE(fs_->GetListing("/dir", &entries).ok());
+  ASSERT_EQ(26u, entries.size());
+  for (int i = 0; i < 25; ++i) {
+    EXPECT_EQ("/dir/file" + std::to_string(100 + i), entries[i].path);
+    EXPECT_EQ(FileInfo::kFile, entries[i].type);
+    EXPECT_EQ(static_cast<uint64_t>(i), entries[i].length);
+  }
+  EXPECT_EQ("/dir/sub", entries[25].path);
+  EXPECT_EQ(FileInfo::kDirectory, entries[25].type);
+  EXPECT_EQ(3u, nn_.calls("getListing"));
+
+  // A file is listed as itself
+  ASSERT_TRUE(fs_->GetListing("/dir/file100", &entries).ok());
+  ASSERT_EQ(1u, entries.size());
+  EXPECT_EQ("/dir/file100", entries[0].path);
+
+  ASSERT_TRUE(fs_->GetListing("/dir/sub", &entries).ok());
+  EXPECT_TRUE(entries.empty());
+  EXPECT_TRUE(fs_->GetListing("/missing", &entries).is_path_not_found());
+}
+
+TEST_F(FileSystemMetadataTest, TestMkdirs) {
+  ASSERT_TRUE(fs_->Mkdirs("/a/b/c", 0755, true).ok());
+  EXPECT_TRUE(ns_.IsDirectory("/a/b/c"));
+  // An existing directory is fine
+  ASSERT_TRUE(fs_->Mkdirs("/a/b", 0755, false).ok());
+
+  Status stat = fs_->Mkdirs("/x/y", 0755, false);
+  EXPECT_TRUE(stat.is_exception());
+  EXPECT_EQ("java.io.FileNotFoundException", stat.exception_class());
+  EXPECT_FALSE(ns_.Exists("/x"));
+
+  ns_.AddFile("/file", 1);
+  stat = fs_->Mkdirs("/file", 0755, true);
+  EXPECT_EQ("org.apache.hadoop.fs.FileAlreadyExistsException", stat.exception_class());
+}
+
+TEST_F(FileSystemMetadataTest, TestDelete) {
+  ns_.AddFile("/dir/file", 1);
+  ns_.AddFile("/dir/sub/file", 1);
+
+  Status stat = fs_->Delete("/dir", false);
+  EXPECT_EQ("org.apache.hadoop.fs.PathIsNotEmptyDirectoryException", stat.exception_class());
+  ASSERT_TRUE(fs_->Delete("/dir/file", false).ok());
+  EXPECT_FALSE(ns_.Exists("/dir/file"));
+  ASSERT_TRUE(fs_->Delete("/dir", true).ok());
+  EXPECT_FALSE(ns_.Exists("/dir/sub/file"));
+
+  // The NameNode returns false for a missing path
+  EXPECT_TRUE(fs_->Delete("/dir", true).is_path_not_found());
+}
+
+TEST_F(FileSystemMetadataTest, TestRename) {
+  ns_.AddFile("/src/file", 1);
+  ns_.AddDirectory("/dst");
+
+  ASSERT_TRUE(fs_->Rename("/src/file", "/src/renamed").ok());
+  EXPECT_TRUE(ns_.Exists("/src/renamed"));
+  EXPECT_FALSE(ns_.Exists("/src/file"));
+
+  // Into an existing directory
+  ASSERT_TRUE(fs_->Rename("/src", "/dst").ok());
+  EXPECT_TRUE(ns_.Exists("/dst/src/renamed"));
+
+  // The NameNode returns false for a missing source or destination
+  // parent, which fail the call without an exception
+  Status stat = fs_->Rename("/missing", "/other");
+  EXPECT_FALSE(stat.ok());
+  EXPECT_FALSE(stat.is_exception());
+  stat = fs_->Rename("/dst/src", "/missing/dir");
+  EXPECT_FALSE(stat.ok());
+  EXPECT_TRUE(ns_.Exists("/dst/src/renamed"));
+}
+
+TEST_F(FileSystemMetadataTest, TestAccessControlException) {
+  ns_.AddDirectory("/private");
+  ns_.SetException("/private", kAccessControlException);
+
+  FileInfo info;
+  Status stat = fs_->GetFileInfo("/private", &info);
+  ASSERT_TRUE(stat.is_exception());
+  EXPECT_EQ(kAccessControlException, stat.exception_class());
+
+  std::vector<FileInfo> entries;
+  EXPECT_EQ(kAccessControlException, fs_->GetListing("/private", &entries).exception_class());
+  EXPECT_EQ(kAccessControlException, fs_->Delete("/private", true).exception_class());
+  EXPECT_TRUE(ns_.Exists("/private"));
+}
+
+}
@@ -18,27 +18,39 @@
 
 #include "filesystem.h"
 
-namespace hdfs {
+#include <asio/deadline_timer.hpp>
+
+#include <algorithm>
+#include <cstring>
 
-using ::hadoop::hdfs::LocatedBlocksProto;
+namespace hdfs {
 
 InputStream::~InputStream()
 {}
 
-InputStreamImpl::InputStreamImpl(FileSystemImpl *fs, const LocatedBlocksProto *blocks)
+InputStreamImpl::InputStreamImpl(FileSystemImpl *fs, const std::string &path,
+                                 const std::shared_ptr<FileBlockLocations> &locations)
     : fs_(fs)
-    , file_length_(blocks->filelength())
-{
-  for (const auto &block : blocks->blocks()) {
-    blocks_.push_back(block);
-  }
+    , path_(path)
+    , locations_(locations)
+    , file_length_(locations->file_length())
+    , position_(0)
+    , stream_position_(0)
+    , stream_end_(0)
+    , read_ahead_offset_(0)
+    , read_ahead_size_(0)
+    , drop_behind_(fs->options().drop_behind)
+    , read_ahead_bytes_(-1)
+    , sequential_end_(0)
+    , sequential_bytes_(0)
+{}
 
-  if (blocks->has_lastblock() && blocks->lastblock().b().numbytes()) {
-    blocks_.push_back(blocks->lastblock());
-  }
+Status InputStreamImpl::PositionRead(void *buf, size_t nbyte, size_t offset, size_t *read_bytes) {
+  return PositionRead(buf, nbyte, offset, CacheStrategy(), read_bytes);
 }
 
-Status InputStreamImpl::PositionRead(void *buf, size_t nbyte, size_t offset, size_t *read_bytes) {
+Status InputStreamImpl::PositionRead(void *buf, size_t nbyte, size_t offset,
+                                     const CacheStrategy &cache_strategy, size_t *read_bytes) {
   auto stat = std::make_shared<std::promise<Status>>();
   std::future<Status> future(stat->get_future());
   auto handler = [stat,read_bytes](const Status &status, size_t transferred) {
@@ -46,8 +58,736 @@ Status InputStreamImpl::PositionRead(void *buf, size_t nbyte, size_t offset, siz
     stat->set_value(status);
   };
 
-  AsyncPreadSome(offset, asio::buffer(buf, nbyte), handler);
+  StartPositionRead(buf, nbyte, offset, cache_strategy, handler);
+  return future.get();
+}
+
+/*
+ * The state of a PositionRead() that spans multiple blocks. Each
+ * block is read by its own sub-read, and the last sub-read to finish
+ * calls the handler. The pending count includes the loop that starts
+ * the sub-reads, so that the handler cannot be called before all of
+ * them have been started.
+ *
+ * All fields are guarded by lock.
+ */
+struct InputStreamImpl::MultiBlockRead {
+  struct Part {
+    size_t offset;
+    size_t length;
+    Status status;
+    size_t transferred;
+  };
+
+  MultiBlockRead(size_t offset, const ::asio::mutable_buffers_1 &buffers,
+                 const BlockReaderOptions &options,
+                 const std::function<void(const Status &, size_t)> &handler)
+      : offset(offset)
+      , buffers(buffers)
+      , options(options)
+      , pending(1)
+      , handler(handler)
+  {}
+
+  std::mutex lock;
+  const size_t offset;
+  const ::asio::mutable_buffers_1 buffers;
+  // The blocks after the first continue the read, thus they share the
+  // cache strategy of the whole read.
+  const BlockReaderOptions options;
+  std::vector<Part> parts;
+  size_t pending;
+  std::function<void(const Status &, size_t)> handler;
+};
+
+void InputStreamImpl::AsyncPositionRead(void *buf, size_t nbyte, size_t offset,
+                                        ReadHandler handler, void *context) {
+  StartPositionRead(buf, nbyte, offset, CacheStrategy(),
+                    [handler,context](const Status &status, size_t read_bytes) {
+                      handler(status, read_bytes, context);
+                    });
+}
+
+void InputStreamImpl::StartPositionRead(
+    void *buf, size_t nbyte, size_t offset, const CacheStrategy &hints,
+    const std::function<void(const Status &, size_t)> &handler) {
+  if (offset >= file_length_) {
+    fs_->io_service().io_service().post([handler]() {
+        handler(Status::InvalidArgument("Cannot find corresponding blocks"), 0);
+      });
+    return;
+  }
+
+  size_t size = std::min<uint64_t>(nbyte, file_length_ - offset);
+  auto r = std::make_shared<MultiBlockRead>(offset, asio::buffer(buf, size),
+                                            ReaderOptions(offset, hints), handler);
+  StartBlockReads(r, offset);
+}
+
+void InputStreamImpl::StartBlockReads(const std::shared_ptr<MultiBlockRead> &r, size_t offset) {
+  size_t end = r->offset + asio::buffer_size(r->buffers);
+  while (offset < end) {
+    auto block = locations_->FindBlock(offset);
+    if (!block) {
+      // Continue once the locations of the block have been fetched
+      AsyncFindBlock(offset, [this,r,offset,end](const Status &status, const BlockPtr &) {
+          if (status.ok()) {
+            StartBlockReads(r, offset);
+          } else {
+            OnBlockReadFinished(r, offset, end - offset, status, 0);
+          }
+        });
+      return;
+    }
+
+    size_t length = std::min<uint64_t>(end, block->offset() + block->length()) - offset;
+    {
+      std::lock_guard<std::mutex> lock(r->lock);
+      ++r->pending;
+    }
+    if (block->endpoints.empty()) {
+      OnBlockReadFinished(r, offset, length,
+                          Status::ResourceUnavailable("No datanodes available"), 0);
+    } else {
+      auto buffers = asio::buffer(r->buffers + (offset - r->offset), length);
+      AsyncReadBlock(block, offset - block->offset(), buffers, r->options,
+                     [this,r,offset,length](const Status &status, size_t transferred) {
+          OnBlockReadFinished(r, offset, length, status, transferred);
+        });
+    }
+    offset += length;
+  }
+
+  // Release the reference of the loop
+  OnBlockReadFinished(r, end, 0, Status::OK(), 0);
+}
+
+void InputStreamImpl::OnBlockReadFinished(
+    const std::shared_ptr<MultiBlockRead> &r, size_t offset, size_t length,
+    const Status &status, size_t transferred) {
+  std::unique_lock<std::mutex> lock(r->lock);
+  if (length) {
+    r->parts.push_back(MultiBlockRead::Part{offset, length, status, transferred});
+  }
+  if (--r->pending) {
+    return;
+  }
+  lock.unlock();
+
+  if (std::any_of(r->parts.begin(), r->parts.end(),
+                  [](const MultiBlockRead::Part &p) { return !p.status.ok(); })) {
+    // The replicas might have moved. Let the next open of the file
+    // fetch the latest locations.
+    fs_->block_location_cache().Invalidate(path_);
+  }
+
+  // Report the bytes up to the first part that has failed or come
+  // up short. The data of a failed part cannot be trusted.
+  std::sort(r->parts.begin(), r->parts.end(),
+            [](const MultiBlockRead::Part &a, const MultiBlockRead::Part &b) {
+              return a.offset < b.offset;
+            });
+  Status stat;
+  size_t total = 0;
+  for (const auto &part : r->parts) {
+    if (!part.status.ok()) {
+      stat = part.status;
+      break;
+    }
+    total += part.transferred;
+    if (part.transferred < part.length) {
+      break;
+    }
+  }
+  RecordRead(r->offset, total);
+  r->handler(stat, total);
+}
+
+/*
+ * The state of a ReadVectored(). The ranges are split at the block
+ * boundaries into pieces, and the pieces of a block that are close to
+ * each other are merged into one request. The buffers of a request
+ * scatter the data of the block into the pieces and the bytes in
+ * between them into the scratch space.
+ *
+ * The requests are set up before they start, after which only the
+ * fields guarded by lock change.
+ */
+struct InputStreamImpl::VectoredRead {
+  struct Piece {
+    BlockPtr block;
+    uint64_t offset_within_block;
+    size_t length;
+    char *buffer;
+    ReadRange *range;
+  };
+
+  struct Request {
+    BlockPtr block;
+    uint64_t offset_within_block;
+    uint64_t length;
+    std::vector<Piece> pieces;
+    std::vector<::asio::mutable_buffer> buffers;
+    std::vector<char> scratch;
+  };
+
+  std::vector<Request> requests;
+
+  std::mutex lock;
+  size_t pending;
+  Status status;
+  std::promise<void> done;
+};
+
+Status InputStreamImpl::ReadVectored(ReadRange *ranges, size_t count) {
+  typedef VectoredRead::Piece Piece;
+  typedef VectoredRead::Request Request;
+  auto r = std::make_shared<VectoredRead>();
+  Status stat;
+
+  std::vector<Piece> pieces;
+  for (size_t i = 0; i < count; ++i) {
+    auto range = &ranges[i];
+    range->read_bytes = 0;
+    if (!range->length) {
+      continue;
+    } else if (range->offset >= file_length_) {
+      stat = Status::InvalidArgument("Cannot find corresponding blocks");
+      continue;
+    }
+
+    size_t end = std::min<uint64_t>(range->offset + range->length, file_length_);
+    for (size_t offset = range->offset; offset < end;) {
+      BlockPtr block;
+      Status found = FindBlock(offset, &block);
+      if (!found.ok()) {
+        stat = found;
+        break;
+      }
+      size_t length = std::min<uint64_t>(end, block->offset() + block->length()) - offset;
+      char *buffer = static_cast<char*>(range->buffer) + (offset - range->offset);
+      pieces.push_back(Piece{block, offset - block->offset(), length, buffer, range});
+      offset += length;
+    }
+  }
+
+  // Read none of the ranges if any of them is invalid
+  if (!stat.ok()) {
+    return stat;
+  }
+
+  std::sort(pieces.begin(), pieces.end(), [](const Piece &a, const Piece &b) {
+      return a.block->offset() + a.offset_within_block <
+          b.block->offset() + b.offset_within_block;
+    });
+
+  // Merge the pieces that follow each other closely. Overlapping
+  // pieces need separate requests as the same bytes cannot be
+  // received into two buffers.
+  const uint64_t max_gap = fs_->options().vectored_read_max_gap;
+  for (const auto &piece : pieces) {
+    Request *last = r->requests.empty() ? nullptr : &r->requests.back();
+    uint64_t last_end = last ? last->offset_within_block + last->length : 0;
+    if (last && last->block == piece.block && piece.offset_within_block >= last_end &&
+        piece.offset_within_block - last_end <= max_gap) {
+      size_t gap = piece.offset_within_block - last_end;
+      // The checksums are verified after the data of a packet has
+      // been received, thus the gaps cannot share the scratch space.
+      last->scratch.resize(last->scratch.size() + gap);
+      last->length += gap + piece.length;
+      last->pieces.push_back(piece);
+    } else {
+      r->requests.push_back(Request{piece.block, piece.offset_within_block, piece.length,
+                                    {piece}, {}, {}});
+    }
+  }
+
+  // The scratch buffers have their final sizes now
+  for (auto &request : r->requests) {
+    uint64_t position = request.offset_within_block;
+    char *scratch = request.scratch.data();
+    for (const auto &piece : request.pieces) {
+      if (piece.offset_within_block > position) {
+        size_t gap = piece.offset_within_block - position;
+        request.buffers.push_back(asio::buffer(scratch, gap));
+        scratch += gap;
+      }
+      request.buffers.push_back(asio::buffer(piece.buffer, piece.length));
+      position = piece.offset_within_block + piece.length;
+    }
+  }
+
+  if (r->requests.empty()) {
+    return Status::OK();
+  }
+
+  std::future<void> future(r->done.get_future());
+  r->pending = r->requests.size();
+  for (size_t i = 0; i < r->requests.size(); ++i) {
+    StartVectoredRead(r, i);
+  }
+  future.wait();
+  return r->status;
+}
+
+void InputStreamImpl::StartVectoredRead(const std::shared_ptr<VectoredRead> &r, size_t index) {
+  const auto &request = r->requests[index];
+  auto on_finished = [this,r,index](const Status &status, size_t transferred) {
+    const auto &request = r->requests[index];
+    std::lock_guard<std::mutex> lock(r->lock);
+    if (!status.ok()) {
+      if (r->status.ok()) {
+        r->status = status;
+      }
+      // The replicas might have moved. Let the next open of the file
+      // fetch the latest locations.
+      fs_->block_location_cache().Invalidate(path_);
+    } else {
+      // Account the bytes of the pieces that have been received
+      for (const auto &piece : request.pieces) {
+        uint64_t position = piece.offset_within_block - request.offset_within_block;
+        if (transferred > position) {
+          piece.range->read_bytes += std::min<uint64_t>(transferred - position, piece.length);
+        }
+      }
+    }
+    if (!--r->pending) {
+      r->done.set_value();
+    }
+  };
+
+  if (request.block->endpoints.empty()) {
+    on_finished(Status::ResourceUnavailable("No datanodes available"), 0);
+    return;
+  }
+
+  // Only a request that continues a sequential scan is considered
+  // part of the scan
+  auto options = ReaderOptions(request.block->offset() + request.offset_within_block);
+  AsyncConnectBlock(request.block, request.offset_within_block, request.length, options,
+                    [this,r,index,on_finished](const Status &status,
+                                               const std::shared_ptr<BlockReaderConnection> &conn) {
+      if (!status.ok()) {
+        on_finished(status, 0);
+        return;
+      }
+
+      typedef std::vector<::asio::mutable_buffer> Buffers;
+      auto m = continuation::Pipeline<size_t>::Create();
+      m->Push(new ReadBlockContinuation<Buffers>(
+          conn.get(), r->requests[index].buffers, &m->state()));
+      m->Run([this,conn,on_finished](const Status &status, size_t transferred) {
+          if (status.ok()) {
+            ReleaseConnection(conn);
+          }
+          on_finished(status, transferred);
+        });
+    });
+}
+
+Status InputStreamImpl::Read(void *buf, size_t nbyte, size_t *read_bytes) {
+  std::lock_guard<std::mutex> lock(stream_lock_);
+  const size_t capacity = fs_->options().read_ahead_buffer_size;
+  char *dst = static_cast<char*>(buf);
+  size_t total = 0;
+  Status stat;
+
+  while (total < nbyte && position_ < file_length_) {
+    size_t want = nbyte - total;
+    if (read_ahead_offset_ <= position_ &&
+        position_ < read_ahead_offset_ + read_ahead_size_) {
+      size_t off = position_ - read_ahead_offset_;
+      size_t n = std::min(want, read_ahead_size_ - off);
+      memcpy(dst + total, read_ahead_.data() + off, n);
+      total += n;
+      position_ += n;
+      continue;
+    }
+
+    // Keep the current stream if the read is a short skip forward,
+    // as reading through the gap is cheaper than a new request.
+    if (!stream_ || position_ < stream_position_ || position_ >= stream_end_ ||
+        position_ - stream_position_ > capacity) {
+      stat = OpenBlockStream(position_);
+      if (!stat.ok()) {
+        break;
+      }
+    }
+
+    size_t transferred = 0;
+    if (position_ == stream_position_ && want >= capacity) {
+      size_t size = std::min<uint64_t>(want, stream_end_ - stream_position_);
+      stat = ReadBlockStream(dst + total, size, &transferred);
+      total += transferred;
+      position_ += transferred;
+    } else {
+      if (read_ahead_.size() < capacity) {
+        read_ahead_.resize(capacity);
+      }
+      size_t size = std::min<uint64_t>(capacity, stream_end_ - stream_position_);
+      read_ahead_offset_ = stream_position_;
+      stat = ReadBlockStream(read_ahead_.data(), size, &transferred);
+      read_ahead_size_ = transferred;
+    }
+
+    if (!stat.ok()) {
+      break;
+    }
+  }
+
+  *read_bytes = total;
+  return stat;
+}
+
+Status InputStreamImpl::Seek(size_t offset) {
+  std::lock_guard<std::mutex> lock(stream_lock_);
+  if (offset > file_length_) {
+    return Status::InvalidArgument("Cannot seek beyond the end of the file");
+  }
+  position_ = offset;
+  return Status::OK();
+}
+
+size_t InputStreamImpl::Tell() {
+  std::lock_guard<std::mutex> lock(stream_lock_);
+  return position_;
+}
+
+void InputStreamImpl::SetDropBehind(DropBehindStrategy strategy) {
+  // The block stream has sent its hints already, thus the next Read()
+  // needs a new one.
+  std::lock_guard<std::mutex> stream_lock(stream_lock_);
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  if (drop_behind_ != strategy) {
+    drop_behind_ = strategy;
+    stream_.reset();
+  }
+}
+
+void InputStreamImpl::SetReadahead(long long bytes) {
+  std::lock_guard<std::mutex> stream_lock(stream_lock_);
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  bytes = std::max(bytes, -1LL);
+  if (read_ahead_bytes_ != bytes) {
+    read_ahead_bytes_ = bytes;
+    stream_.reset();
+  }
+}
+
+BlockReaderOptions InputStreamImpl::ReaderOptions(uint64_t offset, const CacheStrategy &hints) {
+  BlockReaderOptions options;
+  // The cipher suite offered to the DataNodes that encrypt the data
+  // transfer, the only one that is supported
+  options.encryption_scheme = kAESCTRNoPadding;
+  CacheStrategy &cache = options.cache_strategy;
+  {
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    switch (drop_behind_) {
+      case kEnableDropBehind:
+      case kDisableDropBehind:
+        cache.drop_behind_specified = true;
+        cache.drop_behind = drop_behind_ == kEnableDropBehind;
+        break;
+      case kAdaptiveDropBehind:
+        if (offset == sequential_end_ &&
+            sequential_bytes_ >= fs_->options().adaptive_drop_behind_threshold) {
+          cache.drop_behind_specified = true;
+          cache.drop_behind = true;
+        }
+        break;
+      default:
+        break;
+    }
+    if (read_ahead_bytes_ >= 0) {
+      cache.read_ahead_specified = true;
+      cache.read_ahead = read_ahead_bytes_;
+    }
+  }
+
+  if (hints.drop_behind_specified) {
+    cache.drop_behind_specified = true;
+    cache.drop_behind = hints.drop_behind;
+  }
+  if (hints.read_ahead_specified) {
+    cache.read_ahead_specified = true;
+    cache.read_ahead = hints.read_ahead;
+  }
+  return options;
+}
+
+void InputStreamImpl::RecordRead(uint64_t offset, size_t length) {
+  if (!length) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  if (offset != sequential_end_) {
+    sequential_bytes_ = 0;
+  }
+  sequential_bytes_ += length;
+  sequential_end_ = offset + length;
+}
+
+Status InputStreamImpl::FindBlock(uint64_t offset, BlockPtr *block) {
+  *block = locations_->FindBlock(offset);
+  if (*block) {
+    return Status::OK();
+  }
+
+  auto stat = std::make_shared<std::promise<Status>>();
+  std::future<Status> future(stat->get_future());
+  AsyncFindBlock(offset, [stat,block](const Status &status, const BlockPtr &b) {
+      *block = b;
+      stat->set_value(status);
+    });
   return future.get();
 }
 
+void InputStreamImpl::ReleaseConnection(const std::shared_ptr<BlockReaderConnection> &conn) {
+  // The pool keeps the sockets only, without the state of the ciphers
+  // of an encrypted connection.
+  if (conn->local || !conn->is_finished() || conn->sasl->is_encrypted()) {
+    return;
+  }
+
+  asio::error_code ec;
+  auto endpoint = conn->conn->remote_endpoint(ec);
+  if (!ec) {
+    fs_->connection_pool().Release(endpoint, conn->conn);
+  }
+}
+
+Status InputStreamImpl::OpenBlockStream(size_t offset) {
+  /* assumed to be called from a context that has already acquired the stream_lock_ */
+  stream_.reset();
+  BlockPtr block;
+  Status found = FindBlock(offset, &block);
+  if (!found.ok()) {
+    return found;
+  } else if (block->endpoints.empty()) {
+    return Status::ResourceUnavailable("No datanodes available");
+  }
+
+  uint64_t offset_within_block = offset - block->offset();
+  uint64_t length = block->length() - offset_within_block;
+
+  auto stat = std::make_shared<std::promise<Status>>();
+  std::future<Status> future(stat->get_future());
+  std::shared_ptr<BlockReaderConnection> conn;
+  AsyncConnectBlock(block, offset_within_block, length, ReaderOptions(offset),
+                    [stat,&conn](const Status &status,
+                                 const std::shared_ptr<BlockReaderConnection> &c) {
+      conn = c;
+      stat->set_value(status);
+    });
+
+  Status status = future.get();
+  if (status.ok()) {
+    stream_ = conn;
+    stream_position_ = offset;
+    stream_end_ = offset + length;
+  }
+  return status;
+}
+
+Status InputStreamImpl::ReadBlockStream(char *buf, size_t size, size_t *transferred) {
+  /* assumed to be called from a context that has already acquired the stream_lock_ */
+  auto stat = std::make_shared<std::promise<Status>>();
+  std::future<Status> future(stat->get_future());
+  auto m = continuation::Pipeline<size_t>::Create();
+  m->Push(new ReadBlockContinuation<::asio::mutable_buffers_1>(
+      stream_.get(), asio::buffer(buf, size), &m->state()));
+  m->Run([stat,transferred](const Status &status, size_t t) {
+      *transferred = t;
+      stat->set_value(status);
+    });
+
+  Status status = future.get();
+  RecordRead(stream_position_, *transferred);
+  stream_position_ += *transferred;
+  if (!status.ok()) {
+    stream_.reset();
+  } else if (stream_->is_finished()) {
+    ReleaseConnection(stream_);
+    stream_.reset();
+  } else if (!*transferred) {
+    stream_.reset();
+    return Status::Error("Unexpected end of the block");
+  }
+  return status;
+}
+
+/*
+ * The state of a hedged read. The primary leg reads from the replicas
+ * in the order of the NameNode into the buffer of the caller. The
+ * hedged leg starts from the next replica and reads into its own
+ * buffer, which is copied into the buffer of the caller if the hedged
+ * leg wins. The handler is called only after the primary leg has
+ * stopped writing into the buffer of the caller.
+ *
+ * All fields are guarded by lock.
+ */
+struct InputStreamImpl::HedgedRead {
+  enum LegState {
+    kIdle,
+    kConnecting,
+    kReading,
+    kDone,
+  };
+
+  HedgedRead(::asio::io_service &io_service, const ::asio::mutable_buffers_1 &buffers,
+             const std::function<void(const Status &, size_t)> &handler)
+      : timer(io_service)
+      , buffers(buffers)
+      , done(false)
+      , notified(false)
+      , winner(0)
+      , transferred(0)
+      , handler(handler)
+  {
+    legs[0] = legs[1] = kIdle;
+  }
+
+  std::mutex lock;
+  ::asio::deadline_timer timer;
+  BlockPtr blocks[2];
+  uint64_t offset_within_block;
+  BlockReaderOptions options;
+  ::asio::mutable_buffers_1 buffers;
+  std::vector<char> hedged_buffer;
+  LegState legs[2];
+  std::shared_ptr<BlockReaderConnection> conns[2];
+  bool done;
+  bool notified;
+  int winner;
+  Status status;
+  size_t transferred;
+  std::function<void(const Status &, size_t)> handler;
+};
+
+void InputStreamImpl::AsyncHedgedReadBlock(
+    const BlockPtr &block, uint64_t offset_within_block,
+    const ::asio::mutable_buffers_1 &buffers, const BlockReaderOptions &options,
+    const std::function<void(const Status &, size_t)> &handler) {
+  auto h = std::make_shared<HedgedRead>(fs_->io_service().io_service(), buffers, handler);
+  h->offset_within_block = offset_within_block;
+  h->options = options;
+  h->blocks[0] = block;
+  // Move the first replica to the end of the list for the hedged leg
+  auto hedged_block = std::make_shared<LocatedBlock>(*block);
+  std::rotate(hedged_block->endpoints.begin(), hedged_block->endpoints.begin() + 1,
+              hedged_block->endpoints.end());
+  h->blocks[1] = hedged_block;
+
+  {
+    // The legs cancel the timer from other threads
+    std::lock_guard<std::mutex> lock(h->lock);
+    h->timer.expires_from_now(std::chrono::milliseconds(fs_->options().hedged_read_threshold));
+    h->timer.async_wait([this,h](const asio::error_code &ec) {
+        {
+          std::lock_guard<std::mutex> lock(h->lock);
+          if (ec || h->done || h->legs[1] != HedgedRead::kIdle) {
+            return;
+          }
+          h->legs[1] = HedgedRead::kConnecting;
+        }
+        StartHedgedLeg(h, 1);
+      });
+    h->legs[0] = HedgedRead::kConnecting;
+  }
+  StartHedgedLeg(h, 0);
+}
+
+void InputStreamImpl::StartHedgedLeg(const std::shared_ptr<HedgedRead> &h, int leg) {
+  size_t size = asio::buffer_size(h->buffers);
+  if (leg == 1) {
+    h->hedged_buffer.resize(size);
+  }
+  auto buffers = leg == 0 ? h->buffers : asio::buffer(h->hedged_buffer);
+
+  AsyncConnectBlock(h->blocks[leg], h->offset_within_block, size, h->options,
+                    [this,h,leg,buffers](const Status &status,
+                                         const std::shared_ptr<BlockReaderConnection> &conn) {
+      bool reading = false;
+      {
+        std::lock_guard<std::mutex> lock(h->lock);
+        if (status.ok() && !h->done) {
+          h->legs[leg] = HedgedRead::kReading;
+          h->conns[leg] = conn;
+          reading = true;
+        }
+      }
+      if (!reading) {
+        OnHedgedLegFinished(h, leg, status, 0, nullptr);
+        return;
+      }
+
+      auto m = continuation::Pipeline<size_t>::Create();
+      m->Push(new ReadBlockContinuation<::asio::mutable_buffers_1>(
+          conn.get(), buffers, &m->state()));
+      m->Run([this,h,leg,conn](const Status &status, size_t transferred) {
+          OnHedgedLegFinished(h, leg, status, transferred, conn);
+        });
+    });
+}
+
+void InputStreamImpl::OnHedgedLegFinished(
+    const std::shared_ptr<HedgedRead> &h, int leg, const Status &status,
+    size_t transferred, const std::shared_ptr<BlockReaderConnection> &conn) {
+  bool start_hedged_leg = false;
+  std::unique_lock<std::mutex> lock(h->lock);
+  h->legs[leg] = HedgedRead::kDone;
+  h->conns[leg] = nullptr;
+
+  if (!h->done) {
+    int other = 1 - leg;
+    if (status.ok()) {
+      h->done = true;
+      h->winner = leg;
+      h->status = status;
+      h->transferred = transferred;
+      ReleaseConnection(conn);
+      asio::error_code ec;
+      h->timer.cancel(ec);
+      if (h->legs[other] == HedgedRead::kReading) {
+        // Cancel the loser. The DataNode is in the middle of sending
+        // the block thus the connection cannot be reused. The loser
+        // might be starting a read on another thread, which a close()
+        // would race with. shutdown() only acts on the descriptor,
+        // which stays open as long as the connection is referenced, and
+        // makes the pending and the following reads of the loser fail.
+        auto loser = h->conns[other];
+        if (loser->conn) {
+          asio::error_code ec;
+          loser->conn->shutdown(::asio::ip::tcp::socket::shutdown_both, ec);
+        }
+      }
+    } else if (leg == 0 && h->legs[1] == HedgedRead::kIdle) {
+      // Do not wait for the threshold if the primary leg fails
+      asio::error_code ec;
+      h->timer.cancel(ec);
+      h->legs[1] = HedgedRead::kConnecting;
+      start_hedged_leg = true;
+    } else if (h->legs[other] == HedgedRead::kDone) {
+      h->done = true;
+      h->winner = leg;
+      h->status = status;
+    }
+  }
+
+  if (!h->done || h->notified || h->legs[0] == HedgedRead::kReading) {
+    lock.unlock();
+    if (start_hedged_leg) {
+      StartHedgedLeg(h, 1);
+    }
+    return;
+  }
+
+  h->notified = true;
+  if (h->winner == 1 && h->status.ok()) {
+    asio::buffer_copy(h->buffers, asio::buffer(h->hedged_buffer, h->transferred));
+  }
+  lock.unlock();
+  h->handler(h->status, h->transferred);
+}
+
 }
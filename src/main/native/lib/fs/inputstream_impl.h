@@ -19,17 +19,35 @@
 #define FS_INPUTSTREAM_IMPL_H_
 
 #include "reader/block_reader.h"
+#include "reader/local_block_reader.h"
 
 #include "common/continuation/asio.h"
 #include "common/continuation/protobuf.h"
+#include "common/datatransfer_sasl.h"
 
 #include <functional>
 #include <future>
 
 namespace hdfs {
 
+struct InputStreamImpl::BlockReaderConnection {
+  typedef DataTransferSaslStream<::asio::ip::tcp::socket> SaslStream;
+  typedef RemoteBlockReader<SaslStream> Reader;
+  std::shared_ptr<::asio::ip::tcp::socket> conn;
+  // Encrypts the connection if the DataNodes require it
+  std::shared_ptr<SaslStream> sasl;
+  std::shared_ptr<Reader> reader;
+  // Reads a local replica in place of the connection and the reader
+  std::unique_ptr<LocalBlockReader> local;
+  // Whether the connection was taken from the connection pool
+  bool reused;
+
+  bool is_finished() const
+  { return local ? local->is_finished() : reader->is_finished(); }
+};
+
 struct InputStreamImpl::HandshakeContinuation : continuation::Continuation {
-  typedef RemoteBlockReader<::asio::ip::tcp::socket> Reader;
+  typedef BlockReaderConnection::Reader Reader;
   HandshakeContinuation(Reader *reader, const std::string &client_name,
                const hadoop::common::TokenProto *token,
                const hadoop::hdfs::ExtendedBlockProto *block,
@@ -59,44 +77,77 @@ struct InputStreamImpl::HandshakeContinuation : continuation::Continuation {
   uint64_t offset_;
 };
 
+struct InputStreamImpl::DisableNagleContinuation : continuation::Continuation {
+  DisableNagleContinuation(::asio::ip::tcp::socket *conn)
+      : conn_(conn)
+  {}
+
+  virtual void Run(const Next& next) override {
+    // The client sends small messages (e.g., the read status and the
+    // next request) back-to-back on the same connection, which
+    // should not wait for the ACKs of the previous ones.
+    ::asio::error_code ec;
+    conn_->set_option(::asio::ip::tcp::no_delay(true), ec);
+    next(ToStatus(ec));
+  }
+
+ private:
+  ::asio::ip::tcp::socket *conn_;
+};
+
+struct InputStreamImpl::DataTransferSaslContinuation : continuation::Continuation {
+  DataTransferSaslContinuation(FileSystemImpl *fs, BlockReaderConnection::SaslStream *stream)
+      : fs_(fs)
+      , stream_(stream)
+  {}
+
+  virtual void Run(const Next& next) override {
+    auto stream = stream_;
+    fs_->AsyncGetDataEncryptionKey([stream,next](const Status &status,
+                                                 const FileSystemImpl::DataEncryptionKeyPtr &key) {
+        if (!status.ok() || !key) {
+          next(status);
+          return;
+        }
+        std::string username, password;
+        DataTransferSaslStreamUtil::GetCredentials(*key, &username, &password);
+        stream->Handshake(username, password, next);
+      });
+  }
+
+ private:
+  FileSystemImpl *fs_;
+  BlockReaderConnection::SaslStream *stream_;
+};
+
 template<class MutableBufferSequence>
 struct InputStreamImpl::ReadBlockContinuation : continuation::Continuation {
-  typedef RemoteBlockReader<::asio::ip::tcp::socket> Reader;
-  ReadBlockContinuation(Reader *reader, MutableBufferSequence buffer,
+  ReadBlockContinuation(BlockReaderConnection *conn, MutableBufferSequence buffer,
                  size_t *transferred)
-      : reader_(reader)
+      : conn_(conn)
       , buffer_(buffer)
-      , buffer_size_(asio::buffer_size(buffer))
       , transferred_(transferred)
   {}
 
   virtual void Run(const Next& next) override {
     *transferred_ = 0;
-    next_ = next;
-    OnReadData(Status::OK(), 0);
+    if (conn_->local) {
+      next(conn_->local->Read(buffer_, transferred_));
+      return;
+    }
+    // The reader crosses the packet boundaries by itself and calls back
+    // once the buffer is full or the block has been read.
+    size_t *transferred = transferred_;
+    conn_->reader->async_read(buffer_, [transferred,next](const Status &status, size_t t) {
+        *transferred = t;
+        next(status);
+      });
   }
 
  private:
-  Reader *reader_;
+  BlockReaderConnection *conn_;
   MutableBufferSequence buffer_;
-  const size_t buffer_size_;
   size_t *transferred_;
-  std::function<void(const Status &)> next_;
-
-  void OnReadData(const Status &status, size_t transferred) {
-    using std::placeholders::_1;
-    using std::placeholders::_2;
-    *transferred_ += transferred;
-    if (!status.ok()) {
-      next_(status);
-    } else if (*transferred_ >= buffer_size_) {
-      next_(status);
-    } else {
-      reader_->async_read_some(
-          asio::buffer(buffer_ + *transferred_, buffer_size_ - *transferred_),
-          std::bind(&ReadBlockContinuation::OnReadData, this, _1, _2));
-    }
-  }
 };
 
 
@@ -104,54 +155,171 @@ template<class MutableBufferSequence, class Handler>
 void InputStreamImpl::AsyncPreadSome(
     size_t offset, const MutableBufferSequence &buffers,
     const Handler &handler) {
-  using ::hadoop::hdfs::LocatedBlockProto;
-  namespace ip = ::asio::ip;
-  using ::asio::ip::tcp;
+  AsyncFindBlock(offset, [this,offset,buffers,handler](const Status &status, const BlockPtr &block) {
+      if (!status.ok()) {
+        handler(status, 0);
+        return;
+      } else if (block->endpoints.empty()) {
+        handler(Status::ResourceUnavailable("No datanodes available"), 0);
+        return;
+      }
 
-  auto it = std::find_if(
-      blocks_.begin(), blocks_.end(),
-      [offset](const LocatedBlockProto &p) {
-        return p.offset() <= offset && offset < p.offset() + p.b().numbytes();
-      });
+      uint64_t offset_within_block = offset - block->offset();
+      uint64_t size_within_block =
+          std::min<uint64_t>(block->length() - offset_within_block, asio::buffer_size(buffers));
+
+      AsyncReadBlock(block, offset_within_block, asio::buffer(buffers, size_within_block),
+                     ReaderOptions(offset), [this,handler](const Status &status, size_t transferred) {
+          if (!status.ok()) {
+            // The replicas might have moved. Let the next open of the
+            // file fetch the latest locations.
+            fs_->block_location_cache().Invalidate(path_);
+          }
+          handler(status, transferred);
+        });
+    });
+}
 
-  if (it == blocks_.end()) {
-    handler(Status::InvalidArgument("Cannot find corresponding blocks"), 0);
+template<class Handler>
+void InputStreamImpl::AsyncFindBlock(uint64_t offset, const Handler &handler) {
+  auto block = locations_->FindBlock(offset);
+  if (block) {
+    handler(Status::OK(), block);
     return;
-  } else if (!it->locs_size()) {
-    handler(Status::ResourceUnavailable("No datanodes available"), 0);
+  } else if (offset >= file_length_) {
+    handler(Status::InvalidArgument("Cannot find corresponding blocks"), nullptr);
     return;
   }
 
-  uint64_t offset_within_block = offset - it->offset();
-  uint64_t size_within_block =
-      std::min<uint64_t>(it->b().numbytes() - offset_within_block, asio::buffer_size(buffers));
+  fs_->AsyncFetchBlockLocations(path_, offset, locations_, [this,offset,handler](const Status &status) {
+      if (!status.ok()) {
+        handler(status, nullptr);
+        return;
+      }
+      auto block = locations_->FindBlock(offset);
+      if (!block) {
+        handler(Status::InvalidArgument("Cannot find corresponding blocks"), nullptr);
+        return;
+      }
+      handler(Status::OK(), block);
+    });
+}
+
+template<class Handler>
+void InputStreamImpl::AsyncConnectBlock(
+    const BlockPtr &block, uint64_t offset_within_block, uint64_t length,
+    const BlockReaderOptions &options, const Handler &handler) {
+  auto &cache = fs_->short_circuit_cache();
+  const auto &endpoints = block->endpoints;
+  auto local = cache.FindLocalDataNode(endpoints.begin(), endpoints.end());
+  if (local == endpoints.end()) {
+    AsyncConnectDataNode(block, offset_within_block, length, options, true, false, handler);
+    return;
+  }
+
+  cache.AsyncGetReplica(fs_->io_service().io_service(), *local,
+                        fs_->rpc_engine().client_name(), block->block,
+                        [this,block,offset_within_block,length,options,handler](
+                            const std::shared_ptr<ShortCircuitReplica> &replica) {
+      if (!replica) {
+        AsyncConnectDataNode(block, offset_within_block, length, options, true, false, handler);
+        return;
+      }
+      auto conn = std::make_shared<BlockReaderConnection>();
+      conn->local.reset(new LocalBlockReader(options, replica,
+                                             offset_within_block, length));
+      conn->reused = false;
+      handler(Status::OK(), conn);
+    });
+}
+
+template<class Handler>
+void InputStreamImpl::AsyncConnectDataNode(
+    const BlockPtr &block, uint64_t offset_within_block, uint64_t length,
+    const BlockReaderOptions &options, bool use_pooled_connection, bool key_retried,
+    const Handler &handler) {
+  using ::asio::ip::tcp;
 
   struct State {
-    std::unique_ptr<tcp::socket> conn;
-    std::shared_ptr<RemoteBlockReader<tcp::socket> > reader;
-    LocatedBlockProto block;
-    std::vector<tcp::endpoint> endpoints;
-    size_t transferred;
+    std::shared_ptr<BlockReaderConnection> conn;
+    BlockPtr block;
   };
 
   auto m = continuation::Pipeline<State>::Create();
   auto &s = m->state();
-  s.conn.reset(new tcp::socket(fs_->rpc_engine().io_service()));
-  s.reader = std::make_shared<RemoteBlockReader<tcp::socket> >(BlockReaderOptions(), s.conn.get());
-  s.block = *it;
-  for (auto &loc : it->locs()) {
-    auto datanode = loc.id();
-    s.endpoints.push_back(tcp::endpoint(ip::address::from_string(datanode.ipaddr()), datanode.xferport()));
+  s.block = block;
+  const auto &endpoints = block->endpoints;
+
+  s.conn = std::make_shared<BlockReaderConnection>();
+  if (use_pooled_connection) {
+    s.conn->conn = fs_->connection_pool().Acquire(endpoints.begin(), endpoints.end());
+  }
+  s.conn->reused = s.conn->conn != nullptr;
+  if (!s.conn->reused) {
+    s.conn->conn = std::make_shared<tcp::socket>(fs_->io_service().NextIoService());
+  }
+  s.conn->sasl = std::make_shared<BlockReaderConnection::SaslStream>(options, s.conn->conn);
+  if (!s.conn->reused) {
+    // The pooled connections are never encrypted, see ReleaseConnection()
+    m->Push(continuation::Connect(s.conn->conn.get(), endpoints.begin(), endpoints.end()))
+        .Push(new DisableNagleContinuation(s.conn->conn.get()))
+        .Push(new DataTransferSaslContinuation(fs_, s.conn->sasl.get()));
+  }
+
+  s.conn->reader = std::make_shared<BlockReaderConnection::Reader>(
+      options, s.conn->sasl.get());
+  m->Push(new HandshakeContinuation(s.conn->reader.get(), fs_->rpc_engine().client_name(),
+                                    &block->block.blocktoken(), &block->block.b(),
+                                    length, offset_within_block));
+
+  m->Run([this,offset_within_block,length,options,key_retried,handler](
+      const Status &status, const State &state) {
+      if (!status.ok() && state.conn->reused) {
+        // The DataNode might have closed the idle connection in the
+        // meantime. Retry with a new connection.
+        AsyncConnectDataNode(state.block, offset_within_block, length, options, false,
+                             key_retried, handler);
+        return;
+      } else if (status.is_invalid_encryption_key() && !key_retried) {
+        // The NameNode might have rolled its keys. Retry once with a
+        // new key.
+        fs_->InvalidateDataEncryptionKey();
+        AsyncConnectDataNode(state.block, offset_within_block, length, options, false,
+                             true, handler);
+        return;
+      }
+      handler(status, status.ok() ? state.conn : nullptr);
+    });
+}
+
+template<class Handler>
+void InputStreamImpl::AsyncReadBlock(
+    const BlockPtr &block, uint64_t offset_within_block,
+    const ::asio::mutable_buffers_1 &buffers, const BlockReaderOptions &options,
+    const Handler &handler) {
+  if (fs_->options().hedged_read_threshold > 0 && block->endpoints.size() > 1) {
+    AsyncHedgedReadBlock(block, offset_within_block, buffers, options, handler);
+    return;
   }
 
-  m->Push(continuation::Connect(s.conn.get(), s.endpoints.begin(), s.endpoints.end()))
-      .Push(new HandshakeContinuation(s.reader.get(), fs_->rpc_engine().client_name(), nullptr,
-                                   &s.block.b(), size_within_block, offset_within_block))
-      .Push(new ReadBlockContinuation<::asio::mutable_buffers_1>(
-          s.reader.get(), asio::buffer(buffers, size_within_block), &s.transferred));
+  size_t size = asio::buffer_size(buffers);
+  AsyncConnectBlock(block, offset_within_block, size, options,
+                    [this,buffers,handler](const Status &status,
+                                           const std::shared_ptr<BlockReaderConnection> &conn) {
+      if (!status.ok()) {
+        handler(status, 0);
+        return;
+      }
 
-  m->Run([handler](const Status &status, const State &state) {
-      handler(status, state.transferred);
+      auto m = continuation::Pipeline<size_t>::Create();
+      m->Push(new ReadBlockContinuation<::asio::mutable_buffers_1>(
+          conn.get(), buffers, &m->state()));
+      m->Run([this,conn,handler](const Status &status, size_t transferred) {
+          if (status.ok()) {
+            ReleaseConnection(conn);
+          }
+          handler(status, transferred);
+        });
     });
 }
 
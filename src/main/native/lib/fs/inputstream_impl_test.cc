@@ -0,0 +1,692 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "filesystem.h"
+
+#include "reader/mock_datanode.h"
+#include "rpc/mock_namenode.h"
+
+#include "ClientNamenodeProtocol.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+namespace hdfs {
+
+using ::hadoop::hdfs::DataEncryptionKeyProto;
+using ::hadoop::hdfs::GetBlockLocationsResponseProto;
+using ::hadoop::hdfs::GetDataEncryptionKeyResponseProto;
+using ::hadoop::hdfs::GetServerDefaultsResponseProto;
+using ::hadoop::hdfs::LocatedBlocksProto;
+using ::hadoop::hdfs::OpReadBlockProto;
+
+static const uint64_t kBlockSize = 200000;
+
+/*
+ * Streams of a FileSystemImpl whose NameNode and DataNodes are mocks.
+ * The streams are created with the locations of their blocks, thus the
+ * NameNode only tells whether the data transfer is encrypted, which it
+ * is not by default.
+ */
+class InputStreamImplTest : public ::testing::Test {
+ protected:
+  MockNameNode nn_;
+  std::unique_ptr<IoService> io_service_;
+  std::thread worker_;
+  std::unique_ptr<FileSystemImpl> fs_;
+
+  explicit InputStreamImplTest(const IoServiceOptions &options = IoServiceOptions())
+      : io_service_(IoService::New(options))
+      , worker_(std::bind(&IoService::Run, io_service_.get()))
+  {
+    nn_.SetMethod("getServerDefaults", ServerDefaults(false));
+  }
+
+  ~InputStreamImplTest() {
+    if (fs_) {
+      fs_->rpc_engine().Shutdown();
+    }
+    io_service_->Stop();
+    worker_.join();
+  }
+
+  static MockNameNode::Method ServerDefaults(bool encrypt_data_transfer) {
+    return [encrypt_data_transfer](const std::string &, std::string *response) {
+      GetServerDefaultsResponseProto resp;
+      auto defaults = resp.mutable_serverdefaults();
+      defaults->set_blocksize(kBlockSize);
+      defaults->set_bytesperchecksum(MockDataNode::kBytesPerChecksum);
+      defaults->set_writepacketsize(MockDataNode::kPacketSize);
+      defaults->set_replication(3);
+      defaults->set_filebuffersize(4096);
+      defaults->set_encryptdatatransfer(encrypt_data_transfer);
+      *response = resp.SerializeAsString();
+      return Status::OK();
+    };
+  }
+
+  void Connect(const Options &options = Options()) {
+    fs_.reset(new FileSystemImpl(io_service_.get(), options));
+    auto endpoint = nn_.endpoint();
+    ASSERT_TRUE(fs_->Connect({NameNodeAddress{endpoint.address().to_string(),
+                                              endpoint.port()}}).ok());
+  }
+
+  /*
+   * A file of the given length in blocks of kBlockSize, whose replicas
+   * are on the DataNodes in this order.
+   */
+  static LocatedBlocksProto Blocks(uint64_t length, const std::vector<MockDataNode*> &datanodes) {
+    LocatedBlocksProto res;
+    res.set_filelength(length);
+    res.set_underconstruction(false);
+    res.set_islastblockcomplete(true);
+    for (uint64_t offset = 0, id = 1; offset < length; offset += kBlockSize, ++id) {
+      auto b = res.add_blocks();
+      b->set_offset(offset);
+      b->set_corrupt(false);
+      b->mutable_b()->set_poolid("pool");
+      b->mutable_b()->set_blockid(id);
+      b->mutable_b()->set_generationstamp(1);
+      b->mutable_b()->set_numbytes(std::min(kBlockSize, length - offset));
+      auto token = b->mutable_blocktoken();
+      token->set_identifier("");
+      token->set_password("");
+      token->set_kind("");
+      token->set_service("");
+      for (auto dn : datanodes) {
+        auto id = b->add_locs()->mutable_id();
+        id->set_ipaddr(dn->endpoint().address().to_string());
+        id->set_hostname("localhost");
+        id->set_datanodeuuid("uuid");
+        id->set_xferport(dn->endpoint().port());
+        id->set_infoport(0);
+        id->set_ipcport(0);
+      }
+    }
+    return res;
+  }
+
+  std::unique_ptr<InputStreamImpl> Open(uint64_t length, const std::vector<MockDataNode*> &datanodes) {
+    return Open(Blocks(length, datanodes));
+  }
+
+  std::unique_ptr<InputStreamImpl> Open(const LocatedBlocksProto &blocks) {
+    return std::unique_ptr<InputStreamImpl>(new InputStreamImpl(
+        fs_.get(), "/foo", std::make_shared<FileBlockLocations>(blocks)));
+  }
+
+  // The content of the file at [offset, offset + length)
+  static std::string FileData(uint64_t offset, size_t length) {
+    std::string res(length, '\0');
+    for (size_t i = 0; i < length; ++i) {
+      uint64_t pos = offset + i;
+      res[i] = MockDataNode::BlockData(pos / kBlockSize + 1, pos % kBlockSize);
+    }
+    return res;
+  }
+};
+
+TEST_F(InputStreamImplTest, TestReadAdvancesSequentially) {
+  const uint64_t length = 2 * kBlockSize + 100000;
+  MockDataNode dn;
+  Connect();
+
+  // Through the read-ahead buffer, and directly into larger buffers
+  for (size_t size : {7000, 150000}) {
+    auto is = Open(length, {&dn});
+    unsigned requests = dn.requests(kReadBlock);
+    ASSERT_EQ(0u, is->Tell());
+    std::string buf(size, '\0');
+    uint64_t position = 0;
+    while (position < length) {
+      size_t read_bytes = 0;
+      ASSERT_TRUE(is->Read(&buf[0], size, &read_bytes).ok());
+      ASSERT_EQ(std::min<uint64_t>(size, length - position), read_bytes);
+      ASSERT_EQ(FileData(position, read_bytes), buf.substr(0, read_bytes));
+      position += read_bytes;
+      ASSERT_EQ(position, is->Tell());
+    }
+
+    // Each block is streamed by a single request
+    EXPECT_EQ(3u, dn.requests(kReadBlock) - requests);
+
+    size_t read_bytes = 1;
+    ASSERT_TRUE(is->Read(&buf[0], size, &read_bytes).ok());
+    EXPECT_EQ(0u, read_bytes);
+    EXPECT_EQ(length, is->Tell());
+  }
+}
+
+TEST_F(InputStreamImplTest, TestSeek) {
+  const uint64_t length = 2 * kBlockSize;
+  MockDataNode dn;
+  Connect();
+  auto is = Open(length, {&dn});
+
+  std::string buf(1000, '\0');
+  size_t read_bytes = 0;
+  for (uint64_t offset : {kBlockSize + 12345, kBlockSize - 500, kBlockSize / 2000}) {
+    ASSERT_TRUE(is->Seek(offset).ok());
+    ASSERT_EQ(offset, is->Tell());
+    ASSERT_TRUE(is->Read(&buf[0], buf.size(), &read_bytes).ok());
+    ASSERT_EQ(buf.size(), read_bytes);
+    ASSERT_EQ(FileData(offset, buf.size()), buf);
+    ASSERT_EQ(offset + buf.size(), is->Tell());
+  }
+
+  // Past the end of the file, and negative offsets from the C API
+  EXPECT_EQ(Status::InvalidArgument("").code(), is->Seek(length + 1).code());
+  EXPECT_EQ(Status::InvalidArgument("").code(), is->Seek(static_cast<size_t>(-1)).code());
+  EXPECT_EQ(1100u, is->Tell());
+
+  ASSERT_TRUE(is->Seek(length).ok());
+  ASSERT_TRUE(is->Read(&buf[0], buf.size(), &read_bytes).ok());
+  EXPECT_EQ(0u, read_bytes);
+  EXPECT_EQ(length, is->Tell());
+}
+
+TEST_F(InputStreamImplTest, TestTellAfterPartialRead) {
+  const uint64_t length = kBlockSize + 300;
+  MockDataNode dn;
+  Connect();
+  auto is = Open(length, {&dn});
+
+  std::string buf(1000, '\0');
+  size_t read_bytes = 0;
+  ASSERT_TRUE(is->Seek(length - 100).ok());
+  ASSERT_TRUE(is->Read(&buf[0], buf.size(), &read_bytes).ok());
+  ASSERT_EQ(100u, read_bytes);
+  ASSERT_EQ(FileData(length - 100, 100), buf.substr(0, 100));
+  EXPECT_EQ(length, is->Tell());
+
+  // A failed read does not move the position
+  dn.set_read_status(::hadoop::hdfs::ERROR);
+  ASSERT_TRUE(is->Seek(500).ok());
+  EXPECT_FALSE(is->Read(&buf[0], buf.size(), &read_bytes).ok());
+  EXPECT_EQ(0u, read_bytes);
+  EXPECT_EQ(500u, is->Tell());
+}
+
+TEST_F(InputStreamImplTest, TestPositionReadAcrossBlocks) {
+  const uint64_t length = 3 * kBlockSize;
+  MockDataNode dns[3];
+  // The i-th block is only on the i-th DataNode
+  auto blocks = Blocks(length, {&dns[0], &dns[1], &dns[2]});
+  for (int i = 0; i < blocks.blocks_size(); ++i) {
+    auto b = blocks.mutable_blocks(i);
+    auto loc = b->locs(i);
+    b->clear_locs();
+    *b->add_locs() = loc;
+  }
+  Connect();
+  auto is = Open(blocks);
+
+  // The reads of the three blocks are started at once
+  const uint64_t offset = kBlockSize / 2;
+  std::string buf(2 * kBlockSize, '\0');
+  size_t read_bytes = 0;
+  ASSERT_TRUE(is->PositionRead(&buf[0], buf.size(), offset, &read_bytes).ok());
+  ASSERT_EQ(buf.size(), read_bytes);
+  EXPECT_EQ(FileData(offset, buf.size()), buf);
+  for (auto &dn : dns) {
+    EXPECT_EQ(1u, dn.requests(kReadBlock));
+  }
+
+  // A failed block fails the read, which reports the bytes before it
+  // although the block after it has been read
+  dns[1].set_read_status(::hadoop::hdfs::ERROR);
+  Status stat = is->PositionRead(&buf[0], buf.size(), offset, &read_bytes);
+  EXPECT_FALSE(stat.ok());
+  EXPECT_EQ(kBlockSize - offset, read_bytes);
+  EXPECT_EQ(FileData(offset, read_bytes), buf.substr(0, read_bytes));
+  EXPECT_EQ(2u, dns[0].requests(kReadBlock));
+  // The pooled connection failed, so the block was tried on a new one
+  EXPECT_EQ(3u, dns[1].requests(kReadBlock));
+  EXPECT_EQ(2u, dns[2].requests(kReadBlock));
+}
+
+TEST_F(InputStreamImplTest, TestReadVectored) {
+  const uint64_t length = 2 * kBlockSize + 100000;
+  MockDataNode dn;
+  Connect();
+  auto is = Open(length, {&dn});
+
+  struct {
+    size_t offset;
+    size_t length;
+  } ranges[] = {
+    {2 * kBlockSize + 1000, 500},
+    // Merged into one request, the gap between them is discarded
+    {100, 1000},
+    {1500, 2000},
+    // Overlaps the previous range
+    {2000, 1000},
+    // Crosses the end of the first block
+    {kBlockSize - 300, 600},
+    // Crosses the end of the file
+    {length - 100, 300},
+  };
+  const size_t count = sizeof(ranges) / sizeof(ranges[0]);
+
+  std::vector<std::string> bufs;
+  std::vector<ReadRange> read_ranges;
+  for (const auto &r : ranges) {
+    bufs.emplace_back(r.length, '\0');
+  }
+  for (size_t i = 0; i < count; ++i) {
+    read_ranges.push_back(ReadRange{ranges[i].offset, ranges[i].length, &bufs[i][0], 1});
+  }
+  ASSERT_TRUE(is->ReadVectored(read_ranges.data(), count).ok());
+  for (size_t i = 0; i < count; ++i) {
+    size_t expected = std::min<uint64_t>(ranges[i].length, length - ranges[i].offset);
+    ASSERT_EQ(expected, read_ranges[i].read_bytes) << i;
+    EXPECT_EQ(FileData(ranges[i].offset, expected), bufs[i].substr(0, expected)) << i;
+  }
+  // The merged ranges, the overlapping range, the two pieces of the
+  // range across the blocks, and the two ranges of the last block
+  EXPECT_EQ(6u, dn.requests(kReadBlock));
+
+  // A range after the end of the file fails the call, and no range
+  // is read
+  read_ranges[1].offset = length;
+  for (auto &r : read_ranges) {
+    r.read_bytes = 1;
+  }
+  Status stat = is->ReadVectored(read_ranges.data(), count);
+  EXPECT_EQ(Status::InvalidArgument("").code(), stat.code());
+  for (const auto &r : read_ranges) {
+    EXPECT_EQ(0u, r.read_bytes);
+  }
+  EXPECT_EQ(6u, dn.requests(kReadBlock));
+}
+
+// The result of an asynchronous read
+struct AsyncReadResult {
+  std::promise<std::pair<Status, size_t>> done;
+
+  static void OnRead(const Status &status, size_t read_bytes, void *context) {
+    static_cast<AsyncReadResult*>(context)->done.set_value(std::make_pair(status, read_bytes));
+  }
+};
+
+TEST_F(InputStreamImplTest, TestAsyncOpenAndPositionRead) {
+  const uint64_t length = 2 * kBlockSize + 100000;
+  MockDataNode dn;
+  nn_.SetMethod("getBlockLocations", [this,length,&dn](const std::string &,
+                                                       std::string *response) {
+      GetBlockLocationsResponseProto resp;
+      *resp.mutable_locations() = Blocks(length, {&dn});
+      *response = resp.SerializeAsString();
+      return Status::OK();
+    });
+  Connect();
+
+  // The second open takes the locations from the cache
+  for (int i = 0; i < 2; ++i) {
+    std::promise<std::pair<Status, InputStream*>> opened;
+    fs_->AsyncOpen("/foo", [&opened](const Status &status, InputStream *is) {
+        opened.set_value(std::make_pair(status, is));
+      });
+    auto res = opened.get_future().get();
+    ASSERT_TRUE(res.first.ok());
+    ASSERT_NE(nullptr, res.second);
+    std::unique_ptr<InputStream> is(res.second);
+    EXPECT_EQ(1u, nn_.calls("getBlockLocations"));
+
+    const uint64_t offset = kBlockSize - 1000 + i;
+    std::string buf(kBlockSize, '\0');
+    AsyncReadResult read;
+    is->AsyncPositionRead(&buf[0], buf.size(), offset, AsyncReadResult::OnRead, &read);
+    auto result = read.done.get_future().get();
+    ASSERT_TRUE(result.first.ok());
+    ASSERT_EQ(buf.size(), result.second);
+    EXPECT_EQ(FileData(offset, buf.size()), buf);
+
+    // A read after the end of the file fails on the handler as well
+    AsyncReadResult eof;
+    is->AsyncPositionRead(&buf[0], buf.size(), length, AsyncReadResult::OnRead, &eof);
+    result = eof.done.get_future().get();
+    EXPECT_EQ(Status::InvalidArgument("").code(), result.first.code());
+    EXPECT_EQ(0u, result.second);
+  }
+
+  nn_.SetMethod("getBlockLocations", [](const std::string &, std::string *) {
+      return Status::Exception("java.io.FileNotFoundException", "File does not exist: /bar");
+    });
+  std::promise<std::pair<Status, InputStream*>> opened;
+  fs_->AsyncOpen("/bar", [&opened](const Status &status, InputStream *is) {
+      opened.set_value(std::make_pair(status, is));
+    });
+  auto res = opened.get_future().get();
+  EXPECT_TRUE(res.first.is_exception());
+  EXPECT_EQ(nullptr, res.second);
+}
+
+// The hints to the page cache of the DataNode in a request, e.g.,
+// "dropbehind=1 readahead=4096", empty if there are none
+static std::string CacheHints(const OpReadBlockProto &req) {
+  std::string res;
+  const auto &c = req.cachingstrategy();
+  if (c.has_dropbehind()) {
+    res += "dropbehind=" + std::to_string(c.dropbehind());
+  }
+  if (c.has_readahead()) {
+    res += std::string(res.empty() ? "" : " ") + "readahead=" + std::to_string(c.readahead());
+  }
+  return res;
+}
+
+TEST_F(InputStreamImplTest, TestCachingStrategy) {
+  MockDataNode dn;
+  Connect();
+  auto is = Open(kBlockSize, {&dn});
+  auto read = [&is,&dn](size_t offset, const CacheStrategy &hints) {
+    std::string buf(1000, '\0');
+    size_t read_bytes = 0;
+    EXPECT_TRUE(is->PositionRead(&buf[0], buf.size(), offset, hints, &read_bytes).ok());
+    return CacheHints(dn.read_requests().back());
+  };
+
+  // Left to the DataNode by default
+  EXPECT_EQ("", read(0, CacheStrategy()));
+  is->SetDropBehind(kEnableDropBehind);
+  EXPECT_EQ("dropbehind=1", read(0, CacheStrategy()));
+  is->SetDropBehind(kDisableDropBehind);
+  is->SetReadahead(1048576);
+  EXPECT_EQ("dropbehind=0 readahead=1048576", read(0, CacheStrategy()));
+
+  // The hints of a read override those of the stream for that read
+  CacheStrategy hints;
+  hints.drop_behind_specified = true;
+  hints.drop_behind = true;
+  hints.read_ahead_specified = true;
+  hints.read_ahead = 4096;
+  EXPECT_EQ("dropbehind=1 readahead=4096", read(0, hints));
+  EXPECT_EQ("dropbehind=0 readahead=1048576", read(0, CacheStrategy()));
+
+  is->SetDropBehind(kUnspecified);
+  is->SetReadahead(-1);
+  EXPECT_EQ("", read(0, CacheStrategy()));
+}
+
+TEST_F(InputStreamImplTest, TestAdaptiveDropBehind) {
+  MockDataNode dn;
+  Options options;
+  options.drop_behind = kAdaptiveDropBehind;
+  options.adaptive_drop_behind_threshold = 50000;
+  Connect(options);
+  auto is = Open(kBlockSize, {&dn});
+  auto read = [&is,&dn](size_t offset) {
+    std::string buf(20000, '\0');
+    size_t read_bytes = 0;
+    EXPECT_TRUE(is->PositionRead(&buf[0], buf.size(), offset, &read_bytes).ok());
+    return CacheHints(dn.read_requests().back());
+  };
+
+  // Drop-behind once the sequential scan has reached the threshold
+  EXPECT_EQ("", read(0));
+  EXPECT_EQ("", read(20000));
+  EXPECT_EQ("", read(40000));
+  EXPECT_EQ("dropbehind=1", read(60000));
+  EXPECT_EQ("dropbehind=1", read(80000));
+  // A read elsewhere starts a new scan
+  EXPECT_EQ("", read(150000));
+  EXPECT_EQ("", read(80000));
+  EXPECT_EQ(7u, dn.requests(kReadBlock));
+}
+
+static DataEncryptionKeyProto EncryptionKey(uint32_t key_id) {
+  using namespace std::chrono;
+  DataEncryptionKeyProto key;
+  key.set_keyid(key_id);
+  key.set_blockpoolid("pool");
+  key.set_nonce("nonce" + std::to_string(key_id));
+  key.set_encryptionkey("secret key " + std::to_string(key_id));
+  key.set_expirydate(duration_cast<milliseconds>(
+      (system_clock::now() + hours(1)).time_since_epoch()).count());
+  return key;
+}
+
+TEST_F(InputStreamImplTest, TestEncryptedReadAfterKeyRoll) {
+  const uint64_t length = kBlockSize + 100000;
+  MockDataNode dn;
+  dn.set_encryption_key(EncryptionKey(2));
+  nn_.SetMethod("getServerDefaults", ServerDefaults(true));
+  // The first key has been rolled by the time the DataNode sees it
+  auto key_id = std::make_shared<std::atomic_uint>(1);
+  nn_.SetMethod("getDataEncryptionKey", [key_id](const std::string &, std::string *response) {
+      GetDataEncryptionKeyResponseProto resp;
+      *resp.mutable_dataencryptionkey() = EncryptionKey((*key_id)++);
+      *response = resp.SerializeAsString();
+      return Status::OK();
+    });
+  Connect();
+
+  auto is = Open(length, {&dn});
+  std::string buf(150000, '\0');
+  size_t read_bytes = 0;
+  ASSERT_TRUE(is->PositionRead(&buf[0], buf.size(), 1000, &read_bytes).ok());
+  ASSERT_EQ(buf.size(), read_bytes);
+  EXPECT_EQ(FileData(1000, buf.size()), buf);
+  // The rejected key has been replaced once
+  EXPECT_EQ(2u, nn_.calls("getDataEncryptionKey"));
+  EXPECT_EQ(1u, dn.encrypted_connections());
+
+  // The new key is kept for the connections to both blocks
+  ASSERT_TRUE(is->PositionRead(&buf[0], buf.size(), kBlockSize - 50000, &read_bytes).ok());
+  ASSERT_EQ(buf.size(), read_bytes);
+  EXPECT_EQ(FileData(kBlockSize - 50000, buf.size()), buf);
+  EXPECT_EQ(2u, nn_.calls("getDataEncryptionKey"));
+  EXPECT_EQ(3u, dn.encrypted_connections());
+}
+
+TEST_F(InputStreamImplTest, TestKeyRejectedTwice) {
+  MockDataNode dn;
+  dn.set_encryption_key(EncryptionKey(100));
+  nn_.SetMethod("getServerDefaults", ServerDefaults(true));
+  nn_.SetMethod("getDataEncryptionKey", [](const std::string &, std::string *response) {
+      GetDataEncryptionKeyResponseProto resp;
+      *resp.mutable_dataencryptionkey() = EncryptionKey(1);
+      *response = resp.SerializeAsString();
+      return Status::OK();
+    });
+  Connect();
+
+  auto is = Open(kBlockSize, {&dn});
+  std::string buf(1000, '\0');
+  size_t read_bytes = 0;
+  Status stat = is->PositionRead(&buf[0], buf.size(), 0, &read_bytes);
+  EXPECT_TRUE(stat.is_invalid_encryption_key());
+  // The key is fetched again only once
+  EXPECT_EQ(2u, nn_.calls("getDataEncryptionKey"));
+  EXPECT_EQ(0u, dn.requests(kReadBlock));
+}
+
+TEST_F(InputStreamImplTest, TestServerDefaultsUnavailable) {
+  MockDataNode dn;
+  // A NameNode that does not know getServerDefaults fails it with an
+  // exception, after which the reads are not encrypted
+  nn_.SetMethod("getServerDefaults", [](const std::string &, std::string *) {
+      return Status::Exception("org.apache.hadoop.ipc.RpcNoSuchMethodException",
+                               "getServerDefaults");
+    });
+  Connect();
+
+  auto is = Open(kBlockSize, {&dn});
+  std::string buf(1000, '\0');
+  size_t read_bytes = 0;
+  for (uint64_t offset : {0, 50000}) {
+    ASSERT_TRUE(is->PositionRead(&buf[0], buf.size(), offset, &read_bytes).ok());
+    EXPECT_EQ(FileData(offset, buf.size()), buf);
+  }
+  EXPECT_EQ(1u, nn_.calls("getServerDefaults"));
+  EXPECT_EQ(0u, dn.encrypted_connections());
+}
+
+/*
+ * Position reads from many threads on an IoService with several worker
+ * threads, which share one event loop or each run their own.
+ */
+class ConcurrentReadTest : public InputStreamImplTest {
+ protected:
+  explicit ConcurrentReadTest(bool io_service_per_thread)
+      : InputStreamImplTest(Options(io_service_per_thread))
+  {}
+
+  static IoServiceOptions Options(bool io_service_per_thread) {
+    IoServiceOptions options;
+    options.threads = 4;
+    options.pin_threads = true;
+    options.io_service_per_thread = io_service_per_thread;
+    return options;
+  }
+
+  void ReadConcurrently() {
+    const uint64_t length = 3 * kBlockSize;
+    MockDataNode dn;
+    Connect();
+    auto is = Open(length, {&dn});
+
+    std::atomic_uint failures(0);
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 8; ++t) {
+      readers.emplace_back([&is, &failures, t, length]() {
+          for (unsigned i = 0; i < 10; ++i) {
+            // Within a block and across the blocks
+            uint64_t offset = (t * 7919 + i * 104729) % (length - 1);
+            size_t size = std::min<uint64_t>(1000 + (t + 1) * (i + 1) * 997, length - offset);
+            std::string buf(size, '\0');
+            size_t read_bytes = 0;
+            Status stat = is->PositionRead(&buf[0], size, offset, &read_bytes);
+            if (!stat.ok() || read_bytes != size || buf != FileData(offset, size)) {
+              ++failures;
+            }
+          }
+        });
+    }
+    for (auto &t : readers) {
+      t.join();
+    }
+    EXPECT_EQ(0u, failures);
+  }
+};
+
+class SharedIoServiceReadTest : public ConcurrentReadTest {
+ protected:
+  SharedIoServiceReadTest() : ConcurrentReadTest(false) {}
+};
+
+class IoServicePerThreadReadTest : public ConcurrentReadTest {
+ protected:
+  IoServicePerThreadReadTest() : ConcurrentReadTest(true) {}
+};
+
+TEST_F(SharedIoServiceReadTest, TestConcurrentPositionReads) {
+  ReadConcurrently();
+}
+
+TEST_F(IoServicePerThreadReadTest, TestConcurrentPositionReads) {
+  ReadConcurrently();
+}
+
+/*
+ * Hedged reads of a single block from two DataNodes, the first of which
+ * is the primary replica.
+ */
+class HedgedReadTest : public InputStreamImplTest {
+ protected:
+  static const uint64_t kLength = kBlockSize;
+  MockDataNode primary_;
+  MockDataNode hedged_;
+
+  void Connect(std::chrono::milliseconds threshold) {
+    Options options;
+    options.hedged_read_threshold = threshold.count();
+    InputStreamImplTest::Connect(options);
+  }
+
+  Status PositionRead(uint64_t offset, size_t length, std::string *data) {
+    auto is = Open(kLength, {&primary_, &hedged_});
+    data->resize(length);
+    size_t read_bytes = 0;
+    Status stat = is->PositionRead(&(*data)[0], length, offset, &read_bytes);
+    data->resize(read_bytes);
+    return stat;
+  }
+};
+
+TEST_F(HedgedReadTest, TestFirstLegWins) {
+  Connect(std::chrono::milliseconds(1000));
+  std::string data;
+  ASSERT_TRUE(PositionRead(1000, 100000, &data).ok());
+  EXPECT_EQ(FileData(1000, 100000), data);
+  EXPECT_EQ(1u, primary_.requests(kReadBlock));
+  EXPECT_EQ(0u, hedged_.requests(kReadBlock));
+}
+
+TEST_F(HedgedReadTest, TestFirstLegWinsAfterThreshold) {
+  Connect(std::chrono::milliseconds(20));
+  primary_.set_read_delay(std::chrono::milliseconds(300));
+  hedged_.set_read_delay(std::chrono::milliseconds(10000));
+  std::string data;
+  ASSERT_TRUE(PositionRead(1000, 100000, &data).ok());
+  EXPECT_EQ(FileData(1000, 100000), data);
+  // The timer has started the hedged leg, which has lost
+  EXPECT_EQ(1u, primary_.requests(kReadBlock));
+  EXPECT_EQ(1u, hedged_.requests(kReadBlock));
+}
+
+TEST_F(HedgedReadTest, TestSecondLegWins) {
+  Connect(std::chrono::milliseconds(20));
+  primary_.set_read_delay(std::chrono::milliseconds(10000));
+  auto start = std::chrono::steady_clock::now();
+  std::string data;
+  ASSERT_TRUE(PositionRead(1000, 100000, &data).ok());
+  EXPECT_EQ(FileData(1000, 100000), data);
+  // The read does not wait for the primary leg
+  EXPECT_GT(std::chrono::seconds(5), std::chrono::steady_clock::now() - start);
+  EXPECT_EQ(1u, primary_.requests(kReadBlock));
+  EXPECT_EQ(1u, hedged_.requests(kReadBlock));
+}
+
+TEST_F(HedgedReadTest, TestFailedFirstLegStartsSecondLeg) {
+  Connect(std::chrono::milliseconds(10000));
+  primary_.set_read_status(::hadoop::hdfs::ERROR);
+  auto start = std::chrono::steady_clock::now();
+  std::string data;
+  ASSERT_TRUE(PositionRead(1000, 100000, &data).ok());
+  EXPECT_EQ(FileData(1000, 100000), data);
+  // without waiting for the threshold
+  EXPECT_GT(std::chrono::seconds(5), std::chrono::steady_clock::now() - start);
+  EXPECT_EQ(1u, hedged_.requests(kReadBlock));
+}
+
+TEST_F(HedgedReadTest, TestBothLegsFail) {
+  Connect(std::chrono::milliseconds(20));
+  primary_.set_read_status(::hadoop::hdfs::ERROR);
+  hedged_.set_read_status(::hadoop::hdfs::ERROR);
+  std::string data;
+  EXPECT_FALSE(PositionRead(1000, 100000, &data).ok());
+  EXPECT_EQ(1u, primary_.requests(kReadBlock));
+  EXPECT_EQ(1u, hedged_.requests(kReadBlock));
+}
+
+}
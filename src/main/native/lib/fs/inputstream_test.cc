@@ -18,6 +18,7 @@
 
 #include "libhdfs++/hdfs.h"
 
+#include <functional>
 #include <iostream>
 #include <string>
 #include <thread>
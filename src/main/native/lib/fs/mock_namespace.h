@@ -0,0 +1,336 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_FS_MOCK_NAMESPACE_H_
+#define LIB_FS_MOCK_NAMESPACE_H_
+
+#include "rpc/mock_namenode.h"
+
+#include "ClientNamenodeProtocol.pb.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * A tree of files and directories that a MockNameNode serves through
+ * getFileInfo, getListing, mkdirs, delete and rename. The listings
+ * come in pages of at most listing_limit entries, as with dfs.ls.limit
+ * on a real NameNode.
+ **/
+class MockNamespace {
+ public:
+  MockNamespace(MockNameNode *nn, unsigned listing_limit);
+
+  // Add a file or a directory along with its missing parents
+  void AddFile(const std::string &path, uint64_t length);
+  void AddDirectory(const std::string &path);
+  void Remove(const std::string &path);
+  bool Exists(const std::string &path);
+  bool IsDirectory(const std::string &path);
+  // Fail the calls on the path with the exception, e.g., the class of
+  // an AccessControlException
+  void SetException(const std::string &path, const std::string &exception_class);
+  // Called with the path of every getListing before it is answered
+  void set_listing_hook(const std::function<void(const std::string &)> &hook);
+
+ private:
+  struct Inode {
+    bool directory;
+    uint64_t length;
+    uint64_t id;
+  };
+
+  std::mutex lock_;
+  const unsigned listing_limit_;
+  std::map<std::string, Inode> inodes_;
+  std::map<std::string, std::string> exceptions_;
+  std::function<void(const std::string &)> listing_hook_;
+  uint64_t next_id_;
+
+  static std::string Parent(const std::string &path);
+  static std::string Name(const std::string &path);
+  static bool IsUnder(const std::string &path, const std::string &dir);
+  void AddLocked(const std::string &path, bool directory, uint64_t length);
+  void RemoveLocked(const std::string &path);
+  Status CheckException(const std::string &path);
+  void ToProto(const std::string &name, const Inode &inode,
+               ::hadoop::hdfs::HdfsFileStatusProto *fs);
+
+  Status GetFileInfo(const std::string &request, std::string *response);
+  Status GetListing(const std::string &request, std::string *response);
+  Status Mkdirs(const std::string &request, std::string *response);
+  Status Delete(const std::string &request, std::string *response);
+  Status Rename(const std::string &request, std::string *response);
+};
+
+inline MockNamespace::MockNamespace(MockNameNode *nn, unsigned listing_limit)
+    : listing_limit_(listing_limit)
+    , next_id_(16386)
+{
+  using namespace std::placeholders;
+  inodes_["/"] = Inode{true, 0, next_id_++};
+  nn->SetMethod("getFileInfo", std::bind(&MockNamespace::GetFileInfo, this, _1, _2));
+  nn->SetMethod("getListing", std::bind(&MockNamespace::GetListing, this, _1, _2));
+  nn->SetMethod("mkdirs", std::bind(&MockNamespace::Mkdirs, this, _1, _2));
+  nn->SetMethod("delete", std::bind(&MockNamespace::Delete, this, _1, _2));
+  nn->SetMethod("rename", std::bind(&MockNamespace::Rename, this, _1, _2));
+}
+
+inline void MockNamespace::AddFile(const std::string &path, uint64_t length) {
+  std::lock_guard<std::mutex> lock(lock_);
+  AddLocked(path, false, length);
+}
+
+inline void MockNamespace::AddDirectory(const std::string &path) {
+  std::lock_guard<std::mutex> lock(lock_);
+  AddLocked(path, true, 0);
+}
+
+inline void MockNamespace::Remove(const std::string &path) {
+  std::lock_guard<std::mutex> lock(lock_);
+  RemoveLocked(path);
+}
+
+inline bool MockNamespace::Exists(const std::string &path) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return inodes_.count(path) != 0;
+}
+
+inline bool MockNamespace::IsDirectory(const std::string &path) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = inodes_.find(path);
+  return it != inodes_.end() && it->second.directory;
+}
+
+inline void MockNamespace::SetException(const std::string &path,
+                                        const std::string &exception_class) {
+  std::lock_guard<std::mutex> lock(lock_);
+  exceptions_[path] = exception_class;
+}
+
+inline void MockNamespace::set_listing_hook(const std::function<void(const std::string &)> &hook) {
+  std::lock_guard<std::mutex> lock(lock_);
+  listing_hook_ = hook;
+}
+
+inline std::string MockNamespace::Parent(const std::string &path) {
+  size_t pos = path.rfind('/');
+  return pos == 0 ? "/" : path.substr(0, pos);
+}
+
+inline std::string MockNamespace::Name(const std::string &path) {
+  return path.substr(path.rfind('/') + 1);
+}
+
+inline bool MockNamespace::IsUnder(const std::string &path, const std::string &dir) {
+  return path == dir || (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+                         (dir == "/" || path[dir.size()] == '/'));
+}
+
+inline void MockNamespace::AddLocked(const std::string &path, bool directory, uint64_t length) {
+  if (path != "/" && !inodes_.count(Parent(path))) {
+    AddLocked(Parent(path), true, 0);
+  }
+  inodes_[path] = Inode{directory, length, next_id_++};
+}
+
+inline void MockNamespace::RemoveLocked(const std::string &path) {
+  for (auto it = inodes_.begin(); it != inodes_.end();) {
+    if (IsUnder(it->first, path)) {
+      it = inodes_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+inline Status MockNamespace::CheckException(const std::string &path) {
+  auto it = exceptions_.find(path);
+  if (it == exceptions_.end()) {
+    return Status::OK();
+  }
+  return Status::Exception(it->second.c_str(), ("Denied: " + path).c_str());
+}
+
+inline void MockNamespace::ToProto(const std::string &name, const Inode &inode,
+                                   ::hadoop::hdfs::HdfsFileStatusProto *fs) {
+  using ::hadoop::hdfs::HdfsFileStatusProto;
+  fs->set_filetype(inode.directory ? HdfsFileStatusProto::IS_DIR : HdfsFileStatusProto::IS_FILE);
+  fs->set_path(name);
+  fs->set_length(inode.length);
+  fs->mutable_permission()->set_perm(inode.directory ? 0755 : 0644);
+  fs->set_owner("hdfs");
+  fs->set_group("supergroup");
+  fs->set_modification_time(1000000);
+  fs->set_access_time(inode.directory ? 0 : 2000000);
+  if (!inode.directory) {
+    fs->set_block_replication(3);
+    fs->set_blocksize(128 * 1024 * 1024);
+  }
+  fs->set_fileid(inode.id);
+}
+
+inline Status MockNamespace::GetFileInfo(const std::string &request, std::string *response) {
+  ::hadoop::hdfs::GetFileInfoRequestProto req;
+  ::hadoop::hdfs::GetFileInfoResponseProto resp;
+  req.ParseFromString(request);
+  std::lock_guard<std::mutex> lock(lock_);
+  Status stat = CheckException(req.src());
+  if (!stat.ok()) {
+    return stat;
+  }
+  auto it = inodes_.find(req.src());
+  if (it != inodes_.end()) {
+    ToProto("", it->second, resp.mutable_fs());
+  }
+  *response = resp.SerializeAsString();
+  return Status::OK();
+}
+
+inline Status MockNamespace::GetListing(const std::string &request, std::string *response) {
+  ::hadoop::hdfs::GetListingRequestProto req;
+  ::hadoop::hdfs::GetListingResponseProto resp;
+  req.ParseFromString(request);
+  std::function<void(const std::string &)> hook;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    hook = listing_hook_;
+  }
+  if (hook) {
+    hook(req.src());
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  Status stat = CheckException(req.src());
+  if (!stat.ok()) {
+    return stat;
+  }
+  auto it = inodes_.find(req.src());
+  if (it != inodes_.end() && !it->second.directory) {
+    // A file is listed as a single entry without a name
+    ToProto("", it->second, resp.mutable_dirlist()->add_partiallisting());
+    resp.mutable_dirlist()->set_remainingentries(0);
+  } else if (it != inodes_.end()) {
+    std::vector<std::string> children;
+    for (const auto &inode : inodes_) {
+      if (inode.first != "/" && Parent(inode.first) == req.src() &&
+          Name(inode.first) > req.startafter()) {
+        children.push_back(inode.first);
+      }
+    }
+    std::sort(children.begin(), children.end(), [](const std::string &a, const std::string &b) {
+        return Name(a) < Name(b);
+      });
+    size_t count = std::min<size_t>(children.size(), listing_limit_);
+    auto dirlist = resp.mutable_dirlist();
+    for (size_t i = 0; i < count; ++i) {
+      ToProto(Name(children[i]), inodes_[children[i]], dirlist->add_partiallisting());
+    }
+    dirlist->set_remainingentries(children.size() - count);
+  }
+  *response = resp.SerializeAsString();
+  return Status::OK();
+}
+
+inline Status MockNamespace::Mkdirs(const std::string &request, std::string *response) {
+  ::hadoop::hdfs::MkdirsRequestProto req;
+  ::hadoop::hdfs::MkdirsResponseProto resp;
+  req.ParseFromString(request);
+  std::lock_guard<std::mutex> lock(lock_);
+  Status stat = CheckException(req.src());
+  if (!stat.ok()) {
+    return stat;
+  }
+  auto it = inodes_.find(req.src());
+  if (it != inodes_.end() && !it->second.directory) {
+    return Status::Exception("org.apache.hadoop.fs.FileAlreadyExistsException", req.src().c_str());
+  } else if (it == inodes_.end()) {
+    if (!req.createparent() && !inodes_.count(Parent(req.src()))) {
+      return Status::Exception("java.io.FileNotFoundException", Parent(req.src()).c_str());
+    }
+    AddLocked(req.src(), true, 0);
+  }
+  resp.set_result(true);
+  *response = resp.SerializeAsString();
+  return Status::OK();
+}
+
+inline Status MockNamespace::Delete(const std::string &request, std::string *response) {
+  ::hadoop::hdfs::DeleteRequestProto req;
+  ::hadoop::hdfs::DeleteResponseProto resp;
+  req.ParseFromString(request);
+  std::lock_guard<std::mutex> lock(lock_);
+  Status stat = CheckException(req.src());
+  if (!stat.ok()) {
+    return stat;
+  }
+  auto it = inodes_.find(req.src());
+  resp.set_result(it != inodes_.end());
+  if (it != inodes_.end() && it->second.directory && !req.recursive()) {
+    for (const auto &inode : inodes_) {
+      if (inode.first != req.src() && IsUnder(inode.first, req.src())) {
+        return Status::Exception("org.apache.hadoop.fs.PathIsNotEmptyDirectoryException",
+                                 req.src().c_str());
+      }
+    }
+  }
+  RemoveLocked(req.src());
+  *response = resp.SerializeAsString();
+  return Status::OK();
+}
+
+inline Status MockNamespace::Rename(const std::string &request, std::string *response) {
+  ::hadoop::hdfs::RenameRequestProto req;
+  ::hadoop::hdfs::RenameResponseProto resp;
+  req.ParseFromString(request);
+  std::lock_guard<std::mutex> lock(lock_);
+  Status stat = CheckException(req.src());
+  if (!stat.ok()) {
+    return stat;
+  }
+  // A destination directory receives the source as a child
+  std::string dst = req.dst();
+  auto it = inodes_.find(dst);
+  if (it != inodes_.end() && it->second.directory) {
+    dst = (dst == "/" ? "" : dst) + "/" + Name(req.src());
+  }
+  bool ok = req.src() != "/" && inodes_.count(req.src()) && !inodes_.count(dst) &&
+      inodes_.count(Parent(dst)) && !IsUnder(dst, req.src());
+  if (ok) {
+    std::map<std::string, Inode> moved;
+    for (const auto &inode : inodes_) {
+      if (IsUnder(inode.first, req.src())) {
+        moved[dst + inode.first.substr(req.src().size())] = inode.second;
+      }
+    }
+    RemoveLocked(req.src());
+    inodes_.insert(moved.begin(), moved.end());
+  }
+  resp.set_result(ok);
+  *response = resp.SerializeAsString();
+  return Status::OK();
+}
+
+}
+
+#endif
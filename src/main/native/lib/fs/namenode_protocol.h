@@ -19,22 +19,116 @@
 #define FS_NAMENODE_PROTOCOL_H_
 
 #include "ClientNamenodeProtocol.pb.h"
-#include "rpc/rpc_engine.h"
+#include "rpc/ha_rpc_engine.h"
+#include "rpc/single_flight.h"
+
+#include <future>
 
 namespace hdfs {
 
 class ClientNamenodeProtocol {
  public:
-  ClientNamenodeProtocol(RpcEngine *engine)
+  ClientNamenodeProtocol(HaRpcEngine *engine)
       : engine_(engine)
-  {}
+  {
+    // The methods marked as @Idempotent in ClientProtocol.java, which
+    // can be retried after a timeout or a lost connection.
+    engine_->set_idempotent_methods({
+        "getBlockLocations", "getServerDefaults", "setReplication",
+        "setPermission", "setOwner", "getAdditionalDatanode", "complete",
+        "reportBadBlocks", "mkdirs", "getListing", "renewLease",
+        "recoverLease", "getFsStats", "getDatanodeReport",
+        "getPreferredBlockSize", "setSafeMode", "rollEdits",
+        "restoreFailedStorage", "refreshNodes", "finalizeUpgrade",
+        "listCorruptFileBlocks", "metaSave", "setBalancerBandwidth",
+        "getFileInfo", "isFileClosed", "getFileLinkInfo",
+        "getContentSummary", "setQuota", "fsync", "setTimes",
+        "getLinkTarget", "updateBlockForPipeline", "getDataEncryptionKey",
+        "getSnapshottableDirListing", "getSnapshotDiffReport",
+        "listCacheDirectives", "listCachePools", "modifyAclEntries",
+        "removeAclEntries", "removeDefaultAcl", "removeAcl", "setAcl",
+        "getAclStatus", "getXAttrs", "listXAttrs", "checkAccess",
+        "getEZForPath", "listEncryptionZones", "getCurrentEditLogTxid",
+        "getEditsFromTxid",
+      });
+    // The idempotent methods that do not change the namespace. The
+    // identical calls of these methods that are issued at the same
+    // time share one call to the NameNode.
+    single_flight_.set_shared_methods({
+        "getBlockLocations", "getServerDefaults", "getListing",
+        "getFsStats", "getDatanodeReport", "getPreferredBlockSize",
+        "listCorruptFileBlocks", "getFileInfo", "isFileClosed",
+        "getFileLinkInfo", "getContentSummary", "getLinkTarget",
+        "getSnapshottableDirListing", "getSnapshotDiffReport",
+        "listCacheDirectives", "listCachePools", "getAclStatus",
+        "getXAttrs", "listXAttrs", "checkAccess", "getEZForPath",
+        "listEncryptionZones", "getDataEncryptionKey",
+      });
+  }
 
-  Status GetBlockLocations(const ::hadoop::hdfs::GetBlockLocationsRequestProto *request,
-                           std::shared_ptr<::hadoop::hdfs::GetBlockLocationsResponseProto> response) {
-    return engine_->Rpc("getBlockLocations", request, response);
+  /**
+   * A typed synchronous and asynchronous wrapper of every method of
+   * ClientNamenodeProtocol, e.g., for getFileInfo:
+   *
+   *   Status GetFileInfo(const GetFileInfoRequestProto *request,
+   *                      std::shared_ptr<GetFileInfoResponseProto> response);
+   *   void AsyncGetFileInfo(const GetFileInfoRequestProto *request,
+   *                         const std::shared_ptr<GetFileInfoResponseProto> &response,
+   *                         const Handler &handler);
+   *
+   * The list of the methods is generated from the service definition
+   * in ClientNamenodeProtocol.proto.
+   **/
+#define RPC_METHOD(method, Method, Request, Response)                  \
+  Status Method(const Request *request,                                 \
+                std::shared_ptr<Response> response) {                   \
+    return Call(#method, request, response);                            \
+  }                                                                     \
+                                                                        \
+  template<class Handler>                                               \
+  void Async##Method(const Request *request,                            \
+                     const std::shared_ptr<Response> &response,         \
+                     const Handler &handler) {                          \
+    AsyncCall(#method, request, response, handler);                     \
   }
+#include "ClientNamenodeProtocol.methods.h"
+#undef RPC_METHOD
+
  private:
-  RpcEngine *engine_;
+  HaRpcEngine *engine_;
+  SingleFlight single_flight_;
+
+  template <class Handler>
+  void AsyncCall(const char *method_name,
+                 const ::google::protobuf::MessageLite *request,
+                 const std::shared_ptr<::google::protobuf::MessageLite> &response,
+                 const Handler &handler) {
+    if (!single_flight_.IsShared(method_name)) {
+      SingleFlight *single_flight = &single_flight_;
+      engine_->AsyncRpc(method_name, request, response,
+                        [single_flight,handler](const Status &status) {
+                          single_flight->Invalidate();
+                          handler(status);
+                        });
+      return;
+    }
+
+    HaRpcEngine *engine = engine_;
+    single_flight_.Call(method_name, request, response, handler,
+                        [engine,method_name,request,response](const SingleFlight::Handler &h) {
+                          engine->AsyncRpc(method_name, request, response, h);
+                        });
+  }
+
+  Status Call(const char *method_name,
+              const ::google::protobuf::MessageLite *request,
+              const std::shared_ptr<::google::protobuf::MessageLite> &response) {
+    auto stat = std::make_shared<std::promise<Status>>();
+    std::future<Status> future(stat->get_future());
+    AsyncCall(method_name, request, response,
+              [stat](const Status &status) { stat->set_value(status); });
+    return future.get();
+  }
 };
 
 };
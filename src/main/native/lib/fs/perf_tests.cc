@@ -174,16 +174,21 @@ scan_info single_threaded_linear_scan(hdfsFS fs, hdfsFile file, size_t buffsize,
   scan_info info;
 
   std::vector<char> buffer;
-  buffer.reserve(buffsize);
+  buffer.resize(buffsize);
 
   std::chrono::time_point<std::chrono::system_clock> start, end;
   start = std::chrono::system_clock::now();  
 
   std::int64_t count = start_offset;
+  if(0 != hdfsSeek(fs, file, start_offset)) {
+    std::cerr << "failed to seek to " << start_offset << std::endl;
+    end_offset = -1;
+  }
+
+  //sequential reads stream through the blocks over a single DataNode connection per block
   while(count <= end_offset) {
-    std::int64_t read_bytes = hdfsPread(fs, file, count, &buffer[0], buffsize);
+    std::int64_t read_bytes = hdfsRead(fs, file, &buffer[0], buffsize);
     if(read_bytes <= 0) {
-      //todo: add some retry logic to step over block boundary
       break;
     } else {
       count += read_bytes;
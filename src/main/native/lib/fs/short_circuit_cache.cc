@@ -0,0 +1,214 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "short_circuit_cache.h"
+
+#include <ifaddrs.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace hdfs {
+
+using ::hadoop::hdfs::LocatedBlockProto;
+
+// How long a DataNode whose domain socket has failed is not used
+static const std::chrono::minutes kDisableTime(10);
+
+ShortCircuitCache::ShortCircuitCache(const Options &options)
+    : socket_path_(options.domain_socket_path)
+    , max_replicas_(options.max_short_circuit_replicas)
+    , expiry_(options.short_circuit_replica_expiry)
+{}
+
+bool ShortCircuitCache::IsLocalAddress(const ::asio::ip::address &address) {
+  if (address.is_loopback()) {
+    return true;
+  }
+
+  static std::once_flag once;
+  static std::vector<::asio::ip::address> *local_addresses;
+  std::call_once(once, []() {
+      local_addresses = new std::vector<::asio::ip::address>();
+      struct ifaddrs *ifaddr;
+      if (::getifaddrs(&ifaddr)) {
+        return;
+      }
+      for (struct ifaddrs *ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr) {
+          continue;
+        } else if (ifa->ifa_addr->sa_family == AF_INET) {
+          auto sin = reinterpret_cast<const struct sockaddr_in*>(ifa->ifa_addr);
+          ::asio::ip::address_v4::bytes_type bytes;
+          memcpy(bytes.data(), &sin->sin_addr, bytes.size());
+          local_addresses->push_back(::asio::ip::address_v4(bytes));
+        } else if (ifa->ifa_addr->sa_family == AF_INET6) {
+          auto sin6 = reinterpret_cast<const struct sockaddr_in6*>(ifa->ifa_addr);
+          ::asio::ip::address_v6::bytes_type bytes;
+          memcpy(bytes.data(), &sin6->sin6_addr, bytes.size());
+          local_addresses->push_back(::asio::ip::address_v6(bytes, sin6->sin6_scope_id));
+        }
+      }
+      ::freeifaddrs(ifaddr);
+    });
+  return std::find(local_addresses->begin(), local_addresses->end(), address) !=
+      local_addresses->end();
+}
+
+std::string ShortCircuitCache::SocketPath(const Endpoint &datanode) const {
+  std::string path = socket_path_;
+  size_t pos = path.find("_PORT");
+  if (pos != std::string::npos) {
+    path.replace(pos, 5, std::to_string(datanode.port()));
+  }
+  return path;
+}
+
+void ShortCircuitCache::AsyncGetReplica(
+    ::asio::io_service &io_service, const Endpoint &datanode,
+    const std::string &client_name, const LocatedBlockProto &block,
+    const std::function<void(const std::shared_ptr<ShortCircuitReplica> &)> &handler) {
+  const auto &b = block.b();
+  std::string path = SocketPath(datanode);
+  std::string key = path + "\n" + b.poolid() + "\n" + std::to_string(b.blockid()) +
+      "\n" + std::to_string(b.generationstamp());
+
+  std::shared_ptr<ShortCircuitReplica> replica;
+  std::shared_ptr<ShortCircuitShm> shm;
+  int slot = -1;
+  bool disabled = false;
+  bool create_segment = false;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto now = Clock::now();
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      auto entry = it->second;
+      if (entry->replica->IsValid() &&
+          (entry->replica->has_slot() || now - entry->fetched_at < expiry_)) {
+        lru_.splice(lru_.begin(), lru_, entry);
+        replica = entry->replica;
+      } else {
+        lru_.erase(entry);
+        index_.erase(it);
+      }
+    }
+
+    DataNode &dn = datanodes_[path];
+    if (!replica && now < dn.disabled_until) {
+      disabled = true;
+    } else if (!replica && now >= dn.segments_disabled_until) {
+      // The segments of a DataNode that has restarted are gone
+      dn.segments.erase(std::remove_if(dn.segments.begin(), dn.segments.end(),
+                                       [](const std::shared_ptr<ShortCircuitShm> &s) {
+                                         return !s->is_connected();
+                                       }),
+                        dn.segments.end());
+      for (const auto &segment : dn.segments) {
+        slot = segment->AllocateSlot();
+        if (slot >= 0) {
+          shm = segment;
+          break;
+        }
+      }
+      // The replicas requested while the new segment is on its way go
+      // without slots.
+      if (!shm && !dn.requesting_segment) {
+        dn.requesting_segment = true;
+        create_segment = true;
+      }
+    }
+  }
+
+  if (replica || disabled) {
+    handler(replica);
+  } else if (create_segment) {
+    ShortCircuitShm::AsyncCreate(io_service, path, client_name, [this,&io_service,path,key,block,handler](
+        const Status &status, const std::shared_ptr<ShortCircuitShm> &shm) {
+        OnSegmentCreated(io_service, path, key, block, status, shm, handler);
+      });
+  } else {
+    RequestReplica(io_service, path, key, block, shm, slot, handler);
+  }
+}
+
+void ShortCircuitCache::OnSegmentCreated(
+    ::asio::io_service &io_service, const std::string &path, const std::string &key,
+    const LocatedBlockProto &block, const Status &status,
+    const std::shared_ptr<ShortCircuitShm> &shm,
+    const std::function<void(const std::shared_ptr<ShortCircuitReplica> &)> &handler) {
+  int slot = -1;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    DataNode &dn = datanodes_[path];
+    dn.requesting_segment = false;
+    if (status.ok()) {
+      dn.segments.push_back(shm);
+      slot = shm->AllocateSlot();
+    } else {
+      dn.segments_disabled_until = Clock::now() + kDisableTime;
+    }
+  }
+  RequestReplica(io_service, path, key, block, slot >= 0 ? shm : nullptr, slot, handler);
+}
+
+void ShortCircuitCache::RequestReplica(
+    ::asio::io_service &io_service, const std::string &path, const std::string &key,
+    const LocatedBlockProto &block, const std::shared_ptr<ShortCircuitShm> &shm, int slot,
+    const std::function<void(const std::shared_ptr<ShortCircuitReplica> &)> &handler) {
+  AsyncRequestShortCircuitFds(io_service, path, block.b(), &block.blocktoken(), shm, slot,
+                              [this,path,key,handler](const Status &status,
+                                                      const std::shared_ptr<ShortCircuitReplica> &replica) {
+      {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!status.ok()) {
+          datanodes_[path].disabled_until = Clock::now() + kDisableTime;
+        } else if (replica) {
+          PutLocked(key, replica);
+        }
+      }
+      handler(replica);
+    });
+}
+
+void ShortCircuitCache::PutLocked(const std::string &key,
+                                  const std::shared_ptr<ShortCircuitReplica> &replica) {
+  /* assumed to be called from a context that has already acquired the lock_ */
+  if (!max_replicas_) {
+    return;
+  }
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+  lru_.push_front(Entry{key, replica, Clock::now()});
+  index_.insert(std::make_pair(key, lru_.begin()));
+  while (lru_.size() > max_replicas_) {
+    index_.erase(lru_.back().key);
+    lru_.pop_back();
+  }
+}
+
+size_t ShortCircuitCache::size() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return lru_.size();
+}
+
+}
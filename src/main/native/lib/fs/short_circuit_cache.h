@@ -0,0 +1,128 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FS_SHORT_CIRCUIT_CACHE_H_
+#define FS_SHORT_CIRCUIT_CACHE_H_
+
+#include "reader/short_circuit.h"
+#include "libhdfs++/options.h"
+
+#include "hdfs.pb.h"
+
+#include <asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace hdfs {
+
+/**
+ * The local replicas that the DataNodes on this host have passed for
+ * short-circuit reads, and the shared memory segments in which the
+ * DataNodes keep track of them.
+ *
+ * A replica stays in the cache, least recently used first, while the
+ * DataNode considers it valid, so that the subsequent reads of the
+ * block skip the request to the DataNode. A DataNode whose domain
+ * socket does not work is not asked again for a while, and its
+ * replicas are read over TCP in the meantime.
+ **/
+class ShortCircuitCache {
+ public:
+  typedef ::asio::ip::tcp::endpoint Endpoint;
+  typedef std::chrono::steady_clock Clock;
+
+  explicit ShortCircuitCache(const Options &options);
+  bool enabled() const { return !socket_path_.empty(); }
+
+  /**
+   * Return the first endpoint in [begin, end) of a DataNode on this
+   * host, or end if there is none.
+   **/
+  template<class Iterator>
+  Iterator FindLocalDataNode(Iterator begin, Iterator end);
+  /**
+   * Get the replica of the block on the local DataNode. The handler
+   * receives nullptr if the replica cannot be read locally.
+   **/
+  void AsyncGetReplica(::asio::io_service &io_service, const Endpoint &datanode,
+                       const std::string &client_name,
+                       const ::hadoop::hdfs::LocatedBlockProto &block,
+                       const std::function<void(const std::shared_ptr<ShortCircuitReplica> &)> &handler);
+  size_t size();
+
+  static bool IsLocalAddress(const ::asio::ip::address &address);
+
+ private:
+  struct DataNode {
+    std::vector<std::shared_ptr<ShortCircuitShm> > segments;
+    bool requesting_segment;
+    // The replicas are requested without slots until then
+    Clock::time_point segments_disabled_until;
+    Clock::time_point disabled_until;
+    DataNode() : requesting_segment(false) {}
+  };
+  struct Entry {
+    std::string key;
+    std::shared_ptr<ShortCircuitReplica> replica;
+    Clock::time_point fetched_at;
+  };
+  typedef std::list<Entry> LruList;
+
+  const std::string socket_path_;
+  const size_t max_replicas_;
+  const std::chrono::milliseconds expiry_;
+  std::mutex lock_;
+  // Keyed by the path of the domain socket of the DataNode
+  std::map<std::string, DataNode> datanodes_;
+  LruList lru_;
+  std::unordered_map<std::string, LruList::iterator> index_;
+
+  std::string SocketPath(const Endpoint &datanode) const;
+  void RequestReplica(::asio::io_service &io_service, const std::string &path,
+                      const std::string &key,
+                      const ::hadoop::hdfs::LocatedBlockProto &block,
+                      const std::shared_ptr<ShortCircuitShm> &shm, int slot,
+                      const std::function<void(const std::shared_ptr<ShortCircuitReplica> &)> &handler);
+  void OnSegmentCreated(::asio::io_service &io_service, const std::string &path,
+                        const std::string &key,
+                        const ::hadoop::hdfs::LocatedBlockProto &block,
+                        const Status &status, const std::shared_ptr<ShortCircuitShm> &shm,
+                        const std::function<void(const std::shared_ptr<ShortCircuitReplica> &)> &handler);
+  void PutLocked(const std::string &key, const std::shared_ptr<ShortCircuitReplica> &replica);
+};
+
+template<class Iterator>
+Iterator ShortCircuitCache::FindLocalDataNode(Iterator begin, Iterator end) {
+  if (!enabled()) {
+    return end;
+  }
+  for (Iterator it = begin; it != end; ++it) {
+    if (IsLocalAddress(it->address())) {
+      return it;
+    }
+  }
+  return end;
+}
+
+}
+
+#endif
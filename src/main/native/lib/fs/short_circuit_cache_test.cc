@@ -0,0 +1,216 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "short_circuit_cache.h"
+
+#include "reader/mock_datanode.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace hdfs {
+
+using namespace ::hadoop::hdfs;
+
+/*
+ * A ShortCircuitCache in front of a MockDataNode whose replicas are
+ * all backed by the same pair of temporary files.
+ */
+class ShortCircuitCacheTest : public ::testing::Test {
+ protected:
+  ::asio::io_service io_service_;
+  FILE *data_file_;
+  FILE *meta_file_;
+  const ShortCircuitCache::Endpoint datanode_ =
+      ShortCircuitCache::Endpoint(::asio::ip::address_v4::loopback(), 50010);
+
+  virtual void SetUp() override {
+    data_file_ = tmpfile();
+    meta_file_ = tmpfile();
+    std::string meta = {0, 1, static_cast<char>(CHECKSUM_NULL)};
+    uint32_t bpc = htonl(512);
+    meta.append(reinterpret_cast<const char*>(&bpc), sizeof(bpc));
+    ASSERT_EQ(meta.size(), pwrite(fileno(meta_file_), meta.data(), meta.size(), 0));
+  }
+
+  virtual void TearDown() override {
+    fclose(data_file_);
+    fclose(meta_file_);
+  }
+
+  int data_fd() const { return fileno(data_file_); }
+  int meta_fd() const { return fileno(meta_file_); }
+
+  static Options CacheOptions(const MockDataNode &dn) {
+    Options options;
+    options.domain_socket_path = dn.path();
+    return options;
+  }
+
+  static LocatedBlockProto Block(uint64_t id) {
+    LocatedBlockProto block;
+    block.mutable_b()->set_poolid("pool");
+    block.mutable_b()->set_blockid(id);
+    block.mutable_b()->set_generationstamp(1);
+    block.set_offset(0);
+    block.set_corrupt(false);
+    auto token = block.mutable_blocktoken();
+    token->set_identifier("");
+    token->set_password("");
+    token->set_kind("");
+    token->set_service("");
+    return block;
+  }
+
+  bool RunUntil(const std::function<bool()> &done) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!done()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      io_service_.poll();
+      io_service_.reset();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  std::shared_ptr<ShortCircuitReplica> GetReplica(ShortCircuitCache *cache, uint64_t id) {
+    std::shared_ptr<ShortCircuitReplica> replica;
+    bool called = false;
+    cache->AsyncGetReplica(io_service_, datanode_, "libhdfs++", Block(id), [&](
+        const std::shared_ptr<ShortCircuitReplica> &r) {
+        replica = r;
+        called = true;
+      });
+    EXPECT_TRUE(RunUntil([&called]() { return called; }));
+    return replica;
+  }
+};
+
+TEST_F(ShortCircuitCacheTest, TestFindLocalDataNode) {
+  MockDataNode dn(data_fd(), meta_fd());
+  std::vector<ShortCircuitCache::Endpoint> endpoints = {
+    ShortCircuitCache::Endpoint(::asio::ip::address::from_string("192.0.2.1"), 50010),
+    datanode_,
+  };
+  ShortCircuitCache cache(CacheOptions(dn));
+  ASSERT_TRUE(cache.enabled());
+  EXPECT_EQ(endpoints.begin() + 1, cache.FindLocalDataNode(endpoints.begin(), endpoints.end()));
+
+  ShortCircuitCache disabled((Options()));
+  ASSERT_FALSE(disabled.enabled());
+  EXPECT_EQ(endpoints.end(), disabled.FindLocalDataNode(endpoints.begin(), endpoints.end()));
+}
+
+TEST_F(ShortCircuitCacheTest, TestReplicaIsCached) {
+  MockDataNode dn(data_fd(), meta_fd());
+  ShortCircuitCache cache(CacheOptions(dn));
+
+  auto replica = GetReplica(&cache, 1);
+  ASSERT_TRUE(replica != nullptr);
+  EXPECT_TRUE(replica->has_slot());
+  EXPECT_EQ(1u, dn.requests(kRequestShortCircuitShm));
+  EXPECT_EQ(1u, dn.requests(kRequestShortCircuitFds));
+
+  EXPECT_EQ(replica, GetReplica(&cache, 1));
+  EXPECT_EQ(1u, dn.requests(kRequestShortCircuitFds));
+  EXPECT_EQ(1u, cache.size());
+
+  // Another block takes another slot of the same segment
+  int slot = dn.last_slot();
+  auto other = GetReplica(&cache, 2);
+  ASSERT_TRUE(other != nullptr);
+  EXPECT_NE(replica, other);
+  EXPECT_NE(slot, dn.last_slot());
+  EXPECT_EQ(1u, dn.requests(kRequestShortCircuitShm));
+  EXPECT_EQ(2u, dn.requests(kRequestShortCircuitFds));
+  EXPECT_EQ(2u, cache.size());
+}
+
+TEST_F(ShortCircuitCacheTest, TestInvalidReplicaIsRequestedAgain) {
+  MockDataNode dn(data_fd(), meta_fd());
+  ShortCircuitCache cache(CacheOptions(dn));
+
+  auto replica = GetReplica(&cache, 1);
+  ASSERT_TRUE(replica != nullptr);
+  dn.InvalidateSlot(dn.last_slot());
+  ASSERT_FALSE(replica->IsValid());
+
+  auto fresh = GetReplica(&cache, 1);
+  ASSERT_TRUE(fresh != nullptr);
+  EXPECT_NE(replica, fresh);
+  EXPECT_TRUE(fresh->IsValid());
+  EXPECT_EQ(2u, dn.requests(kRequestShortCircuitFds));
+  EXPECT_EQ(1u, cache.size());
+}
+
+TEST_F(ShortCircuitCacheTest, TestDroppedSegmentIsReplaced) {
+  MockDataNode dn(data_fd(), meta_fd());
+  ShortCircuitCache cache(CacheOptions(dn));
+
+  auto replica = GetReplica(&cache, 1);
+  ASSERT_TRUE(replica != nullptr);
+  // A DataNode that restarts drops the segments and their slots
+  dn.DropConnections();
+  ASSERT_TRUE(RunUntil([&replica]() { return !replica->IsValid(); }));
+
+  auto fresh = GetReplica(&cache, 1);
+  ASSERT_TRUE(fresh != nullptr);
+  EXPECT_TRUE(fresh->IsValid());
+  EXPECT_EQ(2u, dn.requests(kRequestShortCircuitShm));
+  EXPECT_EQ(2u, dn.requests(kRequestShortCircuitFds));
+}
+
+TEST_F(ShortCircuitCacheTest, TestFailingDataNodeIsDisabled) {
+  MockDataNode dn(data_fd(), meta_fd());
+  ShortCircuitCache cache(CacheOptions(dn));
+
+  dn.set_fds_status(ERROR_UNSUPPORTED);
+  EXPECT_TRUE(GetReplica(&cache, 1) == nullptr);
+  EXPECT_EQ(1u, dn.requests(kRequestShortCircuitFds));
+
+  // The DataNode is not asked again for a while
+  dn.set_fds_status(SUCCESS);
+  EXPECT_TRUE(GetReplica(&cache, 1) == nullptr);
+  EXPECT_EQ(1u, dn.requests(kRequestShortCircuitFds));
+  EXPECT_EQ(0u, cache.size());
+}
+
+TEST_F(ShortCircuitCacheTest, TestMaxReplicas) {
+  MockDataNode dn(data_fd(), meta_fd());
+  Options options = CacheOptions(dn);
+  options.max_short_circuit_replicas = 1;
+  ShortCircuitCache cache(options);
+
+  auto first = GetReplica(&cache, 1);
+  ASSERT_TRUE(first != nullptr);
+  ASSERT_TRUE(GetReplica(&cache, 2) != nullptr);
+  EXPECT_EQ(1u, cache.size());
+
+  // The least recently used replica has been evicted
+  EXPECT_NE(first, GetReplica(&cache, 1));
+  EXPECT_EQ(3u, dn.requests(kRequestShortCircuitFds));
+}
+
+}
@@ -0,0 +1,44 @@
+# Generate the list of the methods of a protobuf service as X-macros:
+#
+#   RPC_METHOD(method, Method, RequestType, ResponseType)
+#
+# where Method is the method name in upper camel case, and the types
+# are fully qualified C++ names.
+#
+# usage: cmake -DPROTO=<file.proto> -DPACKAGE=<package> -DOUTPUT=<file.h>
+#              -P generate_rpc_methods.cmake
+
+file(STRINGS ${PROTO} lines)
+set(content "")
+foreach(line ${lines})
+  string(REGEX REPLACE "//.*$" "" line "${line}")
+  set(content "${content} ${line}")
+endforeach()
+
+set(type "[A-Za-z0-9_.]+")
+set(rpc_regex "rpc[ \t]+([A-Za-z0-9_]+)[ \t]*\\([ \t]*(${type})[ \t]*\\)[ \t]*returns[ \t]*\\([ \t]*(${type})[ \t]*\\)")
+
+get_filename_component(name ${PROTO} NAME)
+set(out "// Generated from ${name} by generate_rpc_methods.cmake. Do not edit.\n")
+string(REGEX MATCHALL "${rpc_regex}" rpcs "${content}")
+foreach(rpc ${rpcs})
+  string(REGEX REPLACE "${rpc_regex}" "\\1;\\2;\\3" parts "${rpc}")
+  list(GET parts 0 method)
+  set(types "")
+  foreach(index 1 2)
+    list(GET parts ${index} t)
+    if(NOT t MATCHES "\\.")
+      set(t "${PACKAGE}.${t}")
+    endif()
+    string(REPLACE "." "::" t "::${t}")
+    list(APPEND types ${t})
+  endforeach()
+  list(GET types 0 request)
+  list(GET types 1 response)
+  string(SUBSTRING ${method} 0 1 head)
+  string(SUBSTRING ${method} 1 -1 tail)
+  string(TOUPPER ${head} head)
+  set(out "${out}RPC_METHOD(${method}, ${head}${tail}, ${request}, ${response})\n")
+endforeach()
+
+file(WRITE ${OUTPUT} "${out}")
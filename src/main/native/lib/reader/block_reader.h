@@ -22,7 +22,12 @@
 #include "libhdfs++/status.h"
 #include "datatransfer.pb.h"
 
+#include <asio/buffer.hpp>
+
+#include <algorithm>
+#include <array>
 #include <memory>
+#include <vector>
 
 namespace hdfs {
 
@@ -35,12 +40,38 @@ class RemoteBlockReader : public std::enable_shared_from_this<RemoteBlockReader<
       , state_(kOpen)
       , options_(options)
       , chunk_padding_bytes_(0)
+      , bytes_to_read_(0)
+      , header_bytes_(0)
+      , data_len_(0)
+      , checksum_len_(0)
+      , checksum_read_bytes_(0)
+      , packet_data_read_bytes_(0)
+      , iov_user_bytes_(0)
+      , checksum_type_(hadoop::hdfs::CHECKSUM_NULL)
+      , bytes_per_checksum_(0)
+      , chunk_index_(0)
+      , chunk_bytes_(0)
+      , chunk_crc_(0)
   {}
 
+  /**
+   * Read the data of at most one packet into the buffers. The reader
+   * and the buffers must stay alive until the handler is called.
+   **/
   template<class MutableBufferSequence, class ReadHandler>
   void async_read_some(const MutableBufferSequence& buffers,
                        const ReadHandler &handler);
 
+  /**
+   * Read packets until the buffers are full or the requested range of
+   * the block has been read, and call the handler once at the end. The
+   * reader and the buffers must stay alive until the handler is
+   * called.
+   **/
+  template<class MutableBufferSequence, class ReadHandler>
+  void async_read(const MutableBufferSequence& buffers,
+                  const ReadHandler &handler);
+
   template<class MutableBufferSequence>
   size_t read_some(const MutableBufferSequence &buffers, Status *status);
 
@@ -56,31 +87,98 @@ class RemoteBlockReader : public std::enable_shared_from_this<RemoteBlockReader<
                  uint64_t length, uint64_t offset,
                  const ConnectHandler &handler);
 
+  /**
+   * Whether the reader has consumed the whole response of the
+   * OP_READ_BLOCK request and acknowledged it. The underlying
+   * connection can be reused for another request only in this state.
+   **/
+  bool is_finished() const { return state_ == kFinished; }
+
  private:
-  struct ReadPacketHeader;
-  struct ReadChecksum;
-  struct ReadPadding;
-  template<class MutableBufferSequence>
-  struct ReadData;
-  struct AckRead;
+  template<class MutableBufferSequence, class ReadHandler>
+  struct ReadPacketOp;
+  struct BufferRange;
   enum State {
     kOpen,
     kReadPacketHeader,
-    kReadChecksum,
-    kReadPadding,
     kReadData,
     kFinished,
   };
+  static const size_t kMaxPacketHeaderSize = 512;
+  static const size_t kPacketHeaderStart = sizeof(uint32_t) + sizeof(uint16_t);
+  // The size of a PacketHeaderProto with only the required fields, which
+  // all have fixed lengths. A header is never shorter, thus reading
+  // this many bytes never reads into the checksums of the packet.
+  static const size_t kMinPacketHeaderSize = 25;
 
   Stream *stream_;
   hadoop::hdfs::PacketHeaderProto header_;
   State state_;
   BlockReaderOptions options_;
-  size_t packet_len_;
-  int packet_data_read_bytes_;
   int chunk_padding_bytes_;
   long long bytes_to_read_;
+  /*
+   * The buffers of the packet being read, which are reused across the
+   * packets. The header is parsed in place once it has been read. The
+   * checksums of the packet are read into checksum_, followed by the
+   * data that is not returned to the user, i.e., the padding before
+   * the requested range and the data after it. The rest of the data
+   * goes directly into the buffers of the user, in the same read as
+   * the checksums. The read that completes a packet also reads the
+   * beginning of the header of the next packet.
+   */
+  std::array<char, kMaxPacketHeaderSize> header_buf_;
+  size_t header_bytes_;
+  size_t data_len_;
+  size_t checksum_len_;
   std::vector<char> checksum_;
+  size_t checksum_read_bytes_;
+  size_t packet_data_read_bytes_;
+  std::vector<asio::mutable_buffer> iov_;
+  size_t iov_user_bytes_;
+  std::array<char, 16> read_status_buf_;
+  /*
+   * States of the checksum verification. The data of a packet can be
+   * delivered in several pieces (the padding, the buffers of the
+   * user, and the rest of the last packet), thus the checksum of the
+   * current chunk is computed incrementally.
+   */
+  hadoop::hdfs::ChecksumTypeProto checksum_type_;
+  unsigned bytes_per_checksum_;
+  size_t chunk_index_;
+  unsigned chunk_bytes_;
+  uint32_t chunk_crc_;
+
+  size_t PacketHeaderBytesNeeded() const;
+  Status OnPacketHeaderRead(size_t transferred);
+  Status ParsePacketHeader();
+  // The bytes of the data to discard that have not been read yet
+  size_t PendingDiscardBytes() const
+  { return checksum_.size() - std::max(checksum_read_bytes_, checksum_len_); }
+  /*
+   * Fill iov_ with the next read of the current packet, i.e., the rest
+   * of the checksums and of the data to discard, followed by up to
+   * max_user bytes of data for the buffers starting at the offset, and
+   * by the header of the next packet if the read reaches the end of
+   * the packet. Return the number of bytes to read.
+   */
+  template<class MutableBufferSequence>
+  size_t PrepareDataRead(const MutableBufferSequence &buffers, size_t offset,
+                         size_t max_user);
+  template<class MutableBufferSequence>
+  Status OnDataRead(const MutableBufferSequence &buffers, size_t offset,
+                    size_t transferred, size_t *user_transferred,
+                    bool *end_of_packet);
+  // Discard the rest of the data of the current packet
+  void SkipRestOfPacket();
+  size_t SerializeReadStatus();
+
+  bool verifying_checksum() const;
+  template<class MutableBufferSequence>
+  Status UpdateChecksum(const MutableBufferSequence &buffers, size_t offset,
+                        size_t length);
+  Status UpdateChecksum(const char *data, size_t length);
+  Status VerifyChunk();
 };
 
 }
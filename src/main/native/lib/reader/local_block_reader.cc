@@ -0,0 +1,191 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "local_block_reader.h"
+
+#include "common/checksum.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace hdfs {
+
+using namespace ::hadoop::hdfs;
+
+LocalBlockReader::LocalBlockReader(const BlockReaderOptions &options,
+                                   const std::shared_ptr<ShortCircuitReplica> &replica,
+                                   uint64_t offset, uint64_t length)
+    : options_(options)
+    , replica_(replica)
+    , offset_(offset)
+    , end_(offset + length)
+    , read_ahead_end_(offset)
+{}
+
+bool LocalBlockReader::verifying_checksum() const {
+  return options_.verify_checksum && replica_->checksum_type() != CHECKSUM_NULL;
+}
+
+ssize_t LocalBlockReader::ReadFully(int fd, struct iovec *iov, int count, uint64_t offset) {
+  ssize_t total = 0;
+  while (count) {
+    ssize_t n = ::preadv(fd, iov, count, offset + total);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return n < 0 ? n : total;
+    }
+    total += n;
+    // Skip the buffers that have been filled
+    while (count && static_cast<size_t>(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return total;
+}
+
+Status LocalBlockReader::ReadBuffers(size_t length, size_t *transferred) {
+  *transferred = 0;
+  if (!length) {
+    return Status::OK();
+  }
+
+  const unsigned bpc = replica_->bytes_per_checksum();
+  uint64_t begin = offset_;
+  size_t head = 0, tail = 0;
+  if (verifying_checksum()) {
+    begin = offset_ / bpc * bpc;
+    head = offset_ - begin;
+    tail = (bpc - (offset_ + length) % bpc) % bpc;
+    head_.resize(bpc);
+    tail_.resize(bpc);
+  }
+  read_iov_.clear();
+  if (head) {
+    read_iov_.push_back(iovec{head_.data(), head});
+  }
+  read_iov_.insert(read_iov_.end(), iov_.begin(), iov_.end());
+  if (tail) {
+    read_iov_.push_back(iovec{tail_.data(), tail});
+  }
+
+  ssize_t n = ReadFully(replica_->data_fd(), read_iov_.data(), read_iov_.size(), begin);
+  if (n < 0) {
+    replica_->set_failed();
+    return Status(errno, strerror(errno));
+  } else if (static_cast<size_t>(n) < head + length) {
+    // The last chunk of the block can be shorter, the range cannot
+    replica_->set_failed();
+    return Status::Error("Unexpected end of the block file");
+  }
+
+  if (verifying_checksum()) {
+    Status status = VerifyChunks(begin, n);
+    if (!status.ok()) {
+      replica_->set_failed();
+      return status;
+    }
+  }
+  offset_ += length;
+  *transferred = length;
+  AdviseCache(begin, n);
+  return Status::OK();
+}
+
+void LocalBlockReader::AdviseCache(uint64_t begin, size_t length) {
+  const CacheStrategy &cache = options_.cache_strategy;
+  int fd = replica_->data_fd();
+  if (cache.drop_behind_specified && cache.drop_behind) {
+    ::posix_fadvise(fd, begin, length, POSIX_FADV_DONTNEED);
+  }
+
+  // Extend the read-ahead once half of the advised range has been read
+  if (cache.read_ahead_specified && cache.read_ahead && read_ahead_end_ < end_ &&
+      read_ahead_end_ - std::min(offset_, read_ahead_end_) < cache.read_ahead / 2) {
+    uint64_t from = std::max(offset_, read_ahead_end_);
+    uint64_t to = std::min<uint64_t>(offset_ + cache.read_ahead, end_);
+    ::posix_fadvise(fd, from, to - from, POSIX_FADV_WILLNEED);
+    read_ahead_end_ = to;
+  }
+}
+
+Status LocalBlockReader::VerifyChunks(uint64_t begin, size_t length) {
+  const unsigned bpc = replica_->bytes_per_checksum();
+  size_t chunks = (length + bpc - 1) / bpc;
+  checksums_.resize(chunks * sizeof(uint32_t));
+  uint64_t offset = ShortCircuitReplica::kMetaHeaderSize + begin / bpc * sizeof(uint32_t);
+  size_t read = 0;
+  while (read < checksums_.size()) {
+    ssize_t n = ::pread(replica_->meta_fd(), &checksums_[read], checksums_.size() - read,
+                        offset + read);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return Status::Error("Cannot read the checksums from the meta file");
+    }
+    read += n;
+  }
+
+  // The chunks span the head, the buffers of the caller and the tail
+  const bool crc32c = replica_->checksum_type() == CHECKSUM_CRC32C;
+  size_t head = begin < offset_ ? offset_ - begin : 0;
+  read_iov_.clear();
+  if (head) {
+    read_iov_.push_back(iovec{head_.data(), head});
+  }
+  read_iov_.insert(read_iov_.end(), iov_.begin(), iov_.end());
+  read_iov_.push_back(iovec{tail_.data(), tail_.size()});
+
+  size_t chunk = 0, chunk_bytes = 0;
+  uint32_t crc = 0;
+  for (const auto &v : read_iov_) {
+    const char *data = static_cast<const char*>(v.iov_base);
+    size_t size = std::min(v.iov_len, length);
+    length -= size;
+    while (size) {
+      size_t n = std::min<size_t>(size, bpc - chunk_bytes);
+      crc = crc32c ? Crc32c(crc, data, n) : Crc32(crc, data, n);
+      chunk_bytes += n;
+      data += n;
+      size -= n;
+      if (chunk_bytes == bpc || (!size && !length)) {
+        uint32_t expected;
+        memcpy(&expected, &checksums_[chunk * sizeof(expected)], sizeof(expected));
+        if (ntohl(expected) != crc) {
+          return Status::ChecksumMismatch("Checksum mismatch in the block file");
+        }
+        ++chunk;
+        chunk_bytes = 0;
+        crc = 0;
+      }
+    }
+  }
+  return Status::OK();
+}
+
+}
@@ -0,0 +1,103 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_READER_LOCAL_BLOCK_READER_H_
+#define LIB_READER_LOCAL_BLOCK_READER_H_
+
+#include "short_circuit.h"
+#include "libhdfs++/options.h"
+
+#include <asio/buffer.hpp>
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * Reads a range of a local replica from its block file, and verifies
+ * the data against the checksums in the meta file. The range is read
+ * sequentially by successive calls of Read(), each of which fills the
+ * buffers with a single preadv() on the calling thread, as the data
+ * mostly comes from the page cache.
+ *
+ * The checksums cover whole chunks, thus the parts of the first and
+ * the last chunks outside of the range are read into scratch buffers.
+ *
+ * The cache strategy of the options applies to the page cache of this
+ * host as the DataNode would apply it: the data that has been read is
+ * dropped with drop-behind, and the read-ahead is requested with
+ * posix_fadvise().
+ **/
+class LocalBlockReader {
+ public:
+  LocalBlockReader(const BlockReaderOptions &options,
+                   const std::shared_ptr<ShortCircuitReplica> &replica,
+                   uint64_t offset, uint64_t length);
+
+  /**
+   * Read the next bytes of the range into the buffers, until either
+   * the buffers are full or the range ends.
+   **/
+  template<class MutableBufferSequence>
+  Status Read(const MutableBufferSequence &buffers, size_t *transferred);
+  bool is_finished() const { return offset_ == end_; }
+
+ private:
+  const BlockReaderOptions options_;
+  const std::shared_ptr<ShortCircuitReplica> replica_;
+  uint64_t offset_;
+  const uint64_t end_;
+  // The end of the range that has been advised to be read ahead
+  uint64_t read_ahead_end_;
+  std::vector<char> head_;
+  std::vector<char> tail_;
+  std::vector<char> checksums_;
+  std::vector<struct iovec> iov_;
+  // The head and the tail of the chunks around iov_, which preadv()
+  // consumes. Kept across the reads to avoid allocating it every time.
+  std::vector<struct iovec> read_iov_;
+
+  bool verifying_checksum() const;
+  // Read into the buffers in iov_, which hold length bytes
+  Status ReadBuffers(size_t length, size_t *transferred);
+  Status VerifyChunks(uint64_t begin, size_t length);
+  void AdviseCache(uint64_t begin, size_t length);
+  ssize_t ReadFully(int fd, struct iovec *iov, int count, uint64_t offset);
+};
+
+template<class MutableBufferSequence>
+Status LocalBlockReader::Read(const MutableBufferSequence &buffers, size_t *transferred) {
+  uint64_t remaining = end_ - offset_;
+  size_t length = 0;
+  iov_.clear();
+  for (auto it = buffers.begin(); it != buffers.end() && length < remaining; ++it) {
+    size_t size = std::min<uint64_t>(::asio::buffer_size(*it), remaining - length);
+    if (size) {
+      iov_.push_back(iovec{::asio::buffer_cast<void*>(*it), size});
+      length += size;
+    }
+  }
+  return ReadBuffers(length, transferred);
+}
+
+}
+
+#endif
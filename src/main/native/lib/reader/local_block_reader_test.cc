@@ -0,0 +1,395 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "local_block_reader.h"
+#include "mock_datanode.h"
+
+#include "common/checksum.h"
+
+#include <asio/local/connect_pair.hpp>
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace hdfs {
+
+using namespace ::hadoop::hdfs;
+
+static const unsigned kBytesPerChecksum = 512;
+static const size_t kBlockLength = 3000;
+
+/*
+ * A replica whose block and meta files are anonymous temporary files.
+ * The last chunk of the block is partial.
+ */
+class LocalBlockReaderTest : public ::testing::Test {
+ protected:
+  std::vector<char> data_;
+  FILE *data_file_;
+  FILE *meta_file_;
+  std::shared_ptr<ShortCircuitReplica> replica_;
+
+  virtual void SetUp() override {
+    data_.resize(kBlockLength);
+    for (size_t i = 0; i < data_.size(); ++i) {
+      data_[i] = static_cast<char>(i * 7);
+    }
+
+    std::string meta = {0, 1, static_cast<char>(CHECKSUM_CRC32C)};
+    uint32_t bpc = htonl(kBytesPerChecksum);
+    meta.append(reinterpret_cast<const char*>(&bpc), sizeof(bpc));
+    for (size_t i = 0; i < data_.size(); i += kBytesPerChecksum) {
+      size_t n = std::min<size_t>(kBytesPerChecksum, data_.size() - i);
+      uint32_t crc = htonl(Crc32c(0, &data_[i], n));
+      meta.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    }
+
+    data_file_ = tmpfile();
+    meta_file_ = tmpfile();
+    int data_fd = fileno(data_file_);
+    int meta_fd = fileno(meta_file_);
+    ASSERT_EQ(data_.size(), pwrite(data_fd, data_.data(), data_.size(), 0));
+    ASSERT_EQ(meta.size(), pwrite(meta_fd, meta.data(), meta.size(), 0));
+    // The replica takes the file descriptors over
+    replica_ = std::make_shared<ShortCircuitReplica>(dup(data_fd), dup(meta_fd), nullptr, -1);
+    ASSERT_TRUE(replica_->ReadMetaHeader().ok());
+  }
+
+  virtual void TearDown() override {
+    fclose(data_file_);
+    fclose(meta_file_);
+  }
+};
+
+TEST_F(LocalBlockReaderTest, TestReadUnaligned) {
+  LocalBlockReader reader(BlockReaderOptions(), replica_, 100, kBlockLength - 100);
+  std::vector<char> a(1000), b(5000);
+  std::vector<::asio::mutable_buffer> buffers = {::asio::buffer(a), ::asio::buffer(b)};
+  size_t transferred = 0;
+  ASSERT_TRUE(reader.Read(buffers, &transferred).ok());
+  ASSERT_EQ(kBlockLength - 100, transferred);
+  ASSERT_TRUE(reader.is_finished());
+  ASSERT_TRUE(std::equal(a.begin(), a.end(), data_.begin() + 100));
+  ASSERT_TRUE(std::equal(b.begin(), b.begin() + transferred - a.size(), data_.begin() + 1100));
+}
+
+TEST_F(LocalBlockReaderTest, TestReadSequentially) {
+  LocalBlockReader reader(BlockReaderOptions(), replica_, 700, 1000);
+  std::vector<char> buf(300);
+  for (size_t offset = 700; offset < 1700; offset += 300) {
+    size_t transferred = 0;
+    ASSERT_TRUE(reader.Read(::asio::buffer(buf), &transferred).ok());
+    ASSERT_EQ(std::min<size_t>(300, 1700 - offset), transferred);
+    ASSERT_TRUE(std::equal(buf.begin(), buf.begin() + transferred, data_.begin() + offset));
+  }
+  ASSERT_TRUE(reader.is_finished());
+}
+
+TEST_F(LocalBlockReaderTest, TestChecksumMismatch) {
+  char corrupted = data_[2900] + 1;
+  ASSERT_EQ(1, pwrite(replica_->data_fd(), &corrupted, 1, 2900));
+
+  std::vector<char> buf(100);
+  size_t transferred = 0;
+  LocalBlockReader good(BlockReaderOptions(), replica_, 0, 100);
+  ASSERT_TRUE(good.Read(::asio::buffer(buf), &transferred).ok());
+
+  LocalBlockReader bad(BlockReaderOptions(), replica_, 2950, 50);
+  ASSERT_FALSE(bad.Read(::asio::buffer(buf), &transferred).ok());
+  ASSERT_FALSE(replica_->IsValid());
+
+  BlockReaderOptions options;
+  options.verify_checksum = false;
+  LocalBlockReader unverified(options, replica_, 2900, 100);
+  ASSERT_TRUE(unverified.Read(::asio::buffer(buf), &transferred).ok());
+  ASSERT_EQ(corrupted, buf[0]);
+}
+
+/*
+ * The exchanges with the DataNode over domain sockets, either with a
+ * socketpair whose other end the test plays, or with a MockDataNode
+ * that passes the files of the replica of LocalBlockReaderTest.
+ */
+class ShortCircuitTest : public LocalBlockReaderTest {
+ protected:
+  ::asio::io_service io_service_;
+
+  int data_fd() const { return fileno(data_file_); }
+  int meta_fd() const { return fileno(meta_file_); }
+
+  static bool IsSameFile(int fd1, int fd2) {
+    struct stat st1, st2;
+    return !fstat(fd1, &st1) && !fstat(fd2, &st2) &&
+        st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+  }
+
+  static std::string Delimited(const ::google::protobuf::MessageLite &msg) {
+    namespace pbio = ::google::protobuf::io;
+    std::string buf;
+    pbio::StringOutputStream ss(&buf);
+    pbio::CodedOutputStream os(&ss);
+    os.WriteVarint32(static_cast<uint32_t>(msg.ByteSizeLong()));
+    msg.SerializeWithCachedSizes(&os);
+    return buf;
+  }
+
+  static OpRequestShortCircuitAccessProto FdsRequest() {
+    OpRequestShortCircuitAccessProto req;
+    auto block = req.mutable_header()->mutable_block();
+    block->set_poolid("pool");
+    block->set_blockid(1);
+    block->set_generationstamp(1);
+    req.set_maxversion(1);
+    return req;
+  }
+
+  Status RunOp(const std::shared_ptr<DomainSocket> &socket, BlockOpResponseProto *response,
+               std::vector<int> *fds) {
+    Status stat = Status::Error("not called");
+    AsyncDomainSocketOp(socket, kRequestShortCircuitFds, FdsRequest(), response, fds,
+                        [&stat](const Status &status) { stat = status; });
+    io_service_.run();
+    io_service_.reset();
+    return stat;
+  }
+
+  /*
+   * Run the handlers until done() holds, as the segments keep a read
+   * pending on their connections for good.
+   */
+  bool RunUntil(const std::function<bool()> &done) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!done()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      io_service_.poll();
+      io_service_.reset();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  std::shared_ptr<ShortCircuitShm> CreateShm(const MockDataNode &dn) {
+    Status stat = Status::Error("not called");
+    std::shared_ptr<ShortCircuitShm> shm;
+    bool called = false;
+    ShortCircuitShm::AsyncCreate(io_service_, dn.path(), "libhdfs++", [&](
+        const Status &status, const std::shared_ptr<ShortCircuitShm> &s) {
+        stat = status;
+        shm = s;
+        called = true;
+      });
+    EXPECT_TRUE(RunUntil([&called]() { return called; }));
+    EXPECT_TRUE(stat.ok());
+    return shm;
+  }
+
+  Status RequestFds(const MockDataNode &dn, const std::shared_ptr<ShortCircuitShm> &shm,
+                    int slot, std::shared_ptr<ShortCircuitReplica> *replica) {
+    Status stat = Status::Error("not called");
+    bool called = false;
+    AsyncRequestShortCircuitFds(io_service_, dn.path(), FdsRequest().header().block(),
+                                nullptr, shm, slot, [&](
+        const Status &status, const std::shared_ptr<ShortCircuitReplica> &r) {
+        stat = status;
+        *replica = r;
+        called = true;
+      });
+    EXPECT_TRUE(RunUntil([&called]() { return called; }));
+    return stat;
+  }
+};
+
+TEST_F(ShortCircuitTest, TestDomainSocketOpReceivesFds) {
+  BlockOpResponseProto resp;
+  resp.set_status(SUCCESS);
+  std::string buf = Delimited(resp);
+
+  for (bool with_response : {false, true}) {
+    auto socket = std::make_shared<DomainSocket>(io_service_);
+    DomainSocket peer(io_service_);
+    ::asio::local::connect_pair(*socket, peer);
+    int sock = peer.native_handle();
+
+    if (with_response) {
+      // The file descriptors come with the first byte of the response,
+      // which is received along with the length of the message.
+      ASSERT_TRUE(MockDataNode::SendWithFds(sock, (buf + '\0').data(), buf.size() + 1,
+                                            {data_fd(), meta_fd()}));
+    } else {
+      for (char c : buf) {
+        ASSERT_EQ(1, send(sock, &c, 1, 0));
+      }
+      ASSERT_TRUE(MockDataNode::SendWithFds(sock, "", 1, {data_fd(), meta_fd()}));
+    }
+
+    BlockOpResponseProto response;
+    std::vector<int> fds;
+    ASSERT_TRUE(RunOp(socket, &response, &fds).ok());
+    EXPECT_EQ(SUCCESS, response.status());
+    ASSERT_EQ(2u, fds.size());
+    EXPECT_TRUE(IsSameFile(data_fd(), fds[0]));
+    EXPECT_TRUE(IsSameFile(meta_fd(), fds[1]));
+    for (int fd : fds) {
+      close(fd);
+    }
+
+    char header[3];
+    OpRequestShortCircuitAccessProto req;
+    ASSERT_TRUE(MockDataNode::ReadFully(sock, header, sizeof(header)));
+    EXPECT_EQ(kRequestShortCircuitFds, header[2]);
+    ASSERT_TRUE(MockDataNode::ReadDelimited(sock, &req));
+    EXPECT_EQ(1u, req.header().block().blockid());
+  }
+}
+
+TEST_F(ShortCircuitTest, TestDomainSocketOpWithoutFds) {
+  auto socket = std::make_shared<DomainSocket>(io_service_);
+  DomainSocket peer(io_service_);
+  ::asio::local::connect_pair(*socket, peer);
+
+  // The fds do not follow a failed response
+  BlockOpResponseProto resp;
+  resp.set_status(ERROR);
+  ASSERT_TRUE(MockDataNode::WriteDelimited(peer.native_handle(), resp));
+  BlockOpResponseProto response;
+  std::vector<int> fds;
+  ASSERT_TRUE(RunOp(socket, &response, &fds).ok());
+  EXPECT_EQ(ERROR, response.status());
+  EXPECT_TRUE(fds.empty());
+
+  // A successful response must pass them
+  resp.set_status(SUCCESS);
+  ASSERT_TRUE(MockDataNode::WriteDelimited(peer.native_handle(), resp));
+  ASSERT_TRUE(MockDataNode::SendWithFds(peer.native_handle(), "", 1, {}));
+  EXPECT_FALSE(RunOp(socket, &response, &fds).ok());
+  EXPECT_TRUE(fds.empty());
+}
+
+TEST_F(ShortCircuitTest, TestDomainSocketOpClosed) {
+  auto socket = std::make_shared<DomainSocket>(io_service_);
+  DomainSocket peer(io_service_);
+  ::asio::local::connect_pair(*socket, peer);
+
+  BlockOpResponseProto resp;
+  resp.set_status(SUCCESS);
+  std::string buf = Delimited(resp);
+  ASSERT_EQ(2, send(peer.native_handle(), buf.data(), 2, 0));
+  peer.close();
+
+  BlockOpResponseProto response;
+  std::vector<int> fds;
+  EXPECT_FALSE(RunOp(socket, &response, &fds).ok());
+  EXPECT_TRUE(fds.empty());
+}
+
+TEST_F(ShortCircuitTest, TestShmSlots) {
+  MockDataNode dn(data_fd(), meta_fd());
+  auto shm = CreateShm(dn);
+  ASSERT_TRUE(shm != nullptr);
+  EXPECT_EQ(1u, dn.requests(kRequestShortCircuitShm));
+  EXPECT_TRUE(shm->is_connected());
+
+  const int slots = MockDataNode::kShmSize / ShortCircuitShm::kSlotSize;
+  for (int i = 0; i < slots; ++i) {
+    ASSERT_EQ(i, shm->AllocateSlot());
+    ASSERT_TRUE(shm->IsSlotValid(i));
+  }
+  EXPECT_EQ(-1, shm->AllocateSlot());
+
+  dn.InvalidateSlot(3);
+  EXPECT_FALSE(shm->IsSlotValid(3));
+  EXPECT_TRUE(shm->IsSlotValid(4));
+
+  shm->FreeSlot(5);
+  EXPECT_EQ(5, shm->AllocateSlot());
+
+  // The slot is free once the DataNode has unregistered it
+  shm->ReleaseSlot(7);
+  EXPECT_FALSE(shm->IsSlotValid(7));
+  int slot = -1;
+  ASSERT_TRUE(RunUntil([&shm,&slot]() { return (slot = shm->AllocateSlot()) >= 0; }));
+  EXPECT_EQ(7, slot);
+  EXPECT_EQ(std::vector<int>({7}), dn.released_slots());
+
+  // The DataNode drops the segment along with the connection
+  dn.DropConnections();
+  ASSERT_TRUE(RunUntil([&shm]() { return !shm->is_connected(); }));
+  EXPECT_FALSE(shm->IsSlotValid(0));
+}
+
+TEST_F(ShortCircuitTest, TestRequestFds) {
+  MockDataNode dn(data_fd(), meta_fd());
+  auto shm = CreateShm(dn);
+  ASSERT_TRUE(shm != nullptr);
+  int slot = shm->AllocateSlot();
+
+  std::shared_ptr<ShortCircuitReplica> replica;
+  ASSERT_TRUE(RequestFds(dn, shm, slot, &replica).ok());
+  ASSERT_TRUE(replica != nullptr);
+  EXPECT_EQ(slot, dn.last_slot());
+  EXPECT_TRUE(replica->IsValid());
+  EXPECT_TRUE(IsSameFile(data_fd(), replica->data_fd()));
+  EXPECT_EQ(CHECKSUM_CRC32C, replica->checksum_type());
+  EXPECT_EQ(kBytesPerChecksum, replica->bytes_per_checksum());
+
+  {
+    LocalBlockReader reader(BlockReaderOptions(), replica, 0, kBlockLength);
+    std::vector<char> buf(kBlockLength);
+    size_t transferred = 0;
+    ASSERT_TRUE(reader.Read(::asio::buffer(buf), &transferred).ok());
+    ASSERT_EQ(data_, buf);
+  }
+
+  dn.InvalidateSlot(slot);
+  EXPECT_FALSE(replica->IsValid());
+
+  // The last reference releases the slot
+  replica.reset();
+  ASSERT_TRUE(RunUntil([&dn]() { return !dn.released_slots().empty(); }));
+  EXPECT_EQ(std::vector<int>({slot}), dn.released_slots());
+}
+
+TEST_F(ShortCircuitTest, TestRequestFdsRefused) {
+  MockDataNode dn(data_fd(), meta_fd());
+  auto shm = CreateShm(dn);
+  ASSERT_TRUE(shm != nullptr);
+  int slot = shm->AllocateSlot();
+
+  // The DataNode does not share this replica, and the slot is freed
+  dn.set_fds_status(ERROR);
+  std::shared_ptr<ShortCircuitReplica> replica;
+  ASSERT_TRUE(RequestFds(dn, shm, slot, &replica).ok());
+  EXPECT_TRUE(replica == nullptr);
+  EXPECT_EQ(slot, shm->AllocateSlot());
+
+  dn.set_fds_status(ERROR_UNSUPPORTED);
+  EXPECT_FALSE(RequestFds(dn, nullptr, -1, &replica).ok());
+  EXPECT_TRUE(replica == nullptr);
+  EXPECT_EQ(-1, dn.last_slot());
+}
+
+}
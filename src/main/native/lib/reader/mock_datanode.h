@@ -0,0 +1,706 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_READER_MOCK_DATANODE_H_
+#define LIB_READER_MOCK_DATANODE_H_
+
+#include "common/checksum.h"
+#include "common/cipher.h"
+#include "common/datatransfer.h"
+#include "common/util.h"
+#include "datatransfer.pb.h"
+
+#include <asio/ip/tcp.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * A DataNode for the tests. It serves OP_READ_BLOCK on a port of the
+ * loopback interface, with the content of BlockData(). It answers the
+ * short-circuit operations on a UNIX domain socket in a temporary
+ * directory. There it passes the file descriptors of a single replica
+ * for every block, and a segment of shared memory whose slots it can
+ * invalidate. Each connection is served by its own thread.
+ *
+ * With an encryption key the TCP port requires the SASL handshake of
+ * dfs.encrypt.data.transfer, i.e., DIGEST-MD5 with the auth-conf QOP
+ * and the AES/CTR/NoPadding cipher suite.
+ **/
+class MockDataNode {
+ public:
+  static const size_t kShmSize = 8192;
+  static const unsigned kBytesPerChecksum = 512;
+  static const size_t kPacketSize = 64 * 1024;
+
+  explicit MockDataNode(int data_fd = -1, int meta_fd = -1);
+  ~MockDataNode();
+
+  // The byte at the offset of the block
+  static char BlockData(uint64_t block_id, uint64_t offset)
+  { return static_cast<char>(offset * 131 + block_id * 7 + (offset >> 9)); }
+
+  ::asio::ip::tcp::endpoint endpoint() const { return endpoint_; }
+  const std::string &path() const { return path_; }
+  // Wait before answering OP_READ_BLOCK
+  void set_read_delay(std::chrono::milliseconds delay);
+  // The status of the responses to OP_READ_BLOCK
+  void set_read_status(::hadoop::hdfs::Status status);
+  // The status of the responses to REQUEST_SHORT_CIRCUIT_FDS
+  void set_fds_status(::hadoop::hdfs::Status status);
+  // Encrypt the data transfer with the key, and reject any other key
+  void set_encryption_key(const ::hadoop::hdfs::DataEncryptionKeyProto &key);
+  // The number of SASL handshakes that have completed
+  unsigned encrypted_connections();
+  // The number of requests of the operation that have arrived
+  unsigned requests(Operation op);
+  // The OP_READ_BLOCK requests that have arrived, in order
+  std::vector<::hadoop::hdfs::OpReadBlockProto> read_requests();
+  // The slot of the last REQUEST_SHORT_CIRCUIT_FDS, -1 if none
+  int last_slot();
+  std::vector<int> released_slots();
+  // Clear the flags of the slot in the segment
+  void InvalidateSlot(int slot);
+  // Close the connections of the clients, which drops the segments
+  void DropConnections();
+
+  // Blocking helpers for the sockets that play the DataNode
+  static bool ReadFully(int sock, char *buf, size_t length);
+  static bool ReadDelimited(int sock, ::google::protobuf::MessageLite *msg);
+  static bool WriteDelimited(int sock, const ::google::protobuf::MessageLite &msg);
+  // Send the data with the file descriptors attached to it
+  static bool SendWithFds(int sock, const char *buf, size_t length, const std::vector<int> &fds);
+
+ private:
+  /*
+   * A connection of a client. Once the SASL handshake has negotiated
+   * the cipher suite, the reads are decrypted and the writes encrypted.
+   */
+  struct Channel {
+    explicit Channel(int s) : sock(s) {}
+    int sock;
+    AesCtrCipher decrypt;
+    AesCtrCipher encrypt;
+    bool Read(char *buf, size_t length);
+    bool Write(std::string data);
+  };
+
+  const int data_fd_;
+  const int meta_fd_;
+  int tcp_listener_;
+  ::asio::ip::tcp::endpoint endpoint_;
+  std::string dir_;
+  std::string path_;
+  int listener_;
+  FILE *shm_file_;
+  char *shm_;
+  std::atomic_bool stopping_;
+  std::mutex lock_;
+  std::condition_variable stopped_;
+  std::chrono::milliseconds read_delay_;
+  ::hadoop::hdfs::Status read_status_;
+  ::hadoop::hdfs::Status fds_status_;
+  bool encrypted_;
+  ::hadoop::hdfs::DataEncryptionKeyProto encryption_key_;
+  unsigned encrypted_connections_;
+  std::map<int, unsigned> requests_;
+  std::vector<::hadoop::hdfs::OpReadBlockProto> read_requests_;
+  int last_slot_;
+  std::vector<int> released_slots_;
+  std::vector<int> sockets_;
+  std::vector<std::thread> servers_;
+  std::thread tcp_thread_;
+  std::thread thread_;
+
+  void Accept(int listener);
+  void Serve(int sock, bool tcp);
+  bool ServeSasl(Channel *ch);
+  bool ServeRead(Channel *ch, const ::hadoop::hdfs::OpReadBlockProto &req);
+  static bool ReadDelimited(Channel *ch, ::google::protobuf::MessageLite *msg);
+  static bool WriteDelimited(Channel *ch, const ::google::protobuf::MessageLite &msg);
+  static bool SendPacket(Channel *ch, int64_t offset, int64_t seqno, bool last,
+                         const std::string &data);
+  static void Wake(int listener);
+
+  // The server side of DIGEST-MD5, see sasl_digest_md5.cc for the client
+  static std::string Md5(const std::string &src);
+  static std::string Hex(const std::string &src);
+  static std::string Directive(const std::string &payload, const std::string &name);
+  static std::string Seal(EVP_CIPHER_CTX *ctx, const std::string &integrity_key,
+                          uint32_t seq_num, const std::string &message);
+};
+
+inline MockDataNode::MockDataNode(int data_fd, int meta_fd)
+    : data_fd_(data_fd)
+    , meta_fd_(meta_fd)
+    , tcp_listener_(::socket(AF_INET, SOCK_STREAM, 0))
+    , listener_(::socket(AF_UNIX, SOCK_STREAM, 0))
+    , shm_file_(tmpfile())
+    , shm_(static_cast<char*>(MAP_FAILED))
+    , stopping_(false)
+    , read_delay_(0)
+    , read_status_(::hadoop::hdfs::Status::SUCCESS)
+    , fds_status_(::hadoop::hdfs::Status::SUCCESS)
+    , encrypted_(false)
+    , encrypted_connections_(0)
+    , last_slot_(-1)
+{
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sin);
+  ::bind(tcp_listener_, reinterpret_cast<struct sockaddr*>(&sin), sizeof(sin));
+  ::listen(tcp_listener_, 16);
+  ::getsockname(tcp_listener_, reinterpret_cast<struct sockaddr*>(&sin), &len);
+  endpoint_ = ::asio::ip::tcp::endpoint(::asio::ip::address_v4::loopback(), ntohs(sin.sin_port));
+
+  char dir[] = "/tmp/mock_datanode.XXXXXX";
+  dir_ = ::mkdtemp(dir);
+  path_ = dir_ + "/dn_socket";
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+  ::bind(listener_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+  ::listen(listener_, 16);
+
+  if (!::ftruncate(fileno(shm_file_), kShmSize)) {
+    shm_ = static_cast<char*>(::mmap(nullptr, kShmSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                     fileno(shm_file_), 0));
+  }
+  tcp_thread_ = std::thread(std::bind(&MockDataNode::Accept, this, tcp_listener_));
+  thread_ = std::thread(std::bind(&MockDataNode::Accept, this, listener_));
+}
+
+inline MockDataNode::~MockDataNode() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  stopped_.notify_all();
+  Wake(tcp_listener_);
+  tcp_thread_.join();
+  Wake(listener_);
+  thread_.join();
+
+  DropConnections();
+  for (auto &t : servers_) {
+    t.join();
+  }
+  for (int s : sockets_) {
+    ::close(s);
+  }
+  ::close(tcp_listener_);
+  ::close(listener_);
+  ::unlink(path_.c_str());
+  ::rmdir(dir_.c_str());
+  if (shm_ != MAP_FAILED) {
+    ::munmap(shm_, kShmSize);
+  }
+  fclose(shm_file_);
+}
+
+inline void MockDataNode::set_read_delay(std::chrono::milliseconds delay) {
+  std::lock_guard<std::mutex> lock(lock_);
+  read_delay_ = delay;
+}
+
+inline void MockDataNode::set_read_status(::hadoop::hdfs::Status status) {
+  std::lock_guard<std::mutex> lock(lock_);
+  read_status_ = status;
+}
+
+inline void MockDataNode::set_fds_status(::hadoop::hdfs::Status status) {
+  std::lock_guard<std::mutex> lock(lock_);
+  fds_status_ = status;
+}
+
+inline void MockDataNode::set_encryption_key(const ::hadoop::hdfs::DataEncryptionKeyProto &key) {
+  std::lock_guard<std::mutex> lock(lock_);
+  encrypted_ = true;
+  encryption_key_ = key;
+}
+
+inline unsigned MockDataNode::encrypted_connections() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return encrypted_connections_;
+}
+
+inline unsigned MockDataNode::requests(Operation op) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return requests_[op];
+}
+
+inline std::vector<::hadoop::hdfs::OpReadBlockProto> MockDataNode::read_requests() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return read_requests_;
+}
+
+inline int MockDataNode::last_slot() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return last_slot_;
+}
+
+inline std::vector<int> MockDataNode::released_slots() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return released_slots_;
+}
+
+inline void MockDataNode::InvalidateSlot(int slot) {
+  __atomic_store_n(reinterpret_cast<uint64_t*>(shm_ + slot * 64), 0, __ATOMIC_SEQ_CST);
+}
+
+inline void MockDataNode::DropConnections() {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (int s : sockets_) {
+    ::shutdown(s, SHUT_RDWR);
+  }
+}
+
+inline void MockDataNode::Wake(int listener) {
+  // Wake up the thread blocked in accept() with a connection of our own
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  ::getsockname(listener, reinterpret_cast<struct sockaddr*>(&addr), &len);
+  int sock = ::socket(addr.ss_family, SOCK_STREAM, 0);
+  ::connect(sock, reinterpret_cast<struct sockaddr*>(&addr), len);
+  ::close(sock);
+}
+
+inline void MockDataNode::Accept(int listener) {
+  for (;;) {
+    int sock = ::accept(listener, nullptr, nullptr);
+    if (sock < 0 || stopping_) {
+      if (sock >= 0) {
+        ::close(sock);
+      }
+      return;
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    sockets_.push_back(sock);
+    servers_.emplace_back(std::bind(&MockDataNode::Serve, this, sock,
+                                    listener == tcp_listener_));
+  }
+}
+
+inline void MockDataNode::Serve(int sock, bool tcp) {
+  using namespace ::hadoop::hdfs;
+  Channel ch(sock);
+  bool encrypted;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    encrypted = encrypted_ && tcp;
+  }
+  for (bool ok = !encrypted || ServeSasl(&ch); ok;) {
+    // The version and the operation follow a zero byte
+    char header[3];
+    if (!ch.Read(header, sizeof(header))) {
+      break;
+    }
+    Operation op = static_cast<Operation>(header[2]);
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      ++requests_[op];
+    }
+
+    ok = false;
+    if (op == kReadBlock) {
+      OpReadBlockProto req;
+      ok = ReadDelimited(&ch, &req) && ServeRead(&ch, req);
+    } else if (op == kRequestShortCircuitShm) {
+      ShortCircuitShmRequestProto req;
+      ShortCircuitShmResponseProto resp;
+      resp.set_status(SUCCESS);
+      resp.mutable_id()->set_hi(1);
+      resp.mutable_id()->set_lo(2);
+      ok = ReadDelimited(sock, &req) && WriteDelimited(sock, resp) &&
+          SendWithFds(sock, "", 1, {fileno(shm_file_)});
+    } else if (op == kRequestShortCircuitFds) {
+      OpRequestShortCircuitAccessProto req;
+      BlockOpResponseProto resp;
+      if (ReadDelimited(sock, &req)) {
+        std::lock_guard<std::mutex> lock(lock_);
+        last_slot_ = req.has_slotid() ? req.slotid().slotidx() : -1;
+        resp.set_status(fds_status_);
+      }
+      ok = resp.has_status() && WriteDelimited(sock, resp) &&
+          (resp.status() != SUCCESS || SendWithFds(sock, "", 1, {data_fd_, meta_fd_}));
+    } else if (op == kReleaseShortCircuitFds) {
+      ReleaseShortCircuitAccessRequestProto req;
+      ReleaseShortCircuitAccessResponseProto resp;
+      resp.set_status(SUCCESS);
+      if (ReadDelimited(sock, &req)) {
+        std::lock_guard<std::mutex> lock(lock_);
+        released_slots_.push_back(req.slotid().slotidx());
+      }
+      ok = WriteDelimited(sock, resp);
+    }
+  }
+  ::shutdown(sock, SHUT_RDWR);
+}
+
+inline bool MockDataNode::ServeSasl(Channel *ch) {
+  using namespace ::hadoop::hdfs;
+  static const char kRealm[] = "0";
+  static const char kNonce[] = "bW9ja19kYXRhbm9kZV9ub25jZQ==";
+  static const char kEmptyBodyHash[] = ":00000000000000000000000000000000";
+
+  uint32_t magic;
+  DataTransferEncryptorMessageProto msg;
+  if (!ReadFully(ch->sock, reinterpret_cast<char*>(&magic), sizeof(magic)) ||
+      ntohl(magic) != kDataTransferSasl || !ReadDelimited(ch, &msg)) {
+    return false;
+  }
+  msg.Clear();
+  msg.set_status(DataTransferEncryptorMessageProto::SUCCESS);
+  msg.set_payload(std::string("realm=\"") + kRealm + "\",nonce=\"" + kNonce +
+                  "\",qop=\"auth-conf\",charset=utf-8,cipher=\"3des\",algorithm=md5-sess");
+  if (!WriteDelimited(ch, msg) || !ReadDelimited(ch, &msg)) {
+    return false;
+  }
+
+  // The username is "<key id> <block pool id> <nonce>"
+  const std::string payload = msg.payload();
+  const bool cipher_offered = msg.cipheroption_size() > 0;
+  const std::string username = Directive(payload, "username");
+  DataEncryptionKeyProto key;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    key = encryption_key_;
+  }
+  msg.Clear();
+  if (strtoul(username.c_str(), nullptr, 10) != key.keyid()) {
+    msg.set_status(DataTransferEncryptorMessageProto::ERROR_UNKNOWN_KEY);
+    msg.set_message("Can't re-compute encryption key for nonce, since the required block key "
+                    "doesn't exist");
+    WriteDelimited(ch, msg);
+    return false;
+  }
+
+  const std::string cnonce = Directive(payload, "cnonce");
+  const std::string nc = Directive(payload, "nc");
+  const std::string ha1 = Md5(Md5(username + ":" + kRealm + ":" + Base64Encode(key.encryptionkey())) +
+                              ":" + kNonce + ":" + cnonce + ":" + username);
+  auto response_value = [&](const std::string &a2) {
+    return Hex(Md5(Hex(ha1) + ":" + kNonce + ":" + nc + ":" + cnonce + ":auth-conf:" +
+                   Hex(Md5(a2 + kEmptyBodyHash))));
+  };
+  if (Directive(payload, "response") != response_value("AUTHENTICATE:hdfs/0") ||
+      !cipher_offered) {
+    msg.set_status(DataTransferEncryptorMessageProto::ERROR);
+    msg.set_message("Authentication failed");
+    WriteDelimited(ch, msg);
+    return false;
+  }
+
+  // Seal the keys of the cipher suite in the order of inKey and outKey
+  unsigned char keys[4 * AesCtrCipher::kIvSize];
+  RAND_bytes(keys, sizeof(keys));
+  std::string in_key(reinterpret_cast<char*>(keys), AesCtrCipher::kIvSize);
+  std::string in_iv(reinterpret_cast<char*>(keys) + AesCtrCipher::kIvSize, AesCtrCipher::kIvSize);
+  std::string out_key(reinterpret_cast<char*>(keys) + 2 * AesCtrCipher::kIvSize, AesCtrCipher::kIvSize);
+  std::string out_iv(reinterpret_cast<char*>(keys) + 3 * AesCtrCipher::kIvSize, AesCtrCipher::kIvSize);
+  const std::string kc = Md5(ha1 + "Digest H(A1) to server-to-client sealing key magic constant");
+  const std::string ki = Md5(ha1 + "Digest session key to server-to-client signing key magic constant");
+  // The two-key 3DES of S 2.4 in RFC2831, with the parity bits spread
+  // over the 7-byte keys
+  unsigned char des_key[24];
+  for (int k = 0; k < 2; ++k) {
+    const unsigned char *in = reinterpret_cast<const unsigned char*>(kc.data()) + 7 * k;
+    unsigned char *out = des_key + 8 * k;
+    out[0] = in[0];
+    for (int i = 1; i < 7; ++i) {
+      out[i] = (in[i - 1] << (8 - i)) | (in[i] >> i);
+    }
+    out[7] = in[6] << 1;
+  }
+  memcpy(des_key + 16, des_key, 8);
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  EVP_EncryptInit_ex(ctx, EVP_des_ede3_cbc(), nullptr, des_key,
+                     reinterpret_cast<const unsigned char*>(kc.data()) + 8);
+  EVP_CIPHER_CTX_set_padding(ctx, 0);
+  auto option = msg.add_cipheroption();
+  option->set_suite(AES_CTR_NOPADDING);
+  option->set_inkey(Seal(ctx, ki, 0, in_key));
+  option->set_iniv(in_iv);
+  option->set_outkey(Seal(ctx, ki, 1, out_key));
+  option->set_outiv(out_iv);
+  EVP_CIPHER_CTX_free(ctx);
+
+  msg.set_status(DataTransferEncryptorMessageProto::SUCCESS);
+  msg.set_payload("rspauth=" + response_value(":hdfs/0"));
+  if (!WriteDelimited(ch, msg)) {
+    return false;
+  }
+  // The DataNode reads with inKey and writes with outKey
+  ch->decrypt.Init(in_key, in_iv);
+  ch->encrypt.Init(out_key, out_iv);
+  std::lock_guard<std::mutex> lock(lock_);
+  ++encrypted_connections_;
+  return true;
+}
+
+inline bool MockDataNode::ServeRead(Channel *ch, const ::hadoop::hdfs::OpReadBlockProto &req) {
+  using namespace ::hadoop::hdfs;
+  BlockOpResponseProto resp;
+  {
+    // The delay ends early once the DataNode stops
+    std::unique_lock<std::mutex> lock(lock_);
+    read_requests_.push_back(req);
+    stopped_.wait_for(lock, read_delay_, [this]() { return stopping_.load(); });
+    resp.set_status(read_status_);
+  }
+  if (stopping_) {
+    return false;
+  } else if (resp.status() != SUCCESS) {
+    resp.set_message("Replica not found");
+    WriteDelimited(ch, resp);
+    return false;
+  }
+
+  // The whole chunks that cover the range, in packets
+  const auto &block = req.header().baseheader().block();
+  uint64_t begin = req.offset() / kBytesPerChecksum * kBytesPerChecksum;
+  uint64_t end = std::min<uint64_t>(block.numbytes(),
+      (req.offset() + req.len() + kBytesPerChecksum - 1) / kBytesPerChecksum * kBytesPerChecksum);
+  auto info = resp.mutable_readopchecksuminfo();
+  info->mutable_checksum()->set_type(CHECKSUM_CRC32C);
+  info->mutable_checksum()->set_bytesperchecksum(kBytesPerChecksum);
+  info->set_chunkoffset(begin);
+  if (!WriteDelimited(ch, resp)) {
+    return false;
+  }
+
+  const uint64_t packet_size = kPacketSize;
+  int64_t seqno = 0;
+  for (uint64_t offset = begin; offset < end; offset += packet_size) {
+    std::string data(std::min(packet_size, end - offset), '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = BlockData(block.blockid(), offset + i);
+    }
+    if (!SendPacket(ch, offset, seqno++, false, data)) {
+      return false;
+    }
+  }
+  ClientReadStatusProto status;
+  return SendPacket(ch, end, seqno, true, std::string()) && ReadDelimited(ch, &status);
+}
+
+inline bool MockDataNode::SendPacket(Channel *ch, int64_t offset, int64_t seqno, bool last,
+                                     const std::string &data) {
+  ::hadoop::hdfs::PacketHeaderProto header;
+  header.set_offsetinblock(offset);
+  header.set_seqno(seqno);
+  header.set_lastpacketinblock(last);
+  header.set_datalen(static_cast<int32_t>(data.size()));
+
+  std::string checksums;
+  for (size_t i = 0; i < data.size(); i += kBytesPerChecksum) {
+    size_t n = std::min<size_t>(kBytesPerChecksum, data.size() - i);
+    uint32_t crc = htonl(Crc32c(0, &data[i], n));
+    checksums.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+  }
+
+  std::string packet;
+  uint32_t payload_len = htonl(static_cast<uint32_t>(sizeof(payload_len) + checksums.size() + data.size()));
+  uint16_t header_len = htons(static_cast<uint16_t>(header.ByteSizeLong()));
+  packet.append(reinterpret_cast<const char*>(&payload_len), sizeof(payload_len));
+  packet.append(reinterpret_cast<const char*>(&header_len), sizeof(header_len));
+  packet.append(header.SerializeAsString());
+  packet.append(checksums);
+  packet.append(data);
+  return ch->Write(std::move(packet));
+}
+
+inline bool MockDataNode::ReadFully(int sock, char *buf, size_t length) {
+  while (length) {
+    ssize_t n = ::recv(sock, buf, length, 0);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    length -= n;
+  }
+  return true;
+}
+
+inline bool MockDataNode::ReadDelimited(int sock, ::google::protobuf::MessageLite *msg) {
+  Channel ch(sock);
+  return ReadDelimited(&ch, msg);
+}
+
+inline bool MockDataNode::ReadDelimited(Channel *ch, ::google::protobuf::MessageLite *msg) {
+  uint32_t length = 0;
+  for (unsigned shift = 0; shift < 35; shift += 7) {
+    unsigned char b;
+    if (!ch->Read(reinterpret_cast<char*>(&b), 1)) {
+      return false;
+    }
+    length |= (b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      std::string buf(length, '\0');
+      return ch->Read(&buf[0], length) && msg->ParseFromString(buf);
+    }
+  }
+  return false;
+}
+
+inline bool MockDataNode::WriteDelimited(int sock, const ::google::protobuf::MessageLite &msg) {
+  Channel ch(sock);
+  return WriteDelimited(&ch, msg);
+}
+
+inline bool MockDataNode::WriteDelimited(Channel *ch, const ::google::protobuf::MessageLite &msg) {
+  namespace pbio = ::google::protobuf::io;
+  std::string buf;
+  {
+    pbio::StringOutputStream ss(&buf);
+    pbio::CodedOutputStream os(&ss);
+    os.WriteVarint32(static_cast<uint32_t>(msg.ByteSizeLong()));
+    msg.SerializeWithCachedSizes(&os);
+  }
+  return ch->Write(std::move(buf));
+}
+
+inline bool MockDataNode::Channel::Read(char *buf, size_t length) {
+  if (!ReadFully(sock, buf, length)) {
+    return false;
+  }
+  if (decrypt.initialized()) {
+    decrypt.Update(buf, buf, length);
+  }
+  return true;
+}
+
+inline bool MockDataNode::Channel::Write(std::string data) {
+  if (encrypt.initialized()) {
+    encrypt.Update(data.data(), &data[0], data.size());
+  }
+  return ::send(sock, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+}
+
+inline std::string MockDataNode::Md5(const std::string &src) {
+  unsigned char res[EVP_MAX_MD_SIZE];
+  unsigned length = 0;
+  EVP_Digest(src.data(), src.size(), res, &length, EVP_md5(), nullptr);
+  return std::string(reinterpret_cast<char*>(res), length);
+}
+
+inline std::string MockDataNode::Hex(const std::string &src) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string res;
+  for (unsigned char c : src) {
+    res.push_back(kDigits[c >> 4]);
+    res.push_back(kDigits[c & 0xf]);
+  }
+  return res;
+}
+
+inline std::string MockDataNode::Directive(const std::string &payload, const std::string &name) {
+  // The values of the client neither contain commas nor escaped quotes
+  for (size_t off = 0; off < payload.size();) {
+    size_t end = payload.find(',', off);
+    end = end == std::string::npos ? payload.size() : end;
+    std::string directive = payload.substr(off, end - off);
+    if (!directive.compare(0, name.size() + 1, name + "=")) {
+      std::string value = directive.substr(name.size() + 1);
+      if (value.size() >= 2 && value.front() == '"') {
+        value = value.substr(1, value.size() - 2);
+      }
+      return value;
+    }
+    off = end + 1;
+  }
+  return std::string();
+}
+
+inline std::string MockDataNode::Seal(EVP_CIPHER_CTX *ctx, const std::string &integrity_key,
+                                      uint32_t seq_num, const std::string &message) {
+  // The message, the padding and the first 10 bytes of the HMAC in
+  // 8-byte blocks, followed by the message type and the sequence number
+  uint32_t n = htonl(seq_num);
+  const std::string seq(reinterpret_cast<const char*>(&n), sizeof(n));
+  size_t padding = 8 - (message.size() + 10) % 8;
+  std::string plaintext = message;
+  plaintext.append(padding, static_cast<char>(padding));
+  unsigned char mac[EVP_MAX_MD_SIZE];
+  unsigned mac_len = 0;
+  const std::string signed_data = seq + message;
+  HMAC(EVP_md5(), integrity_key.data(), integrity_key.size(),
+       reinterpret_cast<const unsigned char*>(signed_data.data()), signed_data.size(),
+       mac, &mac_len);
+  plaintext.append(reinterpret_cast<char*>(mac), 10);
+
+  std::string res(plaintext.size(), '\0');
+  int length = 0;
+  EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char*>(&res[0]), &length,
+                    reinterpret_cast<const unsigned char*>(plaintext.data()), plaintext.size());
+  res.append("\x00\x01", 2);
+  return res + seq;
+}
+
+inline bool MockDataNode::SendWithFds(int sock, const char *buf, size_t length,
+                                       const std::vector<int> &fds) {
+  struct iovec iov;
+  iov.iov_base = const_cast<char*>(buf);
+  iov.iov_len = length;
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * fds.size());
+  return ::sendmsg(sock, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(length);
+}
+
+}
+
+#endif
@@ -20,7 +20,7 @@
 namespace hdfs {
 
 hadoop::hdfs::OpReadBlockProto ReadBlockProto(const std::string &client_name,
-                                              bool verify_checksum,
+                                              const BlockReaderOptions &options,
                                               const hadoop::common::TokenProto *token,
                                               const hadoop::hdfs::ExtendedBlockProto *block,
                                               uint64_t length, uint64_t offset) {
@@ -39,8 +39,18 @@ hadoop::hdfs::OpReadBlockProto ReadBlockProto(const std::string &client_name,
   p.set_allocated_header(h);
   p.set_offset(offset);
   p.set_len(length);
-  p.set_sendchecksums(verify_checksum);
-  // TODO: p.set_allocated_cachingstrategy();
+  p.set_sendchecksums(options.verify_checksum);
+
+  const CacheStrategy &cache = options.cache_strategy;
+  if (cache.drop_behind_specified || cache.read_ahead_specified) {
+    CachingStrategyProto *c = p.mutable_cachingstrategy();
+    if (cache.drop_behind_specified) {
+      c->set_dropbehind(cache.drop_behind);
+    }
+    if (cache.read_ahead_specified) {
+      c->set_readahead(cache.read_ahead);
+    }
+  }
   return p;
 }
 
@@ -18,22 +18,26 @@
 #ifndef IMPL_REMOTE_BLOCK_READER_H_
 #define IMPL_REMOTE_BLOCK_READER_H_
 
+#include "common/checksum.h"
 #include "common/datatransfer.h"
+#include "common/util.h"
 #include "common/continuation/asio.h"
 #include "common/continuation/protobuf.h"
 
-#include <asio/buffers_iterator.hpp>
-#include <asio/streambuf.hpp>
 #include <asio/write.hpp>
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
 #include <arpa/inet.h>
 
+#include <cstring>
 #include <future>
 
 namespace hdfs {
 
 hadoop::hdfs::OpReadBlockProto ReadBlockProto(
-    const std::string &client_name, bool verify_checksum,
+    const std::string &client_name, const BlockReaderOptions &options,
     const hadoop::common::TokenProto *token,
     const hadoop::hdfs::ExtendedBlockProto *block,
     uint64_t length, uint64_t offset);
@@ -61,12 +65,20 @@ void RemoteBlockReader<Stream>::async_connect(const std::string &client_name,
   State *s = &m->state();
 
   s->header.insert(s->header.begin(), { 0, kDataTransferVersion, Operation::kReadBlock });
-  s->request = std::move(ReadBlockProto(client_name, options_.verify_checksum, token, block, length, offset));
+  s->request = std::move(ReadBlockProto(client_name, options_, token, block, length, offset));
+  {
+    // Send the operation header and the request in a single write,
+    // otherwise the request is delayed by the Nagle's algorithm.
+    namespace pbio = ::google::protobuf::io;
+    pbio::StringOutputStream ss(&s->header);
+    pbio::CodedOutputStream os(&ss);
+    os.WriteVarint32(static_cast<uint32_t>(s->request.ByteSizeLong()));
+    s->request.SerializeWithCachedSizes(&os);
+  }
 
   auto read_pb_message = new continuation::ReadDelimitedPBMessageContinuation<Stream, 16384>(stream_, &s->response);
 
   m->Push(continuation::Write(stream_, asio::buffer(s->header)))
-      .Push(continuation::WriteDelimitedPBMessage(stream_, &s->request))
       .Push(read_pb_message);
 
   m->Run([this,handler,offset](const Status &status, const State &s) {
@@ -77,6 +89,8 @@ void RemoteBlockReader<Stream>::async_connect(const std::string &client_name,
           if(resp.has_readopchecksuminfo()) {
             const auto& checksum_info = resp.readopchecksuminfo();
             chunk_padding_bytes_ = offset - checksum_info.chunkoffset();
+            checksum_type_ = checksum_info.checksum().type();
+            bytes_per_checksum_ = checksum_info.checksum().bytesperchecksum();
           }
           state_ = kReadPacketHeader;
         } else {
@@ -87,195 +101,379 @@ void RemoteBlockReader<Stream>::async_connect(const std::string &client_name,
       });
 }
 
+/*
+ * A MutableBufferSequence over a range of buffers, which asio copies
+ * without copying the buffers themselves.
+ */
 template<class Stream>
-struct RemoteBlockReader<Stream>::ReadPacketHeader : continuation::Continuation {
-  ReadPacketHeader(RemoteBlockReader<Stream> *parent)
-      : parent_(parent)
+struct RemoteBlockReader<Stream>::BufferRange {
+  typedef asio::mutable_buffer value_type;
+  typedef const asio::mutable_buffer *const_iterator;
+  explicit BufferRange(const std::vector<asio::mutable_buffer> &buffers)
+      : begin_(buffers.data())
+      , end_(buffers.data() + buffers.size())
   {}
-
-  virtual void Run(const Next& next) override {
-    parent_->packet_data_read_bytes_ = 0;
-    parent_->packet_len_ = 0;
-    auto handler = [next,this](const asio::error_code &ec, size_t) {
-      Status status;
-      if (ec) {
-        status = Status(ec.value(), ec.message().c_str());
-      } else {
-        parent_->packet_len_ = packet_length();
-        parent_->header_.Clear();
-        bool v = parent_->header_.ParseFromArray(
-            &buf_[kHeaderStart], header_length());
-        assert(v && "Failed to parse the header");
-        parent_->state_ = kReadChecksum;
-      }
-      next(status);
-    };
-
-    asio::async_read(*parent_->stream_, asio::buffer(buf_),
-                     std::bind(&ReadPacketHeader::CompletionHandler, this,
-                               std::placeholders::_1, std::placeholders::_2),
-                     handler);
-  }
-
+  const_iterator begin() const { return begin_; }
+  const_iterator end() const { return end_; }
  private:
-  static const size_t kMaxHeaderSize = 512;
-  static const size_t kPayloadLenOffset = 0;
-  static const size_t kPayloadLenSize = sizeof(int);
-  static const size_t kHeaderLenOffset = 4;
-  static const size_t kHeaderLenSize = sizeof(short);
-  static const size_t kHeaderStart = kPayloadLenSize + kHeaderLenSize;
-
-  RemoteBlockReader<Stream> *parent_;
-  std::array<char, kMaxHeaderSize> buf_;
-
-  size_t packet_length() const
-  { return ntohl(*reinterpret_cast<const unsigned*>(&buf_[kPayloadLenOffset])); }
+  const_iterator begin_;
+  const_iterator end_;
+};
 
-  size_t header_length() const
-  { return ntohs(*reinterpret_cast<const short*>(&buf_[kHeaderLenOffset])); }
+/*
+ * The state machine of async_read_some() and async_read(), which reads
+ * the header, the checksums and the data of one packet, or of as many
+ * packets as fit into the buffers, and, once the requested range has
+ * been read, skips to the end of the block and acknowledges it. The
+ * operation is the completion handler of its own reads, thus it does
+ * not allocate anything besides the handler memory of asio.
+ */
+template<class Stream>
+template<class MutableBufferSequence, class ReadHandler>
+struct RemoteBlockReader<Stream>::ReadPacketOp {
+  ReadPacketOp(const std::shared_ptr<RemoteBlockReader<Stream> > &parent,
+               const MutableBufferSequence &buffers, bool fill_buffers,
+               const ReadHandler &handler)
+      : parent_(parent)
+      , buffers_(buffers)
+      , fill_buffers_(fill_buffers)
+      , buffer_size_(asio::buffer_size(buffers))
+      , transferred_(0)
+      , phase_(kReadPacket)
+      , packet_read_(false)
+      , trailer_started_(false)
+      , handler_(handler)
+  {}
 
-  size_t CompletionHandler(const asio::error_code &ec, size_t transferred) {
+  void operator()(const asio::error_code &ec, size_t transferred) {
+    RemoteBlockReader<Stream> *p = parent_.get();
+    Status status;
     if (ec) {
-      return 0;
-    } else if (transferred < kHeaderStart) {
-      return kHeaderStart - transferred;
+      status = ToStatus(ec);
+    } else if (phase_ == kSendReadStatus) {
+      p->state_ = kFinished;
+      handler_(status, transferred_);
+      return;
+    } else if (p->state_ == kReadPacketHeader) {
+      status = p->OnPacketHeaderRead(transferred);
+      // An empty packet is complete once its header has been read
+      packet_read_ = p->state_ == kReadPacketHeader && !p->header_bytes_;
+    } else {
+      size_t user_transferred = 0;
+      bool end_of_packet = false;
+      status = p->OnDataRead(buffers_, transferred_, transferred, &user_transferred,
+                             &end_of_packet);
+      transferred_ += user_transferred;
+      packet_read_ = packet_read_ || end_of_packet;
+    }
+
+    if (!status.ok()) {
+      handler_(status, transferred_);
     } else {
-      return kHeaderStart + header_length() - transferred;
+      Continue();
     }
   }
-};
 
-template<class Stream>
-struct RemoteBlockReader<Stream>::ReadChecksum : continuation::Continuation {
-  ReadChecksum(RemoteBlockReader<Stream> *parent)
-      : parent_(parent)
-  {}
+  void Continue() {
+    RemoteBlockReader<Stream> *p = parent_.get();
+    size_t max_user = std::min<unsigned long long>(buffer_size_ - transferred_,
+                                                   std::max(p->bytes_to_read_, 0LL));
+    if (phase_ == kReadPacket && max_user && (fill_buffers_ || !packet_read_)) {
+      if (p->state_ == kReadPacketHeader && !p->header_bytes_ &&
+          p->header_.lastpacketinblock()) {
+        handler_(Status::Error("The block ended before the requested range"), transferred_);
+        return;
+      } else if (p->state_ == kReadPacketHeader) {
+        ReadPacketHeader();
+        return;
+      } else if (ReadData(max_user)) {
+        return;
+      }
+    }
+    phase_ = kSkipToEnd;
 
-  virtual void Run(const Next& next) override {
-    auto parent = parent_;
-    if (parent->state_ != kReadChecksum) {
-      next(Status::OK());
+    if (p->bytes_to_read_ > 0 || p->state_ == kFinished) {
+      handler_(Status::OK(), transferred_);
       return;
     }
 
-    auto handler = [parent,next](const asio::error_code &ec, size_t) {
-      Status status;
-      if (ec) {
-        status = Status(ec.value(), ec.message().c_str());
+    // The DataNode sends whole chunks, thus the last packet might
+    // contain data beyond the requested range. Skip it as well as the
+    // trailing empty packet so that the DataNode can serve the next
+    // request on the same connection once the read is acknowledged.
+    const auto &header = p->header_;
+    if (p->state_ == kReadData) {
+      if (trailer_started_ && (header.datalen() || !header.lastpacketinblock())) {
+        UnknownState();
       } else {
-        parent->state_ = parent->chunk_padding_bytes_ ? kReadPadding : kReadData;
+        p->SkipRestOfPacket();
+        ReadData(0);
       }
-      next(status);
-    };
-    parent->checksum_.resize(parent->packet_len_ - sizeof(int) - parent->header_.datalen());
-    asio::async_read(*parent->stream_, asio::buffer(parent->checksum_), handler);
+    } else if (p->header_bytes_ || (!trailer_started_ && !header.lastpacketinblock())) {
+      trailer_started_ = true;
+      ReadPacketHeader();
+    } else if (header.datalen() || !header.lastpacketinblock()) {
+      UnknownState();
+    } else {
+      size_t size = p->SerializeReadStatus();
+      phase_ = kSendReadStatus;
+      asio::async_write(*p->stream_, asio::buffer(p->read_status_buf_.data(), size),
+                        std::move(*this));
+    }
   }
 
  private:
-  RemoteBlockReader<Stream> *parent_;
+  enum Phase {
+    kReadPacket,
+    kSkipToEnd,
+    kSendReadStatus,
+  };
+
+  std::shared_ptr<RemoteBlockReader<Stream> > parent_;
+  MutableBufferSequence buffers_;
+  const bool fill_buffers_;
+  size_t buffer_size_;
+  size_t transferred_;
+  Phase phase_;
+  bool packet_read_;
+  bool trailer_started_;
+  ReadHandler handler_;
+
+  void ReadPacketHeader() {
+    RemoteBlockReader<Stream> *p = parent_.get();
+    p->stream_->async_read_some(
+        asio::buffer(&p->header_buf_[p->header_bytes_], p->PacketHeaderBytesNeeded()),
+        std::move(*this));
+  }
+
+  void UnknownState() {
+    // The connection is left in an unknown state, therefore it cannot
+    // be reused. The requested data has been transferred successfully
+    // though.
+    handler_(Status::OK(), transferred_);
+  }
+
+  bool ReadData(size_t max_user) {
+    RemoteBlockReader<Stream> *p = parent_.get();
+    if (!p->PrepareDataRead(buffers_, transferred_, max_user)) {
+      return false;
+    }
+    p->stream_->async_read_some(BufferRange(p->iov_), std::move(*this));
+    return true;
+  }
 };
 
 template<class Stream>
-struct RemoteBlockReader<Stream>::ReadPadding : continuation::Continuation {
-  ReadPadding(RemoteBlockReader<Stream> *parent)
-      : parent_(parent)
-      , padding_(parent->chunk_padding_bytes_)
-      , bytes_transferred_(std::make_shared<size_t>(0))
-      , read_data_(new ReadData<asio::mutable_buffers_1>(parent, bytes_transferred_, asio::buffer(padding_)))
-  {}
+size_t RemoteBlockReader<Stream>::PacketHeaderBytesNeeded() const {
+  if (header_bytes_ < kPacketHeaderStart + kMinPacketHeaderSize) {
+    return kPacketHeaderStart + kMinPacketHeaderSize - header_bytes_;
+  }
+  uint16_t header_len;
+  memcpy(&header_len, &header_buf_[sizeof(uint32_t)], sizeof(header_len));
+  return kPacketHeaderStart + ntohs(header_len) - header_bytes_;
+}
 
-  virtual void Run(const Next& next) override {
-    if (parent_->state_ != kReadPadding || !parent_->chunk_padding_bytes_) {
-      next(Status::OK());
-      return;
-    }
+template<class Stream>
+Status RemoteBlockReader<Stream>::OnPacketHeaderRead(size_t transferred) {
+  header_bytes_ += transferred;
+  if (header_bytes_ < kPacketHeaderStart + kMinPacketHeaderSize) {
+    return Status::OK();
+  } else if (header_bytes_ + PacketHeaderBytesNeeded() > kMaxPacketHeaderSize) {
+    return Status::Error("Invalid length of the packet header");
+  } else if (PacketHeaderBytesNeeded()) {
+    return Status::OK();
+  }
+  return ParsePacketHeader();
+}
 
-    auto h = [next,this](const Status &status) {
-      if (status.ok()) {
-        assert(reinterpret_cast<const int&>(*bytes_transferred_) == parent_->chunk_padding_bytes_);
-        parent_->chunk_padding_bytes_ = 0;
-        parent_->state_ = kReadData;
-      }
-      next(status);
-    };
-    read_data_->Run(h);
+template<class Stream>
+Status RemoteBlockReader<Stream>::ParsePacketHeader() {
+  uint32_t packet_len;
+  memcpy(&packet_len, &header_buf_[0], sizeof(packet_len));
+  packet_len = ntohl(packet_len);
+  header_.Clear();
+  if (!header_.ParseFromArray(&header_buf_[kPacketHeaderStart],
+                              header_bytes_ - kPacketHeaderStart)) {
+    return Status::Error("Failed to parse the packet header");
+  } else if (header_.datalen() < 0 ||
+             packet_len < sizeof(uint32_t) + header_.datalen()) {
+    return Status::Error("Invalid length of the packet");
+  }
+  data_len_ = header_.datalen();
+  checksum_len_ = packet_len - sizeof(uint32_t) - data_len_;
+  if (verifying_checksum() && checksum_len_ != sizeof(uint32_t) *
+      ((data_len_ + bytes_per_checksum_ - 1) / bytes_per_checksum_)) {
+    return Status::Error("Invalid number of checksums in the packet");
   }
 
- private:
-  RemoteBlockReader<Stream> *parent_;
-  std::vector<char> padding_;
-  std::shared_ptr<size_t> bytes_transferred_;
-  std::shared_ptr<continuation::Continuation> read_data_;
-  ReadPadding(const ReadPadding &) = delete;
-  ReadPadding &operator=(const ReadPadding &) = delete;
-};
+  // The padding precedes the requested range in the first packet
+  size_t padding = std::min<size_t>(chunk_padding_bytes_, data_len_);
+  chunk_padding_bytes_ = 0;
+  checksum_.resize(checksum_len_ + padding);
+  checksum_read_bytes_ = 0;
+  packet_data_read_bytes_ = 0;
+  header_bytes_ = 0;
+  chunk_index_ = 0;
+  chunk_bytes_ = 0;
+  chunk_crc_ = 0;
+  state_ = checksum_.empty() && !data_len_ ? kReadPacketHeader : kReadData;
+  return Status::OK();
+}
 
 template<class Stream>
 template<class MutableBufferSequence>
-struct RemoteBlockReader<Stream>::ReadData : continuation::Continuation {
-  ReadData(RemoteBlockReader<Stream> *parent,
-           std::shared_ptr<size_t> bytes_transferred,
-           const MutableBufferSequence &buf)
-      : parent_(parent)
-      , bytes_transferred_(bytes_transferred)
-      , buf_(buf)
-  {}
-
-  virtual void Run(const Next& next) override {
-    auto handler = [next,this](const asio::error_code &ec, size_t transferred) {
-      Status status;
-      if (ec) {
-        status = Status(ec.value(), ec.message().c_str());
-      }
-      *bytes_transferred_ += transferred;
-      parent_->bytes_to_read_ -= transferred;
-      parent_->packet_data_read_bytes_ += transferred;
-      if (parent_->packet_data_read_bytes_ >= parent_->header_.datalen()) {
-        parent_->state_ = kReadPacketHeader;
-      }
-      next(status);
-    };
+size_t RemoteBlockReader<Stream>::PrepareDataRead(const MutableBufferSequence &buffers,
+                                                  size_t offset, size_t max_user) {
+  iov_.clear();
+  size_t internal = checksum_.size() - checksum_read_bytes_;
+  if (internal) {
+    iov_.push_back(asio::buffer(&checksum_[checksum_read_bytes_], internal));
+  }
 
-    auto data_len = parent_->header_.datalen() - parent_->packet_data_read_bytes_;
-    async_read(*parent_->stream_, buf_, asio::transfer_exactly(data_len), handler);
+  size_t user = std::min(max_user, data_len_ - packet_data_read_bytes_ - PendingDiscardBytes());
+  size_t remaining = user;
+  for (auto it = buffers.begin(); it != buffers.end() && remaining; ++it) {
+    asio::mutable_buffer buffer(*it);
+    size_t size = asio::buffer_size(buffer);
+    if (offset >= size) {
+      offset -= size;
+      continue;
+    }
+    size = std::min(size - offset, remaining);
+    iov_.push_back(asio::buffer(buffer + offset, size));
+    offset = 0;
+    remaining -= size;
   }
+  iov_user_bytes_ = user - remaining;
 
- private:
-  RemoteBlockReader<Stream> *parent_;
-  std::shared_ptr<size_t> bytes_transferred_;
-  MutableBufferSequence buf_;
-};
+  size_t header = 0;
+  if (iov_user_bytes_ + PendingDiscardBytes() + packet_data_read_bytes_ == data_len_ &&
+      !header_.lastpacketinblock()) {
+    header = PacketHeaderBytesNeeded();
+    iov_.push_back(asio::buffer(&header_buf_[header_bytes_], header));
+  }
+  return internal + iov_user_bytes_ + header;
+}
 
 template<class Stream>
-struct RemoteBlockReader<Stream>::AckRead : continuation::Continuation {
-  AckRead(RemoteBlockReader<Stream> *parent)
-      : parent_(parent)
-  {}
+template<class MutableBufferSequence>
+Status RemoteBlockReader<Stream>::OnDataRead(const MutableBufferSequence &buffers,
+                                             size_t offset, size_t transferred,
+                                             size_t *user_transferred,
+                                             bool *end_of_packet) {
+  Status status;
+  size_t internal = std::min(transferred, checksum_.size() - checksum_read_bytes_);
+  size_t discard_begin = std::max(checksum_read_bytes_, checksum_len_);
+  checksum_read_bytes_ += internal;
+  if (checksum_read_bytes_ > discard_begin) {
+    size_t discarded = checksum_read_bytes_ - discard_begin;
+    packet_data_read_bytes_ += discarded;
+    if (verifying_checksum()) {
+      status = UpdateChecksum(&checksum_[discard_begin], discarded);
+    }
+  }
 
-  virtual void Run(const Next& next) override {
-    if (parent_->bytes_to_read_ > 0) {
-      next(Status::OK());
-      return;
+  // The data of the user follows the internal buffer in the read
+  size_t user = std::min(transferred - internal, iov_user_bytes_);
+  packet_data_read_bytes_ += user;
+  bytes_to_read_ -= user;
+  *user_transferred = user;
+  if (status.ok() && verifying_checksum()) {
+    status = UpdateChecksum(buffers, offset, user);
+  }
+
+  if (status.ok() && checksum_read_bytes_ == checksum_.size() &&
+      packet_data_read_bytes_ == data_len_) {
+    if (verifying_checksum() && chunk_bytes_) {
+      // The last chunk of the block can be shorter
+      status = VerifyChunk();
     }
+    state_ = kReadPacketHeader;
+    *end_of_packet = true;
+    if (status.ok() && transferred > internal + user) {
+      status = OnPacketHeaderRead(transferred - internal - user);
+    }
+  }
+  return status;
+}
+
+template<class Stream>
+void RemoteBlockReader<Stream>::SkipRestOfPacket() {
+  checksum_.resize(checksum_.size() + data_len_ - packet_data_read_bytes_ - PendingDiscardBytes());
+}
 
-    auto m = continuation::Pipeline<hadoop::hdfs::ClientReadStatusProto>::Create();
-    m->state().set_status(
-        parent_->options_.verify_checksum ?
-        hadoop::hdfs::Status::CHECKSUM_OK : hadoop::hdfs::Status::SUCCESS);
+template<class Stream>
+size_t RemoteBlockReader<Stream>::SerializeReadStatus() {
+  namespace pbio = ::google::protobuf::io;
+  hadoop::hdfs::ClientReadStatusProto status;
+  status.set_status(verifying_checksum() ?
+                    hadoop::hdfs::Status::CHECKSUM_OK : hadoop::hdfs::Status::SUCCESS);
+  pbio::ArrayOutputStream as(read_status_buf_.data(), read_status_buf_.size());
+  pbio::CodedOutputStream os(&as);
+  os.WriteVarint32(static_cast<uint32_t>(status.ByteSizeLong()));
+  status.SerializeWithCachedSizes(&os);
+  return os.ByteCount();
+}
 
-    m->Push(continuation::WriteDelimitedPBMessage(parent_->stream_, &m->state()));
+template<class Stream>
+bool RemoteBlockReader<Stream>::verifying_checksum() const {
+  return options_.verify_checksum && bytes_per_checksum_ &&
+      checksum_type_ != hadoop::hdfs::CHECKSUM_NULL;
+}
 
-    m->Run([this,next](const Status &status, const hadoop::hdfs::ClientReadStatusProto&) {
-        if (status.ok()) {
-          parent_->state_ = RemoteBlockReader<Stream>::kFinished;
-        }
-        next(status);
-      });
+template<class Stream>
+template<class MutableBufferSequence>
+Status RemoteBlockReader<Stream>::UpdateChecksum(const MutableBufferSequence &buffers,
+                                                 size_t offset, size_t length) {
+  for (auto it = buffers.begin(); it != buffers.end() && length; ++it) {
+    asio::const_buffer buffer(*it);
+    size_t size = asio::buffer_size(buffer);
+    if (offset >= size) {
+      offset -= size;
+      continue;
+    }
+    size = std::min(size - offset, length);
+    Status status = UpdateChecksum(asio::buffer_cast<const char*>(buffer) + offset, size);
+    if (!status.ok()) {
+      return status;
+    }
+    offset = 0;
+    length -= size;
   }
+  return Status::OK();
+}
 
- private:
-  RemoteBlockReader<Stream> *parent_;
-};
+template<class Stream>
+Status RemoteBlockReader<Stream>::UpdateChecksum(const char *data, size_t length) {
+  while (length) {
+    size_t size = std::min<size_t>(length, bytes_per_checksum_ - chunk_bytes_);
+    chunk_crc_ = checksum_type_ == hadoop::hdfs::CHECKSUM_CRC32C ?
+                 Crc32c(chunk_crc_, data, size) : Crc32(chunk_crc_, data, size);
+    chunk_bytes_ += size;
+    data += size;
+    length -= size;
+    if (chunk_bytes_ == bytes_per_checksum_) {
+      Status status = VerifyChunk();
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+  return Status::OK();
+}
+
+template<class Stream>
+Status RemoteBlockReader<Stream>::VerifyChunk() {
+  uint32_t expected;
+  memcpy(&expected, &checksum_[chunk_index_ * sizeof(expected)], sizeof(expected));
+  if (ntohl(expected) != chunk_crc_) {
+    return Status::ChecksumMismatch("Checksum mismatch in the block data");
+  }
+  ++chunk_index_;
+  chunk_bytes_ = 0;
+  chunk_crc_ = 0;
+  return Status::OK();
+}
 
 template<class Stream>
 template<class MutableBufferSequence, class ReadHandler>
@@ -283,22 +481,28 @@ void RemoteBlockReader<Stream>::async_read_some(const MutableBufferSequence& buf
                                                 const ReadHandler &handler) {
   assert(state_ != kOpen && "Not connected");
 
-  struct State {
-    std::shared_ptr<size_t> bytes_transferred;
-  };
-  auto m = continuation::Pipeline<State>::Create();
-  m->state().bytes_transferred = std::make_shared<size_t>(0);
+  if (state_ == kFinished) {
+    handler(Status::OK(), 0);
+    return;
+  }
+
+  ReadPacketOp<MutableBufferSequence, ReadHandler> op(this->shared_from_this(), buffers, false, handler);
+  op.Continue();
+}
 
-  m->Push(new ReadPacketHeader(this))
-      .Push(new ReadChecksum(this))
-      .Push(new ReadPadding(this))
-      .Push(new ReadData<MutableBufferSequence>(this, m->state().bytes_transferred, buffers))
-      .Push(new AckRead(this));
+template<class Stream>
+template<class MutableBufferSequence, class ReadHandler>
+void RemoteBlockReader<Stream>::async_read(const MutableBufferSequence& buffers,
+                                           const ReadHandler &handler) {
+  assert(state_ != kOpen && "Not connected");
 
-  auto self = this->shared_from_this();
-  m->Run([self,handler](const Status &status, const State &state) {
-      handler(status, *state.bytes_transferred);
-    });
+  if (state_ == kFinished) {
+    handler(Status::OK(), 0);
+    return;
+  }
+
+  ReadPacketOp<MutableBufferSequence, ReadHandler> op(this->shared_from_this(), buffers, true, handler);
+  op.Continue();
 }
 
 template<class Stream>
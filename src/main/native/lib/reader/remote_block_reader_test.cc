@@ -1,54 +1,407 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
 #include "block_reader.h"
 
-#include <asio.hpp>
+#include "common/checksum.h"
+
+#include <asio/io_service.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
 
-#include <iostream>
 #include <string>
+#include <vector>
+
+namespace hdfs {
 
-int main(int argc, char *argv[]) {
-  using namespace hdfs;
-  using ::asio::ip::tcp;
+using ::hadoop::hdfs::BlockOpResponseProto;
+using ::hadoop::hdfs::ClientReadStatusProto;
+using ::hadoop::hdfs::OpReadBlockProto;
+using ::hadoop::hdfs::PacketHeaderProto;
+namespace pbio = ::google::protobuf::io;
 
-  if (argc != 8)
-  {
-    std::cerr
-        << "A simple client to read a block in the HDFS cluster.\n"
-        << "Usage: " << argv[0] << " "
-        << "<poolid> <blockid> <genstamp> <size> <offset> <dnhost> <dnport>\n";
-    return 1;
+static const unsigned kBytesPerChecksum = 512;
+static const size_t kBlockLength = 3000;
+
+/*
+ * An in-memory stream that returns at most max_read bytes of the
+ * response of the DataNode per read and records everything written to
+ * it. The handlers are posted to the io_service like a socket does.
+ */
+class FakeStream {
+ public:
+  FakeStream(::asio::io_service *io_service, const std::string &response,
+             size_t max_read)
+      : io_service_(io_service)
+      , response_(response)
+      , max_read_(max_read)
+      , pos_(0)
+  {}
+
+  template<class MutableBufferSequence, class ReadHandler>
+  void async_read_some(const MutableBufferSequence &buffers,
+                       const ReadHandler &handler) {
+    size_t size = std::min(max_read_, response_.size() - pos_);
+    size_t transferred = ::asio::buffer_copy(buffers, ::asio::buffer(&response_[pos_], size));
+    pos_ += transferred;
+    ::asio::error_code ec;
+    if (!transferred && ::asio::buffer_size(buffers)) {
+      ec = ::asio::error::eof;
+    }
+    ReadHandler h = handler;
+    io_service_->post([h,ec,transferred]() mutable { h(ec, transferred); });
   }
 
-  asio::io_service io_service;
+  template<class ConstBufferSequence, class WriteHandler>
+  void async_write_some(const ConstBufferSequence &buffers,
+                        const WriteHandler &handler) {
+    size_t size = ::asio::buffer_size(buffers);
+    size_t offset = written_.size();
+    written_.resize(offset + size);
+    ::asio::buffer_copy(::asio::buffer(&written_[offset], size), buffers);
+    WriteHandler h = handler;
+    io_service_->post([h,size]() mutable { h(::asio::error_code(), size); });
+  }
 
-  hadoop::hdfs::ExtendedBlockProto block;
-  block.set_poolid(argv[1]);
-  block.set_blockid(std::stol(argv[2]));
-  block.set_generationstamp(std::stol(argv[3]));
-  size_t size = std::stol(argv[4]);
-  size_t offset = std::stol(argv[5]);
+  const std::string &written() const { return written_; }
+  bool consumed() const { return pos_ == response_.size(); }
 
-  tcp::resolver resolver(io_service);
-  tcp::resolver::query query(tcp::v4(), argv[6], argv[7]);
-  tcp::resolver::iterator iterator = resolver.resolve(query);
+ private:
+  ::asio::io_service *io_service_;
+  std::string response_;
+  size_t max_read_;
+  size_t pos_;
+  std::string written_;
+};
 
-  std::shared_ptr<tcp::socket> s(new tcp::socket(io_service));
-  asio::connect(*s.get(), iterator);
+static void AppendDelimited(const ::google::protobuf::MessageLite &msg, std::string *out) {
+  pbio::StringOutputStream ss(out);
+  pbio::CodedOutputStream os(&ss);
+  os.WriteVarint32(static_cast<uint32_t>(msg.ByteSizeLong()));
+  msg.SerializeWithCachedSizes(&os);
+}
 
-  BlockReaderOptions options;
-  auto reader = std::make_shared<RemoteBlockReader<tcp::socket> >(options, s.get());
-  std::unique_ptr<char[]> buf(new char[size]);
-  reader->async_connect("libhdfs++", nullptr, &block, size, offset, [&buf,reader,size](const Status &status) {
-      if (!status.ok()) {
-        std::cerr << "Error:" << status.code() << " " << status.ToString() << std::endl;
-      } else {
-        reader->async_read_some(asio::buffer(buf.get(), size), [&buf,size](const Status &status, size_t transferred) {
-            buf[std::min(transferred, size - 1)] = 0;
-            std::cerr << "Done:" << status.code()
-                      << " transferred = " << transferred << "\n"
-                      << buf.get() << std::endl;
-          });
+static void AppendPacket(int64_t offset, int64_t seqno, bool last,
+                         const std::string &data, std::string *out) {
+  PacketHeaderProto header;
+  header.set_offsetinblock(offset);
+  header.set_seqno(seqno);
+  header.set_lastpacketinblock(last);
+  header.set_datalen(static_cast<int32_t>(data.size()));
+
+  std::string checksums;
+  for (size_t i = 0; i < data.size(); i += kBytesPerChecksum) {
+    size_t n = std::min<size_t>(kBytesPerChecksum, data.size() - i);
+    uint32_t crc = htonl(Crc32c(0, &data[i], n));
+    checksums.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+  }
+
+  uint32_t payload_len = htonl(static_cast<uint32_t>(sizeof(payload_len) + checksums.size() + data.size()));
+  uint16_t header_len = htons(static_cast<uint16_t>(header.ByteSizeLong()));
+  out->append(reinterpret_cast<const char*>(&payload_len), sizeof(payload_len));
+  out->append(reinterpret_cast<const char*>(&header_len), sizeof(header_len));
+  out->append(header.SerializeAsString());
+  out->append(checksums);
+  out->append(data);
+}
+
+/*
+ * Drives a RemoteBlockReader with the response that a DataNode sends
+ * for a read of [offset, offset + length) of the block: the whole
+ * chunks that cover the range in packets of packet_size bytes, followed
+ * by the empty packet that ends the block.
+ */
+class RemoteBlockReaderTest : public ::testing::Test {
+ protected:
+  std::string block_;
+
+  virtual void SetUp() override {
+    block_.resize(kBlockLength);
+    for (size_t i = 0; i < block_.size(); ++i) {
+      block_[i] = static_cast<char>(i * 7);
+    }
+  }
+
+  std::string Response(uint64_t offset, uint64_t length, size_t packet_size) {
+    uint64_t begin = offset / kBytesPerChecksum * kBytesPerChecksum;
+    uint64_t end = std::min<uint64_t>(block_.size(),
+        (offset + length + kBytesPerChecksum - 1) / kBytesPerChecksum * kBytesPerChecksum);
+
+    BlockOpResponseProto resp;
+    resp.set_status(::hadoop::hdfs::Status::SUCCESS);
+    auto info = resp.mutable_readopchecksuminfo();
+    info->mutable_checksum()->set_type(::hadoop::hdfs::CHECKSUM_CRC32C);
+    info->mutable_checksum()->set_bytesperchecksum(kBytesPerChecksum);
+    info->set_chunkoffset(begin);
+
+    std::string response;
+    AppendDelimited(resp, &response);
+    int64_t seqno = 0;
+    for (uint64_t pos = begin; pos < end; pos += packet_size) {
+      AppendPacket(pos, seqno++, false, block_.substr(pos, std::min<uint64_t>(packet_size, end - pos)),
+                   &response);
+    }
+    AppendPacket(end, seqno, true, std::string(), &response);
+    return response;
+  }
+
+  std::shared_ptr<RemoteBlockReader<FakeStream> > Connect(
+      FakeStream *stream, uint64_t offset, uint64_t length,
+      const BlockReaderOptions &options = BlockReaderOptions()) {
+    hadoop::hdfs::ExtendedBlockProto block;
+    block.set_poolid("pool");
+    block.set_blockid(1);
+    block.set_generationstamp(1);
+
+    auto reader = std::make_shared<RemoteBlockReader<FakeStream> >(options, stream);
+    Status stat = Status::Error("not called");
+    reader->async_connect("libhdfs++", nullptr, &block, length, offset,
+                          [&stat](const Status &status) { stat = status; });
+    io_service_.run();
+    io_service_.reset();
+    EXPECT_TRUE(stat.ok());
+    return reader;
+  }
+
+  /*
+   * Read with async_read_some() until the reader has finished or fails,
+   * and record the size of every read.
+   */
+  Status ReadSome(RemoteBlockReader<FakeStream> *reader, size_t length,
+                  std::string *data, std::vector<size_t> *reads) {
+    data->resize(length);
+    size_t offset = 0;
+    while (!reader->is_finished()) {
+      Status stat = Status::Error("not called");
+      size_t transferred = 0;
+      reader->async_read_some(::asio::buffer(&(*data)[offset], length - offset),
+                              [&stat,&transferred](const Status &status, size_t n) {
+                                stat = status;
+                                transferred = n;
+                              });
+      io_service_.run();
+      io_service_.reset();
+      if (!stat.ok()) {
+        return stat;
       }
-    });
-  io_service.run();
-  return 0;
+      offset += transferred;
+      reads->push_back(transferred);
+    }
+    data->resize(offset);
+    return Status::OK();
+  }
+
+  template<class MutableBufferSequence>
+  Status Read(RemoteBlockReader<FakeStream> *reader, const MutableBufferSequence &buffers,
+              size_t *transferred) {
+    Status stat = Status::Error("not called");
+    reader->async_read(buffers, [&stat,transferred](const Status &status, size_t n) {
+        stat = status;
+        *transferred = n;
+      });
+    io_service_.run();
+    io_service_.reset();
+    return stat;
+  }
+
+  /*
+   * Parse the OP_READ_BLOCK request and the ClientReadStatusProto that
+   * follows it, if any, out of what the reader wrote.
+   */
+  static bool ParseWritten(const std::string &written, OpReadBlockProto *request,
+                           ClientReadStatusProto *status, bool *has_status) {
+    pbio::CodedInputStream is(reinterpret_cast<const uint8_t*>(written.data()),
+                              static_cast<int>(written.size()));
+    if (!is.Skip(3)) {
+      return false;
+    }
+    uint32_t size;
+    if (!is.ReadVarint32(&size)) {
+      return false;
+    }
+    auto limit = is.PushLimit(size);
+    if (!request->ParseFromCodedStream(&is)) {
+      return false;
+    }
+    is.PopLimit(limit);
+
+    *has_status = is.ReadVarint32(&size);
+    if (*has_status) {
+      limit = is.PushLimit(size);
+      if (!status->ParseFromCodedStream(&is)) {
+        return false;
+      }
+      is.PopLimit(limit);
+    }
+    return is.ExpectAtEnd();
+  }
+
+  static void ExpectReadStatus(const FakeStream &stream, uint64_t offset, uint64_t length,
+                               ::hadoop::hdfs::Status expected) {
+    OpReadBlockProto request;
+    ClientReadStatusProto status;
+    bool has_status = false;
+    ASSERT_TRUE(ParseWritten(stream.written(), &request, &status, &has_status));
+    EXPECT_EQ(offset, request.offset());
+    EXPECT_EQ(length, request.len());
+    ASSERT_TRUE(has_status);
+    EXPECT_EQ(expected, status.status());
+    EXPECT_TRUE(stream.consumed());
+  }
+
+  ::asio::io_service io_service_;
+};
+
+TEST_F(RemoteBlockReaderTest, TestPaddingInFirstChunk) {
+  const uint64_t offset = 700, length = 200;
+  FakeStream stream(&io_service_, Response(offset, length, 64 * 1024), 64 * 1024);
+  auto reader = Connect(&stream, offset, length);
+
+  std::string data;
+  std::vector<size_t> reads;
+  ASSERT_TRUE(ReadSome(reader.get(), length, &data, &reads).ok());
+  EXPECT_EQ(block_.substr(offset, length), data);
+  ExpectReadStatus(stream, offset, length, ::hadoop::hdfs::Status::CHECKSUM_OK);
+}
+
+TEST_F(RemoteBlockReaderTest, TestPartialLastChunk) {
+  const uint64_t offset = 2600, length = kBlockLength - 2600;
+  FakeStream stream(&io_service_, Response(offset, length, 64 * 1024), 64 * 1024);
+  auto reader = Connect(&stream, offset, length);
+
+  std::string data;
+  std::vector<size_t> reads;
+  ASSERT_TRUE(ReadSome(reader.get(), length, &data, &reads).ok());
+  EXPECT_EQ(block_.substr(offset), data);
+  ExpectReadStatus(stream, offset, length, ::hadoop::hdfs::Status::CHECKSUM_OK);
+}
+
+TEST_F(RemoteBlockReaderTest, TestMultiplePackets) {
+  // Small reads from the stream split the headers and the checksums
+  for (size_t max_read : {7, 1000, 64 * 1024}) {
+    const uint64_t offset = 100, length = kBlockLength - 100;
+    FakeStream stream(&io_service_, Response(offset, length, 1024), max_read);
+    auto reader = Connect(&stream, offset, length);
+
+    std::string data;
+    std::vector<size_t> reads;
+    ASSERT_TRUE(ReadSome(reader.get(), length, &data, &reads).ok());
+    EXPECT_EQ(block_.substr(offset), data);
+    // async_read_some() returns the data of at most one packet
+    EXPECT_EQ(std::vector<size_t>({1024 - 100, 1024, kBlockLength - 2048}), reads);
+    ExpectReadStatus(stream, offset, length, ::hadoop::hdfs::Status::CHECKSUM_OK);
+  }
+}
+
+TEST_F(RemoteBlockReaderTest, TestReadStatusWithoutVerification) {
+  const uint64_t offset = 10, length = 1000;
+  FakeStream stream(&io_service_, Response(offset, length, 512), 64 * 1024);
+  BlockReaderOptions options;
+  options.verify_checksum = false;
+  auto reader = Connect(&stream, offset, length, options);
+
+  std::string data;
+  std::vector<size_t> reads;
+  ASSERT_TRUE(ReadSome(reader.get(), length, &data, &reads).ok());
+  EXPECT_EQ(block_.substr(offset, length), data);
+  ExpectReadStatus(stream, offset, length, ::hadoop::hdfs::Status::SUCCESS);
+}
+
+TEST_F(RemoteBlockReaderTest, TestChecksumMismatch) {
+  const uint64_t offset = 0, length = kBlockLength;
+  std::string response = Response(offset, length, 64 * 1024);
+  // Corrupt the last byte of the block, which is followed by the 31
+  // bytes of the empty packet
+  response[response.size() - 32] ^= 1;
+  FakeStream stream(&io_service_, response, 64 * 1024);
+  auto reader = Connect(&stream, offset, length);
+
+  std::string data;
+  std::vector<size_t> reads;
+  Status stat = ReadSome(reader.get(), length, &data, &reads);
+  EXPECT_EQ(Status::ChecksumMismatch("").code(), stat.code());
+  EXPECT_FALSE(reader->is_finished());
+}
+
+TEST_F(RemoteBlockReaderTest, TestReadSpansPackets) {
+  const uint64_t offset = 300, length = kBlockLength - 300;
+  FakeStream stream(&io_service_, Response(offset, length, 512), 1000);
+  auto reader = Connect(&stream, offset, length);
+
+  std::string data(length, 0);
+  std::vector<::asio::mutable_buffer> buffers = {
+    ::asio::buffer(&data[0], 100),
+    ::asio::buffer(&data[100], 1500),
+    ::asio::buffer(&data[1600], length - 1600),
+  };
+  size_t transferred = 0;
+  ASSERT_TRUE(Read(reader.get(), buffers, &transferred).ok());
+  EXPECT_EQ(length, transferred);
+  EXPECT_EQ(block_.substr(offset), data);
+  ExpectReadStatus(stream, offset, length, ::hadoop::hdfs::Status::CHECKSUM_OK);
+}
+
+TEST_F(RemoteBlockReaderTest, TestReadPastLastPacket) {
+  // The last packet has data beyond the requested range, which is skipped
+  const uint64_t offset = 100, length = 1000;
+  FakeStream stream(&io_service_, Response(offset, length, 512), 64 * 1024);
+  auto reader = Connect(&stream, offset, length);
+
+  std::string data(2 * length, 0);
+  size_t transferred = 0;
+  ASSERT_TRUE(Read(reader.get(), ::asio::buffer(&data[0], data.size()), &transferred).ok());
+  EXPECT_EQ(length, transferred);
+  EXPECT_EQ(block_.substr(offset, length), data.substr(0, length));
+  ExpectReadStatus(stream, offset, length, ::hadoop::hdfs::Status::CHECKSUM_OK);
+
+  ASSERT_TRUE(Read(reader.get(), ::asio::buffer(&data[0], data.size()), &transferred).ok());
+  EXPECT_EQ(0u, transferred);
+}
+
+TEST_F(RemoteBlockReaderTest, TestBlockEndsBeforeRange) {
+  const uint64_t offset = 0, length = 1000;
+  FakeStream stream(&io_service_, Response(offset, length, 512), 64 * 1024);
+  auto reader = Connect(&stream, offset, 2 * length);
+
+  std::string data(2 * length, 0);
+  size_t transferred = 0;
+  EXPECT_FALSE(Read(reader.get(), ::asio::buffer(&data[0], data.size()), &transferred).ok());
+  EXPECT_EQ(1024u, transferred);
+  EXPECT_EQ(block_.substr(offset, 1024), data.substr(0, 1024));
+  EXPECT_FALSE(reader->is_finished());
+}
+
+TEST_F(RemoteBlockReaderTest, TestTruncatedResponse) {
+  const uint64_t offset = 0, length = kBlockLength;
+  std::string response = Response(offset, length, 1024);
+  FakeStream stream(&io_service_, response.substr(0, response.size() / 2), 64 * 1024);
+  auto reader = Connect(&stream, offset, length);
+
+  std::string data(length, 0);
+  size_t transferred = 0;
+  EXPECT_FALSE(Read(reader.get(), ::asio::buffer(&data[0], data.size()), &transferred).ok());
+  EXPECT_GT(length, transferred);
+  EXPECT_EQ(block_.substr(0, transferred), data.substr(0, transferred));
+  EXPECT_FALSE(reader->is_finished());
+}
+
 }
@@ -0,0 +1,459 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "short_circuit.h"
+
+#include "common/util.h"
+
+#include <asio/write.hpp>
+
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace hdfs {
+
+using ::google::protobuf::MessageLite;
+using namespace ::hadoop::hdfs;
+
+static const uint32_t kMaxShortCircuitVersion = 1;
+static const uint16_t kMetaVersion = 1;
+
+static void CloseFds(const std::vector<int> &fds) {
+  for (int fd : fds) {
+    ::close(fd);
+  }
+}
+
+/*
+ * Receive up to length bytes without blocking, along with the file
+ * descriptors that come with them.
+ */
+static ssize_t RecvWithFds(int sock, char *buf, size_t length, std::vector<int> *fds) {
+  static const size_t kMaxFds = 4;
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = length;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * kMaxFds)];
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  ssize_t n = ::recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (n < 0) {
+    return n;
+  }
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int *received = reinterpret_cast<const int*>(CMSG_DATA(c));
+      fds->insert(fds->end(), received, received + count);
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return n;
+}
+
+/*
+ * The state of an operation on the domain socket. Every read goes
+ * through recvmsg() so that the file descriptors are not dropped
+ * whichever read receives the byte that carries them.
+ */
+struct DomainSocketOpState {
+  std::shared_ptr<DomainSocket> socket;
+  std::string request;
+  std::string response;
+  unsigned char length_byte;
+  uint32_t length;
+  unsigned length_bytes;
+  char fd_byte;
+  std::vector<int> fds;
+  std::vector<int> *out_fds;
+  MessageLite *message;
+  std::function<bool()> passes_fds;
+  std::function<void(const Status &)> handler;
+};
+
+static void Receive(const std::shared_ptr<DomainSocketOpState> &op, char *buf, size_t length,
+                    const std::function<void(const Status &)> &handler) {
+  if (!length) {
+    handler(Status::OK());
+    return;
+  }
+  op->socket->async_read_some(::asio::null_buffers(), [op,buf,length,handler](
+      const ::asio::error_code &ec, size_t) {
+      if (ec) {
+        handler(ToStatus(ec));
+        return;
+      }
+      ssize_t n = RecvWithFds(op->socket->native_handle(), buf, length, &op->fds);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        Receive(op, buf, length, handler);
+      } else if (n < 0) {
+        handler(Status(errno, strerror(errno)));
+      } else if (n == 0) {
+        handler(Status::Error("The DataNode has closed the domain socket"));
+      } else {
+        Receive(op, buf + n, length - n, handler);
+      }
+    });
+}
+
+static void Finish(const std::shared_ptr<DomainSocketOpState> &op, const Status &status) {
+  if (status.ok() && op->out_fds) {
+    op->out_fds->insert(op->out_fds->end(), op->fds.begin(), op->fds.end());
+  } else {
+    CloseFds(op->fds);
+  }
+  op->fds.clear();
+  op->handler(status);
+}
+
+static void ReceiveResponse(const std::shared_ptr<DomainSocketOpState> &op) {
+  // The response is delimited by its length in a varint, which is
+  // received one byte at a time so as not to read beyond the message.
+  Receive(op, reinterpret_cast<char*>(&op->length_byte), 1, [op](const Status &status) {
+      if (!status.ok()) {
+        Finish(op, status);
+        return;
+      }
+      op->length |= (op->length_byte & 0x7f) << (7 * op->length_bytes++);
+      if (op->length_byte & 0x80) {
+        if (op->length_bytes == 5) {
+          Finish(op, Status::Error("Invalid response from the DataNode"));
+          return;
+        }
+        ReceiveResponse(op);
+        return;
+      }
+
+      op->response.resize(op->length);
+      Receive(op, &op->response[0], op->length, [op](const Status &status) {
+          if (!status.ok()) {
+            Finish(op, status);
+            return;
+          } else if (!op->message->ParseFromString(op->response)) {
+            Finish(op, Status::Error("Invalid response from the DataNode"));
+            return;
+          } else if (!op->passes_fds()) {
+            Finish(op, Status::OK());
+            return;
+          }
+
+          Receive(op, &op->fd_byte, 1, [op](const Status &status) {
+              if (status.ok() && op->fds.empty()) {
+                Finish(op, Status::Error("The DataNode has not passed the file descriptors"));
+                return;
+              }
+              Finish(op, status);
+            });
+        });
+    });
+}
+
+void AsyncDomainSocketOp(const std::shared_ptr<DomainSocket> &socket, Operation op,
+                         const MessageLite &request, MessageLite *response,
+                         const std::function<bool()> &passes_fds,
+                         std::vector<int> *fds,
+                         const std::function<void(const Status &)> &handler) {
+  auto s = std::make_shared<DomainSocketOpState>();
+  s->socket = socket;
+  s->length = 0;
+  s->length_bytes = 0;
+  s->message = response;
+  s->passes_fds = passes_fds;
+  s->out_fds = fds;
+  s->handler = handler;
+
+  s->request.insert(s->request.begin(), { 0, kDataTransferVersion, static_cast<char>(op) });
+  {
+    namespace pbio = ::google::protobuf::io;
+    pbio::StringOutputStream ss(&s->request);
+    pbio::CodedOutputStream os(&ss);
+    os.WriteVarint32(static_cast<uint32_t>(request.ByteSizeLong()));
+    request.SerializeWithCachedSizes(&os);
+  }
+
+  ::asio::async_write(*socket, ::asio::buffer(s->request), [s](const ::asio::error_code &ec, size_t) {
+      if (ec) {
+        Finish(s, ToStatus(ec));
+        return;
+      }
+      ReceiveResponse(s);
+    });
+}
+
+ShortCircuitShm::ShortCircuitShm(const std::shared_ptr<DomainSocket> &socket,
+                                 const std::string &path,
+                                 const ShortCircuitShmIdProto &id,
+                                 char *base, size_t size)
+    : socket_(socket)
+    , path_(path)
+    , id_(id)
+    , base_(base)
+    , size_(size)
+    , connected_(true)
+    , used_(size / kSlotSize)
+{}
+
+ShortCircuitShm::~ShortCircuitShm() {
+  ::asio::error_code ec;
+  socket_->close(ec);
+  ::munmap(base_, size_);
+}
+
+void ShortCircuitShm::AsyncCreate(
+    ::asio::io_service &io_service, const std::string &path, const std::string &client_name,
+    const std::function<void(const Status &, const std::shared_ptr<ShortCircuitShm> &)> &handler) {
+  auto socket = std::make_shared<DomainSocket>(io_service);
+  socket->async_connect(::asio::local::stream_protocol::endpoint(path), [socket,path,client_name,handler](
+      const ::asio::error_code &ec) {
+      if (ec) {
+        handler(ToStatus(ec), nullptr);
+        return;
+      }
+
+      ShortCircuitShmRequestProto req;
+      req.set_clientname(client_name);
+      auto resp = std::make_shared<ShortCircuitShmResponseProto>();
+      auto fds = std::make_shared<std::vector<int> >();
+      AsyncDomainSocketOp(socket, kRequestShortCircuitShm, req, resp.get(), fds.get(),
+                          [socket,path,resp,fds,handler](const Status &status) {
+          if (!status.ok()) {
+            handler(status, nullptr);
+            return;
+          } else if (resp->status() != SUCCESS) {
+            handler(Status::Error(resp->error().c_str()), nullptr);
+            return;
+          }
+
+          // The segment stays mapped after the file descriptor is closed
+          struct stat st;
+          void *base = MAP_FAILED;
+          size_t size = 0;
+          if (!::fstat((*fds)[0], &st)) {
+            size = st.st_size / kSlotSize * kSlotSize;
+            if (size) {
+              base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, (*fds)[0], 0);
+            }
+          }
+          Status stat = base == MAP_FAILED ?
+              Status::Error("Cannot map the shared memory segment") : Status::OK();
+          CloseFds(*fds);
+          if (!stat.ok()) {
+            handler(stat, nullptr);
+            return;
+          }
+
+          std::shared_ptr<ShortCircuitShm> shm(
+              new ShortCircuitShm(socket, path, resp->id(), static_cast<char*>(base), size));
+          shm->WatchConnection();
+          handler(Status::OK(), shm);
+        });
+    });
+}
+
+void ShortCircuitShm::WatchConnection() {
+  // The DataNode never sends anything over the connection, thus the
+  // read completes only when the connection breaks.
+  std::weak_ptr<ShortCircuitShm> self(shared_from_this());
+  socket_->async_read_some(::asio::buffer(&watch_buffer_, 1), [self](
+      const ::asio::error_code &, size_t) {
+      auto shm = self.lock();
+      if (shm) {
+        shm->connected_ = false;
+      }
+    });
+}
+
+int ShortCircuitShm::AllocateSlot() {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (size_t i = 0; i < used_.size(); ++i) {
+    if (!used_[i]) {
+      used_[i] = true;
+      __atomic_store_n(slot_flags(i), kValidFlag, __ATOMIC_SEQ_CST);
+      return i;
+    }
+  }
+  return -1;
+}
+
+void ShortCircuitShm::FreeSlot(int slot) {
+  std::lock_guard<std::mutex> lock(lock_);
+  __atomic_store_n(slot_flags(slot), 0, __ATOMIC_SEQ_CST);
+  used_[slot] = false;
+}
+
+bool ShortCircuitShm::IsSlotValid(int slot) const {
+  return connected_ && (__atomic_load_n(slot_flags(slot), __ATOMIC_SEQ_CST) & kValidFlag);
+}
+
+void ShortCircuitShm::ReleaseSlot(int slot) {
+  __atomic_and_fetch(slot_flags(slot), ~kValidFlag, __ATOMIC_SEQ_CST);
+  if (!connected_) {
+    // The DataNode has dropped the segment along with its slots
+    return;
+  }
+
+  auto self = shared_from_this();
+  auto socket = std::make_shared<DomainSocket>(socket_->get_io_service());
+  socket->async_connect(::asio::local::stream_protocol::endpoint(path_), [self,socket,slot](
+      const ::asio::error_code &ec) {
+      if (ec) {
+        return;
+      }
+      ReleaseShortCircuitAccessRequestProto req;
+      req.mutable_slotid()->mutable_shmid()->CheckTypeAndMergeFrom(self->id_);
+      req.mutable_slotid()->set_slotidx(slot);
+      auto resp = std::make_shared<ReleaseShortCircuitAccessResponseProto>();
+      AsyncDomainSocketOp(socket, kReleaseShortCircuitFds, req, resp.get(), nullptr,
+                          [self,socket,slot,resp](const Status &status) {
+          // A slot that the DataNode still holds cannot be registered
+          // again, thus it is leaked if the release fails.
+          if (status.ok() && resp->status() == SUCCESS) {
+            self->FreeSlot(slot);
+          }
+        });
+    });
+}
+
+ShortCircuitReplica::ShortCircuitReplica(int data_fd, int meta_fd,
+                                         const std::shared_ptr<ShortCircuitShm> &shm,
+                                         int slot)
+    : data_fd_(data_fd)
+    , meta_fd_(meta_fd)
+    , shm_(shm)
+    , slot_(slot)
+    , failed_(false)
+    , checksum_type_(CHECKSUM_NULL)
+    , bytes_per_checksum_(0)
+{}
+
+ShortCircuitReplica::~ShortCircuitReplica() {
+  ::close(data_fd_);
+  ::close(meta_fd_);
+  if (shm_) {
+    shm_->ReleaseSlot(slot_);
+  }
+}
+
+Status ShortCircuitReplica::ReadMetaHeader() {
+  unsigned char header[kMetaHeaderSize];
+  if (::pread(meta_fd_, header, sizeof(header), 0) != sizeof(header)) {
+    return Status::Error("Cannot read the header of the meta file");
+  }
+
+  uint16_t version = (header[0] << 8) | header[1];
+  uint32_t bytes_per_checksum;
+  memcpy(&bytes_per_checksum, &header[3], sizeof(bytes_per_checksum));
+  bytes_per_checksum_ = ntohl(bytes_per_checksum);
+  if (version != kMetaVersion || !ChecksumTypeProto_IsValid(header[2]) ||
+      !bytes_per_checksum_) {
+    return Status::Error("Unsupported meta file of the replica");
+  }
+  checksum_type_ = static_cast<ChecksumTypeProto>(header[2]);
+  return Status::OK();
+}
+
+bool ShortCircuitReplica::IsValid() const {
+  return !failed_ && (!shm_ || shm_->IsSlotValid(slot_));
+}
+
+void AsyncRequestShortCircuitFds(
+    ::asio::io_service &io_service, const std::string &path,
+    const ExtendedBlockProto &block,
+    const ::hadoop::common::TokenProto *token,
+    const std::shared_ptr<ShortCircuitShm> &shm, int slot,
+    const std::function<void(const Status &, const std::shared_ptr<ShortCircuitReplica> &)> &handler) {
+  auto req = std::make_shared<OpRequestShortCircuitAccessProto>();
+  auto header = req->mutable_header();
+  header->mutable_block()->CheckTypeAndMergeFrom(block);
+  if (token) {
+    header->mutable_token()->CheckTypeAndMergeFrom(*token);
+  }
+  req->set_maxversion(kMaxShortCircuitVersion);
+  if (shm) {
+    req->mutable_slotid()->mutable_shmid()->CheckTypeAndMergeFrom(shm->id());
+    req->mutable_slotid()->set_slotidx(slot);
+  }
+
+  auto fail = [shm,slot,handler](const Status &status) {
+    if (shm) {
+      shm->FreeSlot(slot);
+    }
+    handler(status, nullptr);
+  };
+
+  auto socket = std::make_shared<DomainSocket>(io_service);
+  socket->async_connect(::asio::local::stream_protocol::endpoint(path), [socket,req,shm,slot,fail,handler](
+      const ::asio::error_code &ec) {
+      if (ec) {
+        fail(ToStatus(ec));
+        return;
+      }
+
+      auto resp = std::make_shared<BlockOpResponseProto>();
+      auto fds = std::make_shared<std::vector<int> >();
+      AsyncDomainSocketOp(socket, kRequestShortCircuitFds, *req, resp.get(), fds.get(),
+                          [socket,resp,fds,shm,slot,fail,handler](const Status &status) {
+          if (!status.ok()) {
+            fail(status);
+            return;
+          } else if (resp->status() == ERROR_UNSUPPORTED) {
+            fail(Status::Error(("Short-circuit reads are not supported: " + resp->message()).c_str()));
+            return;
+          } else if (resp->status() != SUCCESS) {
+            // The DataNode does not share this replica, e.g., it is not
+            // finalized yet, and has not registered the slot.
+            fail(Status::OK());
+            return;
+          } else if (fds->size() != 2) {
+            CloseFds(*fds);
+            fail(Status::Error("The DataNode has not passed the block and the meta files"));
+            return;
+          }
+
+          // The replica owns the file descriptors and the slot from now
+          auto replica = std::make_shared<ShortCircuitReplica>((*fds)[0], (*fds)[1], shm, slot);
+          Status stat = replica->ReadMetaHeader();
+          if (!stat.ok()) {
+            handler(stat, nullptr);
+            return;
+          }
+          handler(Status::OK(), replica);
+        });
+    });
+}
+
+}
@@ -0,0 +1,188 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_READER_SHORT_CIRCUIT_H_
+#define LIB_READER_SHORT_CIRCUIT_H_
+
+#include "libhdfs++/status.h"
+#include "common/datatransfer.h"
+#include "datatransfer.pb.h"
+
+#include <asio/local/stream_protocol.hpp>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * The short-circuit reads of the replicas on a DataNode of the same
+ * host. The DataNode passes the file descriptors of the block and the
+ * meta files over its UNIX domain socket, and the client reads the
+ * files directly.
+ **/
+
+typedef ::asio::local::stream_protocol::socket DomainSocket;
+
+/**
+ * Send an operation to the DataNode over the domain socket and
+ * receive the response. A successful response of the operations that
+ * pass file descriptors is followed by a byte that carries them,
+ * which is received when passes_fds() returns true once the response
+ * has been parsed. The received file descriptors are appended to fds,
+ * and are owned by the caller.
+ **/
+void AsyncDomainSocketOp(const std::shared_ptr<DomainSocket> &socket, Operation op,
+                         const ::google::protobuf::MessageLite &request,
+                         ::google::protobuf::MessageLite *response,
+                         const std::function<bool()> &passes_fds,
+                         std::vector<int> *fds,
+                         const std::function<void(const Status &)> &handler);
+
+template <class Response>
+void AsyncDomainSocketOp(const std::shared_ptr<DomainSocket> &socket, Operation op,
+                         const ::google::protobuf::MessageLite &request,
+                         Response *response, std::vector<int> *fds,
+                         const std::function<void(const Status &)> &handler) {
+  AsyncDomainSocketOp(socket, op, request, response, [response,fds]() {
+      return fds && response->status() == ::hadoop::hdfs::Status::SUCCESS;
+    }, fds, handler);
+}
+
+/**
+ * A segment of shared memory through which the DataNode tells the
+ * client whether the replicas that it has passed are still valid.
+ * The segment is divided into slots of 64 bytes. The client allocates
+ * a slot for each replica that it requests, and the DataNode clears
+ * the valid flag of the slot when the replica is moved or deleted.
+ *
+ * The DataNode frees the segment when the connection over which it was
+ * requested closes, thus the segment keeps the connection open, and
+ * all of its slots become invalid once the connection breaks.
+ **/
+class ShortCircuitShm : public std::enable_shared_from_this<ShortCircuitShm> {
+ public:
+  static const size_t kSlotSize = 64;
+  /**
+   * Request a new segment from the DataNode listening on the domain
+   * socket at path.
+   **/
+  static void AsyncCreate(::asio::io_service &io_service, const std::string &path,
+                          const std::string &client_name,
+                          const std::function<void(const Status &,
+                                                   const std::shared_ptr<ShortCircuitShm> &)> &handler);
+  ~ShortCircuitShm();
+
+  /**
+   * Allocate a free slot and mark it valid. Return -1 if all slots are
+   * in use.
+   **/
+  int AllocateSlot();
+  void FreeSlot(int slot);
+  /**
+   * Tell the DataNode that the replica of the slot has been closed, and
+   * free the slot once the DataNode has unregistered it.
+   **/
+  void ReleaseSlot(int slot);
+  bool IsSlotValid(int slot) const;
+  bool is_connected() const { return connected_; }
+  const ::hadoop::hdfs::ShortCircuitShmIdProto &id() const { return id_; }
+
+ private:
+  ShortCircuitShm(const std::shared_ptr<DomainSocket> &socket, const std::string &path,
+                  const ::hadoop::hdfs::ShortCircuitShmIdProto &id,
+                  char *base, size_t size);
+  uint64_t *slot_flags(int slot) const
+  { return reinterpret_cast<uint64_t*>(base_ + slot * kSlotSize); }
+  void WatchConnection();
+
+  static const uint64_t kValidFlag = 1ULL << 63;
+
+  const std::shared_ptr<DomainSocket> socket_;
+  const std::string path_;
+  const ::hadoop::hdfs::ShortCircuitShmIdProto id_;
+  char * const base_;
+  const size_t size_;
+  std::atomic_bool connected_;
+  char watch_buffer_;
+  std::mutex lock_;
+  std::vector<bool> used_;
+};
+
+/**
+ * The file descriptors of a local replica, and the checksum parameters
+ * from the header of its meta file. The file descriptors are closed
+ * and the slot is released when the last reader of the replica goes
+ * away.
+ **/
+class ShortCircuitReplica {
+ public:
+  // The version, the checksum type, and the bytes per checksum
+  static const size_t kMetaHeaderSize = 7;
+
+  ShortCircuitReplica(int data_fd, int meta_fd,
+                      const std::shared_ptr<ShortCircuitShm> &shm, int slot);
+  ~ShortCircuitReplica();
+  Status ReadMetaHeader();
+
+  /**
+   * Whether the replica can still be read, i.e., neither the DataNode
+   * has invalidated its slot nor a read has failed on it.
+   **/
+  bool IsValid() const;
+  bool has_slot() const { return shm_ != nullptr; }
+  void set_failed() { failed_ = true; }
+
+  int data_fd() const { return data_fd_; }
+  int meta_fd() const { return meta_fd_; }
+  ::hadoop::hdfs::ChecksumTypeProto checksum_type() const { return checksum_type_; }
+  unsigned bytes_per_checksum() const { return bytes_per_checksum_; }
+
+ private:
+  const int data_fd_;
+  const int meta_fd_;
+  const std::shared_ptr<ShortCircuitShm> shm_;
+  const int slot_;
+  std::atomic_bool failed_;
+  ::hadoop::hdfs::ChecksumTypeProto checksum_type_;
+  unsigned bytes_per_checksum_;
+};
+
+/**
+ * Request the file descriptors of the replica of the block from the
+ * DataNode listening on the domain socket at path. The replica is
+ * registered in the slot of the segment unless shm is null.
+ *
+ * The handler receives a null replica with an OK status when the
+ * DataNode cannot pass this particular replica, e.g., because it is
+ * still being written, and an error when short-circuit reads from the
+ * DataNode do not work at all.
+ **/
+void AsyncRequestShortCircuitFds(
+    ::asio::io_service &io_service, const std::string &path,
+    const ::hadoop::hdfs::ExtendedBlockProto &block,
+    const ::hadoop::common::TokenProto *token,
+    const std::shared_ptr<ShortCircuitShm> &shm, int slot,
+    const std::function<void(const Status &,
+                             const std::shared_ptr<ShortCircuitReplica> &)> &handler);
+
+}
+
+#endif
@@ -0,0 +1,245 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ha_rpc_engine.h"
+
+#include "common/util.h"
+
+#include <future>
+#include <sstream>
+
+namespace hdfs {
+
+using ::asio::ip::tcp;
+
+static const char kStandbyException[] = "org.apache.hadoop.ipc.StandbyException";
+
+HaRpcEngine::HaRpcEngine(::asio::io_service *io_service, const Options &options,
+                         const std::string &client_name,
+                         const char *protocol_name, int protocol_version)
+    : io_service_(io_service)
+    , options_(options)
+    , client_name_(client_name)
+    , protocol_name_(protocol_name)
+    , protocol_version_(protocol_version)
+    , failover_policy_(options.max_rpc_retries, options.rpc_retry_delay,
+                       options.max_rpc_retry_delay)
+    , active_(0)
+    , shutdown_(false)
+{}
+
+std::mutex &HaRpcEngine::active_namenodes_lock() {
+  static std::mutex lock;
+  return lock;
+}
+
+std::unordered_map<std::string, unsigned> &HaRpcEngine::active_namenodes() {
+  static std::unordered_map<std::string, unsigned> active;
+  return active;
+}
+
+void HaRpcEngine::set_idempotent_methods(const std::vector<std::string> &methods) {
+  idempotent_methods_.insert(idempotent_methods_.end(), methods.begin(), methods.end());
+  for (const auto &nn : namenodes_) {
+    nn.engine->set_idempotent_methods(methods);
+  }
+}
+
+bool HaRpcEngine::IsIdempotent(const std::string &method_name) const {
+  return namenodes_.front().engine->IsIdempotent(method_name);
+}
+
+bool HaRpcEngine::IsStandbyException(const Status &status) {
+  return status.exception_class() == kStandbyException;
+}
+
+void HaRpcEngine::AsyncConnect(const std::vector<std::vector<tcp::endpoint> > &namenodes,
+                               const std::function<void(const Status &)> &handler) {
+  std::stringstream ss;
+  for (const auto &endpoints : namenodes) {
+    NameNode nn;
+    nn.endpoints = endpoints;
+    nn.engine.reset(new RpcEngine(io_service_, options_, client_name_,
+                                  protocol_name_.c_str(), protocol_version_));
+    nn.engine->set_idempotent_methods(idempotent_methods_);
+    nn.started = false;
+    if (namenodes.size() > 1) {
+      // A connection error fails over right away instead of retrying
+      // the NameNode that might have gone down. The retries happen
+      // across the NameNodes.
+      nn.engine->set_retry_policy(
+          std::unique_ptr<RetryPolicy>(new ExponentialBackoffRetryPolicy(0, 0, 0)));
+    }
+    namenodes_.push_back(std::move(nn));
+    ss << (endpoints.empty() ? tcp::endpoint() : endpoints.front()) << ",";
+  }
+  nameservice_ = ss.str();
+
+  unsigned active = 0;
+  {
+    std::lock_guard<std::mutex> lock(active_namenodes_lock());
+    auto it = active_namenodes().find(nameservice_);
+    if (it != active_namenodes().end() && it->second < namenodes_.size()) {
+      active = it->second;
+    }
+  }
+  TryConnect(active, 0, handler);
+}
+
+void HaRpcEngine::TryConnect(unsigned index, unsigned attempts,
+                             const std::function<void(const Status &)> &handler) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    namenodes_[index].started = true;
+  }
+  RpcEngine *engine = namenodes_[index].engine.get();
+  engine->AsyncConnect(namenodes_[index].endpoints,
+                       [this, engine, index, attempts, handler](const Status &status) {
+      // The connections that have failed start their read loops once
+      // they are re-established
+      engine->StartReadLoop();
+      if (status.ok() || attempts + 1 >= namenodes_.size()) {
+        active_ = index;
+        handler(status);
+        return;
+      }
+      TryConnect((index + 1) % namenodes_.size(), attempts + 1, handler);
+    });
+}
+
+void HaRpcEngine::StartNameNode(unsigned index) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (namenodes_[index].started || shutdown_) {
+      return;
+    }
+    namenodes_[index].started = true;
+  }
+  // The calls queue up in the engine until it is connected. A failed
+  // connection is retried by the calls themselves.
+  RpcEngine *engine = namenodes_[index].engine.get();
+  engine->AsyncConnect(namenodes_[index].endpoints, [engine](const Status &) {
+      engine->StartReadLoop();
+    });
+}
+
+void HaRpcEngine::Issue(const std::shared_ptr<Call> &call) {
+  unsigned index = active_;
+  StartNameNode(index);
+  namenodes_[index].engine->AsyncRpc(
+      call->method_name, call->request.get(), call->response,
+      [this, call, index](const Status &status) {
+        OnCallFinished(call, index, status);
+      });
+}
+
+void HaRpcEngine::OnCallFinished(const std::shared_ptr<Call> &call, unsigned index,
+                                 const Status &status) {
+  // A standby rejects the calls before executing them, and a call that
+  // could not be sent for the lack of a connection has not reached the
+  // NameNode either. A call that has lost its connection might have
+  // been executed.
+  bool unsent = status.code() == Status::ResourceUnavailable("").code();
+  bool failover = IsStandbyException(status) || unsent ||
+      (!status.ok() && !status.is_exception() && IsIdempotent(call->method_name));
+  // The other NameNodes are tried right away, after that the calls
+  // back off while the NameNodes are switching roles.
+  int delay = 0;
+  if (failover && call->failovers >= namenodes_.size() - 1) {
+    delay = failover_policy_.ShouldRetry(
+        status, call->failovers - (namenodes_.size() - 1), true);
+  }
+  if (!failover || delay < 0) {
+    call->handler(status);
+    return;
+  }
+
+  Failover(index);
+  ++call->failovers;
+  if (!delay) {
+    Issue(call);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!shutdown_) {
+      if (!call->timer) {
+        call->timer.reset(new ::asio::deadline_timer(*io_service_));
+      }
+      waiting_calls_.insert(call);
+      call->timer->expires_from_now(std::chrono::milliseconds(delay));
+      call->timer->async_wait([this, call](const ::asio::error_code &ec) {
+          // Only Shutdown() cancels the timer, and it has failed the
+          // call already. The engine might be gone by now.
+          if (ec == ::asio::error::operation_aborted) {
+            return;
+          }
+          {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (!waiting_calls_.erase(call)) {
+              return;
+            }
+          }
+          Issue(call);
+        });
+      return;
+    }
+  }
+  call->handler(Status::Error("connection shut down"));
+}
+
+void HaRpcEngine::Failover(unsigned index) {
+  // Only the first of the calls that have failed on the same NameNode
+  // moves on, the others follow it.
+  unsigned next = (index + 1) % namenodes_.size();
+  if (!active_.compare_exchange_strong(index, next)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(active_namenodes_lock());
+  active_namenodes()[nameservice_] = next;
+}
+
+Status HaRpcEngine::Rpc(const std::string &method_name,
+                        const ::google::protobuf::MessageLite *req,
+                        const std::shared_ptr<::google::protobuf::MessageLite> &resp) {
+  auto stat = std::make_shared<std::promise<Status>>();
+  std::future<Status> future(stat->get_future());
+  AsyncRpc(method_name, req, resp, [stat](const Status &status) {
+      stat->set_value(status);
+    });
+  return future.get();
+}
+
+void HaRpcEngine::Shutdown() {
+  std::unordered_set<std::shared_ptr<Call> > calls;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    shutdown_ = true;
+    calls.swap(waiting_calls_);
+    for (const auto &call : calls) {
+      call->timer->cancel();
+    }
+  }
+  for (const auto &call : calls) {
+    call->handler(Status::Error("connection shut down"));
+  }
+  for (const auto &nn : namenodes_) {
+    nn.engine->Shutdown();
+  }
+}
+
+}
@@ -0,0 +1,162 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_RPC_HA_RPC_ENGINE_H_
+#define LIB_RPC_HA_RPC_ENGINE_H_
+
+#include "rpc_engine.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * The RPC front end of a nameservice, i.e., of a set of NameNodes of
+ * which one is active and the others are standbys. Each NameNode has
+ * its own RpcEngine, which is only connected when the calls are sent
+ * to it.
+ *
+ * The calls go to the NameNode that is believed to be active. A call
+ * that the NameNode rejects with a StandbyException, a call that could
+ * not be sent for the lack of a connection, or an idempotent call that
+ * has lost its connection, is sent again to the next
+ * NameNode, which becomes the active one for all calls. The active
+ * NameNode is also remembered across the engines of the process, so
+ * that a new FileSystem of the same nameservice starts with it instead
+ * of paying a failover on its first call.
+ *
+ * With a single NameNode the calls go straight to its RpcEngine.
+ **/
+class HaRpcEngine {
+ public:
+  HaRpcEngine(::asio::io_service *io_service, const Options &options,
+              const std::string &client_name,
+              const char *protocol_name, int protocol_version);
+
+  /**
+   * Connect to the nameservice. Each element holds the resolved
+   * endpoints of one NameNode. The NameNodes are tried in turn,
+   * starting from the last known active one, until one of them
+   * accepts the connection.
+   **/
+  void AsyncConnect(const std::vector<std::vector<::asio::ip::tcp::endpoint> > &namenodes,
+                    const std::function<void(const Status &)> &handler);
+
+  template <class Handler>
+  void AsyncRpc(const std::string &method_name,
+                const ::google::protobuf::MessageLite *req,
+                const std::shared_ptr<::google::protobuf::MessageLite> &resp,
+                const Handler &handler);
+
+  Status Rpc(const std::string &method_name,
+             const ::google::protobuf::MessageLite *req,
+             const std::shared_ptr<::google::protobuf::MessageLite> &resp);
+  void Shutdown();
+
+  const std::string &client_name() const { return client_name_; }
+  size_t namenode_count() const { return namenodes_.size(); }
+  // The index of the NameNode that the calls are sent to
+  unsigned active_namenode() const { return active_; }
+  RpcEngine &engine(size_t index) { return *namenodes_[index].engine; }
+  /**
+   * See RpcEngine::set_idempotent_methods(). The idempotent calls are
+   * also the ones that fail over after a connection error.
+   **/
+  void set_idempotent_methods(const std::vector<std::string> &methods);
+
+  static bool IsStandbyException(const Status &status);
+
+ private:
+  struct Call {
+    std::string method_name;
+    std::shared_ptr<::google::protobuf::MessageLite> request;
+    std::shared_ptr<::google::protobuf::MessageLite> response;
+    std::function<void(const Status &)> handler;
+    unsigned failovers;
+    std::unique_ptr<::asio::deadline_timer> timer;
+  };
+
+  struct NameNode {
+    std::vector<::asio::ip::tcp::endpoint> endpoints;
+    std::unique_ptr<RpcEngine> engine;
+    bool started;
+  };
+
+  ::asio::io_service *io_service_;
+  const Options options_;
+  const std::string client_name_;
+  const std::string protocol_name_;
+  const int protocol_version_;
+  std::vector<std::string> idempotent_methods_;
+  ExponentialBackoffRetryPolicy failover_policy_;
+
+  // The NameNodes do not change once connected
+  std::vector<NameNode> namenodes_;
+  // Identifies the nameservice in the process-wide active NameNodes
+  std::string nameservice_;
+  std::atomic_uint active_;
+  // Guards the started flags of the NameNodes and the members below
+  std::mutex lock_;
+  bool shutdown_;
+  // The calls backing off before they fail over, which are failed by
+  // Shutdown()
+  std::unordered_set<std::shared_ptr<Call> > waiting_calls_;
+
+  void TryConnect(unsigned index, unsigned attempts,
+                  const std::function<void(const Status &)> &handler);
+  void StartNameNode(unsigned index);
+  void Issue(const std::shared_ptr<Call> &call);
+  void OnCallFinished(const std::shared_ptr<Call> &call, unsigned index,
+                      const Status &status);
+  void Failover(unsigned index);
+  bool IsIdempotent(const std::string &method_name) const;
+
+  static std::mutex &active_namenodes_lock();
+  static std::unordered_map<std::string, unsigned> &active_namenodes();
+};
+
+template <class Handler>
+void HaRpcEngine::AsyncRpc(const std::string &method_name,
+                           const ::google::protobuf::MessageLite *req,
+                           const std::shared_ptr<::google::protobuf::MessageLite> &resp,
+                           const Handler &handler) {
+  if (namenodes_.size() == 1) {
+    namenodes_[0].engine->AsyncRpc(method_name, req, resp, handler);
+    return;
+  }
+
+  // The request must outlive the caller to be sent again
+  auto call = std::make_shared<Call>();
+  call->method_name = method_name;
+  call->request.reset(req->New());
+  call->request->CheckTypeAndMergeFrom(*req);
+  call->response = resp;
+  call->handler = handler;
+  call->failovers = 0;
+  Issue(call);
+}
+
+}
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ha_rpc_engine.h"
+#include "mock_namenode.h"
+
+#include "ClientNamenodeProtocol.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+
+using ::hadoop::hdfs::GetFileInfoRequestProto;
+using ::hadoop::hdfs::GetFileInfoResponseProto;
+using ::hadoop::hdfs::MkdirsRequestProto;
+using ::hadoop::hdfs::MkdirsResponseProto;
+using ::asio::ip::tcp;
+
+namespace hdfs {
+
+static const char kStandbyException[] = "org.apache.hadoop.ipc.StandbyException";
+static const char kClientProtocol[] = "org.apache.hadoop.hdfs.protocol.ClientProtocol";
+
+TEST(HaRpcEngineTest, TestIsStandbyException) {
+  ASSERT_TRUE(HaRpcEngine::IsStandbyException(
+      Status::Exception(kStandbyException, "Operation category READ is not supported")));
+  ASSERT_TRUE(HaRpcEngine::IsStandbyException(Status::Exception(kStandbyException, "")));
+  // Only the class of the exception counts
+  ASSERT_FALSE(HaRpcEngine::IsStandbyException(
+      Status::Exception("java.io.IOException", kStandbyException)));
+  ASSERT_FALSE(HaRpcEngine::IsStandbyException(
+      Status::Exception("org.apache.hadoop.ipc.StandbyExceptionX", "")));
+  ASSERT_FALSE(HaRpcEngine::IsStandbyException(Status::Error(kStandbyException)));
+  ASSERT_FALSE(HaRpcEngine::IsStandbyException(Status::OK()));
+}
+
+/**
+ * Runs the engines on a background thread against mock NameNodes.
+ **/
+class HaRpcEngineFailoverTest : public ::testing::Test {
+ protected:
+  ::asio::io_service io_service_;
+  std::unique_ptr<::asio::io_service::work> work_;
+  std::thread worker_;
+  std::vector<std::unique_ptr<HaRpcEngine> > engines_;
+
+  HaRpcEngineFailoverTest()
+      : work_(new ::asio::io_service::work(io_service_))
+      , worker_([this]() { io_service_.run(); })
+  {}
+
+  ~HaRpcEngineFailoverTest() {
+    for (const auto &engine : engines_) {
+      engine->Shutdown();
+    }
+    work_.reset();
+    io_service_.stop();
+    worker_.join();
+  }
+
+  HaRpcEngine *Connect(const std::vector<MockNameNode*> &namenodes,
+                       const Options &options = Options()) {
+    std::vector<std::vector<tcp::endpoint> > endpoints;
+    for (auto nn : namenodes) {
+      endpoints.push_back({nn->endpoint()});
+    }
+    engines_.emplace_back(new HaRpcEngine(&io_service_, options, "ha_rpc_engine_test",
+                                          kClientProtocol, 1));
+    HaRpcEngine *engine = engines_.back().get();
+    std::promise<Status> stat;
+    engine->AsyncConnect(endpoints, [&stat](const Status &status) {
+        stat.set_value(status);
+      });
+    EXPECT_TRUE(stat.get_future().get().ok());
+    return engine;
+  }
+
+  static Status GetFileInfo(HaRpcEngine *engine) {
+    GetFileInfoRequestProto req;
+    req.set_src("/foo");
+    return engine->Rpc("getFileInfo", &req, std::make_shared<GetFileInfoResponseProto>());
+  }
+
+  static Status Mkdirs(HaRpcEngine *engine) {
+    MkdirsRequestProto req;
+    req.set_src("/foo");
+    req.mutable_masked()->set_perm(0755);
+    req.set_createparent(false);
+    return engine->Rpc("mkdirs", &req, std::make_shared<MkdirsResponseProto>());
+  }
+
+  static MockNameNode::Method Answer(const Status &status) {
+    return [status](const std::string &, std::string *response) {
+      response->clear();
+      return status;
+    };
+  }
+};
+
+TEST_F(HaRpcEngineFailoverTest, TestFailoverOnStandbyException) {
+  MockNameNode standby, active;
+  standby.SetMethod("getFileInfo", Answer(Status::Exception(
+      kStandbyException, "Operation category READ is not supported in state standby")));
+  active.SetMethod("getFileInfo", Answer(Status::OK()));
+
+  HaRpcEngine *engine = Connect({&standby, &active});
+  ASSERT_EQ(0, engine->active_namenode());
+  ASSERT_TRUE(GetFileInfo(engine).ok());
+  ASSERT_EQ(1, standby.calls("getFileInfo"));
+  ASSERT_EQ(1, active.calls("getFileInfo"));
+  ASSERT_EQ(1, engine->active_namenode());
+
+  // The following calls go to the active NameNode right away
+  ASSERT_TRUE(GetFileInfo(engine).ok());
+  ASSERT_EQ(1, standby.calls("getFileInfo"));
+  ASSERT_EQ(2, active.calls("getFileInfo"));
+
+  // A new engine of the same nameservice starts with the active
+  // NameNode that the process remembers
+  HaRpcEngine *other = Connect({&standby, &active});
+  ASSERT_EQ(1, other->active_namenode());
+  ASSERT_TRUE(GetFileInfo(other).ok());
+  ASSERT_EQ(1, standby.calls("getFileInfo"));
+  ASSERT_EQ(3, active.calls("getFileInfo"));
+}
+
+TEST_F(HaRpcEngineFailoverTest, TestNoFailoverOnOtherExceptions) {
+  MockNameNode first, second;
+  // An exception that only mentions the standby in its message
+  first.SetMethod("getFileInfo", Answer(Status::Exception(
+      "java.io.FileNotFoundException", kStandbyException)));
+  second.SetMethod("getFileInfo", Answer(Status::OK()));
+
+  HaRpcEngine *engine = Connect({&first, &second});
+  Status stat = GetFileInfo(engine);
+  ASSERT_TRUE(stat.is_exception());
+  ASSERT_EQ("java.io.FileNotFoundException", stat.exception_class());
+  ASSERT_EQ(1, first.calls("getFileInfo"));
+  ASSERT_EQ(0, second.calls("getFileInfo"));
+  ASSERT_EQ(0, engine->active_namenode());
+}
+
+TEST_F(HaRpcEngineFailoverTest, TestFailoverUnsentCall) {
+  std::unique_ptr<MockNameNode> first(new MockNameNode());
+  MockNameNode second;
+  second.SetMethod("mkdirs", Answer(Status::OK()));
+
+  HaRpcEngine *engine = Connect({first.get(), &second});
+  ASSERT_EQ(0, engine->active_namenode());
+  // Let the engine notice the closed connection before the call
+  first.reset();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // The call cannot be sent to the first NameNode, thus it fails over
+  // although it is not idempotent
+  ASSERT_TRUE(Mkdirs(engine).ok());
+  ASSERT_EQ(1, second.calls("mkdirs"));
+  ASSERT_EQ(1, engine->active_namenode());
+}
+
+TEST_F(HaRpcEngineFailoverTest, TestShutdownFailsBackingOffCall) {
+  MockNameNode first, second;
+  auto standby = Answer(Status::Exception(kStandbyException, ""));
+  first.SetMethod("getFileInfo", standby);
+  second.SetMethod("getFileInfo", standby);
+
+  Options options;
+  options.rpc_retry_delay = 60000;
+  options.max_rpc_retry_delay = 60000;
+  HaRpcEngine *engine = Connect({&first, &second}, options);
+  std::promise<Status> stat;
+  GetFileInfoRequestProto req;
+  req.set_src("/foo");
+  engine->AsyncRpc("getFileInfo", &req, std::make_shared<GetFileInfoResponseProto>(),
+                   [&stat](const Status &status) { stat.set_value(status); });
+  // Both NameNodes have rejected the call, which backs off now
+  while (first.calls("getFileInfo") + second.calls("getFileInfo") < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  engine->Shutdown();
+  auto future = stat.get_future();
+  ASSERT_EQ(std::future_status::ready, future.wait_for(std::chrono::seconds(10)));
+  ASSERT_FALSE(future.get().ok());
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+}
@@ -35,6 +35,10 @@ class RpcConnection::RequestBase {
   int call_id() const { return call_id_; }
   ::asio::deadline_timer &timer() { return timer_; }
   const std::string &payload() const { return payload_; }
+  bool idempotent() const { return idempotent_; }
+  // The number of times the request has been retried
+  unsigned retries() const { return retries_; }
+  void IncrementRetries() { ++retries_; }
 
   virtual ~RequestBase();
   virtual void OnResponseArrived(
@@ -45,6 +49,8 @@ class RpcConnection::RequestBase {
   int call_id_;
   ::asio::deadline_timer timer_;
   std::string payload_;
+  const bool idempotent_;
+  std::atomic_uint retries_;
 
   RequestBase(RpcConnection *parent, const std::string &method_name,
               const std::string &request);
@@ -78,19 +84,46 @@ class RpcConnection::Request : public RequestBase {
 
 template <class Iterator, class Handler>
 void RpcConnection::Connect(Iterator begin, Iterator end, const Handler &handler) {
-  ::asio::async_connect(next_layer_, begin, end,
-                        [handler](const ::asio::error_code &ec, Iterator) {
-                          handler(ToStatus(ec));
-                        });
+  {
+    // The calls issued in the meantime wait for the connection instead
+    // of reconnecting on their own
+    std::lock_guard<std::mutex> lock(connection_lock_);
+    connecting_ = true;
+    endpoints_.assign(begin, end);
+  }
+  strand_.dispatch([this, begin, end, handler]() {
+      ::asio::async_connect(next_layer_, begin, end,
+                            strand_.wrap([this, handler](const ::asio::error_code &ec, Iterator) {
+                                if (ec) {
+                                  OnConnectFailed();
+                                }
+                                handler(ToStatus(ec));
+                              }));
+    });
 }
 
 template <class Handler>
 void RpcConnection::Handshake(const Handler &handler) {
+  strand_.dispatch([this, handler]() {
+      SendHandshake([this, handler](const Status &status) {
+          if (status.ok()) {
+            OnConnected();
+          } else {
+            OnConnectFailed();
+          }
+          handler(status);
+        });
+    });
+}
+
+template <class Handler>
+void RpcConnection::SendHandshake(const Handler &handler) {
   auto handshake_packet = PrepareHandshakePacket();
 
   ::asio::async_write(next_layer(), asio::buffer(*handshake_packet),
-                      [handshake_packet, handler](const ::asio::error_code &ec, size_t)
-                      { handler(ToStatus(ec)); });
+                      strand_.wrap([handshake_packet, handler](const ::asio::error_code &ec, size_t) {
+                          handler(ToStatus(ec));
+                        }));
 }
 
 
@@ -99,8 +132,6 @@ void RpcConnection::AsyncRpc(const std::string &method_name,
                              const ::google::protobuf::MessageLite *req,
                              std::shared_ptr<::google::protobuf::MessageLite> resp,
                              const Handler &handler) {
-  std::lock_guard<std::mutex> state_lock(engine_state_lock_);
-
   auto wrapped_handler = [resp,handler](::google::protobuf::io::CodedInputStream *is, const Status &status) {
     if (status.ok()) {
       ReadDelimitedPBMessage(is, resp.get());
@@ -109,7 +140,8 @@ void RpcConnection::AsyncRpc(const std::string &method_name,
   };
 
   auto r = new Request<decltype(wrapped_handler)>(this, method_name, req, std::move(wrapped_handler));
-  pending_requests_.push_back(std::shared_ptr<RequestBase>(r));
+  ++outstanding_calls_;
+  queued_requests_.Push(std::shared_ptr<RequestBase>(r));
   StartWriteLoop();
 }
 
@@ -118,8 +150,6 @@ void RpcConnection::AsyncRawRpc(const std::string &method_name,
                                 const std::string &req,
                                 std::shared_ptr<std::string> resp,
                                 const Handler &handler) {
-  std::lock_guard<std::mutex> state_lock(engine_state_lock_);
-
   auto wrapped_handler = [this,resp,handler](::google::protobuf::io::CodedInputStream *is, const Status &status) {
     if (status.ok()) {
       uint32_t size = 0;
@@ -132,7 +162,8 @@ void RpcConnection::AsyncRawRpc(const std::string &method_name,
   };
 
   auto r = new Request<decltype(wrapped_handler)>(this, method_name, req, std::move(wrapped_handler));
-  pending_requests_.push_back(std::shared_ptr<RequestBase>(r));
+  ++outstanding_calls_;
+  queued_requests_.Push(std::shared_ptr<RequestBase>(r));
   StartWriteLoop();
 }
 
@@ -0,0 +1,283 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_RPC_MOCK_NAMENODE_H_
+#define LIB_RPC_MOCK_NAMENODE_H_
+
+#include "libhdfs++/status.h"
+
+#include "RpcHeader.pb.h"
+#include "ProtobufRpcEngine.pb.h"
+
+#include <asio/ip/tcp.hpp>
+#include <asio/read.hpp>
+#include <asio/write.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * A NameNode for the tests, which listens on the loopback interface
+ * and answers the calls with the handlers of their methods. Each
+ * connection is served by its own thread, one call at a time.
+ **/
+class MockNameNode {
+ public:
+  /**
+   * Fill the serialized response of a call. A Status::Exception() is
+   * sent back as the exception of the call, and any other error closes
+   * the connection.
+   **/
+  typedef std::function<Status(const std::string &request, std::string *response)> Method;
+
+  MockNameNode();
+  ~MockNameNode();
+
+  ::asio::ip::tcp::endpoint endpoint() const { return acceptor_.local_endpoint(); }
+  // The methods without a handler fail with RpcNoSuchMethodException
+  void SetMethod(const std::string &name, const Method &method);
+  // The number of calls of the method that have arrived
+  unsigned calls(const std::string &name);
+  // The number of pings that have arrived
+  unsigned pings();
+  // The number of connections that have been accepted
+  unsigned connections();
+  // The number of connections that the clients have not closed yet
+  unsigned open_connections();
+  // Close the connections of the clients, which reconnect on demand
+  void DropConnections();
+  /**
+   * Send a response that no call is waiting for on every connection.
+   * Only call it while no call is in progress, as the response might
+   * interleave with the others.
+   **/
+  void SendUnsolicitedResponse(int call_id);
+
+ private:
+  ::asio::io_service io_service_;
+  ::asio::ip::tcp::acceptor acceptor_;
+  std::mutex lock_;
+  std::map<std::string, Method> methods_;
+  std::map<std::string, unsigned> calls_;
+  unsigned pings_;
+  unsigned open_connections_;
+  std::vector<std::shared_ptr<::asio::ip::tcp::socket> > sockets_;
+  std::vector<std::thread> servers_;
+  std::thread thread_;
+
+  void Accept();
+  void Serve(::asio::ip::tcp::socket *socket);
+  static void SendResponse(::asio::ip::tcp::socket *socket, int call_id,
+                           const Status &status, const std::string &response,
+                           ::asio::error_code *ec);
+};
+
+inline MockNameNode::MockNameNode()
+    : acceptor_(io_service_, ::asio::ip::tcp::endpoint(::asio::ip::address_v4::loopback(), 0))
+    , pings_(0)
+    , open_connections_(0)
+    , thread_(std::bind(&MockNameNode::Accept, this))
+{}
+
+inline MockNameNode::~MockNameNode() {
+  // Wake up the threads blocked in accept() and read()
+  ::shutdown(acceptor_.native_handle(), SHUT_RDWR);
+  thread_.join();
+  DropConnections();
+  for (auto &t : servers_) {
+    t.join();
+  }
+}
+
+inline void MockNameNode::SetMethod(const std::string &name, const Method &method) {
+  std::lock_guard<std::mutex> lock(lock_);
+  methods_[name] = method;
+}
+
+inline unsigned MockNameNode::calls(const std::string &name) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return calls_[name];
+}
+
+inline unsigned MockNameNode::pings() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return pings_;
+}
+
+inline unsigned MockNameNode::connections() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return sockets_.size();
+}
+
+inline unsigned MockNameNode::open_connections() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return open_connections_;
+}
+
+inline void MockNameNode::SendUnsolicitedResponse(int call_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (const auto &s : sockets_) {
+    ::asio::error_code ignored;
+    SendResponse(s.get(), call_id, Status::OK(), "", &ignored);
+  }
+}
+
+inline void MockNameNode::DropConnections() {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (const auto &s : sockets_) {
+    ::shutdown(s->native_handle(), SHUT_RDWR);
+  }
+}
+
+inline void MockNameNode::Accept() {
+  for (;;) {
+    std::shared_ptr<::asio::ip::tcp::socket> socket(new ::asio::ip::tcp::socket(io_service_));
+    ::asio::error_code ec;
+    acceptor_.accept(*socket, ec);
+    if (ec) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    sockets_.push_back(socket);
+    ++open_connections_;
+    servers_.emplace_back(std::bind(&MockNameNode::Serve, this, socket.get()));
+  }
+}
+
+inline void MockNameNode::Serve(::asio::ip::tcp::socket *socket) {
+  namespace pbio = ::google::protobuf::io;
+  using ::hadoop::common::RpcRequestHeaderProto;
+  using ::hadoop::common::RequestHeaderProto;
+
+  ::asio::error_code ec;
+  // "hrpc", version, service class and auth protocol
+  char handshake[7];
+  ::asio::read(*socket, ::asio::buffer(handshake), ec);
+  std::string packet;
+  while (!ec) {
+    uint32_t length;
+    ::asio::read(*socket, ::asio::buffer(&length, sizeof(length)), ec);
+    if (ec) {
+      break;
+    }
+    packet.resize(ntohl(length));
+    ::asio::read(*socket, ::asio::buffer(&packet[0], packet.size()), ec);
+    if (ec) {
+      break;
+    }
+
+    pbio::ArrayInputStream ais(packet.data(), packet.size());
+    pbio::CodedInputStream in(&ais);
+    RpcRequestHeaderProto h;
+    uint32_t size;
+    in.ReadVarint32(&size);
+    auto limit = in.PushLimit(size);
+    h.ParseFromCodedStream(&in);
+    in.PopLimit(limit);
+    // The connection context and the pings (-4) have negative call ids
+    if (h.callid() < 0) {
+      if (h.callid() == -4) {
+        std::lock_guard<std::mutex> lock(lock_);
+        ++pings_;
+      }
+      continue;
+    }
+    RequestHeaderProto rh;
+    in.ReadVarint32(&size);
+    limit = in.PushLimit(size);
+    rh.ParseFromCodedStream(&in);
+    in.PopLimit(limit);
+    std::string request;
+    in.ReadVarint32(&size);
+    in.ReadString(&request, size);
+
+    Method method;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      ++calls_[rh.methodname()];
+      auto it = methods_.find(rh.methodname());
+      if (it != methods_.end()) {
+        method = it->second;
+      }
+    }
+    std::string response;
+    Status status = method ? method(request, &response)
+        : Status::Exception("org.apache.hadoop.ipc.RpcNoSuchMethodException",
+                            rh.methodname().c_str());
+    if (!status.ok() && !status.is_exception()) {
+      break;
+    }
+    SendResponse(socket, h.callid(), status, response, &ec);
+  }
+  ::shutdown(socket->native_handle(), SHUT_RDWR);
+  std::lock_guard<std::mutex> lock(lock_);
+  --open_connections_;
+}
+
+inline void MockNameNode::SendResponse(::asio::ip::tcp::socket *socket, int call_id,
+                                       const Status &status, const std::string &response,
+                                       ::asio::error_code *ec) {
+  namespace pbio = ::google::protobuf::io;
+  using ::hadoop::common::RpcResponseHeaderProto;
+
+  RpcResponseHeaderProto h;
+  h.set_callid(call_id);
+  if (status.ok()) {
+    h.set_status(RpcResponseHeaderProto::SUCCESS);
+  } else {
+    // The message of the status is "<exception class>: <message>"
+    std::string exception_class = status.exception_class();
+    std::string message = status.ToString();
+    h.set_status(RpcResponseHeaderProto::ERROR);
+    h.set_exceptionclassname(exception_class);
+    h.set_errormsg(message.substr(std::min(message.size(), exception_class.size() + 2)));
+  }
+
+  std::string packet(sizeof(uint32_t), '\0');
+  {
+    pbio::StringOutputStream ss(&packet);
+    pbio::CodedOutputStream os(&ss);
+    os.WriteVarint32(h.ByteSizeLong());
+    h.SerializeWithCachedSizes(&os);
+    if (status.ok()) {
+      os.WriteVarint32(response.size());
+      os.WriteString(response);
+    }
+  }
+  uint32_t length = htonl(packet.size() - sizeof(length));
+  memcpy(&packet[0], &length, sizeof(length));
+  ::asio::write(*socket, ::asio::buffer(packet), *ec);
+}
+
+}
+
+#endif
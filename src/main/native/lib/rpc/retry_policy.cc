@@ -0,0 +1,52 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "retry_policy.h"
+
+#include <algorithm>
+#include <random>
+
+namespace hdfs {
+
+RetryPolicy::~RetryPolicy() {}
+
+ExponentialBackoffRetryPolicy::ExponentialBackoffRetryPolicy(
+    unsigned max_retries, int delay, int max_delay)
+    : max_retries_(max_retries)
+    , delay_(std::max(delay, 0))
+    , max_delay_(std::max(max_delay, delay_))
+{}
+
+int ExponentialBackoffRetryPolicy::ShouldRetry(const Status &, unsigned retries,
+                                               bool idempotent) const {
+  if (!idempotent || retries >= max_retries_) {
+    return -1;
+  }
+
+  long long delay = delay_;
+  for (unsigned i = 0; i < retries && delay < max_delay_; ++i) {
+    delay *= 2;
+  }
+  delay = std::min<long long>(delay, max_delay_);
+
+  static thread_local std::mt19937 gen(std::random_device{}());
+  std::uniform_int_distribution<long long> jitter(0, delay / 2);
+  return static_cast<int>(delay - jitter(gen));
+}
+
+}
@@ -0,0 +1,69 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_RPC_RETRY_POLICY_H_
+#define LIB_RPC_RETRY_POLICY_H_
+
+#include "libhdfs++/status.h"
+
+namespace hdfs {
+
+/**
+ * Decides whether an RPC call that has failed because of a connection
+ * error or a timeout is retried, and how long to wait before that.
+ * The RpcEngine also consults it between the attempts to re-establish
+ * a broken connection.
+ *
+ * The policy is shared by all connections of an engine and can be
+ * called from any thread.
+ **/
+class RetryPolicy {
+ public:
+  virtual ~RetryPolicy();
+  /**
+   * Return the delay in milliseconds before the next attempt, or a
+   * negative value if the call should fail with the status.
+   *
+   * @param retries the number of times the call has been retried
+   * @param idempotent whether the call can safely be executed more
+   * than once, i.e., whether it can be retried after it has been sent
+   **/
+  virtual int ShouldRetry(const Status &status, unsigned retries,
+                          bool idempotent) const = 0;
+};
+
+/**
+ * Retry idempotent calls up to a number of times. The delay doubles
+ * with every retry up to a maximum, and a random jitter of up to half
+ * the delay is subtracted so that the clients that lost the same
+ * NameNode do not come back in lockstep.
+ **/
+class ExponentialBackoffRetryPolicy : public RetryPolicy {
+ public:
+  ExponentialBackoffRetryPolicy(unsigned max_retries, int delay, int max_delay);
+  virtual int ShouldRetry(const Status &status, unsigned retries,
+                          bool idempotent) const override;
+
+ private:
+  const unsigned max_retries_;
+  const int delay_;
+  const int max_delay_;
+};
+
+}
+
+#endif
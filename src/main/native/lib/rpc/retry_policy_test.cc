@@ -0,0 +1,61 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "retry_policy.h"
+
+#include <gtest/gtest.h>
+
+namespace hdfs {
+
+TEST(RetryPolicyTest, TestNonIdempotent) {
+  ExponentialBackoffRetryPolicy policy(3, 100, 1000);
+  ASSERT_LT(policy.ShouldRetry(Status::Error("error"), 0, false), 0);
+}
+
+TEST(RetryPolicyTest, TestMaxRetries) {
+  ExponentialBackoffRetryPolicy policy(3, 100, 1000);
+  for (unsigned i = 0; i < 3; ++i) {
+    ASSERT_GE(policy.ShouldRetry(Status::Error("error"), i, true), 0);
+  }
+  ASSERT_LT(policy.ShouldRetry(Status::Error("error"), 3, true), 0);
+
+  ExponentialBackoffRetryPolicy no_retries(0, 100, 1000);
+  ASSERT_LT(no_retries.ShouldRetry(Status::Error("error"), 0, true), 0);
+}
+
+/**
+ * The delay doubles with every retry up to the maximum, and the
+ * jitter takes away at most half of it.
+ **/
+TEST(RetryPolicyTest, TestBackoff) {
+  ExponentialBackoffRetryPolicy policy(100, 100, 1000);
+  const int expected[] = {100, 200, 400, 800, 1000, 1000};
+  for (int n = 0; n < 100; ++n) {
+    for (unsigned i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+      int delay = policy.ShouldRetry(Status::Error("error"), i, true);
+      ASSERT_LE(delay, expected[i]);
+      ASSERT_GE(delay, expected[i] / 2);
+    }
+  }
+  // The number of retries must not overflow the delay
+  int delay = policy.ShouldRetry(Status::Error("error"), 99, true);
+  ASSERT_LE(delay, 1000);
+  ASSERT_GE(delay, 500);
+}
+
+}
@@ -0,0 +1,240 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Measures the number of RPCs per second that a single RpcEngine
+ * sustains against a mock NameNode running in the same process. The
+ * mock NameNode answers every request with an empty response, thus
+ * the benchmark mostly measures the overhead of the client.
+ *
+ * usage: rpc_benchmark [<calls> [<client threads> [<max batch bytes> [<connections>]]]]
+ **/
+
+#include "rpc/rpc_engine.h"
+
+#include "RpcHeader.pb.h"
+#include "ClientNamenodeProtocol.pb.h"
+
+#include <asio/io_service.hpp>
+#include <asio/read.hpp>
+#include <asio/write.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace hdfs;
+using ::asio::ip::tcp;
+using ::hadoop::common::RpcRequestHeaderProto;
+using ::hadoop::common::RpcResponseHeaderProto;
+using ::hadoop::hdfs::GetFileInfoRequestProto;
+using ::hadoop::hdfs::GetFileInfoResponseProto;
+
+namespace pbio = ::google::protobuf::io;
+
+/**
+ * A NameNode that answers every request with an empty response. Each
+ * connection is served by its own thread, which parses all the
+ * requests that arrive in one read and sends their responses in one
+ * write, so that it keeps up with the client.
+ **/
+class MockNameNode {
+ public:
+  MockNameNode()
+      : acceptor_(io_service_, tcp::endpoint(::asio::ip::address_v4::loopback(), 0))
+  {}
+
+  tcp::endpoint endpoint() const { return acceptor_.local_endpoint(); }
+
+  // Accept the given number of connections and serve them until the
+  // client closes them
+  void Start(unsigned connections) {
+    thread_ = std::thread([this, connections]() {
+        std::vector<std::thread> servers;
+        for (unsigned i = 0; i < connections; ++i) {
+          std::shared_ptr<tcp::socket> socket(new tcp::socket(io_service_));
+          acceptor_.accept(*socket);
+          servers.emplace_back([socket]() { Serve(socket.get()); });
+        }
+        for (auto &t : servers) {
+          t.join();
+        }
+      });
+  }
+
+  void Join() {
+    thread_.join();
+  }
+
+ private:
+  ::asio::io_service io_service_;
+  tcp::acceptor acceptor_;
+  std::thread thread_;
+
+  static void Serve(tcp::socket *socket);
+  static void AppendResponse(int call_id, std::string *out);
+};
+
+void MockNameNode::Serve(tcp::socket *socket) {
+  socket->set_option(tcp::no_delay(true));
+
+  asio::error_code ec;
+  // "hrpc", version, service class and auth protocol
+  char handshake[7];
+  asio::read(*socket, asio::buffer(handshake), ec);
+
+  std::vector<char> buf(1024 * 1024);
+  size_t begin = 0, end = 0;
+  std::string out;
+  while (!ec) {
+    if (begin == end) {
+      begin = end = 0;
+    } else if (buf.size() - end < 4096) {
+      memmove(&buf[0], &buf[begin], end - begin);
+      end -= begin;
+      begin = 0;
+    }
+    end += socket->read_some(asio::buffer(&buf[end], buf.size() - end), ec);
+
+    out.clear();
+    while (end - begin >= sizeof(uint32_t)) {
+      uint32_t length;
+      memcpy(&length, &buf[begin], sizeof(length));
+      length = ntohl(length);
+      if (end - begin < sizeof(length) + length) {
+        break;
+      }
+
+      pbio::CodedInputStream in(
+          reinterpret_cast<const uint8_t*>(&buf[begin + sizeof(length)]), length);
+      RpcRequestHeaderProto h;
+      ReadDelimitedPBMessage(&in, &h);
+      // The connection context and the pings have negative call ids
+      if (h.callid() >= 0) {
+        AppendResponse(h.callid(), &out);
+      }
+      begin += sizeof(length) + length;
+    }
+
+    if (!ec && !out.empty()) {
+      asio::write(*socket, asio::buffer(out), ec);
+    }
+  }
+}
+
+void MockNameNode::AppendResponse(int call_id, std::string *out) {
+  RpcResponseHeaderProto h;
+  h.set_callid(call_id);
+  h.set_status(RpcResponseHeaderProto::SUCCESS);
+  GetFileInfoResponseProto resp;
+
+  std::string packet;
+  {
+    pbio::StringOutputStream ss(&packet);
+    pbio::CodedOutputStream os(&ss);
+    os.WriteVarint32(static_cast<uint32_t>(h.ByteSizeLong()));
+    h.SerializeWithCachedSizes(&os);
+    os.WriteVarint32(static_cast<uint32_t>(resp.ByteSizeLong()));
+    resp.SerializeWithCachedSizes(&os);
+  }
+  uint32_t length = htonl(packet.size());
+  out->append(reinterpret_cast<const char*>(&length), sizeof(length));
+  out->append(packet);
+}
+
+int main(int argc, char *argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  unsigned long calls = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  unsigned threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+  Options options;
+  if (argc > 3) {
+    options.rpc_max_batch_bytes = std::strtoul(argv[3], nullptr, 10);
+  }
+  if (argc > 4) {
+    options.rpc_connections = std::strtoul(argv[4], nullptr, 10);
+  }
+  if (!calls || !threads || !options.rpc_connections) {
+    std::cerr << "usage: " << argv[0]
+              << " [<calls> [<client threads> [<max batch bytes> [<connections>]]]]"
+              << std::endl;
+    return 1;
+  }
+
+  MockNameNode namenode;
+  namenode.Start(options.rpc_connections);
+
+  ::asio::io_service io_service;
+  std::unique_ptr<::asio::io_service::work> work(new ::asio::io_service::work(io_service));
+  std::thread worker([&io_service]() { io_service.run(); });
+
+  RpcEngine engine(&io_service, options, "rpc_benchmark",
+                   "org.apache.hadoop.hdfs.protocol.ClientProtocol", 1);
+  Status stat = engine.Connect(namenode.endpoint());
+  if (!stat.ok()) {
+    std::cerr << "Connection failed: " << stat.ToString() << std::endl;
+    return 1;
+  }
+  engine.StartReadLoop();
+
+  // Each client thread issues synchronous calls, as the applications
+  // that open files from many threads do.
+  std::atomic<unsigned long> issued(0), failed(0);
+  auto client = [&]() {
+    GetFileInfoRequestProto req;
+    req.set_src("/rpc_benchmark");
+    auto resp = std::make_shared<GetFileInfoResponseProto>();
+    while (issued++ < calls) {
+      if (!engine.Rpc("getFileInfo", &req, resp).ok()) {
+        ++failed;
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (unsigned i = 0; i < threads; ++i) {
+    clients.emplace_back(client);
+  }
+  for (auto &t : clients) {
+    t.join();
+  }
+  std::chrono::duration<double> runtime = std::chrono::steady_clock::now() - start;
+
+  std::cout << "calls: " << calls << ", client threads: " << threads
+            << ", max batch bytes: " << options.rpc_max_batch_bytes
+            << ", connections: " << options.rpc_connections
+            << ", failed calls: " << failed
+            << ", runtime: " << runtime.count() << "s"
+            << ", calls/sec: " << calls / runtime.count() << std::endl;
+
+  engine.Shutdown();
+  work.reset();
+  worker.join();
+  namenode.Join();
+  return failed ? 1 : 0;
+}
@@ -88,6 +88,8 @@ RpcConnection::RequestBase::RequestBase(
     const std::string &request)
     : call_id_(parent->engine_->NextCallId())
     , timer_(parent->io_service())
+    , idempotent_(parent->engine_->IsIdempotent(method_name))
+    , retries_(0)
 {
   RpcRequestHeaderProto rpc_header;
   RequestHeaderProto req_header;
@@ -101,6 +103,8 @@ RpcConnection::RequestBase::RequestBase(
     const pb::MessageLite *request)
     : call_id_(parent->engine_->NextCallId())
     , timer_(parent->io_service())
+    , idempotent_(parent->engine_->IsIdempotent(method_name))
+    , retries_(0)
 {
   RpcRequestHeaderProto rpc_header;
   RequestHeaderProto req_header;
@@ -118,102 +122,476 @@ RpcConnection::ResponseState::ResponseState()
 RpcConnection::RpcConnection(RpcEngine *engine)
     : engine_(engine)
     , next_layer_(engine->io_service())
+    , strand_(engine->io_service())
+    , writing_(false)
+    , ping_pending_(false)
+    , ping_packet_(PreparePingPacket())
+    , outstanding_calls_(0)
+    , connected_(false)
+    , connecting_(false)
+    , shutdown_(false)
+    , generation_(0)
+    , reconnect_timer_(engine->io_service())
+    , last_write_(0)
+    , last_call_(0)
+    , ping_timer_(engine->io_service())
+    , idle_timer_(engine->io_service())
 {}
 
+void RpcConnection::RequestMap::Insert(const std::shared_ptr<RequestBase> &req) {
+  Shard &shard = shards_[static_cast<unsigned>(req->call_id()) % kShards];
+  std::lock_guard<std::mutex> lock(shard.lock);
+  shard.requests[req->call_id()] = req;
+}
+
+std::shared_ptr<RpcConnection::RequestBase>
+RpcConnection::RequestMap::Remove(int call_id) {
+  Shard &shard = shards_[static_cast<unsigned>(call_id) % kShards];
+  std::lock_guard<std::mutex> lock(shard.lock);
+  auto it = shard.requests.find(call_id);
+  if (it == shard.requests.end()) {
+    return nullptr;
+  }
+  auto req = it->second;
+  shard.requests.erase(it);
+  return req;
+}
+
+void RpcConnection::RequestMap::RemoveAll(
+    std::vector<std::shared_ptr<RequestBase> > *requests) {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    for (const auto &it : shard.requests) {
+      requests->push_back(it.second);
+    }
+    shard.requests.clear();
+  }
+}
+
 ::asio::io_service &RpcConnection::io_service() {
   return engine_->io_service();
 }
 
-void RpcConnection::OnHandleWrite(const ::asio::error_code &ec, size_t) {
-  std::lock_guard<std::mutex> state_lock(engine_state_lock_);
+void RpcConnection::OnHandleWrite(unsigned generation,
+                                  const ::asio::error_code &ec, size_t) {
+  requests_over_the_wire_.clear();
+  if (generation != generation_) {
+    // The socket has been closed, and the requests sent on it have
+    // been retried or failed. Hand the loop over to the current socket.
+    bool pending = !pending_requests_.empty();
+    writing_ = false;
+    if (pending || !queued_requests_.empty()) {
+      StartWriteLoop();
+    }
+    return;
+  } else if (ec && ec != ::asio::error::operation_aborted) {
+    OnConnectionError(generation, ToStatus(ec));
+  }
+
+  FlushPendingRequests();
+}
 
-  request_over_the_wire_.reset();
-  if (ec) {
-    // TODO: Current RPC has failed -- we should abandon the
-    // connection and do proper clean up
-    assert(false && "Unimplemented");
+void RpcConnection::FlushPendingRequests() {
+  /* assumed to be called from the write loop, i.e., with writing_ set */
+  queued_requests_.PopAll(&pending_requests_);
+  if (pending_requests_.empty() && !ping_pending_) {
+    writing_ = false;
+    // A request queued after PopAll() has seen writing_ still set and
+    // left it to this loop to send.
+    if ((queued_requests_.empty() && !ping_pending_) || writing_.exchange(true)) {
+      return;
+    }
+    queued_requests_.PopAll(&pending_requests_);
   }
 
-  if (!pending_requests_.size()) {
+  std::unique_lock<std::mutex> lock(connection_lock_);
+  if (!connected_) {
+    // Keep the requests until the connection is back, or fail them if
+    // it cannot be re-established. A ping is pointless by then.
+    ping_pending_ = false;
+    std::deque<std::shared_ptr<RequestBase> > failed;
+    Status status;
+    if (shutdown_) {
+      status = Status::Error("connection shut down");
+    } else if (!connect_error_.ok()) {
+      // The requests have never been sent, thus the caller can send
+      // them elsewhere even if they are not idempotent
+      status = Status::ResourceUnavailable(connect_error_.ToString().c_str());
+    }
+    if (!status.ok()) {
+      failed.swap(pending_requests_);
+      connect_error_ = Status::OK();
+    }
+    bool reconnect = status.ok() && !connecting_ && !shutdown_ &&
+        !endpoints_.empty() && !pending_requests_.empty();
+    connecting_ = connecting_ || reconnect;
+    writing_ = false;
+    lock.unlock();
+
+    for (const auto &req : failed) {
+      FailRequest(req, status);
+    }
+    if (reconnect) {
+      Reconnect(0);
+    } else if (!queued_requests_.empty()) {
+      StartWriteLoop();
+    }
     return;
   }
 
-  std::shared_ptr<RequestBase> req = pending_requests_.front();
-  pending_requests_.erase(pending_requests_.begin());
-  requests_on_fly_[req->call_id()] = req;
-  request_over_the_wire_ = req;
+  // Send all requests that have been queued since the last write in a
+  // single gathered write, as long as they fit into the batch limit.
+  size_t max_batch_bytes = engine_->options().rpc_max_batch_bytes;
+  size_t batch_bytes = 0;
+  std::vector<::asio::const_buffer> buffers;
+  if (ping_pending_.exchange(false)) {
+    batch_bytes += ping_packet_.size();
+    buffers.push_back(::asio::buffer(ping_packet_));
+  }
+  while (!pending_requests_.empty()) {
+    const auto &req = pending_requests_.front();
+    const std::string &payload = req->payload();
+    if (!buffers.empty() && batch_bytes + payload.size() > max_batch_bytes) {
+      break;
+    }
+    batch_bytes += payload.size();
+    buffers.push_back(::asio::buffer(payload));
+    // The timer must be armed before the request becomes visible to
+    // the read loop, which cancels it.
+    StartTimer(req);
+    requests_on_fly_.Insert(req);
+    requests_over_the_wire_.push_back(req);
+    pending_requests_.pop_front();
+  }
 
-  // TODO: set the timeout for the RPC request
+  Clock::rep now = Clock::now().time_since_epoch().count();
+  last_write_ = now;
+  if (!requests_over_the_wire_.empty()) {
+    last_call_ = now;
+  }
 
-  asio::async_write(next_layer(), asio::buffer(req->payload()),
-                    std::bind(&RpcConnection::OnHandleWrite, this, _1, _2));
+  asio::async_write(next_layer(), buffers,
+                    strand_.wrap(std::bind(&RpcConnection::OnHandleWrite, this,
+                                           generation_.load(), _1, _2)));
 }
 
-void RpcConnection::OnHandleRead(const ::asio::error_code &ec, size_t) {
-  std::lock_guard<std::mutex> state_lock(engine_state_lock_);
-
-  switch (ec.value()) {
-    case 0:
-      // No errors
-      break;
-    case asio::error::operation_aborted:
-      // The event loop has been shut down. Ignore the error.
-      return;
-    default:
-      assert(false && "Unimplemented");
+void RpcConnection::OnHandleRead(unsigned generation,
+                                 const ::asio::error_code &ec, size_t) {
+  if (ec == asio::error::operation_aborted || generation != generation_) {
+    // The socket has been closed. Ignore the error.
+    return;
+  } else if (ec) {
+    OnConnectionError(generation, ToStatus(ec));
+    return;
   }
 
   auto s = &response_state_;
+  auto next = strand_.wrap(std::bind(&RpcConnection::OnHandleRead, this,
+                                     generation, _1, _2));
   if (s->state == ResponseState::kReadLength) {
     s->state = ResponseState::kReadContent;
     auto buf = ::asio::buffer(reinterpret_cast<char*>(&s->length),
                               sizeof(s->length));
-    asio::async_read(next_layer(), buf,
-                     std::bind(&RpcConnection::OnHandleRead, this, _1, _2));
+    asio::async_read(next_layer(), buf, next);
 
   } else if (s->state == ResponseState::kReadContent) {
     s->state = ResponseState::kParseResponse;
     s->length = ntohl(s->length);
-    s->data.resize(s->length);
-    asio::async_read(next_layer(), ::asio::buffer(s->data),
-                     std::bind(&RpcConnection::OnHandleRead, this, _1, _2));
+    // The buffer is reused across the responses and only grows, thus
+    // it is neither reallocated nor zero-filled for every response.
+    if (s->data.size() < s->length) {
+      s->data.resize(s->length);
+    }
+    asio::async_read(next_layer(), ::asio::buffer(s->data.data(), s->length), next);
 
   } else if (s->state == ResponseState::kParseResponse) {
     s->state = ResponseState::kReadLength;
-    HandleRpcResponse(s->data);
-    s->data.clear();
-    StartReadLoop();
+    HandleRpcResponse(generation, s->data.data(), s->length);
+    // Do not hold on to the memory of an exceptionally large response
+    if (s->data.size() > ResponseState::kMaxRetainedBufferSize) {
+      std::vector<char>().swap(s->data);
+    }
+    strand_.post(std::bind(&RpcConnection::OnHandleRead, this, generation,
+                           ::asio::error_code(), 0));
   }
 }
 
 void RpcConnection::StartReadLoop() {
-  io_service().post(std::bind(&RpcConnection::OnHandleRead, this, ::asio::error_code(), 0));
+  response_state_.state = ResponseState::kReadLength;
+  strand_.post(std::bind(&RpcConnection::OnHandleRead, this,
+                         generation_.load(), ::asio::error_code(), 0));
 }
 
 void RpcConnection::StartWriteLoop() {
-  io_service().post([this]() {
-      if (!request_over_the_wire_) {
-        OnHandleWrite(::asio::error_code(), 0);
-      }});
+  // At most one write is in progress at a time. The write loop keeps
+  // running until the queue is empty.
+  if (!writing_.exchange(true)) {
+    strand_.post(std::bind(&RpcConnection::FlushPendingRequests, this));
+  }
 }
 
-void RpcConnection::HandleRpcResponse(const std::vector<char> &data) {
-  /* assumed to be called from a context that has already acquired the engine_state_lock */
+void RpcConnection::OnConnected() {
+  unsigned generation;
+  {
+    std::lock_guard<std::mutex> lock(connection_lock_);
+    connected_ = true;
+    connecting_ = false;
+    generation = generation_;
+  }
+
+  // Detect a dead NameNode on an idle connection instead of waiting
+  // for the next call
+  ::asio::error_code ignored;
+  next_layer_.set_option(::asio::socket_base::keep_alive(true), ignored);
+  Clock::rep now = Clock::now().time_since_epoch().count();
+  last_write_ = now;
+  last_call_ = now;
+  const Options &options = engine_->options();
+  if (options.rpc_ping_interval > 0) {
+    StartPingTimer(generation, std::chrono::milliseconds(options.rpc_ping_interval));
+  }
+  if (options.rpc_max_idle_time > 0) {
+    StartIdleTimer(generation, std::chrono::milliseconds(options.rpc_max_idle_time));
+  }
+
+  // Send the requests queued while the connection was down
+  StartWriteLoop();
+}
 
-  pbio::ArrayInputStream ar(&data[0], data.size());
-  pbio::CodedInputStream in(&ar);
-  in.PushLimit(data.size());
+void RpcConnection::StartPingTimer(unsigned generation, Clock::duration delay) {
+  ping_timer_.expires_from_now(std::chrono::duration_cast<std::chrono::milliseconds>(delay));
+  ping_timer_.async_wait(strand_.wrap([this, generation](const ::asio::error_code &ec) {
+      if (!ec) {
+        OnPingTimer(generation);
+      }
+    }));
+}
+
+void RpcConnection::OnPingTimer(unsigned generation) {
+  if (generation != generation_) {
+    return;
+  }
+
+  Clock::duration interval = std::chrono::milliseconds(engine_->options().rpc_ping_interval);
+  Clock::duration idle = Clock::now() - Clock::time_point(Clock::duration(last_write_));
+  if (idle < interval) {
+    StartPingTimer(generation, interval - idle);
+    return;
+  }
+  // The NameNode does not answer pings. A broken connection fails the
+  // write, which closes it.
+  ping_pending_ = true;
+  StartWriteLoop();
+  StartPingTimer(generation, interval);
+}
+
+void RpcConnection::StartIdleTimer(unsigned generation, Clock::duration delay) {
+  idle_timer_.expires_from_now(std::chrono::duration_cast<std::chrono::milliseconds>(delay));
+  idle_timer_.async_wait(strand_.wrap([this, generation](const ::asio::error_code &ec) {
+      if (!ec) {
+        OnIdleTimer(generation);
+      }
+    }));
+}
+
+void RpcConnection::OnIdleTimer(unsigned generation) {
+  if (generation != generation_) {
+    return;
+  }
+
+  Clock::duration max_idle = std::chrono::milliseconds(engine_->options().rpc_max_idle_time);
+  Clock::duration idle = Clock::now() - Clock::time_point(Clock::duration(last_call_));
+  if (outstanding_calls_ || idle < max_idle) {
+    StartIdleTimer(generation, outstanding_calls_ ? max_idle : max_idle - idle);
+    return;
+  }
+  // A call that races with the close is retried on a new connection
+  // like after any other connection error
+  OnConnectionError(generation, ToStatus(::asio::error::timed_out));
+}
+
+void RpcConnection::OnConnectFailed() {
+  {
+    std::lock_guard<std::mutex> lock(connection_lock_);
+    connecting_ = false;
+  }
+  ::asio::error_code ignored;
+  next_layer_.close(ignored);
+  // The calls queued in the meantime reconnect on their own
+  StartWriteLoop();
+}
+
+void RpcConnection::OnConnectionError(unsigned generation, const Status &status) {
+  std::vector<std::shared_ptr<RequestBase> > requests;
+  {
+    std::lock_guard<std::mutex> lock(connection_lock_);
+    if (generation != generation_ || !connected_) {
+      return;
+    }
+    connected_ = false;
+    ++generation_;
+    ::asio::error_code ignored;
+    next_layer_.close(ignored);
+    requests_on_fly_.RemoveAll(&requests);
+  }
+
+  // The requests might or might not have reached the NameNode. A fatal
+  // error of the NameNode is not cured by retrying.
+  for (const auto &req : requests) {
+    req->timer().cancel();
+    if (status.is_exception()) {
+      FailRequest(req, status);
+    } else {
+      OnRequestFailed(req, status);
+    }
+  }
+  // Reconnect if there is anything to send
+  StartWriteLoop();
+}
+
+void RpcConnection::Reconnect(unsigned attempt) {
+  ::asio::async_connect(
+      next_layer_, endpoints_.begin(), endpoints_.end(),
+      strand_.wrap([this, attempt](const ::asio::error_code &ec,
+                                   std::vector<::asio::ip::tcp::endpoint>::iterator) {
+        if (ec) {
+          OnReconnectFailed(attempt, ToStatus(ec));
+          return;
+        }
+        SendHandshake([this, attempt](const Status &status) {
+            if (!status.ok()) {
+              OnReconnectFailed(attempt, status);
+              return;
+            }
+            OnConnected();
+            StartReadLoop();
+          });
+      }));
+}
+
+void RpcConnection::OnReconnectFailed(unsigned attempt, const Status &status) {
+  {
+    std::lock_guard<std::mutex> lock(connection_lock_);
+    if (shutdown_) {
+      return;
+    }
+  }
+  ::asio::error_code ignored;
+  next_layer_.close(ignored);
+
+  // Reconnecting never executes a call twice, thus it is idempotent
+  int delay = engine_->retry_policy().ShouldRetry(status, attempt, true);
+  if (delay >= 0) {
+    reconnect_timer_.expires_from_now(std::chrono::milliseconds(delay));
+    reconnect_timer_.async_wait(strand_.wrap([this, attempt](const ::asio::error_code &ec) {
+        if (!ec) {
+          Reconnect(attempt + 1);
+        }
+      }));
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(connection_lock_);
+    connecting_ = false;
+    // The calls issued from now on start over with a new connection
+    if (outstanding_calls_) {
+      connect_error_ = status;
+    }
+  }
+  // Let the write loop fail the queued requests
+  StartWriteLoop();
+}
+
+void RpcConnection::StartTimer(const std::shared_ptr<RequestBase> &req) {
+  int timeout = engine_->options().rpc_timeout;
+  if (timeout <= 0) {
+    return;
+  }
+
+  // The timer does not keep the request alive, so that a request whose
+  // connection has gone away is freed together with its timer.
+  std::weak_ptr<RequestBase> weak_req(req);
+  unsigned retries = req->retries();
+  req->timer().expires_from_now(std::chrono::milliseconds(timeout));
+  req->timer().async_wait(strand_.wrap([this, weak_req, retries](const ::asio::error_code &ec) {
+      auto req = weak_req.lock();
+      // Ignore the timer of an attempt that has been superseded
+      if (ec || !req || req->retries() != retries) {
+        return;
+      }
+      if (requests_on_fly_.Remove(req->call_id()) == req) {
+        OnRequestFailed(req, ToStatus(::asio::error::timed_out));
+      }
+    }));
+}
+
+void RpcConnection::OnRequestFailed(const std::shared_ptr<RequestBase> &req,
+                                    const Status &status) {
+  int delay = engine_->retry_policy().ShouldRetry(status, req->retries(),
+                                                  req->idempotent());
+  if (delay < 0) {
+    FailRequest(req, status);
+    return;
+  }
+
+  req->IncrementRetries();
+  retrying_requests_.Insert(req);
+  req->timer().expires_from_now(std::chrono::milliseconds(delay));
+  // Shutdown() cancels the timer, thus the handler does not touch the
+  // connection once it has been shut down.
+  req->timer().async_wait(strand_.wrap([this, req](const ::asio::error_code &ec) {
+      if (ec || retrying_requests_.Remove(req->call_id()) != req) {
+        return;
+      }
+      queued_requests_.Push(std::shared_ptr<RequestBase>(req));
+      StartWriteLoop();
+    }));
+}
+
+void RpcConnection::FailRequest(const std::shared_ptr<RequestBase> &req,
+                                const Status &status) {
+  --outstanding_calls_;
+  req->OnResponseArrived(nullptr, status);
+}
+
+void RpcConnection::HandleRpcResponse(unsigned generation, const char *data,
+                                      size_t length) {
+  // Parse the response in place. The handler of the request parses
+  // the body into the message of the caller, which can live on an
+  // arena, see CreateArenaMessage().
+  pbio::CodedInputStream in(reinterpret_cast<const uint8_t*>(data), length);
+  in.PushLimit(length);
   RpcResponseHeaderProto h;
   ReadDelimitedPBMessage(&in, &h);
 
-  auto it = requests_on_fly_.find(h.callid());
-  if (it == requests_on_fly_.end()) {
-    // TODO: out of line RPC request
-    assert (false && "Out of line request with unknown call id");
+  last_call_ = Clock::now().time_since_epoch().count();
+
+  if (h.status() == RpcResponseHeaderProto::FATAL) {
+    // The NameNode closes the connection after a fatal error, e.g., a
+    // version mismatch or a failed authorization. The error might not
+    // belong to any call, thus all calls on the connection see it.
+    Status stat = Status::Exception(h.exceptionclassname().c_str(),
+                                    h.errormsg().c_str());
+    auto req = requests_on_fly_.Remove(h.callid());
+    if (req) {
+      req->timer().cancel();
+      FailRequest(req, stat);
+    }
+    OnConnectionError(generation, stat);
+    return;
   }
 
-  auto req = it->second;
-  requests_on_fly_.erase(it);
+  auto req = requests_on_fly_.Remove(h.callid());
+  if (!req) {
+    // The call has timed out or failed already, or the response is an
+    // out-of-band message, e.g., an answer to a ping. Neither has a
+    // caller waiting.
+    return;
+  }
+  req->timer().cancel();
+  --outstanding_calls_;
+
   Status stat;
   if (h.has_exceptionclassname()) {
     stat = Status::Exception(h.exceptionclassname().c_str(),
@@ -239,8 +617,44 @@ std::shared_ptr<std::string> RpcConnection::PrepareHandshakePacket() {
   return res;
 }
 
+std::string RpcConnection::PreparePingPacket() {
+  RpcRequestHeaderProto h;
+  h.set_rpckind(RPC_PROTOCOL_BUFFER);
+  h.set_rpcop(RpcRequestHeaderProto::RPC_FINAL_PACKET);
+  h.set_callid(kCallIdPing);
+  h.set_clientid(engine_->client_name());
+
+  std::string res;
+  ConstructPacket(&res, {&h}, nullptr);
+  return res;
+}
+
 void RpcConnection::Shutdown() {
-  next_layer_.close();
+  // Closing the socket must not race with the loops that use it
+  strand_.dispatch([this]() {
+      std::vector<std::shared_ptr<RequestBase> > requests;
+      {
+        std::lock_guard<std::mutex> lock(connection_lock_);
+        shutdown_ = true;
+        connected_ = false;
+        ++generation_;
+        reconnect_timer_.cancel();
+        ping_timer_.cancel();
+        idle_timer_.cancel();
+        ::asio::error_code ignored;
+        next_layer_.close(ignored);
+        requests_on_fly_.RemoveAll(&requests);
+        retrying_requests_.RemoveAll(&requests);
+      }
+
+      Status status = Status::Error("connection shut down");
+      for (const auto &req : requests) {
+        req->timer().cancel();
+        FailRequest(req, status);
+      }
+      // Let the write loop fail the pending and the queued requests
+      StartWriteLoop();
+    });
 }
 
 }
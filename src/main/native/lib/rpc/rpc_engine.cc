@@ -21,44 +21,113 @@
 
 #include <openssl/rand.h>
 
+#include <algorithm>
 #include <sstream>
 #include <future>
 
 namespace hdfs {
 
-RpcEngine::RpcEngine(::asio::io_service *io_service,
+RpcEngine::RpcEngine(::asio::io_service *io_service, const Options &options,
                      const std::string &client_name,
                      const char *protocol_name, int protocol_version)
     : io_service_(io_service)
+    , options_(options)
     , client_name_(client_name)
     , protocol_name_(protocol_name)
     , protocol_version_(protocol_version)
     , call_id_(0)
-    , conn_(this)
-{}
+    , retry_policy_(new ExponentialBackoffRetryPolicy(
+          options.max_rpc_retries, options.rpc_retry_delay, options.max_rpc_retry_delay))
+    , next_conn_(0)
+{
+  for (unsigned i = 0; i < std::max(options.rpc_connections, 1u); ++i) {
+    conns_.emplace_back(new RpcConnection(this));
+  }
+}
 
 Status RpcEngine::Connect(const ::asio::ip::tcp::endpoint &server) {
-  using ::asio::ip::tcp;
   auto stat = std::make_shared<std::promise<Status>>();
   std::future<Status> future(stat->get_future());
-  std::vector<tcp::endpoint> ep;
-  ep.push_back(server);
-  conn_.Connect(ep.begin(), ep.end(), [this,stat](const Status &status) {
-      if (!status.ok()) {
-        stat->set_value(status);
+  AsyncConnect(server, [stat](const Status &status) { stat->set_value(status); });
+  return future.get();
+}
+
+void RpcEngine::AsyncConnect(const ::asio::ip::tcp::endpoint &server,
+                             const std::function<void(const Status &)> &handler) {
+  AsyncConnect(std::vector<::asio::ip::tcp::endpoint>(1, server), handler);
+}
+
+void RpcEngine::AsyncConnect(const std::vector<::asio::ip::tcp::endpoint> &servers,
+                             const std::function<void(const Status &)> &handler) {
+  using ::asio::ip::tcp;
+  // Connect all connections in parallel and report the first error
+  // once all of them have finished.
+  struct State {
+    std::mutex lock;
+    size_t pending;
+    Status status;
+    std::function<void(const Status &)> handler;
+
+    void OnConnectionFinished(const Status &stat) {
+      std::unique_lock<std::mutex> l(lock);
+      if (!stat.ok() && status.ok()) {
+        status = stat;
+      }
+      if (--pending) {
         return;
       }
-      conn_.Handshake([this,stat](const Status &status) { stat->set_value(status); });
-    });
-  return future.get();
+      l.unlock();
+      handler(status);
+    }
+  };
+  auto state = std::make_shared<State>();
+  state->pending = conns_.size();
+  state->handler = handler;
+
+  // The endpoints must outlive the connect operation
+  auto ep = std::make_shared<std::vector<tcp::endpoint>>(servers);
+  for (const auto &c : conns_) {
+    RpcConnection *conn = c.get();
+    conn->Connect(ep->begin(), ep->end(), [conn,ep,state](const Status &status) {
+        if (!status.ok()) {
+          state->OnConnectionFinished(status);
+          return;
+        }
+        conn->Handshake([state](const Status &status) {
+            state->OnConnectionFinished(status);
+          });
+      });
+  }
 }
 
 void RpcEngine::StartReadLoop() {
-  conn_.StartReadLoop();
+  for (const auto &conn : conns_) {
+    conn->StartReadLoop();
+  }
 }
 
 void RpcEngine::Shutdown() {
-  io_service_->post([this]() { conn_.Shutdown(); });
+  io_service_->post([this]() {
+      for (const auto &conn : conns_) {
+        conn->Shutdown();
+      }
+    });
+}
+
+RpcConnection &RpcEngine::NextConnection() {
+  // Pick the connection with the fewest outstanding calls. Starting
+  // the scan at a rotating position spreads the calls in round-robin
+  // among the connections that are equally busy.
+  size_t n = conns_.size();
+  size_t start = next_conn_++ % n;
+  RpcConnection *best = conns_[start].get();
+  for (size_t i = 1; i < n && best->outstanding_calls(); ++i) {
+    RpcConnection *conn = conns_[(start + i) % n].get();
+    if (conn->outstanding_calls() < best->outstanding_calls()) {
+      best = conn;
+    }
+  }
+  return *best;
 }
 
 Status RpcEngine::Rpc(const std::string &method_name,
@@ -76,7 +145,7 @@ Status RpcEngine::RawRpc(const std::string &method_name, const std::string &req,
                          std::shared_ptr<std::string> resp) {
   auto stat = std::make_shared<std::promise<Status>>();
   std::future<Status> future(stat->get_future());
-  conn_.AsyncRawRpc(method_name, req, resp, [stat](const Status &status) {
+  NextConnection().AsyncRawRpc(method_name, req, resp, [stat](const Status &status) {
       stat->set_value(status);
     });
   return future.get();
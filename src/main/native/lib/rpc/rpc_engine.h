@@ -18,16 +18,24 @@
 #ifndef LIB_RPC_ENGINE_H_
 #define LIB_RPC_ENGINE_H_
 
+#include "libhdfs++/options.h"
 #include "libhdfs++/status.h"
+#include "common/mpsc_queue.h"
+#include "retry_policy.h"
 
 #include <google/protobuf/message_lite.h>
 
 #include <asio/ip/tcp.hpp>
 #include <asio/deadline_timer.hpp>
+#include <asio/strand.hpp>
 
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <mutex>
 
@@ -39,6 +47,10 @@ class RpcConnection {
  public:
   typedef ::asio::ip::tcp::socket NextLayer;
   RpcConnection(RpcEngine *engine);
+  /**
+   * Connect to the first reachable endpoint. The endpoints are kept to
+   * reconnect the connection when it breaks.
+   **/
   template <class Iterator, class Handler>
   void Connect(Iterator begin, Iterator end, const Handler &handler);
   template <class Handler>
@@ -61,6 +73,11 @@ class RpcConnection {
   { return next_layer_; }
 
   void StartReadLoop();
+  // Number of calls that have been issued but not answered
+  unsigned outstanding_calls() const { return outstanding_calls_; }
+  // Size of the buffer that the responses are received into, which is
+  // kept for the next response unless it has grown too large
+  size_t response_buffer_size() const { return response_state_.data.size(); }
 
  private:
   class RequestBase;
@@ -69,6 +86,13 @@ class RpcConnection {
 
   RpcEngine * const engine_;
   NextLayer next_layer_;
+  /**
+   * The socket and the timers are not safe to use from several threads
+   * at once, while the io_service can be run by many threads. Every
+   * operation on them, i.e., the read and write loops, the connecting,
+   * the timers and the shutdown, runs on the strand of the connection.
+   **/
+  ::asio::io_service::strand strand_;
   enum {
     kCallIdAuthorizationFailed = -1,
     kCallIdInvalid = -2,
@@ -82,31 +106,115 @@ class RpcConnection {
       kReadContent,
       kParseResponse,
     } state;
+    // The size above which the receive buffer is released after use
+    static const size_t kMaxRetainedBufferSize = 1024 * 1024;
     unsigned length;
     std::vector<char> data;
     ResponseState();
   };
   ResponseState response_state_;
 
-  // The request being sent over the wire
-  std::shared_ptr<RequestBase> request_over_the_wire_;
-  // Requests to be sent over the wire
-  std::vector<std::shared_ptr<RequestBase> > pending_requests_;
-  // Requests that are waiting for responses
-  std::unordered_map<int, std::shared_ptr<RequestBase> > requests_on_fly_;
-  // Lock for mutable parts of this class that need to be thread safe
-  std::mutex engine_state_lock_;
+  /**
+   * The requests that are waiting for responses, sharded by call id
+   * so that the write loop and the read loop rarely contend.
+   **/
+  class RequestMap {
+   public:
+    void Insert(const std::shared_ptr<RequestBase> &req);
+    // Return nullptr if there is no request with the call id
+    std::shared_ptr<RequestBase> Remove(int call_id);
+    void RemoveAll(std::vector<std::shared_ptr<RequestBase> > *requests);
+
+   private:
+    static const unsigned kShards = 16;
+    struct Shard {
+      std::mutex lock;
+      std::unordered_map<int, std::shared_ptr<RequestBase> > requests;
+    };
+    Shard shards_[kShards];
+  };
+
+  // Requests queued by AsyncRpc() from any thread
+  MpscQueue<std::shared_ptr<RequestBase> > queued_requests_;
+  // Whether the write loop is running. Only the write loop accesses
+  // the two members below.
+  std::atomic_bool writing_;
+  // Requests taken from the queue that did not fit into the last write
+  std::deque<std::shared_ptr<RequestBase> > pending_requests_;
+  // Whether the write loop should send a ping along with the requests
+  std::atomic_bool ping_pending_;
+  const std::string ping_packet_;
+  // The requests being sent over the wire in a single write
+  std::vector<std::shared_ptr<RequestBase> > requests_over_the_wire_;
+  RequestMap requests_on_fly_;
+  // The requests waiting for the backoff before they are retried
+  RequestMap retrying_requests_;
+  std::atomic_uint outstanding_calls_;
+
+  /**
+   * The state of the underlying socket. A broken connection is closed,
+   * and the calls that were waiting for responses are either retried
+   * or failed. The connection is re-established when the write loop
+   * has requests to send, and the requests wait in the queue until
+   * then.
+   *
+   * The generation counts the sockets used by the connection. The
+   * read and write loops carry the generation that they were started
+   * in, so that an error of a socket that has already been replaced is
+   * ignored.
+   **/
+  std::mutex connection_lock_;
+  bool connected_;
+  bool connecting_;
+  bool shutdown_;
+  std::atomic_uint generation_;
+  // The error of the last reconnection, to be reported to the queued
+  // requests by the write loop
+  Status connect_error_;
+  std::vector<::asio::ip::tcp::endpoint> endpoints_;
+  ::asio::deadline_timer reconnect_timer_;
 
+  /**
+   * The keepalive of an established connection. The times of the last
+   * write and of the last call are kept as ticks of the steady clock,
+   * and the timers check them periodically, so that the calls do not
+   * need to touch the timers.
+   **/
+  typedef std::chrono::steady_clock Clock;
+  std::atomic<Clock::rep> last_write_;
+  std::atomic<Clock::rep> last_call_;
+  ::asio::deadline_timer ping_timer_;
+  ::asio::deadline_timer idle_timer_;
   template <class Handler>
   void StartRpc(std::string &&request, const Handler &handler);
 
   ::asio::io_service &io_service();
   std::shared_ptr<std::string> PrepareHandshakePacket();
+  std::string PreparePingPacket();
+  template <class Handler>
+  void SendHandshake(const Handler &handler);
   static std::string SerializeRpcRequest(const std::string &method_name, const ::google::protobuf::MessageLite *req);
-  void HandleRpcResponse(const std::vector<char> &data);
-  void OnHandleWrite(const ::asio::error_code &ec, size_t transferred);
-  void OnHandleRead(const ::asio::error_code &ec, size_t transferred);
+  void HandleRpcResponse(unsigned generation, const char *data, size_t length);
+  void OnHandleWrite(unsigned generation, const ::asio::error_code &ec,
+                     size_t transferred);
+  void FlushPendingRequests();
+  void OnHandleRead(unsigned generation, const ::asio::error_code &ec,
+                    size_t transferred);
   void StartWriteLoop();
+  void OnConnected();
+  void OnConnectFailed();
+  void StartPingTimer(unsigned generation, Clock::duration delay);
+  void OnPingTimer(unsigned generation);
+  void StartIdleTimer(unsigned generation, Clock::duration delay);
+  void OnIdleTimer(unsigned generation);
+  void OnConnectionError(unsigned generation, const Status &status);
+  void Reconnect(unsigned attempt);
+  void OnReconnectFailed(unsigned attempt, const Status &status);
+  void StartTimer(const std::shared_ptr<RequestBase> &req);
+  void OnRequestFailed(const std::shared_ptr<RequestBase> &req,
+                       const Status &status);
+  void FailRequest(const std::shared_ptr<RequestBase> &req,
+                   const Status &status);
 };
 
 class RpcEngine {
@@ -115,7 +223,7 @@ class RpcEngine {
     kRpcVersion = 9
   };
 
-  RpcEngine(::asio::io_service *io_service,
+  RpcEngine(::asio::io_service *io_service, const Options &options,
             const std::string &client_name,
             const char *protocol_name, int protocol_version);
 
@@ -124,7 +232,7 @@ class RpcEngine {
                 const ::google::protobuf::MessageLite *req,
                 const std::shared_ptr<::google::protobuf::MessageLite> &resp,
                 const Handler &handler) {
-    conn_.AsyncRpc(method_name, req, resp, handler);
+    NextConnection().AsyncRpc(method_name, req, resp, handler);
   }
 
   Status Rpc(const std::string &method_name,
@@ -137,6 +245,14 @@ class RpcEngine {
   Status RawRpc(const std::string &method_name, const std::string &req,
                 std::shared_ptr<std::string> resp);
   Status Connect(const ::asio::ip::tcp::endpoint &server);
+  void AsyncConnect(const ::asio::ip::tcp::endpoint &server,
+                    const std::function<void(const Status &)> &handler);
+  /**
+   * Connect to the first reachable endpoint, e.g., one of the addresses
+   * that the host name of the NameNode resolves to.
+   **/
+  void AsyncConnect(const std::vector<::asio::ip::tcp::endpoint> &servers,
+                    const std::function<void(const Status &)> &handler);
   void StartReadLoop();
   void Shutdown();
 
@@ -146,17 +262,44 @@ class RpcEngine {
   const std::string &client_name() const { return client_name_; }
   const std::string &protocol_name() const { return protocol_name_; }
   int protocol_version() const { return protocol_version_; }
-  RpcConnection &connection() { return conn_; }
+  const Options &options() const { return options_; }
+  size_t connection_count() const { return conns_.size(); }
+  RpcConnection &connection(size_t index = 0) { return *conns_[index]; }
   ::asio::io_service &io_service() { return *io_service_; }
 
+  const RetryPolicy &retry_policy() const { return *retry_policy_; }
+  /**
+   * Replace the retry policy built from the options. It must be called
+   * before any call is issued.
+   **/
+  void set_retry_policy(std::unique_ptr<RetryPolicy> &&policy)
+  { retry_policy_ = std::move(policy); }
+  /**
+   * Declare the methods of the protocol that are idempotent, i.e., can
+   * be retried after they have been sent. It must be called before any
+   * call is issued.
+   **/
+  void set_idempotent_methods(const std::vector<std::string> &methods)
+  { idempotent_methods_.insert(methods.begin(), methods.end()); }
+  bool IsIdempotent(const std::string &method_name) const
+  { return idempotent_methods_.count(method_name); }
+
   static std::string GetRandomClientName();
  private:
   ::asio::io_service *io_service_;
+  const Options options_;
   const std::string client_name_;
   const std::string protocol_name_;
   const int protocol_version_;
   std::atomic_int call_id_;
-  RpcConnection conn_;
+  std::unique_ptr<RetryPolicy> retry_policy_;
+  std::unordered_set<std::string> idempotent_methods_;
+  // The call ids are unique across the connections, and each
+  // connection routes the responses to the calls it has sent.
+  std::vector<std::unique_ptr<RpcConnection> > conns_;
+  std::atomic_uint next_conn_;
+
+  RpcConnection &NextConnection();
 };
 
 }
@@ -0,0 +1,391 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rpc_engine.h"
+#include "mock_namenode.h"
+#include "common/util.h"
+
+#include "ClientNamenodeProtocol.pb.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <thread>
+
+using ::hadoop::hdfs::GetFileInfoRequestProto;
+using ::hadoop::hdfs::GetFileInfoResponseProto;
+using ::hadoop::hdfs::GetListingRequestProto;
+using ::hadoop::hdfs::GetListingResponseProto;
+using ::hadoop::hdfs::MkdirsRequestProto;
+using ::hadoop::hdfs::MkdirsResponseProto;
+
+namespace hdfs {
+
+static const char kClientProtocol[] = "org.apache.hadoop.hdfs.protocol.ClientProtocol";
+
+/**
+ * Runs an engine on two threads against a mock NameNode.
+ **/
+class RpcEngineTest : public ::testing::Test {
+ protected:
+  MockNameNode nn_;
+  ::asio::io_service io_service_;
+  std::unique_ptr<::asio::io_service::work> work_;
+  std::vector<std::thread> workers_;
+  std::unique_ptr<RpcEngine> engine_;
+
+  RpcEngineTest()
+      : work_(new ::asio::io_service::work(io_service_))
+  {
+    for (int i = 0; i < 2; ++i) {
+      workers_.emplace_back([this]() { io_service_.run(); });
+    }
+  }
+
+  ~RpcEngineTest() {
+    if (engine_) {
+      engine_->Shutdown();
+    }
+    work_.reset();
+    io_service_.stop();
+    for (auto &t : workers_) {
+      t.join();
+    }
+  }
+
+  static Options DefaultOptions() {
+    Options options;
+    options.rpc_retry_delay = 10;
+    options.max_rpc_retry_delay = 10;
+    return options;
+  }
+
+  void Connect(const Options &options = DefaultOptions()) {
+    engine_.reset(new RpcEngine(&io_service_, options, "rpc_engine_test",
+                                kClientProtocol, 1));
+    engine_->set_idempotent_methods({"getFileInfo"});
+    std::promise<Status> stat;
+    engine_->AsyncConnect(nn_.endpoint(), [&stat](const Status &status) {
+        stat.set_value(status);
+      });
+    ASSERT_TRUE(stat.get_future().get().ok());
+    engine_->StartReadLoop();
+  }
+
+  Status GetFileInfo() {
+    GetFileInfoRequestProto req;
+    req.set_src("/foo");
+    return engine_->Rpc("getFileInfo", &req, std::make_shared<GetFileInfoResponseProto>());
+  }
+
+  Status Mkdirs() {
+    MkdirsRequestProto req;
+    req.set_src("/foo");
+    req.mutable_masked()->set_perm(0755);
+    req.set_createparent(false);
+    return engine_->Rpc("mkdirs", &req, std::make_shared<MkdirsResponseProto>());
+  }
+
+  /**
+   * Answer the calls with an empty response. The calls that the
+   * predicate selects close the connection instead.
+   **/
+  static MockNameNode::Method DropIf(const std::function<bool(unsigned)> &drop) {
+    auto calls = std::make_shared<std::atomic_uint>(0);
+    return [drop, calls](const std::string &, std::string *response) {
+      response->clear();
+      return drop((*calls)++) ? Status::Error("dropped") : Status::OK();
+    };
+  }
+};
+
+TEST_F(RpcEngineTest, TestReconnectAfterBrokenConnection) {
+  nn_.SetMethod("getFileInfo", DropIf([](unsigned) { return false; }));
+  Connect();
+  ASSERT_TRUE(GetFileInfo().ok());
+
+  // The connection is re-established by the next call, whether or not
+  // the read loop has noticed the broken socket by then
+  nn_.DropConnections();
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_EQ(3, nn_.calls("getFileInfo"));
+}
+
+TEST_F(RpcEngineTest, TestReplayIdempotentCall) {
+  // The first call breaks the connection before it is answered
+  nn_.SetMethod("getFileInfo", DropIf([](unsigned call) { return call == 0; }));
+  Connect();
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_EQ(2, nn_.calls("getFileInfo"));
+}
+
+TEST_F(RpcEngineTest, TestFailNonIdempotentCall) {
+  nn_.SetMethod("mkdirs", DropIf([](unsigned call) { return call == 0; }));
+  Connect();
+  // The call might have been executed, thus it is not sent again
+  Status stat = Mkdirs();
+  ASSERT_FALSE(stat.ok());
+  ASSERT_FALSE(stat.is_exception());
+  ASSERT_EQ(1, nn_.calls("mkdirs"));
+
+  // The connection is usable again
+  ASSERT_TRUE(Mkdirs().ok());
+  ASSERT_EQ(2, nn_.calls("mkdirs"));
+}
+
+TEST_F(RpcEngineTest, TestCallTimeout) {
+  std::promise<void> release;
+  std::shared_future<void> released(release.get_future());
+  nn_.SetMethod("mkdirs", [released](const std::string &, std::string *response) {
+      released.wait();
+      response->clear();
+      return Status::OK();
+    });
+  nn_.SetMethod("getFileInfo", DropIf([](unsigned) { return false; }));
+
+  Options options = DefaultOptions();
+  options.rpc_timeout = 100;
+  Connect(options);
+  auto start = std::chrono::steady_clock::now();
+  Status stat = Mkdirs();
+  ASSERT_FALSE(stat.ok());
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+  ASSERT_EQ(1, nn_.calls("mkdirs"));
+
+  // The late response of the timed out call is dropped, and the
+  // connection carries on with the next call
+  release.set_value();
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_EQ(1, nn_.calls("mkdirs"));
+  ASSERT_EQ(0, engine_->connection().outstanding_calls());
+}
+
+/**
+ * Poll the condition until it holds or ten seconds have passed.
+ **/
+static bool WaitFor(const std::function<bool()> &condition) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+TEST_F(RpcEngineTest, TestDropUnknownResponses) {
+  nn_.SetMethod("getFileInfo", DropIf([](unsigned) { return false; }));
+  Connect();
+  ASSERT_TRUE(GetFileInfo().ok());
+
+  // The answer to a ping, and a call id that has never been used
+  nn_.SendUnsolicitedResponse(-4);
+  nn_.SendUnsolicitedResponse(1000000);
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_EQ(2, nn_.calls("getFileInfo"));
+  ASSERT_EQ(0, engine_->connection().outstanding_calls());
+  // The connection has been kept
+  ASSERT_EQ(1, nn_.connections());
+}
+
+TEST_F(RpcEngineTest, TestPingIdleConnection) {
+  nn_.SetMethod("getFileInfo", DropIf([](unsigned) { return false; }));
+  Options options = DefaultOptions();
+  options.rpc_ping_interval = 50;
+  auto start = std::chrono::steady_clock::now();
+  Connect(options);
+  ASSERT_TRUE(WaitFor([this]() { return nn_.pings() >= 1; }));
+  ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+
+  // The pings keep coming while the connection is idle, and do not
+  // disturb the calls
+  ASSERT_TRUE(WaitFor([this]() { return nn_.pings() >= 3; }));
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_EQ(1, nn_.connections());
+}
+
+TEST_F(RpcEngineTest, TestCloseIdleConnection) {
+  nn_.SetMethod("getFileInfo", DropIf([](unsigned) { return false; }));
+  Options options = DefaultOptions();
+  options.rpc_max_idle_time = 100;
+  Connect(options);
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_EQ(1, nn_.open_connections());
+
+  // The client closes the connection, and reopens it on the next call
+  ASSERT_TRUE(WaitFor([this]() { return nn_.open_connections() == 0; }));
+  ASSERT_EQ(1, nn_.connections());
+  ASSERT_TRUE(GetFileInfo().ok());
+  ASSERT_EQ(2, nn_.connections());
+  ASSERT_EQ(1, nn_.open_connections());
+  ASSERT_EQ(2, nn_.calls("getFileInfo"));
+}
+
+TEST_F(RpcEngineTest, TestSpreadCallsOverConnections) {
+  const unsigned kConnections = 3;
+  // Each connection is served one call at a time, thus the calls only
+  // meet here if each has come on its own connection. The call that
+  // arrives last is answered first.
+  std::mutex lock;
+  std::condition_variable arrived_all;
+  unsigned arrived = 0;
+  nn_.SetMethod("getFileInfo", [&](const std::string &request, std::string *response) {
+      GetFileInfoRequestProto req;
+      req.ParseFromString(request);
+      unsigned index;
+      {
+        std::unique_lock<std::mutex> l(lock);
+        index = arrived++;
+        arrived_all.notify_all();
+        if (!arrived_all.wait_for(l, std::chrono::seconds(10),
+                                  [&]() { return arrived == kConnections; })) {
+          return Status::Error("The calls share a connection");
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20 * (kConnections - index)));
+
+      // Echo the path, so that each caller can tell its response
+      GetFileInfoResponseProto resp;
+      auto fs = resp.mutable_fs();
+      fs->set_filetype(::hadoop::hdfs::HdfsFileStatusProto::IS_FILE);
+      fs->set_path(req.src());
+      fs->set_length(0);
+      fs->mutable_permission()->set_perm(0644);
+      fs->set_owner("");
+      fs->set_group("");
+      fs->set_modification_time(0);
+      fs->set_access_time(0);
+      *response = resp.SerializeAsString();
+      return Status::OK();
+    });
+
+  Options options = DefaultOptions();
+  options.rpc_connections = kConnections;
+  Connect(options);
+  ASSERT_EQ(kConnections, engine_->connection_count());
+  ASSERT_TRUE(WaitFor([this]() { return nn_.connections() == kConnections; }));
+
+  std::vector<std::shared_ptr<GetFileInfoResponseProto>> resps;
+  std::vector<std::promise<Status>> done(kConnections);
+  for (unsigned i = 0; i < kConnections; ++i) {
+    GetFileInfoRequestProto req;
+    req.set_src("/file" + std::to_string(i));
+    resps.push_back(std::make_shared<GetFileInfoResponseProto>());
+    std::promise<Status> *d = &done[i];
+    engine_->AsyncRpc("getFileInfo", &req, resps.back(), [d](const Status &status) {
+        d->set_value(status);
+      });
+  }
+  for (unsigned i = 0; i < kConnections; ++i) {
+    ASSERT_TRUE(done[i].get_future().get().ok()) << i;
+    EXPECT_EQ("/file" + std::to_string(i), resps[i]->fs().path());
+  }
+  for (unsigned i = 0; i < kConnections; ++i) {
+    EXPECT_EQ(0, engine_->connection(i).outstanding_calls()) << i;
+  }
+  EXPECT_EQ(kConnections, nn_.connections());
+}
+
+// The name of the i-th entry of a listing, 100 bytes long
+static std::string EntryName(unsigned i) {
+  std::string res = std::to_string(i);
+  return res + std::string(100 - res.size(), 'x');
+}
+
+TEST_F(RpcEngineTest, TestLargeResponseThenSmallOnes) {
+  // A listing of as many entries as the path says
+  nn_.SetMethod("getListing", [](const std::string &request, std::string *response) {
+      GetListingRequestProto req;
+      req.ParseFromString(request);
+      GetListingResponseProto resp;
+      auto dirlist = resp.mutable_dirlist();
+      for (unsigned i = 0, n = std::stoul(req.src().substr(1)); i < n; ++i) {
+        auto fs = dirlist->add_partiallisting();
+        fs->set_filetype(::hadoop::hdfs::HdfsFileStatusProto::IS_FILE);
+        fs->set_path(EntryName(i));
+        fs->set_length(i);
+        fs->mutable_permission()->set_perm(0644);
+        fs->set_owner("hdfs");
+        fs->set_group("supergroup");
+        fs->set_modification_time(0);
+        fs->set_access_time(0);
+      }
+      dirlist->set_remainingentries(0);
+      *response = resp.SerializeAsString();
+      return Status::OK();
+    });
+  Connect();
+  auto list = [this](unsigned entries, const std::shared_ptr<GetListingResponseProto> &resp) {
+    GetListingRequestProto req;
+    req.set_src("/" + std::to_string(entries));
+    req.set_startafter("");
+    req.set_needlocation(false);
+    return engine_->Rpc("getListing", &req, resp);
+  };
+  const size_t kMaxRetainedBufferSize = 1024 * 1024;
+
+  // About 2.5MB, parsed into a message on an arena
+  auto large = CreateArenaMessage<GetListingResponseProto>();
+  ASSERT_TRUE(list(20000, large).ok());
+  ASSERT_EQ(20000, large->dirlist().partiallisting_size());
+  // The buffer of the large response is released
+  ASSERT_TRUE(WaitFor([this]() { return engine_->connection().response_buffer_size() == 0; }));
+
+  auto small = CreateArenaMessage<GetListingResponseProto>();
+  ASSERT_TRUE(list(1, small).ok());
+  ASSERT_EQ(1, small->dirlist().partiallisting_size());
+  EXPECT_EQ(EntryName(0), small->dirlist().partiallisting(0).path());
+  size_t small_size = engine_->connection().response_buffer_size();
+  EXPECT_GT(small_size, 0u);
+  EXPECT_LT(small_size, 1000u);
+
+  // A response below the limit keeps its buffer for the next ones
+  auto medium = CreateArenaMessage<GetListingResponseProto>();
+  ASSERT_TRUE(list(4000, medium).ok());
+  ASSERT_EQ(4000, medium->dirlist().partiallisting_size());
+  size_t medium_size = engine_->connection().response_buffer_size();
+  EXPECT_GT(medium_size, 400000u);
+  EXPECT_LT(medium_size, kMaxRetainedBufferSize);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(list(1, CreateArenaMessage<GetListingResponseProto>()).ok());
+    EXPECT_EQ(medium_size, engine_->connection().response_buffer_size());
+  }
+
+  // The messages do not refer to the receive buffer, which has been
+  // released or overwritten since
+  for (unsigned i = 0; i < 20000; i += 997) {
+    EXPECT_EQ(EntryName(i), large->dirlist().partiallisting(i).path());
+    EXPECT_EQ(i, large->dirlist().partiallisting(i).length());
+  }
+  EXPECT_EQ(EntryName(19999), large->dirlist().partiallisting(19999).path());
+  EXPECT_EQ(EntryName(3999), medium->dirlist().partiallisting(3999).path());
+  EXPECT_EQ(EntryName(0), small->dirlist().partiallisting(0).path());
+
+  // The arena of a message lives as long as a sub-message is referred
+  // to through the message
+  std::shared_ptr<const ::hadoop::hdfs::HdfsFileStatusProto> entry(
+      large, &large->dirlist().partiallisting(12345));
+  large.reset();
+  EXPECT_EQ(EntryName(12345), entry->path());
+}
+
+}
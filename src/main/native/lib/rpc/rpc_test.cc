@@ -18,7 +18,7 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  RpcEngine engine(&io_service, "libhdfs++", "org.apache.hadoop.hdfs.protocol.ClientProtocol", 1);
+  RpcEngine engine(&io_service, Options(), "libhdfs++", "org.apache.hadoop.hdfs.protocol.ClientProtocol", 1);
   GetFileInfoRequestProto req;
   auto resp = std::make_shared<GetFileInfoResponseProto>();
   req.set_src(argv[3]);
@@ -0,0 +1,72 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "single_flight.h"
+
+namespace hdfs {
+
+using ::google::protobuf::MessageLite;
+
+void SingleFlight::Call(const std::string &method_name, const MessageLite *req,
+                        const std::shared_ptr<MessageLite> &resp,
+                        const Handler &handler,
+                        const std::function<void(const Handler &)> &issue) {
+  std::string key = method_name + "\n" + std::to_string(epoch_.load()) + "\n";
+  req->AppendToString(&key);
+
+  std::shared_ptr<Flight> flight;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = flights_.find(key);
+    if (it != flights_.end()) {
+      it->second->waiters.push_back(Waiter{resp, handler});
+      return;
+    }
+    flight = std::make_shared<Flight>();
+    flights_.insert(std::make_pair(key, flight));
+  }
+
+  issue([this,key,flight,resp,handler](const Status &status) {
+      OnCallFinished(key, flight, resp, handler, status);
+    });
+}
+
+void SingleFlight::OnCallFinished(const std::string &key,
+                                  const std::shared_ptr<Flight> &flight,
+                                  const std::shared_ptr<MessageLite> &resp,
+                                  const Handler &handler, const Status &status) {
+  std::vector<Waiter> waiters;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    flights_.erase(key);
+    waiters.swap(flight->waiters);
+  }
+
+  for (const auto &w : waiters) {
+    if (status.ok()) {
+      w.response->Clear();
+      w.response->CheckTypeAndMergeFrom(*resp);
+    }
+  }
+  handler(status);
+  for (const auto &w : waiters) {
+    w.handler(status);
+  }
+}
+
+}
@@ -0,0 +1,96 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIB_RPC_SINGLE_FLIGHT_H_
+#define LIB_RPC_SINGLE_FLIGHT_H_
+
+#include "libhdfs++/status.h"
+
+#include <google/protobuf/message_lite.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace hdfs {
+
+/**
+ * Shares one RPC call among the callers that issue identical requests
+ * at the same time, e.g., the threads that open the same file when a
+ * job starts. The first caller sends the call, and the others wait for
+ * it and receive a copy of its response.
+ *
+ * Only the read-only methods can be shared. A caller must not receive
+ * the response of a call that was sent before the changes it has made
+ * itself, thus the calls that finish after a call of any other method
+ * are never shared with the calls issued before it.
+ **/
+class SingleFlight {
+ public:
+  typedef std::function<void(const Status &)> Handler;
+
+  SingleFlight() : epoch_(0) {}
+  /**
+   * Declare the methods whose calls can be shared. It must be called
+   * before any call is issued.
+   **/
+  void set_shared_methods(const std::vector<std::string> &methods)
+  { shared_methods_.insert(methods.begin(), methods.end()); }
+  bool IsShared(const std::string &method_name) const
+  { return shared_methods_.count(method_name); }
+
+  /**
+   * Join the call in flight with the same method and request, or send
+   * a new one by calling issue with the handler of the call.
+   **/
+  void Call(const std::string &method_name,
+            const ::google::protobuf::MessageLite *req,
+            const std::shared_ptr<::google::protobuf::MessageLite> &resp,
+            const Handler &handler, const std::function<void(const Handler &)> &issue);
+  /**
+   * Stop sharing the calls in flight with the calls issued from now on.
+   * It is called when a call of a method that is not shared finishes.
+   **/
+  void Invalidate() { ++epoch_; }
+
+ private:
+  struct Waiter {
+    std::shared_ptr<::google::protobuf::MessageLite> response;
+    Handler handler;
+  };
+  struct Flight {
+    std::vector<Waiter> waiters;
+  };
+
+  std::unordered_set<std::string> shared_methods_;
+  std::atomic_uint epoch_;
+  std::mutex lock_;
+  std::unordered_map<std::string, std::shared_ptr<Flight> > flights_;
+
+  void OnCallFinished(const std::string &key, const std::shared_ptr<Flight> &flight,
+                      const std::shared_ptr<::google::protobuf::MessageLite> &resp,
+                      const Handler &handler, const Status &status);
+};
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "single_flight.h"
+
+#include "ClientNamenodeProtocol.pb.h"
+
+#include <gtest/gtest.h>
+
+using ::hadoop::hdfs::GetFileInfoRequestProto;
+using ::hadoop::hdfs::GetFileInfoResponseProto;
+
+namespace hdfs {
+
+/**
+ * Records the issued calls, which the tests finish explicitly.
+ **/
+class SingleFlightTest : public ::testing::Test {
+ protected:
+  SingleFlight single_flight_;
+  std::vector<std::pair<std::shared_ptr<GetFileInfoResponseProto>,
+                        SingleFlight::Handler> > issued_;
+
+  void Call(const char *path, const std::shared_ptr<GetFileInfoResponseProto> &resp,
+            Status *status) {
+    GetFileInfoRequestProto req;
+    req.set_src(path);
+    single_flight_.Call("getFileInfo", &req, resp,
+                        [status](const Status &s) { *status = s; },
+                        [this,resp](const SingleFlight::Handler &h) {
+                          issued_.push_back(std::make_pair(resp, h));
+                        });
+  }
+
+  void Finish(size_t index, const char *owner) {
+    issued_[index].first->mutable_fs()->set_owner(owner);
+    issued_[index].second(Status::OK());
+  }
+};
+
+TEST_F(SingleFlightTest, TestShareIdenticalCalls) {
+  auto r1 = std::make_shared<GetFileInfoResponseProto>();
+  auto r2 = std::make_shared<GetFileInfoResponseProto>();
+  auto r3 = std::make_shared<GetFileInfoResponseProto>();
+  Status s1 = Status::Error(""), s2 = Status::Error(""), s3 = Status::Error("");
+  Call("/a", r1, &s1);
+  Call("/a", r2, &s2);
+  Call("/b", r3, &s3);
+  ASSERT_EQ(2, issued_.size());
+
+  Finish(0, "alice");
+  ASSERT_TRUE(s1.ok());
+  ASSERT_TRUE(s2.ok());
+  ASSERT_EQ("alice", r2->fs().owner());
+  ASSERT_FALSE(s3.ok());
+
+  // The finished call is not shared anymore
+  Call("/a", r2, &s2);
+  ASSERT_EQ(3, issued_.size());
+}
+
+TEST_F(SingleFlightTest, TestInvalidate) {
+  auto r1 = std::make_shared<GetFileInfoResponseProto>();
+  auto r2 = std::make_shared<GetFileInfoResponseProto>();
+  Status s1, s2;
+  Call("/a", r1, &s1);
+  single_flight_.Invalidate();
+  Call("/a", r2, &s2);
+  ASSERT_EQ(2, issued_.size());
+}
+
+TEST_F(SingleFlightTest, TestError) {
+  auto r1 = std::make_shared<GetFileInfoResponseProto>();
+  auto r2 = std::make_shared<GetFileInfoResponseProto>();
+  Status s1, s2;
+  Call("/a", r1, &s1);
+  Call("/a", r2, &s2);
+  issued_[0].second(Status::Error("error"));
+  ASSERT_FALSE(s1.ok());
+  ASSERT_FALSE(s2.ok());
+  ASSERT_FALSE(r2->has_fs());
+}
+
+}